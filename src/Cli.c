@@ -1,14 +1,39 @@
 #include "Cli.h"
 
 #include <assert.h>
+#include <errno.h>
+#include <limits.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+/**
+ * Keys of options without short name. Values are outside of character range,
+ * so they are never matched by short option parser.
+ */
+enum {
+  OPT_LONG_ONLY = 0x100,
+  OPT_DRY_RUN = OPT_LONG_ONLY,
+  OPT_MAX_DEPTH,
+  OPT_PIPELINE,
+  OPT_REFLINK,
+  OPT_IO_URING,
+  OPT_CACHE_POLICY,
+  OPT_SYNC,
+  OPT_INCREMENTAL,
+  OPT_DEDUP,
+  OPT_INDEX_WIDTH,
+  OPT_PER_DATE_NUMBERING,
+  OPT_MAX_MEMORY,
+  OPT_BATCH_SIZE,
+  OPT_RULES
+};
+
 typedef struct {
   const char* long_name;
-  int short_name;
+  int short_name; /* Option character, or OPT_* key for long-only options */
   const char* arg_name;
   const char* help;
 } CliOptionDef;
@@ -21,13 +46,28 @@ typedef struct {
 } CliParseState;
 
 static const CliOptionDef CliOptions[] = {
-  {"tag",     't', "TAG", "Add tag to indexed files (can be used multiple times)"},
-  {"source",  's', "DIR", "Source directory (required)"},
-  {"target",  'd', "DIR", "Target directory (required)"},
-  {"verbose", 'v',  NULL, "Print source and generated target file names"},
-  {"force",   'f',  NULL, "Allow overwriting existing files in target directory"},
-  {"dry-run",   0,  NULL, "Do not copy files"},
-  {"help",    'h',  NULL, "Print this help message"},
+  {"tag",       't',           "TAG", "Add tag to indexed files (can be used multiple times)"},
+  {"source",    's',           "DIR", "Source directory (required)"},
+  {"target",    'd',           "DIR", "Target directory (required)"},
+  {"verbose",   'v',           NULL,  "Print source and generated target file names"},
+  {"force",     'f',           NULL,  "Allow overwriting existing files in target directory"},
+  {"jobs",      'j',           "N",   "Number of worker threads (default: 1)"},
+  {"recursive", 'r',           NULL,  "Scan nested source directories"},
+  {"max-depth", OPT_MAX_DEPTH, "N",   "Maximum nesting level of scanned directories (implies --recursive)"},
+  {"pipeline",  OPT_PIPELINE,  NULL,  "Copy files while source directory is still being scanned"},
+  {"reflink",   OPT_REFLINK,   "MODE", "Clone files sharing data blocks: auto, always or never (default: auto)"},
+  {"io-uring",  OPT_IO_URING,  NULL,  "Copy many files at once with io_uring when available"},
+  {"cache-policy", OPT_CACHE_POLICY, "POLICY", "Page cache use by copied files: keep, drop or direct (default: keep)"},
+  {"sync",      OPT_SYNC,      "MODE", "Flush copies to disk before removing sources: none, file or batch (default: none)"},
+  {"incremental", OPT_INCREMENTAL, NULL, "Skip files recorded as imported in manifest of target directory"},
+  {"dedup",     OPT_DEDUP,     NULL,  "Skip files with the same contents as another source file or a file in target directory (disables --pipeline)"},
+  {"index-width", OPT_INDEX_WIDTH, "N", "Pad file numbers with zeros to N digits, or 'auto' to fit the largest number (default: 3)"},
+  {"per-date-numbering", OPT_PER_DATE_NUMBERING, NULL, "Number files of every date separately, after files of this date in target directory"},
+  {"max-memory", OPT_MAX_MEMORY, "SIZE", "Sort found files in temporary files and import them in windows to keep memory use under SIZE bytes, K, M or G (disables --pipeline)"},
+  {"batch-size", OPT_BATCH_SIZE, "N|SIZE", "Import files in separate transactions of N files, or of SIZE bytes with B, K, M or G suffix, each committed before the next one (disables --pipeline)"},
+  {"rules",     OPT_RULES,     "FILE", "Decide action and extra tags of every file by rules in FILE: copy, move, ignore or delete (disables --pipeline)"},
+  {"dry-run",   OPT_DRY_RUN,   NULL,  "Do not copy files"},
+  {"help",      'h',           NULL,  "Print this help message"},
 };
 
 enum {
@@ -103,6 +143,187 @@ static int is_short_option(const char* arg) {
   return strlen(arg) > 1 && arg[0] == '-' && arg[1] != '-';
 }
 
+/**
+ * Parse decimal number in range [min_value, max_value].
+ * Returns 0 on success, -1 on invalid value.
+ */
+static int parse_number(
+  const char* value,
+  unsigned long min_value,
+  unsigned long max_value,
+  unsigned long* result
+) {
+  if (value[0] < '0' || value[0] > '9') {
+    return -1;
+  }
+
+  char* end = NULL;
+  errno = 0;
+  unsigned long number = strtoul(value, &end, 10);
+  if (errno != 0 || *end != '\0') {
+    return -1;
+  }
+  if (number < min_value || number > max_value) {
+    return -1;
+  }
+
+  *result = number;
+  return 0;
+}
+
+/**
+ * Parse reflink mode name.
+ * Returns 0 on success, -1 on invalid value.
+ */
+static int parse_reflink_mode(const char* value, reflink_mode_t* result) {
+  if (strcmp(value, "auto") == 0) {
+    *result = REFLINK_AUTO;
+  } else if (strcmp(value, "always") == 0) {
+    *result = REFLINK_ALWAYS;
+  } else if (strcmp(value, "never") == 0) {
+    *result = REFLINK_NEVER;
+  } else {
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Parse page cache policy name.
+ * Returns 0 on success, -1 on invalid value.
+ */
+static int parse_cache_policy(const char* value, cache_policy_t* result) {
+  if (strcmp(value, "keep") == 0) {
+    *result = CACHE_POLICY_KEEP;
+  } else if (strcmp(value, "drop") == 0) {
+    *result = CACHE_POLICY_DROP;
+  } else if (strcmp(value, "direct") == 0) {
+    *result = CACHE_POLICY_DIRECT;
+  } else {
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Parse durability mode name.
+ * Returns 0 on success, -1 on invalid value.
+ */
+static int parse_sync_mode(const char* value, sync_mode_t* result) {
+  if (strcmp(value, "none") == 0) {
+    *result = SYNC_NONE;
+  } else if (strcmp(value, "file") == 0) {
+    *result = SYNC_FILE;
+  } else if (strcmp(value, "batch") == 0) {
+    *result = SYNC_BATCH;
+  } else {
+    return -1;
+  }
+  return 0;
+}
+
+static int parse_index_width(const char* value, unsigned* result) {
+  if (strcmp(value, "auto") == 0) {
+    *result = 0;
+    return 0;
+  }
+  unsigned long width = 0;
+  if (parse_number(value, 1, FILE_INDEX_MAX_WIDTH, &width) != 0) {
+    return -1;
+  }
+  *result = (unsigned) width;
+  return 0;
+}
+
+/**
+ * Parse amount of bytes: decimal number, optionally followed by B for bytes,
+ * or K, M or G for binary kilobytes, megabytes or gigabytes. Sets `has_suffix`
+ * if a suffix was given.
+ * Returns 0 on success, -1 on invalid value.
+ */
+static int parse_byte_count(const char* value, unsigned long long* result, int* has_suffix) {
+  if (value[0] < '0' || value[0] > '9') {
+    return -1;
+  }
+
+  char* end = NULL;
+  errno = 0;
+  unsigned long long number = strtoull(value, &end, 10);
+  if (errno != 0) {
+    return -1;
+  }
+
+  unsigned shift = 0;
+  switch (*end) {
+  case '\0':
+  case 'B':
+  case 'b':
+    break;
+  case 'K':
+  case 'k':
+    shift = 10;
+    break;
+  case 'M':
+  case 'm':
+    shift = 20;
+    break;
+  case 'G':
+  case 'g':
+    shift = 30;
+    break;
+  default:
+    return -1;
+  }
+  *has_suffix = *end != '\0';
+  if (*has_suffix && *(end + 1) != '\0') {
+    return -1;
+  }
+  if (number > (ULLONG_MAX >> shift)) {
+    return -1;
+  }
+
+  *result = number << shift;
+  return 0;
+}
+
+/**
+ * Parse memory limit, in bytes or with a suffix, at least `CLI_MIN_MEMORY`.
+ * Returns 0 on success, -1 on invalid value.
+ */
+static int parse_memory_size(const char* value, size_t* result) {
+  unsigned long long number = 0;
+  int has_suffix = 0;
+  if (parse_byte_count(value, &number, &has_suffix) != 0) {
+    return -1;
+  }
+  if (number > SIZE_MAX || number < CLI_MIN_MEMORY) {
+    return -1;
+  }
+
+  *result = (size_t) number;
+  return 0;
+}
+
+/**
+ * Parse batch size: a number of files, or a number of bytes if followed by
+ * a suffix. The other limit is set to 0.
+ * Returns 0 on success, -1 on invalid value.
+ */
+static int parse_batch_size(const char* value, size_t* file_count, uint64_t* byte_count) {
+  unsigned long long number = 0;
+  int has_suffix = 0;
+  if (parse_byte_count(value, &number, &has_suffix) != 0) {
+    return -1;
+  }
+  if (number == 0 || (!has_suffix && number > SIZE_MAX)) {
+    return -1;
+  }
+
+  *file_count = has_suffix ? 0 : (size_t) number;
+  *byte_count = has_suffix ? (uint64_t) number : 0;
+  return 0;
+}
+
 static int apply_option(int option_idx, char* value, CliArgs* parsed) {
   const CliOptionDef* opt = &CliOptions[option_idx];
 
@@ -116,12 +337,30 @@ static int apply_option(int option_idx, char* value, CliArgs* parsed) {
     case 'f':
       parsed->force = 1;
       break;
+    case 'r':
+      parsed->recursive = 1;
+      break;
     case 'h':
       print_help(parsed->program_name);
       exit(0);
-    case 0:
+    case OPT_DRY_RUN:
       parsed->dry_run = 1;
       break;
+    case OPT_PIPELINE:
+      parsed->pipeline = 1;
+      break;
+    case OPT_IO_URING:
+      parsed->io_uring = 1;
+      break;
+    case OPT_INCREMENTAL:
+      parsed->incremental = 1;
+      break;
+    case OPT_DEDUP:
+      parsed->dedup = 1;
+      break;
+    case OPT_PER_DATE_NUMBERING:
+      parsed->per_date_numbering = 1;
+      break;
     default:
       fprintf(stderr, "Unknown option '-%c'\n", opt->short_name);
       return -1;
@@ -163,6 +402,66 @@ static int apply_option(int option_idx, char* value, CliArgs* parsed) {
     }
     parsed->target_dir = value;
     break;
+  case 'j': {
+    unsigned long jobs = 0;
+    if (parse_number(value, 1, CLI_MAX_JOBS, &jobs) != 0) {
+      fprintf(stderr, "Number of jobs must be between 1 and %d\n", CLI_MAX_JOBS);
+      return -1;
+    }
+    parsed->jobs = (unsigned) jobs;
+    break;
+  }
+  case OPT_MAX_DEPTH: {
+    unsigned long depth = 0;
+    if (parse_number(value, 1, CLI_MAX_DEPTH, &depth) != 0) {
+      fprintf(stderr, "Maximum depth must be between 1 and %d\n", CLI_MAX_DEPTH);
+      return -1;
+    }
+    parsed->max_depth = (unsigned) depth;
+    parsed->recursive = 1;
+    break;
+  }
+  case OPT_REFLINK:
+    if (parse_reflink_mode(value, &parsed->reflink) != 0) {
+      fprintf(stderr, "Reflink mode must be one of: auto, always, never\n");
+      return -1;
+    }
+    break;
+  case OPT_CACHE_POLICY:
+    if (parse_cache_policy(value, &parsed->cache_policy) != 0) {
+      fprintf(stderr, "Cache policy must be one of: keep, drop, direct\n");
+      return -1;
+    }
+    break;
+  case OPT_SYNC:
+    if (parse_sync_mode(value, &parsed->sync) != 0) {
+      fprintf(stderr, "Sync mode must be one of: none, file, batch\n");
+      return -1;
+    }
+    break;
+  case OPT_INDEX_WIDTH:
+    if (parse_index_width(value, &parsed->index_width) != 0) {
+      fprintf(stderr, "Index width must be 'auto' or between 1 and %d\n", FILE_INDEX_MAX_WIDTH);
+      return -1;
+    }
+    break;
+  case OPT_MAX_MEMORY:
+    if (parse_memory_size(value, &parsed->max_memory) != 0) {
+      fprintf(stderr, "Memory limit must be a number of bytes, optionally followed by "
+                      "K, M or G, and at least %dK\n", CLI_MIN_MEMORY / 1024);
+      return -1;
+    }
+    break;
+  case OPT_RULES:
+    parsed->rules_path = value;
+    break;
+  case OPT_BATCH_SIZE:
+    if (parse_batch_size(value, &parsed->batch_files, &parsed->batch_bytes) != 0) {
+      fprintf(stderr, "Batch size must be a positive number of files, or of bytes "
+                      "followed by B, K, M or G\n");
+      return -1;
+    }
+    break;
   default:
     fprintf(stderr, "Unknown option '-%c'\n", opt->short_name);
     return -1;
@@ -255,7 +554,7 @@ void print_help(const char* progname) {
   printf("Usage: %s -s DIR -d DIR [options]\n", progname);
   for (size_t i = 0; i < CLI_OPTION_COUNT; ++i) {
     printf("  ");
-    if (CliOptions[i].short_name) {
+    if (CliOptions[i].short_name && CliOptions[i].short_name < OPT_LONG_ONLY) {
       printf("-%c", CliOptions[i].short_name);
       if (CliOptions[i].arg_name)
         printf(" %s", CliOptions[i].arg_name);
@@ -276,6 +575,22 @@ int parse_args(int argc, char** argv, CliArgs* parsed) {
   parsed->dry_run = 0;
   parsed->verbose = 0;
   parsed->force = 0;
+  parsed->jobs = 1;
+  parsed->recursive = 0;
+  parsed->max_depth = 0;
+  parsed->pipeline = 0;
+  parsed->reflink = REFLINK_AUTO;
+  parsed->io_uring = 0;
+  parsed->cache_policy = CACHE_POLICY_KEEP;
+  parsed->sync = SYNC_NONE;
+  parsed->incremental = 0;
+  parsed->dedup = 0;
+  parsed->index_width = FILE_INDEX_DEFAULT_WIDTH;
+  parsed->per_date_numbering = 0;
+  parsed->max_memory = 0;
+  parsed->batch_files = 0;
+  parsed->batch_bytes = 0;
+  parsed->rules_path = NULL;
 
   CliParseState state = {
     .argc = argc,
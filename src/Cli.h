@@ -11,9 +11,15 @@
 #define CLI_H
 
 #include <stddef.h>
+#include <stdint.h>
+
+#include "Files/Transaction.h"
 
 enum {
-  CLI_MAX_TAGS = 16 /*!< Maximum amount of tags passed as options */
+  CLI_MAX_TAGS = 16, /*!< Maximum amount of tags passed as options */
+  CLI_MAX_JOBS = 256, /*!< Maximum number of worker threads */
+  CLI_MAX_DEPTH = 4096, /*!< Maximum nesting level of scanned directories */
+  CLI_MIN_MEMORY = 16 * 1024 /*!< Minimum memory limit in bytes */
 };
 
 /**
@@ -28,6 +34,22 @@ typedef struct {
   int verbose;                    /*!< Verbose output flag */
   int dry_run;                    /*!< Dry-run mode flag */
   int force;                      /*!< Force overwrite flag */
+  unsigned jobs;                  /*!< Number of worker threads */
+  int recursive;                  /*!< Recursive scan flag */
+  unsigned max_depth;             /*!< Maximum scan depth, 0 for no limit */
+  int pipeline;                   /*!< Copy files during scan flag */
+  reflink_mode_t reflink;         /*!< Use of copy-on-write clones */
+  int io_uring;                   /*!< Copy files with io_uring flag */
+  cache_policy_t cache_policy;    /*!< Use of page cache by copied files */
+  sync_mode_t sync;               /*!< Durability of copied files */
+  int incremental;                /*!< Skip already imported files flag */
+  int dedup;                      /*!< Skip duplicate files flag */
+  unsigned index_width;           /*!< Digits of file numbers, 0 to fit the largest one */
+  int per_date_numbering;         /*!< Number every date separately flag */
+  size_t max_memory;              /*!< Memory limit of windowed import in bytes, 0 for no limit */
+  size_t batch_files;             /*!< Files per transaction of chunked import, 0 for no limit */
+  uint64_t batch_bytes;           /*!< Source bytes per transaction of chunked import, 0 for no limit */
+  char* rules_path;               /*!< Path to rules file, NULL to copy every file */
 } CliArgs;
 
 /**
@@ -0,0 +1,126 @@
+#include "Arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "Common/Panic.h"
+
+enum {
+  ARENA_ALIGNMENT = 16,           /* Enough for any scalar type on supported hosts */
+  ARENA_BLOCK_SIZE = 256 * 1024,  /* Usable size of regular block */
+  ARENA_LARGE_SIZE = ARENA_BLOCK_SIZE / 4 /* Larger objects get block of their own */
+};
+
+struct ArenaBlock_ {
+  ArenaBlock* next;
+  size_t size;  /* Usable size */
+};
+
+/* Usable space of block starts after aligned header */
+static const size_t BlockHeaderSize =
+  (sizeof(ArenaBlock) + ARENA_ALIGNMENT - 1) & ~((size_t) ARENA_ALIGNMENT - 1);
+
+static char* block_data(ArenaBlock* block) {
+  return (char*) block + BlockHeaderSize;
+}
+
+static ArenaBlock* create_block(size_t size) {
+  /* Zeroed memory of fresh blocks comes from kernel without extra writes */
+  ArenaBlock* block = (ArenaBlock*) calloc(1, BlockHeaderSize + size);
+  PANIC_ON_BAD_ALLOC(block);
+  block->next = NULL;
+  block->size = size;
+  return block;
+}
+
+void arena_init(Arena* arena) {
+  PANIC_IF_NULL(arena);
+
+  arena->blocks = NULL;
+  arena->cursor = NULL;
+  arena->end = NULL;
+  arena->block_count = 0;
+}
+
+void arena_destroy(Arena* arena) {
+  PANIC_IF_NULL(arena);
+
+  ArenaBlock* block = arena->blocks;
+  while (block != NULL) {
+    ArenaBlock* next = block->next;
+    free(block);
+    block = next;
+  }
+  arena_init(arena);
+}
+
+void* arena_alloc(Arena* arena, size_t size) {
+  PANIC_IF_NULL(arena);
+
+  size = (size + ARENA_ALIGNMENT - 1) & ~((size_t) ARENA_ALIGNMENT - 1);
+  if (size == 0) {
+    size = ARENA_ALIGNMENT;
+  }
+
+  if ((size_t) (arena->end - arena->cursor) >= size) {
+    void* result = arena->cursor;
+    arena->cursor += size;
+    return result;
+  }
+
+  if (size > ARENA_LARGE_SIZE && arena->blocks != NULL) {
+    /* Keep filling current block, put large object behind it */
+    ArenaBlock* block = create_block(size);
+    block->next = arena->blocks->next;
+    arena->blocks->next = block;
+    arena->block_count++;
+    return block_data(block);
+  }
+
+  ArenaBlock* block = create_block(size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE);
+  block->next = arena->blocks;
+  arena->blocks = block;
+  arena->block_count++;
+  arena->cursor = block_data(block) + size;
+  arena->end = block_data(block) + block->size;
+  return block_data(block);
+}
+
+char* arena_copy_string_n(Arena* arena, const char* string, size_t length) {
+  PANIC_IF_NULL(string);
+
+  char* copy = (char*) arena_alloc(arena, length + 1);
+  memcpy(copy, string, length);
+  copy[length] = '\0';
+  return copy;
+}
+
+char* arena_copy_string(Arena* arena, const char* string) {
+  PANIC_IF_NULL(string);
+
+  return arena_copy_string_n(arena, string, strlen(string));
+}
+
+void arena_merge(Arena* target, Arena* source) {
+  PANIC_IF_NULL(target);
+  PANIC_IF_NULL(source);
+
+  if (source->blocks == NULL) {
+    return;
+  }
+  if (target->blocks == NULL) {
+    *target = *source;
+    arena_init(source);
+    return;
+  }
+
+  /* Target keeps filling its own block, blocks of source go behind it */
+  ArenaBlock* last = source->blocks;
+  while (last->next != NULL) {
+    last = last->next;
+  }
+  last->next = target->blocks->next;
+  target->blocks->next = source->blocks;
+  target->block_count += source->block_count;
+  arena_init(source);
+}
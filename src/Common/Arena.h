@@ -0,0 +1,65 @@
+/**
+ * @file Arena.h
+ * @author MeerkatBoss (solodovnikov.ia@phystech.su)
+ *
+ * @brief Region allocator for objects sharing one lifetime
+ *
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright MeerkatBoss (c) 2026
+ */
+#ifndef __COMMON_ARENA_H
+#define __COMMON_ARENA_H
+
+#include <stddef.h>
+
+typedef struct ArenaBlock_ ArenaBlock;
+
+/**
+ * @brief Region allocator. Memory is taken from large blocks by advancing
+ * a pointer and is released all at once when arena is destroyed.
+ *
+ * @warning Arena is not thread-safe. Threads should either allocate from
+ *          arenas of their own and merge them, or serialize allocations.
+ */
+typedef struct {
+  ArenaBlock* blocks; /*!< Allocated blocks, the one being filled first */
+  char* cursor;       /*!< Free space in the first block */
+  char* end;          /*!< End of the first block */
+  size_t block_count; /*!< Number of allocated blocks */
+} Arena;
+
+/**
+ * @brief Initialize empty arena. No memory is allocated until it is needed.
+ */
+void arena_init(Arena* arena);
+
+/**
+ * @brief Release all memory allocated from arena
+ */
+void arena_destroy(Arena* arena);
+
+/**
+ * @brief Allocate `size` zero-filled bytes, aligned for any object type
+ */
+void* arena_alloc(Arena* arena, size_t size);
+
+/**
+ * @brief Copy first `length` characters of `string` to arena, appending
+ * terminating null character
+ */
+char* arena_copy_string_n(Arena* arena, const char* string, size_t length);
+
+/**
+ * @brief Copy null-terminated `string` to arena
+ */
+char* arena_copy_string(Arena* arena, const char* string);
+
+/**
+ * @brief Make `target` own all memory of `source`, leaving `source` empty.
+ * Pointers allocated from `source` stay valid.
+ */
+void arena_merge(Arena* target, Arena* source);
+
+#endif /* Arena.h */
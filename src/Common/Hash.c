@@ -0,0 +1,151 @@
+#include "Hash.h"
+
+#include <string.h>
+
+#include "Common/Panic.h"
+
+static const uint64_t Prime1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t Prime2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t Prime3 = 0x165667B19E3779F9ULL;
+static const uint64_t Prime4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t Prime5 = 0x27D4EB2F165667C5ULL;
+
+static uint64_t rotate_left(uint64_t value, unsigned shift) {
+  return (value << shift) | (value >> (64 - shift));
+}
+
+static uint64_t read_u64(const unsigned char* data) {
+  uint64_t value;
+  memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+static uint32_t read_u32(const unsigned char* data) {
+  uint32_t value;
+  memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+static uint64_t mix_lane(uint64_t lane, uint64_t input) {
+  lane += input * Prime2;
+  lane = rotate_left(lane, 31);
+  return lane * Prime1;
+}
+
+static uint64_t merge_lane(uint64_t hash, uint64_t lane) {
+  hash ^= mix_lane(0, lane);
+  return hash * Prime1 + Prime4;
+}
+
+/* Lanes do not depend on each other, so their rounds overlap in pipeline */
+static const unsigned char* consume_stripes(
+  uint64_t lanes[4],
+  const unsigned char* data,
+  const unsigned char* end
+) {
+  uint64_t lane0 = lanes[0];
+  uint64_t lane1 = lanes[1];
+  uint64_t lane2 = lanes[2];
+  uint64_t lane3 = lanes[3];
+
+  while ((size_t) (end - data) >= HASH_STRIPE_SIZE) {
+    lane0 = mix_lane(lane0, read_u64(data));
+    lane1 = mix_lane(lane1, read_u64(data + 8));
+    lane2 = mix_lane(lane2, read_u64(data + 16));
+    lane3 = mix_lane(lane3, read_u64(data + 24));
+    data += HASH_STRIPE_SIZE;
+  }
+
+  lanes[0] = lane0;
+  lanes[1] = lane1;
+  lanes[2] = lane2;
+  lanes[3] = lane3;
+  return data;
+}
+
+void hash_init(HashState* state, uint64_t seed) {
+  PANIC_IF_NULL(state);
+
+  state->lanes[0] = seed + Prime1 + Prime2;
+  state->lanes[1] = seed + Prime2;
+  state->lanes[2] = seed;
+  state->lanes[3] = seed - Prime1;
+  state->total_length = 0;
+  state->pending_length = 0;
+}
+
+void hash_update(HashState* state, const void* data, size_t size) {
+  PANIC_IF_NULL(state);
+
+  const unsigned char* bytes = (const unsigned char*) data;
+  const unsigned char* end = bytes + size;
+  state->total_length += size;
+
+  /* Complete stripe left from previous update */
+  if (state->pending_length > 0) {
+    size_t missing = HASH_STRIPE_SIZE - state->pending_length;
+    if (size < missing) {
+      memcpy(state->pending + state->pending_length, bytes, size);
+      state->pending_length += size;
+      return;
+    }
+    memcpy(state->pending + state->pending_length, bytes, missing);
+    consume_stripes(state->lanes, state->pending, state->pending + HASH_STRIPE_SIZE);
+    bytes += missing;
+    state->pending_length = 0;
+  }
+
+  bytes = consume_stripes(state->lanes, bytes, end);
+
+  if (bytes < end) {
+    state->pending_length = (size_t) (end - bytes);
+    memcpy(state->pending, bytes, state->pending_length);
+  }
+}
+
+uint64_t hash_digest(const HashState* state) {
+  PANIC_IF_NULL(state);
+
+  uint64_t hash = 0;
+  if (state->total_length >= HASH_STRIPE_SIZE) {
+    hash = rotate_left(state->lanes[0], 1) + rotate_left(state->lanes[1], 7)
+         + rotate_left(state->lanes[2], 12) + rotate_left(state->lanes[3], 18);
+    for (size_t i = 0; i < 4; ++i) {
+      hash = merge_lane(hash, state->lanes[i]);
+    }
+  } else {
+    /* Lanes were never mixed, third one holds the seed */
+    hash = state->lanes[2] + Prime5;
+  }
+  hash += state->total_length;
+
+  const unsigned char* tail = state->pending;
+  const unsigned char* end = state->pending + state->pending_length;
+  for (; end - tail >= 8; tail += 8) {
+    hash ^= mix_lane(0, read_u64(tail));
+    hash = rotate_left(hash, 27) * Prime1 + Prime4;
+  }
+  if (end - tail >= 4) {
+    hash ^= (uint64_t) read_u32(tail) * Prime1;
+    hash = rotate_left(hash, 23) * Prime2 + Prime3;
+    tail += 4;
+  }
+  for (; tail < end; ++tail) {
+    hash ^= (uint64_t) *tail * Prime5;
+    hash = rotate_left(hash, 11) * Prime1;
+  }
+
+  hash ^= hash >> 33;
+  hash *= Prime2;
+  hash ^= hash >> 29;
+  hash *= Prime3;
+  hash ^= hash >> 32;
+  return hash;
+}
+
+uint64_t hash_bytes(const void* data, size_t size, uint64_t seed) {
+  HashState state;
+  hash_init(&state, seed);
+  hash_update(&state, data, size);
+  return hash_digest(&state);
+}
@@ -0,0 +1,57 @@
+/**
+ * @file Hash.h
+ * @author MeerkatBoss (solodovnikov.ia@phystech.su)
+ *
+ * @brief Fast non-cryptographic hash of byte streams
+ *
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright MeerkatBoss (c) 2026
+ */
+#ifndef __COMMON_HASH_H
+#define __COMMON_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum {
+  HASH_STRIPE_SIZE = 32 /*!< Bytes consumed by one round of all lanes */
+};
+
+/**
+ * @brief State of incremental 64-bit hash.
+ *
+ * @note
+ * Data is consumed in 32-byte stripes by four independent 64-bit lanes, so
+ * that lanes are computed in parallel by the CPU. On little-endian hosts
+ * values are equal to XXH64; on others they differ, so they must not be stored.
+ */
+typedef struct {
+  uint64_t lanes[4];                        /*!< Accumulators of lanes */
+  uint64_t total_length;                    /*!< Number of bytes consumed */
+  unsigned char pending[HASH_STRIPE_SIZE];  /*!< Incomplete stripe */
+  size_t pending_length;                    /*!< Bytes in `pending` */
+} HashState;
+
+/**
+ * @brief Start hashing with given `seed`
+ */
+void hash_init(HashState* state, uint64_t seed);
+
+/**
+ * @brief Consume `size` bytes of `data`
+ */
+void hash_update(HashState* state, const void* data, size_t size);
+
+/**
+ * @brief Get hash of all consumed bytes. State is not modified.
+ */
+uint64_t hash_digest(const HashState* state);
+
+/**
+ * @brief Hash `size` bytes of `data` at once
+ */
+uint64_t hash_bytes(const void* data, size_t size, uint64_t seed);
+
+#endif /* Hash.h */
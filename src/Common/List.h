@@ -145,6 +145,120 @@ static inline LinkedListNode* list_pop_back(LinkedList* list) {
   return node;
 }
 
+/**
+ * @brief Move all nodes of `source` to the end of `list`, leaving `source` empty
+ */
+static inline void list_splice_back(LinkedList* list, LinkedList* source) {
+  if (list_is_empty(source)) {
+    return;
+  }
+
+  LinkedListNode* first = source->root.next;
+  LinkedListNode* last = source->root.prev;
+  LinkedListNode* tail = list->root.prev;
+
+  tail->next = first;
+  first->prev = tail;
+  last->next = &list->root;
+  list->root.prev = last;
+
+  list_init(source);
+}
+
+/**
+ * @brief Node comparison function
+ *
+ * @return Negative value if `lhs` should precede `rhs`, positive value if
+ *         `rhs` should precede `lhs`, zero if nodes are equivalent
+ */
+typedef int (*list_compare_t)(const LinkedListNode* lhs, const LinkedListNode* rhs);
+
+/**
+ * @brief Merge two `NULL`-terminated chains linked by `next` field.
+ * Nodes of `lhs` precede equivalent nodes of `rhs`.
+ *
+ * @return Head of merged chain
+ */
+static inline LinkedListNode* list_merge_chains(
+    LinkedListNode* lhs,
+    LinkedListNode* rhs,
+    list_compare_t compare
+) {
+  LinkedListNode head = {NULL, NULL};
+  LinkedListNode* tail = &head;
+
+  while (lhs != NULL && rhs != NULL) {
+    if (compare(rhs, lhs) < 0) {
+      tail->next = rhs;
+      rhs = rhs->next;
+    } else {
+      tail->next = lhs;
+      lhs = lhs->next;
+    }
+    tail = tail->next;
+  }
+  tail->next = (lhs != NULL) ? lhs : rhs;
+
+  return head.next;
+}
+
+/**
+ * @brief Sort list in O(n log n) time. Order of equivalent nodes is preserved.
+ *
+ * @note Uses bottom-up merge sort and does not allocate memory
+ */
+static inline void list_sort(LinkedList* list, list_compare_t compare) {
+  enum {
+    MAX_RUNS = 64 /* Run `i` holds 2^i nodes, enough for any address space */
+  };
+
+  if (list_is_empty(list)) {
+    return;
+  }
+
+  /* Pending runs; runs with greater index hold earlier nodes */
+  LinkedListNode* runs[MAX_RUNS] = {NULL};
+  size_t run_count = 0;
+
+  list->root.prev->next = NULL;
+  LinkedListNode* node = list->root.next;
+  while (node != NULL) {
+    LinkedListNode* next = node->next;
+    node->next = NULL;
+
+    LinkedListNode* carry = node;
+    size_t run = 0;
+    while (run + 1 < MAX_RUNS && runs[run] != NULL) {
+      carry = list_merge_chains(runs[run], carry, compare);
+      runs[run] = NULL;
+      ++run;
+    }
+    runs[run] = carry;
+    if (run + 1 > run_count) {
+      run_count = run + 1;
+    }
+
+    node = next;
+  }
+
+  LinkedListNode* sorted = NULL;
+  for (size_t run = 0; run < run_count; ++run) {
+    if (runs[run] != NULL) {
+      sorted = list_merge_chains(runs[run], sorted, compare);
+    }
+  }
+
+  /* Restore back links */
+  LinkedListNode* prev = &list->root;
+  for (node = sorted; node != NULL; node = node->next) {
+    prev->next = node;
+    node->prev = prev;
+    prev = node;
+  }
+  prev->next = &list->root;
+  list->root.prev = prev;
+}
+
 /**
  * @brief Iterate over linked list
  *
@@ -0,0 +1,106 @@
+#include "StringSet.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "Common/Hash.h"
+#include "Common/Panic.h"
+
+enum {
+  INITIAL_CAPACITY = 64
+};
+
+void string_set_init(StringSet* set) {
+  PANIC_IF_NULL(set);
+
+  set->slots = NULL;
+  set->capacity = 0;
+  set->count = 0;
+  arena_init(&set->strings);
+}
+
+void string_set_destroy(StringSet* set) {
+  PANIC_IF_NULL(set);
+
+  arena_destroy(&set->strings);
+  free(set->slots);
+  string_set_init(set);
+}
+
+/* Find slot holding string, or empty slot where it belongs */
+static StringSetSlot* find_slot(
+  StringSetSlot* slots,
+  size_t capacity,
+  const char* string,
+  size_t length,
+  uint64_t hash
+) {
+  size_t mask = capacity - 1;
+  for (size_t pos = (size_t) hash & mask;; pos = (pos + 1) & mask) {
+    StringSetSlot* slot = &slots[pos];
+    if (slot->string == NULL) {
+      return slot;
+    }
+    if (slot->hash == hash && strncmp(slot->string, string, length) == 0
+        && slot->string[length] == '\0') {
+      return slot;
+    }
+  }
+}
+
+static void grow(StringSet* set) {
+  size_t capacity = set->capacity > 0 ? 2 * set->capacity : INITIAL_CAPACITY;
+  StringSetSlot* slots = (StringSetSlot*) calloc(capacity, sizeof(*slots));
+  PANIC_ON_BAD_ALLOC(slots);
+
+  for (size_t i = 0; i < set->capacity; ++i) {
+    const StringSetSlot* old = &set->slots[i];
+    if (old->string == NULL) {
+      continue;
+    }
+    /* Stored strings are distinct, so the first empty slot is the place */
+    size_t mask = capacity - 1;
+    size_t pos = (size_t) old->hash & mask;
+    while (slots[pos].string != NULL) {
+      pos = (pos + 1) & mask;
+    }
+    slots[pos] = *old;
+  }
+
+  free(set->slots);
+  set->slots = slots;
+  set->capacity = capacity;
+}
+
+int string_set_insert(StringSet* set, const char* string, size_t length) {
+  PANIC_IF_NULL(set);
+  PANIC_IF_NULL(string);
+
+  /* Keep load factor at most one half, so that probe sequences stay short */
+  if (2 * (set->count + 1) > set->capacity) {
+    grow(set);
+  }
+
+  uint64_t hash = hash_bytes(string, length, 0);
+  StringSetSlot* slot = find_slot(set->slots, set->capacity, string, length, hash);
+  if (slot->string != NULL) {
+    return 0;
+  }
+
+  slot->string = arena_copy_string_n(&set->strings, string, length);
+  slot->hash = hash;
+  set->count++;
+  return 1;
+}
+
+int string_set_contains(const StringSet* set, const char* string, size_t length) {
+  PANIC_IF_NULL(set);
+  PANIC_IF_NULL(string);
+
+  if (set->count == 0) {
+    return 0;
+  }
+
+  uint64_t hash = hash_bytes(string, length, 0);
+  return find_slot(set->slots, set->capacity, string, length, hash)->string != NULL;
+}
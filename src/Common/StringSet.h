@@ -0,0 +1,61 @@
+/**
+ * @file StringSet.h
+ * @author MeerkatBoss (solodovnikov.ia@phystech.su)
+ *
+ * @brief Hash set of strings
+ *
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright MeerkatBoss (c) 2026
+ */
+#ifndef __COMMON_STRING_SET_H
+#define __COMMON_STRING_SET_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "Common/Arena.h"
+
+/**
+ * @brief Slot of string set
+ */
+typedef struct {
+  uint64_t hash;  /*!< Hash of stored string */
+  char* string;   /*!< Stored string (in `strings`), NULL for empty slot */
+} StringSetSlot;
+
+/**
+ * @brief Set of strings with open addressing and linear probing
+ */
+typedef struct {
+  StringSetSlot* slots;   /*!< Slots, number is a power of two */
+  size_t capacity;        /*!< Number of slots */
+  size_t count;           /*!< Number of stored strings */
+  Arena strings;          /*!< Copies of stored strings */
+} StringSet;
+
+/**
+ * @brief Initialize empty set
+ */
+void string_set_init(StringSet* set);
+
+/**
+ * @brief Free all stored strings at once
+ */
+void string_set_destroy(StringSet* set);
+
+/**
+ * @brief Add copy of first `length` characters of `string` to set
+ *
+ * @return Nonzero if string was added, zero if it was already in set
+ */
+int string_set_insert(StringSet* set, const char* string, size_t length);
+
+/**
+ * @brief Check whether set contains first `length` characters of `string`.
+ * Can be called from several threads at once while set is not modified.
+ */
+int string_set_contains(const StringSet* set, const char* string, size_t length);
+
+#endif /* StringSet.h */
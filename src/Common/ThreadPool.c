@@ -0,0 +1,146 @@
+#include "ThreadPool.h"
+
+#include <stdlib.h>
+
+#include "Common/Panic.h"
+
+static void* worker_main(void* argument) {
+  ThreadPool* pool = (ThreadPool*) argument;
+
+  pthread_mutex_lock(&pool->lock);
+  for (;;) {
+    while (pool->queue_length == 0 && !pool->stopping) {
+      pthread_cond_wait(&pool->has_tasks, &pool->lock);
+    }
+    if (pool->queue_length == 0) {
+      /* Stopping and nothing left to do */
+      break;
+    }
+
+    ThreadPoolTask task = pool->queue[pool->queue_head];
+    pool->queue_head = (pool->queue_head + 1) % pool->queue_capacity;
+    pool->queue_length--;
+    pool->active_count++;
+    pthread_cond_signal(&pool->has_space);
+    pthread_mutex_unlock(&pool->lock);
+
+    task.function(task.argument);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->active_count--;
+    if (pool->queue_length == 0 && pool->active_count == 0) {
+      pthread_cond_broadcast(&pool->is_idle);
+    }
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  return NULL;
+}
+
+void thread_pool_init(ThreadPool* pool, size_t thread_count, size_t queue_capacity) {
+  PANIC_IF_NULL(pool);
+
+  pool->threads = NULL;
+  pool->thread_count = 0;
+  pool->queue = NULL;
+  pool->queue_capacity = queue_capacity > 0 ? queue_capacity : 1;
+  pool->queue_head = 0;
+  pool->queue_length = 0;
+  pool->active_count = 0;
+  pool->stopping = 0;
+
+  if (thread_count == 0) {
+    return;
+  }
+
+  pool->queue = (ThreadPoolTask*) calloc(pool->queue_capacity, sizeof(*pool->queue));
+  PANIC_ON_BAD_ALLOC(pool->queue);
+  pool->threads = (pthread_t*) calloc(thread_count, sizeof(*pool->threads));
+  PANIC_ON_BAD_ALLOC(pool->threads);
+
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->has_tasks, NULL);
+  pthread_cond_init(&pool->has_space, NULL);
+  pthread_cond_init(&pool->is_idle, NULL);
+
+  for (size_t i = 0; i < thread_count; ++i) {
+    if (pthread_create(&pool->threads[i], NULL, worker_main, pool) != 0) {
+      break;
+    }
+    pool->thread_count++;
+  }
+
+  if (pool->thread_count == 0) {
+    /* Could not start any threads, run tasks synchronously */
+    pthread_cond_destroy(&pool->is_idle);
+    pthread_cond_destroy(&pool->has_space);
+    pthread_cond_destroy(&pool->has_tasks);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->threads);
+    free(pool->queue);
+    pool->threads = NULL;
+    pool->queue = NULL;
+  }
+}
+
+void thread_pool_submit(ThreadPool* pool, thread_pool_task_t function, void* argument) {
+  PANIC_IF_NULL(pool);
+  PANIC_IF_NULL(function);
+
+  if (pool->thread_count == 0) {
+    function(argument);
+    return;
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  while (pool->queue_length == pool->queue_capacity) {
+    pthread_cond_wait(&pool->has_space, &pool->lock);
+  }
+  size_t tail = (pool->queue_head + pool->queue_length) % pool->queue_capacity;
+  pool->queue[tail].function = function;
+  pool->queue[tail].argument = argument;
+  pool->queue_length++;
+  pthread_cond_signal(&pool->has_tasks);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+void thread_pool_wait(ThreadPool* pool) {
+  PANIC_IF_NULL(pool);
+
+  if (pool->thread_count == 0) {
+    return;
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  while (pool->queue_length > 0 || pool->active_count > 0) {
+    pthread_cond_wait(&pool->is_idle, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
+
+void thread_pool_destroy(ThreadPool* pool) {
+  PANIC_IF_NULL(pool);
+
+  if (pool->thread_count == 0) {
+    return;
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  pool->stopping = 1;
+  pthread_cond_broadcast(&pool->has_tasks);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (size_t i = 0; i < pool->thread_count; ++i) {
+    pthread_join(pool->threads[i], NULL);
+  }
+
+  pthread_cond_destroy(&pool->is_idle);
+  pthread_cond_destroy(&pool->has_space);
+  pthread_cond_destroy(&pool->has_tasks);
+  pthread_mutex_destroy(&pool->lock);
+  free(pool->threads);
+  free(pool->queue);
+  pool->threads = NULL;
+  pool->queue = NULL;
+  pool->thread_count = 0;
+}
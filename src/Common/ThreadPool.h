@@ -0,0 +1,74 @@
+/**
+ * @file ThreadPool.h
+ * @author MeerkatBoss (solodovnikov.ia@phystech.su)
+ *
+ * @brief Fixed-size worker thread pool with bounded task queue
+ *
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright MeerkatBoss (c) 2026
+ */
+#ifndef __COMMON_THREAD_POOL_H
+#define __COMMON_THREAD_POOL_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+/**
+ * @brief Function executed by pool workers
+ */
+typedef void (*thread_pool_task_t)(void* argument);
+
+/**
+ * @brief Pending task
+ */
+typedef struct {
+  thread_pool_task_t function;
+  void* argument;
+} ThreadPoolTask;
+
+/**
+ * @brief Pool of worker threads consuming tasks from bounded queue
+ */
+typedef struct {
+  pthread_t* threads;       /*!< Worker threads */
+  size_t thread_count;      /*!< Number of running workers */
+
+  ThreadPoolTask* queue;    /*!< Ring buffer of pending tasks */
+  size_t queue_capacity;    /*!< Maximum number of pending tasks */
+  size_t queue_head;        /*!< Position of oldest pending task */
+  size_t queue_length;      /*!< Number of pending tasks */
+  size_t active_count;      /*!< Number of tasks being executed */
+  int stopping;             /*!< Nonzero if workers should exit */
+
+  pthread_mutex_t lock;
+  pthread_cond_t has_tasks; /*!< Signalled when task is queued or pool stops */
+  pthread_cond_t has_space; /*!< Signalled when task is taken from queue */
+  pthread_cond_t is_idle;   /*!< Signalled when queue is empty and no tasks run */
+} ThreadPool;
+
+/**
+ * @brief Start pool with `thread_count` workers.
+ *
+ * @note Pool with zero workers executes tasks synchronously on submission.
+ *       If not all threads can be started, pool runs with fewer workers.
+ */
+void thread_pool_init(ThreadPool* pool, size_t thread_count, size_t queue_capacity);
+
+/**
+ * @brief Queue task for execution. Blocks while queue is full.
+ */
+void thread_pool_submit(ThreadPool* pool, thread_pool_task_t function, void* argument);
+
+/**
+ * @brief Wait until all submitted tasks are complete
+ */
+void thread_pool_wait(ThreadPool* pool);
+
+/**
+ * @brief Complete all submitted tasks, stop workers and free resources
+ */
+void thread_pool_destroy(ThreadPool* pool);
+
+#endif /* ThreadPool.h */
@@ -0,0 +1,634 @@
+#if defined(__linux__)
+/* copy_file_range(), fallocate(), sync_file_range() and O_DIRECT are GNU extensions */
+#define _GNU_SOURCE
+#endif
+
+#include "Copy.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#if defined(__linux__)
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+/* Kernel headers are optional, e.g. on musl without linux-headers */
+#if defined(__has_include)
+#if __has_include(<linux/fs.h>)
+#include <linux/fs.h>
+#endif
+#endif
+#endif
+
+#include "Common/Panic.h"
+
+enum {
+  KERNEL_CHUNK_SIZE = 1 << 30,  /* Bytes requested by single in-kernel copy call */
+  BUFFER_SIZE = 1 << 20,        /* Size of buffer for read/write copy */
+  MAX_STRATEGIES = 32,          /* Number of remembered file system pairs */
+  CHUNK_SIZE = 1 << 25,         /* Bytes taken by chunk worker at a time */
+  CACHE_WINDOW_SIZE = 1 << 23,  /* Bytes evicted from page cache at a time */
+  PREFETCH_SIZE = 1 << 23,      /* Bytes read ahead by file prefetch */
+  DIRECT_BUFFER_SIZE = 1 << 23, /* Size of buffer for O_DIRECT copy */
+  DIRECT_ALIGNMENT = 1 << 12    /* Alignment of O_DIRECT buffers, offsets and sizes */
+};
+
+/* Files of this size and larger are copied in chunks by several workers */
+#define CHUNKED_COPY_THRESHOLD ((off_t) 1 << 27)
+
+/* Files of this size and larger bypass page cache with CACHE_POLICY_DIRECT */
+#define DIRECT_COPY_THRESHOLD ((off_t) 1 << 27)
+
+typedef enum {
+  COPY_STATUS_DONE,         /* All data copied */
+  COPY_STATUS_UNSUPPORTED,  /* Method cannot be used for these files */
+  COPY_STATUS_FAILED        /* I/O error */
+} copy_status_t;
+
+/*
+ * Copy data from `*offset` up to `end` or end of source file, advancing
+ * `*offset`. Method may report itself unsupported at any point, leaving
+ * `*offset` at the first byte it did not copy.
+ */
+typedef copy_status_t (*copy_backend_t)(int source_fd, int dest_fd, off_t end, off_t* offset);
+
+/* Method selected for pair of file systems */
+typedef struct {
+  dev_t source_device;
+  dev_t dest_device;
+  copy_method_t method;
+} CopyStrategy;
+
+static CopyStrategy sStrategies[MAX_STRATEGIES];
+static size_t sStrategyCount = 0;
+static pthread_mutex_t sStrategyLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Large file copied by several chunk workers */
+typedef struct {
+  int source_fd;
+  int dest_fd;
+  off_t size;
+  cache_policy_t cache_policy;
+
+  pthread_mutex_t lock;
+  off_t next_offset;      /* Start of the first chunk not taken by any worker */
+  copy_method_t method;   /* Most portable method used by any worker */
+  int failed;             /* Nonzero if some chunk was not copied */
+} ChunkedCopy;
+
+static int is_unsupported_error(int error) {
+  return error == ENOSYS || error == EXDEV || error == EINVAL
+      || error == EOPNOTSUPP || error == ENOTSUP;
+}
+
+static size_t span_length(off_t offset, off_t end, size_t limit) {
+  return end - offset < (off_t) limit ? (size_t) (end - offset) : limit;
+}
+
+static copy_status_t copy_range(int source_fd, int dest_fd, off_t end, off_t* offset) {
+#if defined(__linux__)
+  while (*offset < end) {
+    loff_t source_offset = *offset;
+    loff_t dest_offset = *offset;
+    ssize_t copied = copy_file_range(source_fd, &source_offset,
+                                     dest_fd, &dest_offset,
+                                     span_length(*offset, end, KERNEL_CHUNK_SIZE), 0);
+    if (copied < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return is_unsupported_error(errno) ? COPY_STATUS_UNSUPPORTED : COPY_STATUS_FAILED;
+    }
+    if (copied == 0) {
+      /* Some pseudo file systems report no data instead of failing */
+      return COPY_STATUS_UNSUPPORTED;
+    }
+    *offset += copied;
+  }
+  return COPY_STATUS_DONE;
+#else
+  (void) source_fd;
+  (void) dest_fd;
+  (void) end;
+  (void) offset;
+  return COPY_STATUS_UNSUPPORTED;
+#endif
+}
+
+static copy_status_t copy_sendfile(int source_fd, int dest_fd, off_t end, off_t* offset) {
+#if defined(__linux__)
+  /* sendfile() writes at current position of destination */
+  if (lseek(dest_fd, *offset, SEEK_SET) < 0) {
+    return COPY_STATUS_FAILED;
+  }
+
+  while (*offset < end) {
+    off_t source_offset = *offset;
+    ssize_t copied = sendfile(dest_fd, source_fd, &source_offset,
+                              span_length(*offset, end, KERNEL_CHUNK_SIZE));
+    if (copied < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return is_unsupported_error(errno) ? COPY_STATUS_UNSUPPORTED : COPY_STATUS_FAILED;
+    }
+    if (copied == 0) {
+      return COPY_STATUS_UNSUPPORTED;
+    }
+    *offset += copied;
+  }
+  return COPY_STATUS_DONE;
+#else
+  (void) source_fd;
+  (void) dest_fd;
+  (void) end;
+  (void) offset;
+  return COPY_STATUS_UNSUPPORTED;
+#endif
+}
+
+static copy_status_t copy_read_write(int source_fd, int dest_fd, off_t end, off_t* offset) {
+  char* buffer = (char*) malloc(BUFFER_SIZE);
+  PANIC_ON_BAD_ALLOC(buffer);
+
+  copy_status_t status = COPY_STATUS_DONE;
+  while (*offset < end) {
+    ssize_t bytes_read = pread(source_fd, buffer,
+                               span_length(*offset, end, BUFFER_SIZE), *offset);
+    if (bytes_read < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      status = COPY_STATUS_FAILED;
+      goto quit;
+    }
+    if (bytes_read == 0) {
+      goto quit;
+    }
+
+    ssize_t bytes_written = 0;
+    while (bytes_written < bytes_read) {
+      ssize_t written = pwrite(dest_fd, buffer + bytes_written,
+                               (size_t) (bytes_read - bytes_written),
+                               *offset + bytes_written);
+      if (written < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        status = COPY_STATUS_FAILED;
+        goto quit;
+      }
+      bytes_written += written;
+    }
+    *offset += bytes_read;
+  }
+
+quit:
+  free(buffer);
+  return status;
+}
+
+/* Copy with O_DIRECT from `*offset` to `end`, restoring cached I/O afterwards */
+static copy_status_t copy_direct(int source_fd, int dest_fd, off_t end, off_t* offset) {
+#if defined(O_DIRECT)
+  int source_flags = fcntl(source_fd, F_GETFL);
+  int dest_flags = fcntl(dest_fd, F_GETFL);
+  if (source_flags < 0 || dest_flags < 0) {
+    return COPY_STATUS_UNSUPPORTED;
+  }
+  if (fcntl(source_fd, F_SETFL, source_flags | O_DIRECT) != 0) {
+    return COPY_STATUS_UNSUPPORTED;
+  }
+  if (fcntl(dest_fd, F_SETFL, dest_flags | O_DIRECT) != 0) {
+    fcntl(source_fd, F_SETFL, source_flags);
+    return COPY_STATUS_UNSUPPORTED;
+  }
+
+  void* buffer = NULL;
+  if (posix_memalign(&buffer, DIRECT_ALIGNMENT, DIRECT_BUFFER_SIZE) != 0) {
+    buffer = NULL;
+  }
+  PANIC_ON_BAD_ALLOC(buffer);
+
+  const off_t start = *offset;
+  copy_status_t status = COPY_STATUS_DONE;
+  while (*offset < end) {
+    ssize_t bytes_read = pread(source_fd, buffer, DIRECT_BUFFER_SIZE, *offset);
+    if (bytes_read < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      /* File system may reject O_DIRECT only on first access */
+      status = errno == EINVAL && *offset == start ? COPY_STATUS_UNSUPPORTED : COPY_STATUS_FAILED;
+      goto quit;
+    }
+    if (bytes_read == 0) {
+      break;
+    }
+
+    /* Last block is padded, file is truncated to its size afterwards */
+    size_t length = ((size_t) bytes_read + DIRECT_ALIGNMENT - 1) & ~((size_t) DIRECT_ALIGNMENT - 1);
+    memset((char*) buffer + bytes_read, 0, length - (size_t) bytes_read);
+
+    size_t bytes_written = 0;
+    while (bytes_written < length) {
+      ssize_t written = pwrite(dest_fd, (char*) buffer + bytes_written,
+                               length - bytes_written, *offset + (off_t) bytes_written);
+      if (written < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        status = errno == EINVAL && *offset == start ? COPY_STATUS_UNSUPPORTED : COPY_STATUS_FAILED;
+        goto quit;
+      }
+      bytes_written += (size_t) written;
+    }
+    *offset += bytes_read;
+
+    /* Unaligned short read happens only at the end of file */
+    if ((size_t) bytes_read % DIRECT_ALIGNMENT != 0) {
+      break;
+    }
+  }
+
+  if (ftruncate(dest_fd, *offset) != 0) {
+    status = COPY_STATUS_FAILED;
+  }
+
+quit:
+  free(buffer);
+  fcntl(source_fd, F_SETFL, source_flags);
+  fcntl(dest_fd, F_SETFL, dest_flags);
+  return status;
+#else
+  (void) source_fd;
+  (void) dest_fd;
+  (void) end;
+  (void) offset;
+  return COPY_STATUS_UNSUPPORTED;
+#endif
+}
+
+static const copy_backend_t sBackends[] = {
+  [COPY_METHOD_NONE]       = NULL,
+  [COPY_METHOD_RANGE]      = copy_range,
+  [COPY_METHOD_SENDFILE]   = copy_sendfile,
+  [COPY_METHOD_READ_WRITE] = copy_read_write
+};
+
+static copy_method_t find_strategy(dev_t source_device, dev_t dest_device) {
+  copy_method_t method = COPY_METHOD_RANGE;
+
+  pthread_mutex_lock(&sStrategyLock);
+  for (size_t i = 0; i < sStrategyCount; ++i) {
+    if (sStrategies[i].source_device == source_device
+        && sStrategies[i].dest_device == dest_device) {
+      method = sStrategies[i].method;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&sStrategyLock);
+
+  return method;
+}
+
+static void remember_strategy(dev_t source_device, dev_t dest_device, copy_method_t method) {
+  pthread_mutex_lock(&sStrategyLock);
+  for (size_t i = 0; i < sStrategyCount; ++i) {
+    if (sStrategies[i].source_device == source_device
+        && sStrategies[i].dest_device == dest_device) {
+      /* Never upgrade: other file may have already found method unsupported */
+      if (method > sStrategies[i].method) {
+        sStrategies[i].method = method;
+      }
+      goto quit;
+    }
+  }
+
+  if (sStrategyCount < MAX_STRATEGIES) {
+    sStrategies[sStrategyCount].source_device = source_device;
+    sStrategies[sStrategyCount].dest_device = dest_device;
+    sStrategies[sStrategyCount].method = method;
+    sStrategyCount++;
+  }
+
+quit:
+  pthread_mutex_unlock(&sStrategyLock);
+}
+
+const char* copy_method_name(copy_method_t method) {
+  switch (method) {
+  case COPY_METHOD_NONE:
+    return "none";
+  case COPY_METHOD_RANGE:
+    return "copy_file_range";
+  case COPY_METHOD_SENDFILE:
+    return "sendfile";
+  case COPY_METHOD_READ_WRITE:
+    return "read/write";
+  case COPY_METHOD_CLONE:
+    return "reflink";
+  case COPY_METHOD_URING:
+    return "io_uring";
+  case COPY_METHOD_DIRECT:
+    return "direct";
+  default:
+    return "unknown";
+  }
+}
+
+/*
+ * Copy bytes from `start` to `end`, trying methods starting from `*method`
+ * and leaving in `*method` the one which copied the last byte. Chunk workers
+ * share file positions, so they must not use `sendfile()`.
+ */
+static file_error_t copy_window(int source_fd, int dest_fd, off_t start, off_t end,
+                                int is_chunk, copy_method_t* method) {
+  off_t offset = start;
+
+  for (;;) {
+    if (is_chunk && *method == COPY_METHOD_SENDFILE) {
+      *method = COPY_METHOD_READ_WRITE;
+    }
+
+    copy_status_t status = sBackends[*method](source_fd, dest_fd, end, &offset);
+    if (status == COPY_STATUS_DONE) {
+      return FERR_NONE;
+    }
+    if (status == COPY_STATUS_FAILED) {
+      return FERR_ACCESS_DENIED;
+    }
+
+    /* Read/write copy works with any file */
+    if (*method == COPY_METHOD_READ_WRITE) {
+      return FERR_ACCESS_DENIED;
+    }
+    *method = (copy_method_t) (*method + 1);
+  }
+}
+
+/* Start writing copied range to disk */
+static void start_writeback(int dest_fd, off_t start, off_t end) {
+#if defined(__linux__)
+  sync_file_range(dest_fd, start, end - start, SYNC_FILE_RANGE_WRITE);
+#else
+  (void) dest_fd;
+  (void) start;
+  (void) end;
+#endif
+}
+
+/* Drop copied range of both files from page cache */
+static void evict_range(int source_fd, int dest_fd, off_t start, off_t end) {
+#if defined(__linux__)
+  /* Dirty pages are not evicted, wait until they are written */
+  sync_file_range(dest_fd, start, end - start,
+                  SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+#endif
+#if defined(POSIX_FADV_DONTNEED)
+  posix_fadvise(source_fd, start, end - start, POSIX_FADV_DONTNEED);
+  posix_fadvise(dest_fd, start, end - start, POSIX_FADV_DONTNEED);
+#else
+  (void) source_fd;
+  (void) dest_fd;
+  (void) start;
+  (void) end;
+#endif
+}
+
+/*
+ * Copy bytes from `start` to `end` as `copy_window()`, evicting copied
+ * windows from page cache unless policy is `CACHE_POLICY_KEEP`. Writeback of
+ * each window overlaps with copying the next one.
+ */
+static file_error_t copy_span(int source_fd, int dest_fd, off_t start, off_t end,
+                              int is_chunk, cache_policy_t cache_policy,
+                              copy_method_t* method) {
+  if (cache_policy == CACHE_POLICY_KEEP) {
+    return copy_window(source_fd, dest_fd, start, end, is_chunk, method);
+  }
+
+  off_t window = start;
+  off_t previous = start;
+  while (window < end) {
+    off_t window_end = window + (off_t) span_length(window, end, CACHE_WINDOW_SIZE);
+    file_error_t result = copy_window(source_fd, dest_fd, window, window_end, is_chunk, method);
+    if (result != FERR_NONE) {
+      return result;
+    }
+
+    start_writeback(dest_fd, window, window_end);
+    if (previous < window) {
+      evict_range(source_fd, dest_fd, previous, window);
+    }
+    previous = window;
+    window = window_end;
+  }
+
+  if (previous < end) {
+    evict_range(source_fd, dest_fd, previous, end);
+  }
+  return FERR_NONE;
+}
+
+static void* copy_chunks(void* arg) {
+  ChunkedCopy* copy = (ChunkedCopy*) arg;
+
+  for (;;) {
+    pthread_mutex_lock(&copy->lock);
+    if (copy->failed || copy->next_offset >= copy->size) {
+      pthread_mutex_unlock(&copy->lock);
+      break;
+    }
+    off_t start = copy->next_offset;
+    off_t end = start + (off_t) span_length(start, copy->size, CHUNK_SIZE);
+    copy->next_offset = end;
+    /* Do not probe methods already found unsupported by other workers */
+    copy_method_t method = copy->method;
+    pthread_mutex_unlock(&copy->lock);
+
+    file_error_t result = copy_span(copy->source_fd, copy->dest_fd, start, end,
+                                    1, copy->cache_policy, &method);
+
+    pthread_mutex_lock(&copy->lock);
+    if (result != FERR_NONE) {
+      copy->failed = 1;
+    }
+    if (method > copy->method) {
+      copy->method = method;
+    }
+    pthread_mutex_unlock(&copy->lock);
+  }
+
+  return NULL;
+}
+
+/* Reserve space for large file upfront, so that it is not fragmented */
+static file_error_t preallocate(int dest_fd, off_t size) {
+#if defined(__linux__)
+  if (fallocate(dest_fd, 0, 0, size) != 0 && errno == ENOSPC) {
+    return FERR_ACCESS_DENIED;
+  }
+#else
+  (void) dest_fd;
+  (void) size;
+#endif
+  return FERR_NONE;
+}
+
+/* Copy large file in chunks on `options->jobs` threads, including the calling one */
+static file_error_t copy_chunked(int source_fd, int dest_fd, off_t size,
+                                 const CopyOptions* options, copy_method_t* method) {
+  if (preallocate(dest_fd, size) != FERR_NONE) {
+    return FERR_ACCESS_DENIED;
+  }
+
+  const unsigned jobs = options->jobs;
+  ChunkedCopy copy = {
+    .source_fd = source_fd,
+    .dest_fd = dest_fd,
+    .size = size,
+    .cache_policy = options->cache_policy,
+    .next_offset = 0,
+    .method = *method,
+    .failed = 0
+  };
+  pthread_mutex_init(&copy.lock, NULL);
+
+  size_t chunk_count = (size_t) ((size + CHUNK_SIZE - 1) / CHUNK_SIZE);
+  size_t thread_count = jobs < chunk_count ? jobs - 1 : chunk_count - 1;
+  pthread_t* threads = (pthread_t*) calloc(thread_count, sizeof(*threads));
+  PANIC_ON_BAD_ALLOC(threads);
+
+  size_t started_count = 0;
+  while (started_count < thread_count
+         && pthread_create(&threads[started_count], NULL, copy_chunks, &copy) == 0) {
+    started_count++;
+  }
+
+  /* Remaining chunks are copied here if some threads could not be started */
+  copy_chunks(&copy);
+
+  for (size_t i = 0; i < started_count; ++i) {
+    pthread_join(threads[i], NULL);
+  }
+  free(threads);
+  pthread_mutex_destroy(&copy.lock);
+
+  if (copy.failed) {
+    return FERR_ACCESS_DENIED;
+  }
+  *method = copy.method;
+  return FERR_NONE;
+}
+
+/* Copy large file bypassing page cache, reports method unsupported if it cannot */
+static copy_status_t copy_uncached(int source_fd, int dest_fd, off_t size) {
+  if (preallocate(dest_fd, size) != FERR_NONE) {
+    return COPY_STATUS_FAILED;
+  }
+
+  off_t offset = 0;
+  copy_status_t status = copy_direct(source_fd, dest_fd, size, &offset);
+  if (status == COPY_STATUS_UNSUPPORTED && offset == 0) {
+    /* Drop preallocated size, cached copy expects empty file */
+    if (ftruncate(dest_fd, 0) != 0) {
+      return COPY_STATUS_FAILED;
+    }
+  }
+  return status;
+}
+
+file_error_t file_copy_data(int source_fd, int dest_fd, const CopyOptions* options,
+                            copy_method_t* used_method) {
+  PANIC_IF_NULL(options);
+
+  if (used_method != NULL) {
+    *used_method = COPY_METHOD_NONE;
+  }
+
+  struct stat source_stat;
+  struct stat dest_stat;
+  if (fstat(source_fd, &source_stat) != 0 || fstat(dest_fd, &dest_stat) != 0) {
+    return FERR_ACCESS_DENIED;
+  }
+
+  const cache_policy_t cache_policy = options->cache_policy;
+  if (cache_policy == CACHE_POLICY_DIRECT && source_stat.st_size >= DIRECT_COPY_THRESHOLD) {
+    copy_status_t status = copy_uncached(source_fd, dest_fd, source_stat.st_size);
+    if (status == COPY_STATUS_DONE) {
+      if (used_method != NULL) {
+        *used_method = COPY_METHOD_DIRECT;
+      }
+      return FERR_NONE;
+    }
+    if (status == COPY_STATUS_FAILED) {
+      return FERR_ACCESS_DENIED;
+    }
+    /* Fall back to cached copy evicting copied data */
+  }
+
+#if defined(POSIX_FADV_SEQUENTIAL)
+  if (cache_policy != CACHE_POLICY_KEEP) {
+    posix_fadvise(source_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  }
+#endif
+
+  copy_method_t method = find_strategy(source_stat.st_dev, dest_stat.st_dev);
+  const copy_method_t first_method = method;
+
+  if (options->jobs > 1 && source_stat.st_size >= CHUNKED_COPY_THRESHOLD) {
+    file_error_t result = copy_chunked(source_fd, dest_fd, source_stat.st_size,
+                                       options, &method);
+    if (result != FERR_NONE) {
+      return result;
+    }
+    /* Chunk workers skip sendfile(), so their method is not remembered */
+  } else {
+    file_error_t result = copy_span(source_fd, dest_fd, 0, source_stat.st_size,
+                                    0, cache_policy, &method);
+    if (result != FERR_NONE) {
+      return result;
+    }
+    if (method != first_method) {
+      remember_strategy(source_stat.st_dev, dest_stat.st_dev, method);
+    }
+  }
+
+  if (used_method != NULL) {
+    *used_method = method;
+  }
+  return FERR_NONE;
+}
+
+file_error_t file_clone_data(int source_fd, int dest_fd) {
+#if defined(FICLONE)
+  if (ioctl(dest_fd, FICLONE, source_fd) == 0) {
+    return FERR_NONE;
+  }
+#else
+  (void) source_fd;
+  (void) dest_fd;
+#endif
+  return FERR_INVALID_OPERATION;
+}
+
+void file_prefetch(const char* path) {
+  PANIC_IF_NULL(path);
+
+#if defined(POSIX_FADV_WILLNEED)
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return;
+  }
+  posix_fadvise(fd, 0, PREFETCH_SIZE, POSIX_FADV_WILLNEED);
+  close(fd);
+#else
+  (void) path;
+#endif
+}
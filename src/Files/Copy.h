@@ -0,0 +1,105 @@
+/**
+ * @file Copy.h
+ * @author MeerkatBoss (solodovnikov.ia@phystech.su)
+ *
+ * @brief File data copying with in-kernel copy methods
+ *
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright MeerkatBoss (c) 2026
+ */
+#ifndef __FILES_COPY_H
+#define __FILES_COPY_H
+
+#include "Files/Error.h"
+
+/**
+ * @brief Ways of copying file data, from fastest to most portable
+ */
+enum CopyMethod {
+  COPY_METHOD_NONE = 0,   /*!< No data was copied */
+  COPY_METHOD_RANGE,      /*!< `copy_file_range()`, can be offloaded to file system */
+  COPY_METHOD_SENDFILE,   /*!< `sendfile()`, copies data within kernel */
+  COPY_METHOD_READ_WRITE, /*!< `read()` and `write()` with large buffer */
+  COPY_METHOD_CLONE,      /*!< Copy-on-write clone sharing data blocks (reflink) */
+  COPY_METHOD_URING,      /*!< Asynchronous reads and writes through io_uring */
+  COPY_METHOD_DIRECT      /*!< Aligned reads and writes bypassing page cache (`O_DIRECT`) */
+};
+
+typedef enum CopyMethod copy_method_t;
+
+/**
+ * @brief Use of page cache by copied files
+ */
+enum CachePolicy {
+  CACHE_POLICY_KEEP,    /*!< Leave caching to kernel */
+  CACHE_POLICY_DROP,    /*!< Read sources sequentially, evict copied data from cache */
+  CACHE_POLICY_DIRECT   /*!< As `CACHE_POLICY_DROP`, bypass cache for large files */
+};
+
+typedef enum CachePolicy cache_policy_t;
+
+/**
+ * @brief Options for copying file data
+ */
+typedef struct {
+  unsigned jobs;                /*!< Maximum number of threads copying one file */
+  cache_policy_t cache_policy;  /*!< Use of page cache */
+} CopyOptions;
+
+/**
+ * @brief Get human-readable name of copy method
+ */
+const char* copy_method_name(copy_method_t method);
+
+/**
+ * @brief Copy all data from `source_fd` to empty file `dest_fd`
+ *
+ * @note
+ * Methods are tried from fastest to most portable, continuing from the last
+ * copied byte if some method turns out to be unsupported. The first working
+ * method is remembered for each pair of source and destination file systems,
+ * so that following copies between them do not probe unsupported methods.
+ * Files of 128 MiB and larger are preallocated and split into chunks copied
+ * with positional I/O by `options->jobs` threads at once; if any chunk fails,
+ * no more chunks are started and the destination is left partially written.
+ *
+ * Unless cache policy is `CACHE_POLICY_KEEP`, sources are read with
+ * sequential readahead, and every copied window of both files is written
+ * back and evicted from page cache. With `CACHE_POLICY_DIRECT` files of
+ * 128 MiB and larger are copied by a single thread with `O_DIRECT`, falling
+ * back to cached copy on file systems which do not support it.
+ * Can be called from several threads at once.
+ *
+ * @return FERR_NONE on success,
+ *         FERR_ACCESS_DENIED if file cannot be read or written
+ */
+file_error_t file_copy_data(
+  int source_fd,              /*!< [in]  Source file opened for reading */
+  int dest_fd,                /*!< [in]  Destination file opened for writing */
+  const CopyOptions* options, /*!< [in]  Copy options */
+  copy_method_t* used_method  /*!< [out] Method that copied the data, may be `NULL` */
+);
+
+/**
+ * @brief Ask kernel to start reading the beginning of file at `path` in
+ * background, so that it is cached by the time the file is copied.
+ * Errors are ignored.
+ */
+void file_prefetch(const char* path);
+
+/**
+ * @brief Make empty file `dest_fd` a copy-on-write clone of `source_fd`.
+ * Takes constant time, but requires both files to reside on the same
+ * file system supporting reflinks (e.g. btrfs or XFS).
+ *
+ * @return FERR_NONE on success,
+ *         FERR_INVALID_OPERATION if files cannot share data
+ */
+file_error_t file_clone_data(
+  int source_fd,  /*!< [in] Source file opened for reading */
+  int dest_fd     /*!< [in] Destination file opened for writing */
+);
+
+#endif /* Copy.h */
@@ -0,0 +1,439 @@
+#if defined(__linux__)
+#define _GNU_SOURCE /* pread(), posix_fadvise(), dirfd() */
+#endif
+
+#include "Dedup.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "Common/Hash.h"
+#include "Common/Panic.h"
+#include "Common/ThreadPool.h"
+
+enum {
+  PARTIAL_SIZE = 64 * 1024,         /* Bytes hashed at each end of file */
+  FULL_BUFFER_SIZE = 1024 * 1024,   /* Read size of complete hashing */
+  HASH_BATCH_SIZE = 16,             /* Files hashed by a single task */
+  HASH_QUEUE_PER_JOB = 4            /* Tasks queued per hashing thread */
+};
+
+/* Regular file compared by contents */
+typedef struct {
+  const char* path;
+  int is_indexed;         /* Zero for file in target directory */
+  size_t row;             /* Row of file in index */
+  char* owned_path;       /* Path of file in target directory (allocated) */
+  int64_t size;
+  size_t order;           /* Position in index or in target directory listing */
+
+  uint64_t partial_hash;  /* Hash of head and tail, or of whole small file */
+  uint64_t full_hash;
+  int is_complete;        /* Nonzero if file is hashed completely */
+  int is_failed;          /* Nonzero if file cannot be read */
+} DedupEntry;
+
+typedef struct {
+  DedupEntry* entries;
+  size_t count;
+  size_t capacity;
+} DedupEntries;
+
+/* Files hashed by pool worker */
+typedef struct {
+  DedupEntry* entries[HASH_BATCH_SIZE];
+  size_t count;
+  int is_full;            /* Hash whole files instead of head and tail */
+} HashBatch;
+
+static DedupEntry* push_entry(DedupEntries* entries) {
+  if (entries->count == entries->capacity) {
+    size_t capacity = entries->capacity > 0 ? 2 * entries->capacity : 256;
+    DedupEntry* grown = (DedupEntry*) realloc(entries->entries, capacity * sizeof(*grown));
+    PANIC_ON_BAD_ALLOC(grown);
+    entries->entries = grown;
+    entries->capacity = capacity;
+  }
+  DedupEntry* entry = &entries->entries[entries->count++];
+  memset(entry, 0, sizeof(*entry));
+  return entry;
+}
+
+static int read_exact(int fd, void* buffer, size_t size, off_t offset) {
+  char* data = (char*) buffer;
+  while (size > 0) {
+    ssize_t count = pread(fd, data, size, offset);
+    if (count < 0 && errno == EINTR) {
+      continue;
+    }
+    if (count <= 0) {
+      return -1;
+    }
+    data += count;
+    size -= (size_t) count;
+    offset += count;
+  }
+  return 0;
+}
+
+/* Hash first and last `PARTIAL_SIZE` bytes, or whole file if it is not larger */
+static void hash_partial(DedupEntry* entry, unsigned char* buffer) {
+  int fd = open(entry->path, O_RDONLY);
+  if (fd < 0) {
+    entry->is_failed = 1;
+    return;
+  }
+
+  HashState state;
+  hash_init(&state, 0);
+  if (entry->size <= 2 * PARTIAL_SIZE) {
+    entry->is_failed = read_exact(fd, buffer, (size_t) entry->size, 0) != 0;
+    hash_update(&state, buffer, (size_t) entry->size);
+    entry->is_complete = 1;
+  } else {
+    entry->is_failed = read_exact(fd, buffer, PARTIAL_SIZE, 0) != 0
+                    || read_exact(fd, buffer + PARTIAL_SIZE, PARTIAL_SIZE,
+                                  (off_t) (entry->size - PARTIAL_SIZE)) != 0;
+    hash_update(&state, buffer, 2 * PARTIAL_SIZE);
+  }
+  close(fd);
+
+  entry->partial_hash = hash_digest(&state);
+  if (entry->is_complete) {
+    entry->full_hash = entry->partial_hash;
+  }
+}
+
+static void hash_full(DedupEntry* entry, unsigned char* buffer) {
+  int fd = open(entry->path, O_RDONLY);
+  if (fd < 0) {
+    entry->is_failed = 1;
+    return;
+  }
+#if defined(POSIX_FADV_SEQUENTIAL)
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+  HashState state;
+  hash_init(&state, 0);
+  int64_t remaining = entry->size;
+  off_t offset = 0;
+  while (remaining > 0) {
+    size_t chunk = remaining < FULL_BUFFER_SIZE ? (size_t) remaining : FULL_BUFFER_SIZE;
+    if (read_exact(fd, buffer, chunk, offset) != 0) {
+      entry->is_failed = 1;
+      break;
+    }
+    hash_update(&state, buffer, chunk);
+    offset += (off_t) chunk;
+    remaining -= (int64_t) chunk;
+  }
+  close(fd);
+
+  entry->full_hash = hash_digest(&state);
+  entry->is_complete = 1;
+}
+
+static void hash_batch(void* argument) {
+  HashBatch* batch = (HashBatch*) argument;
+
+  unsigned char* buffer = (unsigned char*) malloc(
+    batch->is_full ? FULL_BUFFER_SIZE : 2 * PARTIAL_SIZE);
+  PANIC_ON_BAD_ALLOC(buffer);
+  for (size_t i = 0; i < batch->count; ++i) {
+    if (batch->is_full) {
+      hash_full(batch->entries[i], buffer);
+    } else {
+      hash_partial(batch->entries[i], buffer);
+    }
+  }
+  free(buffer);
+}
+
+/* Hash entries selected by `needs_hash` on `jobs` threads */
+static size_t hash_entries(
+  DedupEntries* entries,
+  int is_full,
+  unsigned jobs,
+  const unsigned char* needs_hash
+) {
+  size_t worker_count = jobs > 1 ? jobs : 0;
+  size_t batch_count = entries->count / HASH_BATCH_SIZE + 1;
+  HashBatch* batches = (HashBatch*) calloc(batch_count, sizeof(*batches));
+  PANIC_ON_BAD_ALLOC(batches);
+
+  ThreadPool pool;
+  thread_pool_init(&pool, worker_count, worker_count * HASH_QUEUE_PER_JOB);
+
+  size_t hashed = 0;
+  HashBatch* current = batches;
+  for (size_t i = 0; i < entries->count; ++i) {
+    if (!needs_hash[i]) {
+      continue;
+    }
+    current->is_full = is_full;
+    current->entries[current->count++] = &entries->entries[i];
+    hashed++;
+    if (current->count == HASH_BATCH_SIZE) {
+      thread_pool_submit(&pool, hash_batch, current);
+      current++;
+    }
+  }
+  if (current->count > 0) {
+    thread_pool_submit(&pool, hash_batch, current);
+  }
+  thread_pool_destroy(&pool);
+
+  free(batches);
+  return hashed;
+}
+
+static int compare_sizes(const void* lhs_ptr, const void* rhs_ptr) {
+  int64_t lhs = *(const int64_t*) lhs_ptr;
+  int64_t rhs = *(const int64_t*) rhs_ptr;
+  return lhs < rhs ? -1 : lhs > rhs;
+}
+
+/*
+ * Order entries by size and hashes. Files in target directory go first
+ * and files in index follow in index order, so the first file of every
+ * group of equal files is the one to keep.
+ */
+static int compare_entries(const void* lhs_ptr, const void* rhs_ptr) {
+  const DedupEntry* lhs = (const DedupEntry*) lhs_ptr;
+  const DedupEntry* rhs = (const DedupEntry*) rhs_ptr;
+
+  if (lhs->size != rhs->size) {
+    return lhs->size < rhs->size ? -1 : 1;
+  }
+  if (lhs->partial_hash != rhs->partial_hash) {
+    return lhs->partial_hash < rhs->partial_hash ? -1 : 1;
+  }
+  if (lhs->full_hash != rhs->full_hash) {
+    return lhs->full_hash < rhs->full_hash ? -1 : 1;
+  }
+  if (lhs->is_indexed != rhs->is_indexed) {
+    return lhs->is_indexed ? 1 : -1;
+  }
+  return lhs->order < rhs->order ? -1 : lhs->order > rhs->order;
+}
+
+static int is_same_group(const DedupEntry* lhs, const DedupEntry* rhs) {
+  return lhs->size == rhs->size
+      && lhs->partial_hash == rhs->partial_hash
+      && lhs->full_hash == rhs->full_hash;
+}
+
+/*
+ * Sort entries and keep only groups of equal entries which contain at least
+ * two entries and at least one file from index. Failed entries are dropped.
+ */
+static void keep_candidate_groups(DedupEntries* entries) {
+  qsort(entries->entries, entries->count, sizeof(*entries->entries), compare_entries);
+
+  size_t kept = 0;
+  size_t group_start = 0;
+  while (group_start < entries->count) {
+    size_t group_end = group_start;
+    int has_indexed = 0;
+    size_t valid_count = 0;
+    while (group_end < entries->count
+           && is_same_group(&entries->entries[group_start], &entries->entries[group_end])) {
+      if (!entries->entries[group_end].is_failed) {
+        valid_count++;
+        has_indexed |= entries->entries[group_end].is_indexed;
+      }
+      group_end++;
+    }
+
+    for (size_t i = group_start; i < group_end; ++i) {
+      DedupEntry* entry = &entries->entries[i];
+      if (valid_count >= 2 && has_indexed && !entry->is_failed) {
+        entries->entries[kept++] = *entry;
+      } else {
+        free(entry->owned_path);
+      }
+    }
+    group_start = group_end;
+  }
+  entries->count = kept;
+}
+
+/* Add files from target directory with sizes of some indexed files */
+static file_error_t add_target_files(
+  DedupEntries* entries,
+  const char* target_dir,
+  const int64_t* sizes,
+  size_t size_count
+) {
+  DIR* dir = opendir(target_dir);
+  if (dir == NULL) {
+    return (errno == ENOENT) ? FERR_NONE : FERR_ACCESS_DENIED;
+  }
+
+  size_t dir_length = strlen(target_dir);
+  size_t order = 0;
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != NULL) {
+    /* Skip service files of corgi along with "." and ".." */
+    if (entry->d_name[0] == '.') {
+      continue;
+    }
+    struct stat st;
+    if (fstatat(dirfd(dir), entry->d_name, &st, 0) != 0 || !S_ISREG(st.st_mode)) {
+      continue;
+    }
+    int64_t size = (int64_t) st.st_size;
+    if (bsearch(&size, sizes, size_count, sizeof(*sizes), compare_sizes) == NULL) {
+      continue;
+    }
+
+    size_t name_length = strlen(entry->d_name);
+    char* path = (char*) calloc(dir_length + name_length + 2, 1);
+    PANIC_ON_BAD_ALLOC(path);
+    memcpy(path, target_dir, dir_length);
+    path[dir_length] = '/';
+    memcpy(path + dir_length + 1, entry->d_name, name_length);
+
+    DedupEntry* target = push_entry(entries);
+    target->path = path;
+    target->owned_path = path;
+    target->size = size;
+    target->order = order++;
+  }
+
+  closedir(dir);
+  return FERR_NONE;
+}
+
+/*
+ * Compare contents of two files of `size` bytes. Equal hashes are not enough
+ * to drop a file from import, since distinct files may collide.
+ */
+static int files_are_equal(const char* lhs, const char* rhs, int64_t size, unsigned char* buffer) {
+  int lhs_fd = open(lhs, O_RDONLY);
+  if (lhs_fd < 0) {
+    return 0;
+  }
+  int rhs_fd = open(rhs, O_RDONLY);
+  if (rhs_fd < 0) {
+    close(lhs_fd);
+    return 0;
+  }
+
+  unsigned char* lhs_buffer = buffer;
+  unsigned char* rhs_buffer = buffer + FULL_BUFFER_SIZE;
+  int is_equal = 1;
+  off_t offset = 0;
+  while (is_equal && offset < size) {
+    int64_t remaining = size - (int64_t) offset;
+    size_t chunk = remaining < FULL_BUFFER_SIZE ? (size_t) remaining : FULL_BUFFER_SIZE;
+    is_equal = read_exact(lhs_fd, lhs_buffer, chunk, offset) == 0
+            && read_exact(rhs_fd, rhs_buffer, chunk, offset) == 0
+            && memcmp(lhs_buffer, rhs_buffer, chunk) == 0;
+    offset += (off_t) chunk;
+  }
+
+  close(rhs_fd);
+  close(lhs_fd);
+  return is_equal;
+}
+
+file_error_t file_index_mark_duplicates(
+  FileIndex* index,
+  const char* target_dir,
+  unsigned jobs,
+  DedupStats* stats
+) {
+  PANIC_IF_NULL(index);
+  PANIC_IF_NULL(target_dir);
+  PANIC_IF_NULL(stats);
+
+  memset(stats, 0, sizeof(*stats));
+
+  DedupEntries entries = {NULL, 0, 0};
+  size_t order = 0;
+  FILE_INDEX_FOREACH(row, *index) {
+    if (index->actions[row] != FACT_COPY) {
+      continue;
+    }
+    DedupEntry* entry = push_entry(&entries);
+    entry->path = file_index_path(index, row);
+    entry->is_indexed = 1;
+    entry->row = row;
+    entry->size = index->identities[row].size;
+    entry->order = order++;
+  }
+
+  /* Stage 1: only files of equal sizes can be equal */
+  int64_t* sizes = (int64_t*) malloc((entries.count + 1) * sizeof(*sizes));
+  PANIC_ON_BAD_ALLOC(sizes);
+  for (size_t i = 0; i < entries.count; ++i) {
+    sizes[i] = entries.entries[i].size;
+  }
+  qsort(sizes, entries.count, sizeof(*sizes), compare_sizes);
+  file_error_t result = add_target_files(&entries, target_dir, sizes, entries.count);
+  free(sizes);
+  if (result != FERR_NONE) {
+    goto quit;
+  }
+  keep_candidate_groups(&entries);
+
+  unsigned char* needs_hash = (unsigned char*) calloc(entries.count + 1, 1);
+  PANIC_ON_BAD_ALLOC(needs_hash);
+
+  /* Stage 2: hash head and tail of candidates */
+  memset(needs_hash, 1, entries.count);
+  stats->partial_hash_count = hash_entries(&entries, 0, jobs, needs_hash);
+  keep_candidate_groups(&entries);
+
+  /* Stage 3: hash remaining candidates completely */
+  for (size_t i = 0; i < entries.count; ++i) {
+    needs_hash[i] = !entries.entries[i].is_complete;
+  }
+  stats->full_hash_count = hash_entries(&entries, 1, jobs, needs_hash);
+  keep_candidate_groups(&entries);
+  free(needs_hash);
+
+  /*
+   * First file of every group is kept, the rest are duplicates if their
+   * contents are equal to it
+   */
+  unsigned char* compare_buffer = (unsigned char*) malloc(2 * FULL_BUFFER_SIZE);
+  PANIC_ON_BAD_ALLOC(compare_buffer);
+  for (size_t i = 0; i < entries.count; ++i) {
+    size_t keeper = i;
+    while (i + 1 < entries.count
+           && is_same_group(&entries.entries[keeper], &entries.entries[i + 1])) {
+      ++i;
+      if (!entries.entries[i].is_indexed) {
+        /* Equal files already in target directory are left alone */
+        continue;
+      }
+      if (!files_are_equal(entries.entries[keeper].path, entries.entries[i].path,
+                           entries.entries[i].size, compare_buffer)) {
+        continue;
+      }
+      index->actions[entries.entries[i].row] = FACT_IGNORE;
+      stats->duplicate_count++;
+      if (!entries.entries[keeper].is_indexed) {
+        stats->in_target_count++;
+      }
+    }
+  }
+  free(compare_buffer);
+
+quit:
+  for (size_t i = 0; i < entries.count; ++i) {
+    free(entries.entries[i].owned_path);
+  }
+  free(entries.entries);
+  return result;
+}
@@ -0,0 +1,54 @@
+/**
+ * @file Dedup.h
+ * @author MeerkatBoss (solodovnikov.ia@phystech.su)
+ *
+ * @brief Detection of duplicate files by content
+ *
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright MeerkatBoss (c) 2026
+ */
+#ifndef __FILES_DEDUP_H
+#define __FILES_DEDUP_H
+
+#include <stddef.h>
+
+#include "Files/Error.h"
+#include "Files/Index.h"
+
+/**
+ * @brief Statistics of duplicate detection
+ */
+typedef struct {
+  size_t duplicate_count;     /*!< Files marked as duplicates */
+  size_t in_target_count;     /*!< Duplicates of files already in target directory */
+  size_t partial_hash_count;  /*!< Files hashed by their head and tail */
+  size_t full_hash_count;     /*!< Files hashed completely */
+} DedupStats;
+
+/**
+ * @brief Mark files to be copied which duplicate contents of another file
+ * in index, or of a file already in `target_dir`, as ignored.
+ *
+ * @note
+ * Candidates are narrowed in stages: files are grouped by size, files of
+ * equal size are hashed by their first and last 64 KiB, and only files with
+ * equal partial hashes are hashed completely. Files are hashed on `jobs`
+ * threads. A file is marked only after its contents are compared byte by byte
+ * with the kept file of its group, so hash collisions never drop a file. Of
+ * equal files in index, the first one is kept, unless target
+ * directory already has such a file. Files which cannot be read are never
+ * marked, so that copying reports the error.
+ *
+ * @return FERR_NONE on success,
+ *         FERR_ACCESS_DENIED if target directory cannot be read
+ */
+file_error_t file_index_mark_duplicates(
+  FileIndex* index,           /*!< [inout] Indexed files */
+  const char* target_dir,     /*!< [in]    Target directory, may not exist yet */
+  unsigned jobs,              /*!< [in]    Number of hashing threads */
+  DedupStats* stats           /*!< [out]   Statistics of detection */
+);
+
+#endif /* Dedup.h */
@@ -1,46 +1,137 @@
+#if defined(__linux__)
+#define _GNU_SOURCE /* statx() */
+#endif
+
 #include "File.h"
 
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdarg.h>
 #include <string.h>
 #include <stdlib.h>
 #include <sys/stat.h>
+#if defined(__linux__)
+#include <sys/sysmacros.h>
+#endif
 #include <time.h>
 #include <unistd.h>
 
-#include "Common/List.h"
 #include "Common/Panic.h"
 #include "Common/Strings.h"
 #include "Files/Error.h"
 
-file_error_t file_init(IndexedFile* file, const char* path) {
-  PANIC_IF_NULL(file);
-  PANIC_IF_NULL(path);
+static file_error_t error_from_errno(int error) {
+  if (error == ENOENT || error == ENOTDIR) {
+    return FERR_INVALID_VALUE;
+  }
+  return FERR_ACCESS_DENIED;
+}
 
-  /* Check if file exists and is readable */
-  if (access(path, R_OK) != 0) {
-    if (errno == ENOENT || errno == ENOTDIR) {
-      return FERR_INVALID_VALUE;
-    }
+/*
+ * Decide readability from permission bits where the answer is certain and
+ * fall back to `faccessat()` otherwise. Like `access()`, checks are made
+ * against the real user ID.
+ */
+static file_error_t check_readable(
+  int dir_fd,
+  const char* name,
+  mode_t mode,
+  uid_t owner
+) {
+  const mode_t READ_ALL = S_IRUSR | S_IRGRP | S_IROTH;
+  uid_t uid = getuid();
 
-    return FERR_ACCESS_DENIED;
+  if (uid == 0 || (mode & READ_ALL) == READ_ALL) {
+    return FERR_NONE;
+  }
+  if (owner == uid) {
+    return (mode & S_IRUSR) ? FERR_NONE : FERR_ACCESS_DENIED;
   }
 
-  /* Get file timestamp */
+  if (faccessat(dir_fd, name, R_OK, 0) != 0) {
+    return error_from_errno(errno);
+  }
+  return FERR_NONE;
+}
+
+file_error_t file_probe_at(int dir_fd, const char* name, FileMetadata* metadata) {
+  PANIC_IF_NULL(name);
+  PANIC_IF_NULL(metadata);
+
+#if defined(STATX_BTIME)
+  struct statx stx;
+  const unsigned mask = STATX_TYPE | STATX_MODE | STATX_UID | STATX_INO
+                      | STATX_SIZE | STATX_MTIME | STATX_CTIME | STATX_BTIME;
+  if (statx(dir_fd, name, AT_STATX_DONT_SYNC, mask, &stx) == 0) {
+    metadata->is_regular = S_ISREG(stx.stx_mode);
+    metadata->is_directory = S_ISDIR(stx.stx_mode);
+    metadata->timestamp = (stx.stx_mask & STATX_BTIME)
+                            ? (time_t) stx.stx_btime.tv_sec
+                            : (time_t) stx.stx_ctime.tv_sec;
+    if (!metadata->is_regular) {
+      return FERR_NONE;
+    }
+    metadata->identity.device = (uint64_t) makedev(stx.stx_dev_major, stx.stx_dev_minor);
+    metadata->identity.inode = (uint64_t) stx.stx_ino;
+    metadata->identity.size = (int64_t) stx.stx_size;
+    metadata->identity.mtime = (int64_t) stx.stx_mtime.tv_sec * 1000000000
+                             + stx.stx_mtime.tv_nsec;
+    return check_readable(dir_fd, name, stx.stx_mode, stx.stx_uid);
+  }
+  if (errno != ENOSYS) {
+    return error_from_errno(errno);
+  }
+  /* Kernel without statx(), fall through to fstatat() */
+#endif
+
   struct stat file_stat;
-  int res = stat(path, &file_stat);
-  if (res != 0) {
-    return FERR_ACCESS_DENIED;
+  if (fstatat(dir_fd, name, &file_stat, 0) != 0) {
+    return error_from_errno(errno);
+  }
+  metadata->is_regular = S_ISREG(file_stat.st_mode);
+  metadata->is_directory = S_ISDIR(file_stat.st_mode);
+  metadata->timestamp = file_stat.st_ctime;
+  if (!metadata->is_regular) {
+    return FERR_NONE;
   }
-  file->real_timestamp = file_stat.st_ctime;
+  metadata->identity.device = (uint64_t) file_stat.st_dev;
+  metadata->identity.inode = (uint64_t) file_stat.st_ino;
+  metadata->identity.size = (int64_t) file_stat.st_size;
+  metadata->identity.mtime = (int64_t) file_stat.st_mtime * 1000000000;
+#if defined(__APPLE__)
+  metadata->identity.mtime += file_stat.st_mtimespec.tv_nsec;
+#elif defined(__linux__)
+  metadata->identity.mtime += file_stat.st_mtim.tv_nsec;
+#endif
+  return check_readable(dir_fd, name, file_stat.st_mode, file_stat.st_uid);
+}
+
+void file_init_with_timestamp(IndexedFile* file, const char* path, time_t timestamp) {
+  PANIC_IF_NULL(file);
+  PANIC_IF_NULL(path);
+
+  file->real_timestamp = timestamp;
   file->override_timestamp = file->real_timestamp;
-  file->path = copy_string(path);
-  file->tag_count = 0;
-  for (size_t i = 0; i < FILE_MAX_TAGS; ++i) {
-    file->tags[i] = NULL;
+  memset(&file->identity, 0, sizeof(file->identity));
+  file->path = path;
+  file->tags = 0;
+  file->changes.action = FACT_COPY;
+}
+
+file_error_t file_init(IndexedFile* file, const char* path) {
+  PANIC_IF_NULL(file);
+  PANIC_IF_NULL(path);
+
+  /* Check if file exists and is readable, get file timestamp */
+  FileMetadata metadata;
+  file_error_t res = file_probe_at(AT_FDCWD, path, &metadata);
+  if (res != FERR_NONE) {
+    return res;
   }
-  list_node_init(&file->as_node);
+
+  file_init_with_timestamp(file, path, metadata.timestamp);
+  file->identity = metadata.identity;
 
   return FERR_NONE;
 }
@@ -48,11 +139,7 @@ file_error_t file_init(IndexedFile* file, const char* path) {
 void file_cleanup(IndexedFile* file) {
   PANIC_IF_NULL(file);
 
-  if (!list_node_is_null(&file->as_node)) {
-    list_take_node(&file->as_node);
-  }
   file_clear_tags(file);
-  free(file->path);
   file->path = NULL;
 }
 
@@ -78,8 +165,8 @@ static const char* get_extension(const char* path) {
   return extension;
 }
 
-static size_t pad_with_zeros(unsigned value, unsigned padding, size_t buf_size, char* buf) {
-  unsigned value_copy = value;
+static size_t pad_with_zeros(uint64_t value, unsigned padding, size_t buf_size, char* buf) {
+  uint64_t value_copy = value;
   unsigned length = 0;
   while (value_copy > 0) {
     length++;
@@ -105,54 +192,150 @@ static size_t pad_with_zeros(unsigned value, unsigned padding, size_t buf_size,
   return length;
 }
 
-unsigned long file_generate_name(
+/* Writer of name parts, counting length of parts which did not fit */
+typedef struct {
+  char* buf;
+  unsigned long buf_length;
+  unsigned long length;
+} NameWriter;
+
+static void put_part(NameWriter* writer, const char* part, size_t part_length) {
+  if (writer->length + 1 < writer->buf_length) {
+    size_t available = writer->buf_length - writer->length - 1;
+    memcpy(writer->buf + writer->length, part,
+           part_length < available ? part_length : available);
+  }
+  writer->length += part_length;
+}
+
+static int64_t day_number(time_t timestamp) {
+  enum {
+    SECONDS_PER_DAY = 24 * 60 * 60
+  };
+  int64_t seconds = (int64_t) timestamp;
+  int64_t day = seconds / SECONDS_PER_DAY;
+  /* Round towards negative infinity for dates before epoch */
+  if (seconds % SECONDS_PER_DAY < 0) {
+    day--;
+  }
+  return day;
+}
+
+void file_name_formatter_init(FileNameFormatter* formatter) {
+  PANIC_IF_NULL(formatter);
+
+  formatter->index_width = FILE_INDEX_DEFAULT_WIDTH;
+  formatter->has_date = 0;
+  formatter->date_day = 0;
+  formatter->date[0] = '\0';
+  formatter->has_suffix = 0;
+  formatter->suffix_tags = 0;
+  formatter->suffix_length = 0;
+  formatter->suffix[0] = '\0';
+}
+
+const char* file_name_date(FileNameFormatter* formatter, time_t timestamp) {
+  PANIC_IF_NULL(formatter);
+
+  int64_t day = day_number(timestamp);
+  if (!formatter->has_date || formatter->date_day != day) {
+    /* Names may be generated by several threads at once */
+    struct tm time;
+    gmtime_r(&timestamp, &time);
+    strftime(formatter->date, FILE_DATE_BUFSIZE, "%Y-%m-%d", &time);
+    formatter->date_day = day;
+    formatter->has_date = 1;
+  }
+  return formatter->date;
+}
+
+static void put_tags(FileNameFormatter* formatter, NameWriter* writer, tag_set_t tags) {
+  if (formatter->has_suffix && formatter->suffix_tags == tags) {
+    put_part(writer, formatter->suffix, formatter->suffix_length);
+    return;
+  }
+
+  const char* names[FILE_MAX_TAGS];
+  size_t count = tag_dictionary_names(tags, FILE_MAX_TAGS, names);
+  if (count > FILE_MAX_TAGS) {
+    count = FILE_MAX_TAGS;
+  }
+
+  /* Build suffix of tags, separated by underscores */
+  NameWriter suffix = { formatter->suffix, FILE_TAG_SUFFIX_BUFSIZE, 0 };
+  for (size_t i = 0; i < count; ++i) {
+    put_part(&suffix, "_", 1);
+    put_part(&suffix, names[i], strlen(names[i]));
+  }
+
+  if (suffix.length < FILE_TAG_SUFFIX_BUFSIZE) {
+    formatter->suffix[suffix.length] = '\0';
+    formatter->suffix_length = suffix.length;
+    formatter->suffix_tags = tags;
+    formatter->has_suffix = 1;
+    put_part(writer, formatter->suffix, formatter->suffix_length);
+    return;
+  }
+
+  /* Too long to be cached */
+  formatter->has_suffix = 0;
+  for (size_t i = 0; i < count; ++i) {
+    put_part(writer, "_", 1);
+    put_part(writer, names[i], strlen(names[i]));
+  }
+}
+
+unsigned long file_name_format(
+  FileNameFormatter* formatter,
   const IndexedFile* file,
-  unsigned short index,
+  uint64_t index,
   unsigned long buf_length,
   char* name_buf
 ) {
+  PANIC_IF_NULL(formatter);
   PANIC_IF_NULL(file);
   PANIC_IF_NULL(name_buf);
 
   enum {
-    DATE_BUFSIZE = 11, /* YYYY-MM-DD\0 */
-    INDEX_BUFSIZE = 6, /* XXXXX\0*/
-    INDEX_PADDING = 3
+    INDEX_BUFSIZE = FILE_INDEX_MAX_WIDTH + 1
   };
-  /* Format timestamp */
-  const struct tm* time = gmtime(&file->override_timestamp);
-  char date_buf[DATE_BUFSIZE];
-  strftime(date_buf, DATE_BUFSIZE, "%Y-%m-%d", time);
 
-  const char* tags[FILE_MAX_TAGS];
-  size_t unique_count = file_get_unique_tags(file, FILE_MAX_TAGS, tags);
+  NameWriter writer = { name_buf, buf_length, 0 };
 
-  const char* extension = get_extension(file->path);
+  const char* date = file_name_date(formatter, file->override_timestamp);
+  put_part(&writer, date, strlen(date));
+  put_part(&writer, "_", 1);
 
+  unsigned width = formatter->index_width < FILE_INDEX_MAX_WIDTH ? formatter->index_width
+                                                                  : FILE_INDEX_MAX_WIDTH;
   char index_buf[INDEX_BUFSIZE];
-  pad_with_zeros(index, INDEX_PADDING, INDEX_BUFSIZE, index_buf);
-
-  /* Catenate all parts of file name */
-  unsigned long total_len = 0;
+  size_t index_length = pad_with_zeros(index, width, INDEX_BUFSIZE, index_buf);
+  put_part(&writer, index_buf, index_length);
 
-  name_buf[0] = '\0';
-  append_string(name_buf, buf_length, date_buf);
-  append_string(name_buf, buf_length, "_");
-  total_len = append_string(name_buf, buf_length, index_buf);
-
-  /* Add tags, separated by underscores */
-  for (size_t i = 0; i < unique_count; ++i) {
-    append_string(name_buf, buf_length, "_");
-    total_len = append_string(name_buf, buf_length, tags[i]);
-  }
+  put_tags(formatter, &writer, file->tags);
 
   /* Add extension if present */
+  const char* extension = get_extension(file->path);
   if (extension[0] != '\0') {
-    append_string(name_buf, buf_length, ".");
-    total_len = append_string(name_buf, buf_length, extension);
+    put_part(&writer, ".", 1);
+    put_part(&writer, extension, strlen(extension));
   }
 
-  return total_len;
+  if (buf_length > 0) {
+    name_buf[writer.length < buf_length ? writer.length : buf_length - 1] = '\0';
+  }
+  return writer.length;
+}
+
+unsigned long file_generate_name(
+  const IndexedFile* file,
+  uint64_t index,
+  unsigned long buf_length,
+  char* name_buf
+) {
+  FileNameFormatter formatter;
+  file_name_formatter_init(&formatter);
+  return file_name_format(&formatter, file, index, buf_length, name_buf);
 }
 
 int file_tag_is_valid(const char* tag) {
@@ -178,29 +361,21 @@ file_error_t file_add_tag(IndexedFile* file, const char* tag) {
     return FERR_INVALID_VALUE;
   }
 
-  /* Find insertion position in sorted array; detect duplicates */
-  size_t insert_pos = 0;
-  for (; insert_pos < file->tag_count; insert_pos++) {
-    int cmp = strcmp(file->tags[insert_pos], tag);
-    if (cmp == 0) {
-      return FERR_NONE; /* Duplicate — silent no-op */
-    }
-    if (cmp > 0) {
-      break;
-    }
+  unsigned id = 0;
+  file_error_t result = tag_dictionary_intern(tag, &id);
+  if (result != FERR_NONE) {
+    return result;
   }
 
-  if (file->tag_count == FILE_MAX_TAGS) {
-    return FERR_INVALID_OPERATION;
+  tag_set_t bit = (tag_set_t) 1 << id;
+  if (file->tags & bit) {
+    return FERR_NONE; /* Duplicate — silent no-op */
   }
-
-  /* Shift elements right to make room at insert_pos */
-  for (size_t i = file->tag_count; i > insert_pos; i--) {
-    file->tags[i] = file->tags[i - 1];
+  if (tag_set_count(file->tags) == FILE_MAX_TAGS) {
+    return FERR_INVALID_OPERATION;
   }
-  file->tags[insert_pos] = copy_string(tag);
-  ++file->tag_count;
 
+  file->tags |= bit;
   return FERR_NONE;
 }
 
@@ -212,45 +387,28 @@ size_t file_get_unique_tags(
   PANIC_IF_NULL(file);
   PANIC_IF_NULL(unique_tags);
 
-  size_t count =
-    file->tag_count < unique_count 
-      ? file->tag_count
-      : unique_count;
-  for (size_t i = 0; i < count; i++) {
-    unique_tags[i] = file->tags[i];
-  }
-  return count;
+  /* Dictionary lists tags in alphabetical order */
+  size_t count = tag_dictionary_names(file->tags, unique_count, unique_tags);
+  return count < unique_count ? count : unique_count;
 }
 
 int file_remove_tag(IndexedFile* file, const char* tag) {
   PANIC_IF_NULL(file);
   PANIC_IF_NULL(tag);
 
-  /* Tags are sorted and deduplicated, so at most one match exists */
-  for (size_t i = 0; i < file->tag_count; i++) {
-    if (strcmp(file->tags[i], tag) != 0) {
-      continue;
-    }
-
-    free(file->tags[i]);
-    /* Shift remaining elements left to preserve sorted order */
-    for (size_t j = i; j < file->tag_count - 1; j++) {
-      file->tags[j] = file->tags[j + 1];
-    }
-    file->tags[file->tag_count - 1] = NULL;
-    file->tag_count--;
-    return 1;
+  unsigned id = 0;
+  if (!tag_dictionary_find(tag, &id)) {
+    return 0;
   }
 
-  return 0;
+  tag_set_t bit = (tag_set_t) 1 << id;
+  int is_present = (file->tags & bit) != 0;
+  file->tags &= ~bit;
+  return is_present;
 }
 
 void file_clear_tags(IndexedFile* file) {
   PANIC_IF_NULL(file);
 
-  for (size_t i = 0; i < file->tag_count; ++i) {
-    free(file->tags[i]);
-    file->tags[i] = NULL;
-  }
-  file->tag_count = 0;
+  file->tags = 0;
 }
@@ -16,8 +16,8 @@
 #include <stdint.h>
 #include <time.h>
 
-#include "Common/List.h"
 #include "Files/Error.h"
+#include "Files/Tags.h"
 
 /**
  * @brief Description of action that should be performed on file
@@ -39,32 +39,76 @@ typedef struct {
 } FileChanges;
 
 /**
- * @brief Description of file found in source directory
+ * @brief Identity of file contents, which changes whenever file is replaced
+ * or modified
  */
 typedef struct {
-  LinkedListNode as_node;
+  uint64_t device;  /*!< Device containing file */
+  uint64_t inode;   /*!< Inode number */
+  int64_t size;     /*!< File size in bytes */
+  int64_t mtime;    /*!< Modification time in nanoseconds since epoch */
+} FileIdentity;
 
-  char* path;                 /*!< Full path to file */
+/**
+ * @brief Description of file found in source directory. Index stores files
+ * column by column, see `FileIndex`; this is a copy of a single row.
+ */
+typedef struct {
+  const char* path;           /*!< Full path to file */
   time_t real_timestamp;      /*!< File creation date */
   time_t override_timestamp;  /*!< Timestamp used for file name */
+  FileIdentity identity;      /*!< Identity of file when it was indexed */
 
-  unsigned tag_count;         /*!< Number of tags added to file */
-  char* tags[FILE_MAX_TAGS];  /*!< File tags */
+  tag_set_t tags;             /*!< Set of interned file tags */
 
   FileChanges changes;  /*!< Changes to be applied */
 } IndexedFile;
 
+/**
+ * @brief File metadata required for indexing
+ */
+typedef struct {
+  int is_regular;   /*!< Nonzero if file is a regular file */
+  int is_directory; /*!< Nonzero if file is a directory */
+  time_t timestamp; /*!< File creation date if known, status change date otherwise */
+  FileIdentity identity; /*!< Identity of file, filled for regular files only */
+} FileMetadata;
+
+/**
+ * @brief Query metadata of file `name` relative to directory `dir_fd`
+ * with at most one metadata syscall (`statx` where available, `fstatat`
+ * otherwise). Symbolic links are followed.
+ *
+ * @return FERR_NONE on success
+ *         FERR_INVALID_VALUE if file does not exist,
+ *         FERR_ACCESS_DENIED if file cannot be accessed or read
+ *
+ * @note Pass `AT_FDCWD` as `dir_fd` to resolve `name` relative to current
+ *       working directory.
+ */
+file_error_t file_probe_at(int dir_fd, const char* name, FileMetadata* metadata);
+
+/**
+ * @brief Initialize file from path and already known timestamp,
+ * without accessing file system. Identity of file is zeroed.
+ *
+ * @warning Path is not copied and must outlive the file
+ */
+void file_init_with_timestamp(IndexedFile* file, const char* path, time_t timestamp);
+
 /**
  * @brief Initialize file from path
  * 
  * @return FERR_NONE on success
  *         FERR_INVALID_VALUE on invalid path,
  *         FERR_ACCESS_DENIED if path cannot be accessed
+ *
+ * @warning Path is not copied and must outlive the file
  */
 file_error_t file_init(IndexedFile* file, const char* path);
 
 /**
- * @brief Deallocate resources used by IndexedFile
+ * @brief Reset fields of file. Strings used by file are owned by caller.
  */
 void file_cleanup(IndexedFile* file);
 
@@ -78,11 +122,13 @@ void file_cleanup(IndexedFile* file);
 int file_tag_is_valid(const char* tag);
 
 /**
- * @brief Add tag to list of file tags. Duplicate tags are ignored.
+ * @brief Add tag to set of file tags, interning it in tag dictionary.
+ * Duplicate tags are ignored.
  *
  * @return FERR_NONE on success,
  *         FERR_INVALID_VALUE if tag contains invalid characters,
- *         FERR_INVALID_OPERATION if number of tags exceeds FILE_MAX_TAGS
+ *         FERR_INVALID_OPERATION if number of tags exceeds FILE_MAX_TAGS,
+ *         or tag dictionary is full
  *
  * @note Tags can only contain lowercase latin letters and dash symbol '-'
  */
@@ -104,8 +150,6 @@ size_t file_get_unique_tags(
  * @brief Remove provided tag from file
  * 
  * @return Number of removed tags
- *
- * @note This operation does not preserve order of tags
  */
 int file_remove_tag(IndexedFile* file, const char* tag);
 
@@ -114,20 +158,73 @@ int file_remove_tag(IndexedFile* file, const char* tag);
  */
 void file_clear_tags(IndexedFile* file);
 
+enum {
+  FILE_DATE_BUFSIZE = 11,         /*!< Length of `YYYY-MM-DD` with terminator */
+  FILE_TAG_SUFFIX_BUFSIZE = 256,  /*!< Longest cached suffix of tags with terminator */
+  FILE_INDEX_DEFAULT_WIDTH = 3,   /*!< Digits of file number unless configured */
+  FILE_INDEX_MAX_WIDTH = 20       /*!< Digits of the largest 64-bit number */
+};
+
+/**
+ * @brief Generator of file names, remembering parts shared by consecutive
+ * files: date of the last day and suffix of the last set of tags.
+ *
+ * @warning Formatter must not be used by several threads at once
+ */
+typedef struct {
+  unsigned index_width;                 /*!< Minimal number of digits in file number */
+
+  int has_date;                         /*!< Nonzero if `date` is valid */
+  int64_t date_day;                     /*!< Days since epoch of cached date */
+  char date[FILE_DATE_BUFSIZE];         /*!< Cached date */
+
+  int has_suffix;                       /*!< Nonzero if `suffix` is valid */
+  tag_set_t suffix_tags;                /*!< Tags of cached suffix */
+  size_t suffix_length;                 /*!< Length of cached suffix */
+  char suffix[FILE_TAG_SUFFIX_BUFSIZE]; /*!< Cached underscore-prefixed tags */
+} FileNameFormatter;
+
+/**
+ * @brief Initialize formatter with empty caches and default index width
+ */
+void file_name_formatter_init(FileNameFormatter* formatter);
+
+/**
+ * @brief Get date used in names of files with `timestamp`, `YYYY-MM-DD`.
+ * Returned string is owned by formatter and is valid until the next call.
+ */
+const char* file_name_date(FileNameFormatter* formatter, time_t timestamp);
+
+/**
+ * @brief Generate name of file like `file_generate_name()`, reusing parts
+ * cached by formatter. Name is written in a single pass.
+ *
+ * @return Length of generated name. If this length exceeds buffer length,
+ *         the name is truncated to fit.
+ */
+unsigned long file_name_format(
+  FileNameFormatter* formatter, /*!< [inout] Formatter */
+  const IndexedFile* file,      /*!< [in]    Target file */
+  uint64_t file_index,          /*!< [in]    Number of file */
+  unsigned long buf_length,     /*!< [in]    Length of `name_buf` */
+  char* name_buf                /*!< [out]   Output buffer for file name */
+);
+
 /**
  * @brief Generate new name for file based on timestamp, index and tags
  *
  * @note
  * File name has the following format:
  * `YYYY-MM-DD_XXX_underscore_separated_tags.extension`
- * Tags are sorted alphabetically and duplicate tags are removed.
+ * Tags are sorted alphabetically and duplicate tags are removed. Number is
+ * padded with zeros to `FILE_INDEX_DEFAULT_WIDTH` digits.
  *
  * @return Length of generated name. If this length exceeds buffer length,
  *         the name is truncated to fit.
  */
 unsigned long file_generate_name(
   const IndexedFile* file,    /*!< [in]  Target file */
-  unsigned short file_index,  /*!< [in]  Index of file in list */
+  uint64_t file_index,        /*!< [in]  Number of file */
   unsigned long buf_length,   /*!< [in]  Length of `name_buf` */
   char* name_buf              /*!< [out] Output buffer for file name */
 );
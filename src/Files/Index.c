@@ -1,72 +1,435 @@
+#if defined(__linux__)
+#define _GNU_SOURCE /* dirfd(), d_type */
+#endif
+
 #include "Index.h"
 
 #include <errno.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <dirent.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <string.h>
 
 #include "Files/Error.h"
 #include "Files/File.h"
+#include "Files/Tags.h"
+#include "Files/Walker.h"
+#include "Common/Arena.h"
 #include "Common/Panic.h"
-#include "Common/Strings.h"
+#include "Common/ThreadPool.h"
+
+enum {
+  INDEX_INITIAL_CAPACITY = 1024,        /* Rows allocated for the first file */
+  PATHS_INITIAL_CAPACITY = 64 * 1024    /* Bytes allocated for the first path */
+};
 
 void file_index_init(FileIndex* index) {
   PANIC_IF_NULL(index);
 
-  list_init(&index->files);
-  index->file_count = 0;
+  memset(index, 0, sizeof(*index));
 }
 
 void file_index_clear(FileIndex* index) {
   PANIC_IF_NULL(index);
 
-  LinkedListNode* node = NULL;
-  while ((node = list_pop_front(&index->files))) {
-    IndexedFile* file = (IndexedFile*) node;
-    file_cleanup(file);
-    free(file);
+  free(index->timestamps);
+  free(index->name_timestamps);
+  free(index->tags);
+  free(index->actions);
+  free(index->identities);
+  free(index->path_offsets);
+  free(index->paths);
+  file_index_init(index);
+}
+
+static void* resize_column(void* column, size_t capacity, size_t element_size) {
+  void* resized = realloc(column, capacity * element_size);
+  PANIC_ON_BAD_ALLOC(resized);
+  return resized;
+}
+
+/* Make room for `count` more files with `paths_size` bytes of paths */
+static void reserve_rows(FileIndex* index, size_t count, size_t paths_size) {
+  if (index->file_count + count > index->capacity) {
+    size_t capacity = index->capacity > 0 ? index->capacity : INDEX_INITIAL_CAPACITY;
+    while (capacity < index->file_count + count) {
+      capacity *= 2;
+    }
+    index->timestamps = (time_t*) resize_column(index->timestamps, capacity,
+                                                sizeof(*index->timestamps));
+    index->name_timestamps = (time_t*) resize_column(index->name_timestamps, capacity,
+                                                     sizeof(*index->name_timestamps));
+    index->tags = (tag_set_t*) resize_column(index->tags, capacity, sizeof(*index->tags));
+    index->actions = (file_action_t*) resize_column(index->actions, capacity,
+                                                    sizeof(*index->actions));
+    index->identities = (FileIdentity*) resize_column(index->identities, capacity,
+                                                      sizeof(*index->identities));
+    index->path_offsets = (size_t*) resize_column(index->path_offsets, capacity,
+                                                  sizeof(*index->path_offsets));
+    index->capacity = capacity;
+  }
+
+  if (index->paths_size + paths_size > index->paths_capacity) {
+    size_t capacity = index->paths_capacity > 0 ? index->paths_capacity
+                                                : PATHS_INITIAL_CAPACITY;
+    while (capacity < index->paths_size + paths_size) {
+      capacity *= 2;
+    }
+    index->paths = (char*) resize_column(index->paths, capacity, 1);
+    index->paths_capacity = capacity;
+  }
+}
+
+size_t file_index_push(
+  FileIndex* index,
+  const char* dir_path,
+  const char* name,
+  const FileMetadata* metadata
+) {
+  PANIC_IF_NULL(index);
+  PANIC_IF_NULL(name);
+  PANIC_IF_NULL(metadata);
+
+  size_t dir_length = dir_path != NULL ? strlen(dir_path) + 1 : 0;
+  size_t name_length = strlen(name);
+  reserve_rows(index, 1, dir_length + name_length + 1);
+
+  char* path = index->paths + index->paths_size;
+  if (dir_path != NULL) {
+    memcpy(path, dir_path, dir_length - 1);
+    path[dir_length - 1] = '/';
   }
-  index->file_count = 0;
+  memcpy(path + dir_length, name, name_length + 1);
+
+  size_t row = index->file_count++;
+  index->timestamps[row] = metadata->timestamp;
+  index->name_timestamps[row] = metadata->timestamp;
+  index->tags[row] = 0;
+  index->actions[row] = FACT_COPY;
+  index->identities[row] = metadata->identity;
+  index->path_offsets[row] = index->paths_size;
+  index->paths_size += dir_length + name_length + 1;
+
+  return row;
+}
+
+void file_index_truncate(FileIndex* index, size_t file_count) {
+  PANIC_IF_NULL(index);
+
+  if (file_count >= index->file_count) {
+    return;
+  }
+  /* Rows may be sorted, so paths of kept rows are not necessarily a prefix
+   * of the pool: keep everything up to the end of the last of them */
+  size_t paths_size = 0;
+  for (size_t row = 0; row < file_count; ++row) {
+    const char* path = index->paths + index->path_offsets[row];
+    size_t path_end = index->path_offsets[row] + strlen(path) + 1;
+    if (path_end > paths_size) {
+      paths_size = path_end;
+    }
+  }
+  index->paths_size = paths_size;
+  index->file_count = file_count;
+}
+
+size_t file_index_used_memory(const FileIndex* index) {
+  PANIC_IF_NULL(index);
+
+  size_t row_size = sizeof(*index->timestamps) + sizeof(*index->name_timestamps)
+                  + sizeof(*index->tags) + sizeof(*index->actions)
+                  + sizeof(*index->identities) + sizeof(*index->path_offsets);
+  return index->file_count * row_size + index->paths_size;
+}
+
+void file_index_splice_back(FileIndex* index, FileIndex* source) {
+  PANIC_IF_NULL(index);
+  PANIC_IF_NULL(source);
+
+  index->skipped_count += source->skipped_count;
+  size_t first = index->file_count;
+  size_t count = source->file_count;
+  if (count == 0) {
+    file_index_clear(source);
+    return;
+  }
+  reserve_rows(index, count, source->paths_size);
+
+  memcpy(index->timestamps + first, source->timestamps, count * sizeof(*index->timestamps));
+  memcpy(index->name_timestamps + first, source->name_timestamps,
+         count * sizeof(*index->name_timestamps));
+  memcpy(index->tags + first, source->tags, count * sizeof(*index->tags));
+  memcpy(index->actions + first, source->actions, count * sizeof(*index->actions));
+  memcpy(index->identities + first, source->identities, count * sizeof(*index->identities));
+  for (size_t i = 0; i < count; ++i) {
+    index->path_offsets[first + i] = source->path_offsets[i] + index->paths_size;
+  }
+  memcpy(index->paths + index->paths_size, source->paths, source->paths_size);
+  index->paths_size += source->paths_size;
+  index->file_count += count;
+
+  file_index_clear(source);
+}
+
+static file_error_t probe_and_push(FileIndex* index, const char* path, size_t* row) {
+  FileMetadata metadata;
+  file_error_t res = file_probe_at(AT_FDCWD, path, &metadata);
+  if (res != FERR_NONE) {
+    return res;
+  }
+
+  *row = file_index_push(index, NULL, path, &metadata);
+  return FERR_NONE;
+}
+
+/* Move file at `row` to `position`, shifting files in between */
+static void move_row(FileIndex* index, size_t row, size_t position) {
+  IndexedFile file = file_index_get(index, row);
+  size_t path_offset = index->path_offsets[row];
+  size_t count = row - position;
+
+  memmove(index->timestamps + position + 1, index->timestamps + position,
+          count * sizeof(*index->timestamps));
+  memmove(index->name_timestamps + position + 1, index->name_timestamps + position,
+          count * sizeof(*index->name_timestamps));
+  memmove(index->tags + position + 1, index->tags + position, count * sizeof(*index->tags));
+  memmove(index->actions + position + 1, index->actions + position,
+          count * sizeof(*index->actions));
+  memmove(index->identities + position + 1, index->identities + position,
+          count * sizeof(*index->identities));
+  memmove(index->path_offsets + position + 1, index->path_offsets + position,
+          count * sizeof(*index->path_offsets));
+
+  index->timestamps[position] = file.real_timestamp;
+  index->name_timestamps[position] = file.override_timestamp;
+  index->tags[position] = file.tags;
+  index->actions[position] = file.changes.action;
+  index->identities[position] = file.identity;
+  index->path_offsets[position] = path_offset;
 }
 
 file_error_t file_add_to_index(FileIndex* index, const char* path) {
   PANIC_IF_NULL(index);
   PANIC_IF_NULL(path);
 
-  /* Initialize IndexedFile */
-  IndexedFile* file = (IndexedFile*) calloc(1, sizeof(*file));
-  PANIC_ON_BAD_ALLOC(file);
-  file_error_t res = file_init(file, path);
+  size_t row = 0;
+  file_error_t res = probe_and_push(index, path, &row);
   if (res != FERR_NONE) {
-    free(file);
     return res;
   }
 
-  /* Insert in sorted order by real_timestamp */
-  LinkedListNode* insert_after = &index->files.root;
-  LIST_FOREACH(node, index->files) {
-    IndexedFile* cur_file = (IndexedFile*) node;
-    if (file->real_timestamp < cur_file->real_timestamp) {
-      break;
-    }
-    insert_after = node;
+  /* Files usually arrive in ascending order, so appending is enough */
+  time_t timestamp = index->timestamps[row];
+  size_t position = row;
+  while (position > 0 && index->timestamps[position - 1] > timestamp) {
+    position--;
+  }
+  if (position != row) {
+    move_row(index, row, position);
   }
-  list_insert_node(insert_after, &file->as_node);
-  index->file_count++;
 
   return FERR_NONE;
 }
 
-file_error_t file_index_read_directory(FileIndex* index, const char* source_path) {
+file_error_t file_index_append(FileIndex* index, const char* path) {
   PANIC_IF_NULL(index);
-  PANIC_IF_NULL(source_path);
+  PANIC_IF_NULL(path);
+
+  size_t row = 0;
+  return probe_and_push(index, path, &row);
+}
+
+/* Sort key of file, ties are broken by current row to keep sort stable */
+typedef struct {
+  time_t timestamp;
+  const char* path;   /* NULL if files are ordered by timestamp only */
+  size_t row;
+} RowKey;
+
+static int compare_row_keys(const void* lhs, const void* rhs) {
+  const RowKey* lhs_key = (const RowKey*) lhs;
+  const RowKey* rhs_key = (const RowKey*) rhs;
+
+  if (lhs_key->timestamp != rhs_key->timestamp) {
+    return lhs_key->timestamp < rhs_key->timestamp ? -1 : 1;
+  }
+  if (lhs_key->path != NULL) {
+    int cmp = strcmp(lhs_key->path, rhs_key->path);
+    if (cmp != 0) {
+      return cmp;
+    }
+  }
+  if (lhs_key->row != rhs_key->row) {
+    return lhs_key->row < rhs_key->row ? -1 : 1;
+  }
+  return 0;
+}
 
-  enum {
-    MAX_FILENAME = 256
-  };
+/* Rearrange `column` of `element_size` bytes so that row `i` is old row `keys[i].row` */
+static void permute_column(
+  void* column,
+  size_t element_size,
+  const RowKey* keys,
+  size_t count,
+  void* buffer
+) {
+  char* source = (char*) column;
+  char* target = (char*) buffer;
+  for (size_t i = 0; i < count; ++i) {
+    memcpy(target + i * element_size, source + keys[i].row * element_size, element_size);
+  }
+  memcpy(column, buffer, count * element_size);
+}
 
+/*
+ * Sort keys are small and contiguous, so sorting them is cache-friendly.
+ * Columns are rearranged once afterwards, each in a single pass.
+ */
+static void sort_rows(FileIndex* index, int by_path) {
+  size_t count = index->file_count;
+  if (count < 2) {
+    return;
+  }
+
+  RowKey* keys = (RowKey*) malloc(count * sizeof(*keys));
+  PANIC_ON_BAD_ALLOC(keys);
+  for (size_t i = 0; i < count; ++i) {
+    keys[i].timestamp = index->timestamps[i];
+    keys[i].path = by_path ? file_index_path(index, i) : NULL;
+    keys[i].row = i;
+  }
+  qsort(keys, count, sizeof(*keys), compare_row_keys);
+
+  /* Widest column is identity */
+  void* buffer = malloc(count * sizeof(FileIdentity));
+  PANIC_ON_BAD_ALLOC(buffer);
+  permute_column(index->timestamps, sizeof(*index->timestamps), keys, count, buffer);
+  permute_column(index->name_timestamps, sizeof(*index->name_timestamps), keys, count, buffer);
+  permute_column(index->tags, sizeof(*index->tags), keys, count, buffer);
+  permute_column(index->actions, sizeof(*index->actions), keys, count, buffer);
+  permute_column(index->identities, sizeof(*index->identities), keys, count, buffer);
+  permute_column(index->path_offsets, sizeof(*index->path_offsets), keys, count, buffer);
+
+  free(buffer);
+  free(keys);
+}
+
+void file_index_sort(FileIndex* index) {
+  PANIC_IF_NULL(index);
+
+  sort_rows(index, 0);
+}
+
+void file_index_sort_by_path(FileIndex* index) {
+  PANIC_IF_NULL(index);
+
+  sort_rows(index, 1);
+}
+
+enum {
+  PROBE_BATCH_SIZE = 64,    /* Directory entries probed by a single task */
+  PROBE_QUEUE_PER_JOB = 4,  /* Batches queued per probing thread */
+  PROBE_DISCARD_BATCHES = 64  /* Batches listed before they are released, if files are discarded */
+};
+
+/*
+ * Directory entries listed by scanning thread and probed by a pool worker.
+ * Batches are kept in listing order, so results can be merged
+ * deterministically regardless of which worker probed them.
+ */
+typedef struct ProbeBatch_ {
+  struct ProbeBatch_* next;
+
+  const IndexOptions* options;
+  int dir_fd;
+  size_t name_offset;     /* Offset of entry name in its path */
+  size_t count;
+  size_t skipped_count;  /* Files skipped as already imported */
+  const char* paths[PROBE_BATCH_SIZE];
+  FileMetadata metadata[PROBE_BATCH_SIZE];
+  int is_found[PROBE_BATCH_SIZE];       /* Nonzero for files to be indexed */
+  file_error_t results[PROBE_BATCH_SIZE];
+} ProbeBatch;
+
+static void probe_batch(void* argument) {
+  ProbeBatch* batch = (ProbeBatch*) argument;
+
+  for (size_t i = 0; i < batch->count; ++i) {
+    batch->is_found[i] = 0;
+    batch->results[i] = file_probe_at(batch->dir_fd, batch->paths[i] + batch->name_offset,
+                                      &batch->metadata[i]);
+    if (batch->results[i] != FERR_NONE || !batch->metadata[i].is_regular) {
+      continue;
+    }
+    if (batch->options->manifest != NULL
+        && manifest_contains(batch->options->manifest, &batch->metadata[i].identity)) {
+      batch->skipped_count++;
+      continue;
+    }
+    batch->is_found[i] = 1;
+
+    if (batch->options->on_file != NULL) {
+      IndexedFile file;
+      file_init_with_timestamp(&file, batch->paths[i], batch->metadata[i].timestamp);
+      file.identity = batch->metadata[i].identity;
+      batch->options->on_file(batch->options->callback_context, &file);
+    }
+  }
+}
+
+static file_error_t merge_probe_batch(FileIndex* index, ProbeBatch* batch) {
+  index->skipped_count += batch->skipped_count;
+  for (size_t i = 0; i < batch->count; ++i) {
+    if (batch->results[i] == FERR_INVALID_VALUE) {
+      /* Entry was removed after it has been listed */
+      continue;
+    }
+    if (batch->results[i] != FERR_NONE) {
+      return batch->results[i];
+    }
+    if (!batch->is_found[i]) {
+      continue;
+    }
+
+    if (batch->options->discard_files) {
+      continue;
+    }
+    /* Sorting once after the scan is much cheaper than sorted insertion */
+    file_index_push(index, NULL, batch->paths[i], &batch->metadata[i]);
+  }
+
+  return FERR_NONE;
+}
+
+static void free_probe_batches(ProbeBatch* batch) {
+  /* Files not merged into index due to an error are released with index */
+  while (batch != NULL) {
+    ProbeBatch* next = batch->next;
+    free(batch);
+    batch = next;
+  }
+}
+
+/* Add found files of all batches to index in listing order and free batches */
+static file_error_t merge_probe_batches(FileIndex* index, ProbeBatch* batches) {
+  file_error_t result = FERR_NONE;
+  for (ProbeBatch* batch = batches; batch != NULL; batch = batch->next) {
+    result = merge_probe_batch(index, batch);
+    if (result != FERR_NONE) {
+      break;
+    }
+  }
+  free_probe_batches(batches);
+  return result;
+}
+
+static file_error_t read_flat_directory(
+  FileIndex* index,
+  const char* source_path,
+  const IndexOptions* options
+) {
   DIR* dir = opendir(source_path);
   if (!dir) {
     if (errno == ENOENT || errno == ENOTDIR) {
@@ -74,44 +437,115 @@ file_error_t file_index_read_directory(FileIndex* index, const char* source_path
     }
     return FERR_ACCESS_DENIED;
   }
+  int dir_fd = dirfd(dir);
 
-  /* Prepare buffer for full path */
-  size_t base_length = strlen(source_path);
-  size_t full_length = base_length + MAX_FILENAME + 2;
-  char* full_path = calloc(full_length, 1);
-  PANIC_ON_BAD_ALLOC(full_path);
-  memcpy(full_path, source_path, base_length);
-  full_path[base_length] = '/';
-  full_path[base_length + 1] = '\0';
+  /* Single job probes entries synchronously on this thread */
+  size_t worker_count = options->jobs > 1 ? options->jobs : 0;
+  ThreadPool pool;
+  thread_pool_init(&pool, worker_count, worker_count * PROBE_QUEUE_PER_JOB);
 
-  struct dirent* entry;
+  /* Listed paths are needed only until batches are merged */
+  Arena paths;
+  arena_init(&paths);
+  size_t dir_length = strlen(source_path);
+
+  ProbeBatch* batches = NULL;
+  ProbeBatch** batches_end = &batches;
+  ProbeBatch* current = NULL;
+  size_t batch_count = 0;
   file_error_t result = FERR_NONE;
+  struct dirent* entry;
 
-  /* Add all regular files from directory */
+  /* List directory and hand out entries to workers in batches */
   while ((entry = readdir(dir)) != NULL) {
     if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
       continue;
     }
-    full_path[base_length + 1] = '\0';
-    append_string(full_path, full_length, entry->d_name);
+#if defined(DT_UNKNOWN)
+    /* Skip entries known to be irrelevant without touching their inodes */
+    if (entry->d_type != DT_REG && entry->d_type != DT_LNK
+        && entry->d_type != DT_UNKNOWN) {
+      continue;
+    }
+#endif
 
-    struct stat st;
-    if (stat(full_path, &st) != 0) {
-      result = FERR_ACCESS_DENIED;
-      break;
+    if (current == NULL) {
+      current = (ProbeBatch*) calloc(1, sizeof(*current));
+      PANIC_ON_BAD_ALLOC(current);
+      current->options = options;
+      current->dir_fd = dir_fd;
+      current->name_offset = dir_length + 1;
     }
-    if (!S_ISREG(st.st_mode)) {
-      continue;
+    size_t name_length = strlen(entry->d_name);
+    char* path = (char*) arena_alloc(&paths, dir_length + name_length + 2);
+    memcpy(path, source_path, dir_length);
+    path[dir_length] = '/';
+    memcpy(path + dir_length + 1, entry->d_name, name_length + 1);
+    current->paths[current->count++] = path;
+
+    if (current->count == PROBE_BATCH_SIZE) {
+      *batches_end = current;
+      batches_end = &current->next;
+      thread_pool_submit(&pool, probe_batch, current);
+      current = NULL;
+      batch_count++;
     }
 
-    result = file_add_to_index(index, full_path);
-    if (result != FERR_NONE) {
-      break;
+    /* Discarded files need no paths after probing, release them as scan goes */
+    if (options->discard_files && batch_count == PROBE_DISCARD_BATCHES) {
+      thread_pool_wait(&pool);
+      result = merge_probe_batches(index, batches);
+      batches = NULL;
+      batches_end = &batches;
+      batch_count = 0;
+      arena_destroy(&paths);
+      arena_init(&paths);
+      if (result != FERR_NONE) {
+        break;
+      }
     }
   }
-  free(full_path);
+  if (current != NULL) {
+    *batches_end = current;
+    thread_pool_submit(&pool, probe_batch, current);
+  }
+  thread_pool_destroy(&pool);
+
+  /* Add all regular files from directory in listing order */
+  if (result == FERR_NONE) {
+    result = merge_probe_batches(index, batches);
+  } else {
+    free_probe_batches(batches);
+  }
+  arena_destroy(&paths);
   closedir(dir);
 
+  return result;
+}
+
+file_error_t file_index_read_directory(
+  FileIndex* index,
+  const char* source_path,
+  const IndexOptions* options
+) {
+  PANIC_IF_NULL(index);
+  PANIC_IF_NULL(source_path);
+  PANIC_IF_NULL(options);
+
+  file_error_t result = FERR_NONE;
+  if (options->recursive) {
+    result = file_walker_scan(index, source_path, options);
+    if (result == FERR_NONE) {
+      /* Walk order is not deterministic, files of equal timestamps are ordered by path */
+      sort_rows(index, 1);
+    }
+  } else {
+    result = read_flat_directory(index, source_path, options);
+    if (result == FERR_NONE) {
+      file_index_sort(index);
+    }
+  }
+
   /* If error occurred, rollback indexing */
   if (result != FERR_NONE) {
     file_index_clear(index);
@@ -123,33 +557,37 @@ file_error_t file_index_add_tags(FileIndex* index, size_t tag_count, const char*
   PANIC_IF_NULL(index);
   PANIC_IF_NULL(tags);
 
-  if (tag_count > FILE_MAX_TAGS) {
-    return FERR_INVALID_OPERATION;
-  }
-
   for (size_t i = 0; i < tag_count; ++i) {
     if (!file_tag_is_valid(tags[i])) {
       return FERR_INVALID_VALUE;
     }
   }
 
-  LIST_FOREACH(node, index->files) {
-    IndexedFile* file = (IndexedFile*) node;
-
-    /* Check that all tags can be added */
-    if (file->tag_count + tag_count > FILE_MAX_TAGS) {
-      return FERR_INVALID_OPERATION;
+  /* Intern tags once, files only get their IDs */
+  tag_set_t added = 0;
+  for (size_t i = 0; i < tag_count; ++i) {
+    unsigned id = 0;
+    file_error_t result = tag_dictionary_intern(tags[i], &id);
+    if (result != FERR_NONE) {
+      return result;
     }
+    added |= (tag_set_t) 1 << id;
   }
 
-  LIST_FOREACH(node, index->files) {
-    IndexedFile* file = (IndexedFile*) node;
+  if (tag_set_count(added) > FILE_MAX_TAGS) {
+    return FERR_INVALID_OPERATION;
+  }
 
-    for (size_t i = 0; i < tag_count; ++i) {
-      /* After all checks, this cannot fail */
-      file_add_tag(file, tags[i]);
+  /* Check that all tags can be added */
+  FILE_INDEX_FOREACH(row, *index) {
+    if (tag_set_count(index->tags[row] | added) > FILE_MAX_TAGS) {
+      return FERR_INVALID_OPERATION;
     }
   }
 
+  FILE_INDEX_FOREACH(row, *index) {
+    index->tags[row] |= added;
+  }
+
   return FERR_NONE;
 }
@@ -10,41 +10,181 @@
 #ifndef __FILES_INDEX_H
 #define __FILES_INDEX_H
 
-#include "Common/List.h"
+#include <stddef.h>
+#include <time.h>
+
 #include "Files/Error.h"
+#include "Files/File.h"
+#include "Files/Manifest.h"
+#include "Files/Tags.h"
 
 /**
- * @brief Description of all files found in source directory
+ * @brief Description of all files found in source directory.
+ *
+ * @note
+ * Files are stored column by column: loops over all files, such as sorting,
+ * tagging and numbering, read only the columns they need from contiguous
+ * memory. Row `i` of every column describes the `i`-th file of index.
+ * Paths are kept in a single pool and referenced by offset, so that columns
+ * and pool can grow without invalidating them.
  */
 typedef struct {
-  LinkedList files; /*!< List of indexed files */
   size_t file_count;
+  size_t capacity;            /*!< Number of rows allocated in every column */
+  size_t skipped_count;       /*!< Files skipped as already imported */
+
+  time_t* timestamps;         /*!< File creation dates, files are sorted by them */
+  time_t* name_timestamps;    /*!< Timestamps used for file names */
+  tag_set_t* tags;            /*!< Sets of interned file tags */
+  file_action_t* actions;     /*!< Actions to be applied to files */
+  FileIdentity* identities;   /*!< Identities of files when they were indexed */
+  size_t* path_offsets;       /*!< Offsets of file paths in `paths` */
+
+  char* paths;                /*!< Pool of null-terminated file paths */
+  size_t paths_size;          /*!< Bytes used in pool */
+  size_t paths_capacity;      /*!< Bytes allocated for pool */
 } FileIndex;
 
+/**
+ * @brief Iterate over rows of index in order, in the manner of `LIST_FOREACH`
+ */
+#define FILE_INDEX_FOREACH(row, index)\
+  for (size_t row = 0; row < (index).file_count; ++row)
+
+/**
+ * @brief Get path of file at `row`, owned by index. Path is valid until
+ * a file is added to index.
+ */
+static inline const char* file_index_path(const FileIndex* index, size_t row) {
+  return index->paths + index->path_offsets[row];
+}
+
+/**
+ * @brief Get copy of file at `row`. Path is owned by index, see `file_index_path()`.
+ */
+static inline IndexedFile file_index_get(const FileIndex* index, size_t row) {
+  IndexedFile file;
+  file.path = file_index_path(index, row);
+  file.real_timestamp = index->timestamps[row];
+  file.override_timestamp = index->name_timestamps[row];
+  file.identity = index->identities[row];
+  file.tags = index->tags[row];
+  file.changes.action = index->actions[row];
+  return file;
+}
+
+/**
+ * @brief Function notified about every file found during directory scan
+ *
+ * @warning Can be called from several threads at once. File is not yet
+ *          added to index when the function is called, and it is only
+ *          valid during the call.
+ */
+typedef void (*file_index_callback_t)(void* context, const IndexedFile* file);
+
+/**
+ * @brief Options for directory scanning
+ */
+typedef struct {
+  unsigned jobs;      /*!< Number of threads querying file metadata, 0 or 1 to scan sequentially */
+  int recursive;      /*!< If true, scan nested directories as well */
+  unsigned max_depth; /*!< Maximum nesting level of scanned directories, 0 for no limit */
+  const ImportManifest* manifest; /*!< Files recorded in manifest are skipped, may be NULL */
+
+  file_index_callback_t on_file;  /*!< Called as soon as file is found, may be NULL */
+  void* callback_context;         /*!< Context passed to `on_file` */
+  int discard_files;              /*!< If true, found files are only passed to `on_file`
+                                       and not added to index */
+} IndexOptions;
+
 /**
  * @brief Initialize empty file index
  */
 void file_index_init(FileIndex* index);
 
 /**
- * @brief Remove all files from index
+ * @brief Remove all files from index and release memory used by them at once
  */
 void file_index_clear(FileIndex* index);
 
 /**
- * @brief Add file at `path` to index. Files in index are sorted by `real_timestamp` field.
+ * @brief Add file at `path` to index. Files in index are sorted by `timestamps` column.
  *
  * @return FERR_NONE on success,
  *         FERR_INVALID_VALUE if the path is invalid,
  *         FERR_ACCESS_DENIED if the file cannot be accessed
  */
 file_error_t file_add_to_index(
-  FileIndex* index, /*!< [inout] List of indexed files */
+  FileIndex* index, /*!< [inout] Indexed files */
+  const char* path  /*!< [in]    Path to indexed file */
+);
+
+/**
+ * @brief Add file at `path` to the end of index without keeping it sorted.
+ * Intended for bulk ingestion: append all files, then call `file_index_sort()`.
+ *
+ * @return FERR_NONE on success,
+ *         FERR_INVALID_VALUE if the path is invalid,
+ *         FERR_ACCESS_DENIED if the file cannot be accessed
+ */
+file_error_t file_index_append(
+  FileIndex* index, /*!< [inout] Indexed files */
   const char* path  /*!< [in]    Path to indexed file */
 );
 
 /**
- * @brief Add all files from directory to index
+ * @brief Add file with already known metadata to the end of index, without
+ * accessing file system. Path of file is `dir_path/name`, or just `name`
+ * if `dir_path` is NULL; it is copied. File gets no tags and `FACT_COPY` action.
+ *
+ * @return Row of added file
+ */
+size_t file_index_push(
+  FileIndex* index,               /*!< [inout] Indexed files */
+  const char* dir_path,           /*!< [in]    Directory of file, may be NULL */
+  const char* name,               /*!< [in]    Name of file in directory */
+  const FileMetadata* metadata    /*!< [in]    Timestamp and identity of file */
+);
+
+/**
+ * @brief Remove all files after the first `file_count` ones, keeping memory
+ * allocated for them
+ *
+ * @note Rows need not be in insertion order. Paths of removed files are
+ * released only if they follow paths of all kept files in the pool.
+ */
+void file_index_truncate(FileIndex* index, size_t file_count);
+
+/**
+ * @brief Get number of bytes taken by files of index, not counting memory
+ * allocated in advance
+ */
+size_t file_index_used_memory(const FileIndex* index);
+
+/**
+ * @brief Move all files of `source` to the end of `index`, leaving `source` empty
+ */
+void file_index_splice_back(FileIndex* index, FileIndex* source);
+
+/**
+ * @brief Sort files in index by `timestamps` column.
+ * Files with equal timestamps keep their relative order.
+ */
+void file_index_sort(FileIndex* index);
+
+/**
+ * @brief Sort files in index by `timestamps` column, and files with equal
+ * timestamps by path
+ */
+void file_index_sort_by_path(FileIndex* index);
+
+/**
+ * @brief Add all files from directory to index.
+ * Resulting order does not depend on number of jobs. In recursive mode files
+ * with equal timestamps are ordered by path. Files found in
+ * `options->manifest` are counted in `skipped_count` instead of being added.
+ * With `options->discard_files` index stays empty, and memory used by scan
+ * does not grow with number of files in a flat directory.
  *
  * @return FERR_NONE on success,
  *         FERR_INVALID_VALUE if the path is invalid,
@@ -52,7 +192,8 @@ file_error_t file_add_to_index(
  */
 file_error_t file_index_read_directory(
   FileIndex* index,
-  const char* source_path
+  const char* source_path,
+  const IndexOptions* options
 );
 
 /**
@@ -60,7 +201,8 @@ file_error_t file_index_read_directory(
  *
  * @return FERR_NONE on success
  *         FERR_INVALID_VALUE if one of the tags is invalid
- *         FERR_INVALID_OPERATION if one of the files exceeds tag limit
+ *         FERR_INVALID_OPERATION if one of the files exceeds tag limit or
+ *                                tag dictionary is full
  */
 file_error_t file_index_add_tags(
   FileIndex* index,
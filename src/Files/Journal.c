@@ -0,0 +1,578 @@
+#if defined(__linux__)
+#define _GNU_SOURCE /* st_mtim */
+#endif
+
+#include "Journal.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "Common/Panic.h"
+
+#define JOURNAL_NAME "/.corgi-journal"
+#define JOURNAL_MAGIC "CORGIJ01"
+
+enum {
+  MAGIC_LENGTH = sizeof(JOURNAL_MAGIC) - 1
+};
+
+typedef enum {
+  RECORD_INTENT = 1,  /* Target is about to be created */
+  RECORD_DONE,        /* Operation completed */
+  RECORD_COMMIT       /* Commit started */
+} record_type_t;
+
+/* Fixed part of journal record, followed by source and target paths */
+typedef struct {
+  uint32_t checksum;      /* FNV-1a hash of the rest of record */
+  uint16_t type;
+  uint16_t action;
+  uint32_t source_length;
+  uint32_t target_length;
+  FileStamp source;
+  FileStamp target;
+} RecordHeader;
+
+/* Record read from journal */
+typedef struct {
+  RecordHeader header;
+  const char* source;   /* Not terminated */
+  const char* target;   /* Not terminated */
+  size_t sequence;      /* Position of record in journal */
+} Record;
+
+static uint32_t hash_bytes(uint32_t hash, const void* data, size_t size) {
+  const unsigned char* bytes = (const unsigned char*) data;
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= bytes[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+static uint32_t record_checksum(const RecordHeader* header, const char* paths) {
+  uint32_t hash = 2166136261u;
+  hash = hash_bytes(hash, (const char*) header + sizeof(header->checksum),
+                    sizeof(*header) - sizeof(header->checksum));
+  return hash_bytes(hash, paths, header->source_length + header->target_length);
+}
+
+static int64_t stat_mtime(const struct stat* st) {
+  int64_t nanoseconds = 0;
+#if defined(__APPLE__)
+  nanoseconds = st->st_mtimespec.tv_nsec;
+#elif defined(__linux__)
+  nanoseconds = st->st_mtim.tv_nsec;
+#endif
+  return (int64_t) st->st_mtime * 1000000000 + nanoseconds;
+}
+
+int file_stamp_read(const char* path, FileStamp* stamp) {
+  PANIC_IF_NULL(path);
+  PANIC_IF_NULL(stamp);
+
+  struct stat st;
+  if (stat(path, &st) != 0) {
+    return -1;
+  }
+  stamp->size = (int64_t) st.st_size;
+  stamp->mtime = stat_mtime(&st);
+  return 0;
+}
+
+/* Check that file at `path` was not changed since `stamp` was taken */
+static int is_unchanged(const char* path, const FileStamp* stamp) {
+  FileStamp current;
+  return file_stamp_read(path, &current) == 0
+      && current.size == stamp->size
+      && current.mtime == stamp->mtime;
+}
+
+static int write_all(int fd, const char* data, size_t size) {
+  while (size > 0) {
+    ssize_t written = write(fd, data, size);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    data += written;
+    size -= (size_t) written;
+  }
+  return 0;
+}
+
+/* Append record with single write, so that it is never interleaved with others */
+static file_error_t append_record(
+  Journal* journal,
+  record_type_t type,
+  journal_action_t action,
+  const char* source_path,
+  const char* target_path,
+  const FileStamp* source,
+  const FileStamp* target
+) {
+  size_t source_length = source_path != NULL ? strlen(source_path) : 0;
+  size_t target_length = target_path != NULL ? strlen(target_path) : 0;
+
+  RecordHeader header;
+  memset(&header, 0, sizeof(header));
+  header.type = (uint16_t) type;
+  header.action = (uint16_t) action;
+  header.source_length = (uint32_t) source_length;
+  header.target_length = (uint32_t) target_length;
+  if (source != NULL) {
+    header.source = *source;
+  }
+  if (target != NULL) {
+    header.target = *target;
+  }
+
+  size_t size = sizeof(header) + source_length + target_length;
+  char* record = (char*) malloc(size);
+  PANIC_ON_BAD_ALLOC(record);
+  char* paths = record + sizeof(header);
+  if (source_length > 0) {
+    memcpy(paths, source_path, source_length);
+  }
+  if (target_length > 0) {
+    memcpy(paths + source_length, target_path, target_length);
+  }
+  header.checksum = record_checksum(&header, paths);
+  memcpy(record, &header, sizeof(header));
+
+  pthread_mutex_lock(&journal->lock);
+  int write_result = write_all(journal->fd, record, size);
+  pthread_mutex_unlock(&journal->lock);
+
+  free(record);
+  return write_result == 0 ? FERR_NONE : FERR_ACCESS_DENIED;
+}
+
+/* Read whole journal file, returns NULL if it is empty */
+static char* read_journal(int fd, size_t* size) {
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+    *size = 0;
+    return NULL;
+  }
+
+  char* data = (char*) malloc((size_t) st.st_size);
+  PANIC_ON_BAD_ALLOC(data);
+
+  size_t total = 0;
+  while (total < (size_t) st.st_size) {
+    ssize_t bytes_read = pread(fd, data + total, (size_t) st.st_size - total, (off_t) total);
+    if (bytes_read < 0 && errno == EINTR) {
+      continue;
+    }
+    if (bytes_read <= 0) {
+      break;
+    }
+    total += (size_t) bytes_read;
+  }
+
+  *size = total;
+  return data;
+}
+
+/*
+ * Split journal into records. Reading stops at the first incomplete or
+ * damaged record, which is left by interrupted write.
+ */
+static Record* parse_records(const char* data, size_t size, size_t* count) {
+  *count = 0;
+  if (size < MAGIC_LENGTH || memcmp(data, JOURNAL_MAGIC, MAGIC_LENGTH) != 0) {
+    return NULL;
+  }
+
+  size_t capacity = 16;
+  Record* records = (Record*) calloc(capacity, sizeof(*records));
+  PANIC_ON_BAD_ALLOC(records);
+
+  size_t offset = MAGIC_LENGTH;
+  while (size - offset >= sizeof(RecordHeader)) {
+    RecordHeader header;
+    memcpy(&header, data + offset, sizeof(header));
+
+    size_t paths_length = (size_t) header.source_length + header.target_length;
+    if (size - offset - sizeof(header) < paths_length) {
+      break;
+    }
+    const char* paths = data + offset + sizeof(header);
+    if (header.checksum != record_checksum(&header, paths)) {
+      break;
+    }
+
+    if (*count == capacity) {
+      capacity *= 2;
+      records = (Record*) realloc(records, capacity * sizeof(*records));
+      PANIC_ON_BAD_ALLOC(records);
+    }
+    records[*count].header = header;
+    records[*count].source = paths;
+    records[*count].target = paths + header.source_length;
+    records[*count].sequence = *count;
+    (*count)++;
+
+    offset += sizeof(header) + paths_length;
+  }
+
+  return records;
+}
+
+static char* copy_bytes(const char* data, size_t length) {
+  char* result = (char*) malloc(length + 1);
+  PANIC_ON_BAD_ALLOC(result);
+  memcpy(result, data, length);
+  result[length] = '\0';
+  return result;
+}
+
+static int compare_paths(const char* lhs, size_t lhs_length, const char* rhs, size_t rhs_length) {
+  size_t common = lhs_length < rhs_length ? lhs_length : rhs_length;
+  int result = memcmp(lhs, rhs, common);
+  if (result != 0) {
+    return result;
+  }
+  return (lhs_length > rhs_length) - (lhs_length < rhs_length);
+}
+
+/* Order records by target path, then by position in journal */
+static int compare_records(const void* lhs, const void* rhs) {
+  const Record* lhs_record = (const Record*) lhs;
+  const Record* rhs_record = (const Record*) rhs;
+
+  int result = compare_paths(lhs_record->target, lhs_record->header.target_length,
+                             rhs_record->target, rhs_record->header.target_length);
+  if (result != 0) {
+    return result;
+  }
+  return (lhs_record->sequence > rhs_record->sequence)
+       - (lhs_record->sequence < rhs_record->sequence);
+}
+
+/* Finish interrupted commit by removing sources of moved and deleted files */
+static void roll_forward(const Record* records, size_t count, JournalRecovery* recovery) {
+  for (size_t i = 0; i < count; ++i) {
+    const RecordHeader* header = &records[i].header;
+    if (header->type != RECORD_DONE
+        || (header->action != JOURNAL_ACTION_MOVE && header->action != JOURNAL_ACTION_DELETE)) {
+      continue;
+    }
+
+    char* source_path = copy_bytes(records[i].source, header->source_length);
+    if (is_unchanged(source_path, &header->source) && unlink(source_path) == 0) {
+      recovery->rolled_forward_count++;
+    }
+    free(source_path);
+  }
+}
+
+/*
+ * Keep completed targets which were not changed since, remove the others.
+ * The last record for every target tells whether it was completed.
+ */
+static void roll_back(Journal* journal, Record* records, size_t count, JournalRecovery* recovery) {
+  qsort(records, count, sizeof(*records), compare_records);
+
+  journal->entries = (JournalEntry*) calloc(count + 1, sizeof(*journal->entries));
+  PANIC_ON_BAD_ALLOC(journal->entries);
+
+  for (size_t i = 0; i < count; ++i) {
+    const Record* record = &records[i];
+    if (record->header.target_length == 0) {
+      continue;
+    }
+    /* Skip to the last record for target */
+    if (i + 1 < count
+        && compare_paths(record->target, record->header.target_length,
+                         records[i + 1].target, records[i + 1].header.target_length) == 0) {
+      continue;
+    }
+
+    char* target_path = copy_bytes(record->target, record->header.target_length);
+    char* source_path = copy_bytes(record->source, record->header.source_length);
+
+    if (record->header.type == RECORD_DONE
+        && is_unchanged(target_path, &record->header.target)
+        && is_unchanged(source_path, &record->header.source)) {
+      JournalEntry* entry = &journal->entries[journal->entry_count++];
+      entry->source_path = source_path;
+      entry->target_path = target_path;
+      entry->action = (journal_action_t) record->header.action;
+      entry->source = record->header.source;
+      entry->target = record->header.target;
+      entry->is_released = 0;
+      recovery->resumable_count++;
+      continue;
+    }
+
+    if (unlink(target_path) == 0) {
+      recovery->rolled_back_count++;
+    }
+    free(target_path);
+    free(source_path);
+  }
+}
+
+static void recover(Journal* journal, JournalRecovery* recovery) {
+  size_t size = 0;
+  char* data = read_journal(journal->fd, &size);
+  if (data == NULL) {
+    return;
+  }
+
+  size_t count = 0;
+  Record* records = parse_records(data, size, &count);
+
+  int is_committed = 0;
+  for (size_t i = 0; i < count; ++i) {
+    if (records[i].header.type == RECORD_COMMIT) {
+      is_committed = 1;
+      break;
+    }
+  }
+
+  if (is_committed) {
+    roll_forward(records, count, recovery);
+  } else if (count > 0) {
+    roll_back(journal, records, count, recovery);
+  }
+
+  free(records);
+  free(data);
+}
+
+static void journal_init(Journal* journal) {
+  journal->fd = -1;
+  journal->path = NULL;
+  journal->entries = NULL;
+  journal->entry_count = 0;
+  pthread_mutex_init(&journal->lock, NULL);
+}
+
+/*
+ * Open and lock journal file. Finished journal is unlinked while its owner
+ * still holds the lock, so a lock taken on a file that is no longer at `path`
+ * is released and taken again on the current one.
+ */
+static file_error_t lock_journal_file(const char* path, int* fd) {
+  enum {
+    MAX_LOCK_ATTEMPTS = 16
+  };
+
+  for (unsigned attempt = 0; attempt < MAX_LOCK_ATTEMPTS; ++attempt) {
+    int file = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (file < 0) {
+      /* Read-only target is reported when files are created */
+      *fd = -1;
+      return FERR_NONE;
+    }
+
+    struct flock lock;
+    memset(&lock, 0, sizeof(lock));
+    lock.l_type = F_WRLCK;
+    lock.l_whence = SEEK_SET;
+    if (fcntl(file, F_SETLK, &lock) != 0) {
+      close(file);
+      return FERR_ALREADY_EXISTS;
+    }
+
+    struct stat locked;
+    struct stat current;
+    if (fstat(file, &locked) == 0 && stat(path, &current) == 0
+        && locked.st_dev == current.st_dev && locked.st_ino == current.st_ino) {
+      *fd = file;
+      return FERR_NONE;
+    }
+    close(file);
+  }
+  return FERR_ALREADY_EXISTS;
+}
+
+file_error_t journal_open(Journal* journal, const char* directory, JournalRecovery* recovery) {
+  PANIC_IF_NULL(journal);
+  PANIC_IF_NULL(directory);
+  PANIC_IF_NULL(recovery);
+
+  journal_init(journal);
+  memset(recovery, 0, sizeof(*recovery));
+
+  size_t directory_length = strlen(directory);
+  journal->path = (char*) malloc(directory_length + sizeof(JOURNAL_NAME));
+  PANIC_ON_BAD_ALLOC(journal->path);
+  memcpy(journal->path, directory, directory_length);
+  memcpy(journal->path + directory_length, JOURNAL_NAME, sizeof(JOURNAL_NAME));
+
+  int fd = -1;
+  file_error_t result = lock_journal_file(journal->path, &fd);
+  if (result != FERR_NONE || fd < 0) {
+    return result;
+  }
+  journal->fd = fd;
+
+  recover(journal, recovery);
+
+  /* Start new journal, keeping resumable targets in case of another crash */
+  if (ftruncate(fd, 0) != 0 || write_all(fd, JOURNAL_MAGIC, MAGIC_LENGTH) != 0) {
+    journal_release_unclaimed(journal);
+    close(fd);
+    journal->fd = -1;
+    return FERR_NONE;
+  }
+  for (size_t i = 0; i < journal->entry_count; ++i) {
+    const JournalEntry* entry = &journal->entries[i];
+    append_record(journal, RECORD_DONE, entry->action, entry->source_path,
+                  entry->target_path, &entry->source, &entry->target);
+  }
+
+  return FERR_NONE;
+}
+
+void journal_finish(Journal* journal) {
+  PANIC_IF_NULL(journal);
+
+  if (journal->fd >= 0 && journal->path != NULL) {
+    unlink(journal->path);
+  }
+}
+
+void journal_close(Journal* journal) {
+  if (journal == NULL) {
+    return;
+  }
+
+  if (journal->fd >= 0) {
+    close(journal->fd);
+  }
+  for (size_t i = 0; i < journal->entry_count; ++i) {
+    free(journal->entries[i].source_path);
+    free(journal->entries[i].target_path);
+  }
+  free(journal->entries);
+  free(journal->path);
+  pthread_mutex_destroy(&journal->lock);
+  journal->fd = -1;
+  journal->path = NULL;
+  journal->entries = NULL;
+  journal->entry_count = 0;
+}
+
+void journal_disable(Journal* journal) {
+  PANIC_IF_NULL(journal);
+  journal_init(journal);
+}
+
+static int compare_entry_target(const void* key, const void* element) {
+  return strcmp((const char*) key, ((const JournalEntry*) element)->target_path);
+}
+
+int journal_claim(
+  Journal* journal,
+  const char* source_path,
+  const char* target_path,
+  journal_action_t action
+) {
+  PANIC_IF_NULL(journal);
+  PANIC_IF_NULL(source_path);
+  PANIC_IF_NULL(target_path);
+
+  if (journal->fd < 0 || journal->entry_count == 0) {
+    return 0;
+  }
+
+  int is_claimed = 0;
+  pthread_mutex_lock(&journal->lock);
+
+  JournalEntry* entry = (JournalEntry*) bsearch(
+    target_path, journal->entries, journal->entry_count,
+    sizeof(*journal->entries), compare_entry_target
+  );
+  if (entry != NULL && !entry->is_released) {
+    entry->is_released = 1;
+    is_claimed = entry->action == action
+              && strcmp(entry->source_path, source_path) == 0
+              && is_unchanged(entry->source_path, &entry->source)
+              && is_unchanged(entry->target_path, &entry->target);
+    if (!is_claimed) {
+      unlink(entry->target_path);
+    }
+  }
+
+  pthread_mutex_unlock(&journal->lock);
+  return is_claimed;
+}
+
+void journal_release_unclaimed(Journal* journal) {
+  PANIC_IF_NULL(journal);
+
+  pthread_mutex_lock(&journal->lock);
+  for (size_t i = 0; i < journal->entry_count; ++i) {
+    JournalEntry* entry = &journal->entries[i];
+    if (!entry->is_released) {
+      entry->is_released = 1;
+      unlink(entry->target_path);
+    }
+  }
+  pthread_mutex_unlock(&journal->lock);
+}
+
+file_error_t journal_record_intent(Journal* journal, const char* target_path) {
+  PANIC_IF_NULL(journal);
+  PANIC_IF_NULL(target_path);
+
+  if (journal->fd < 0) {
+    return FERR_NONE;
+  }
+  return append_record(journal, RECORD_INTENT, JOURNAL_ACTION_COPY,
+                       NULL, target_path, NULL, NULL);
+}
+
+file_error_t journal_record_done(
+  Journal* journal,
+  const char* source_path,
+  const char* target_path,
+  journal_action_t action
+) {
+  PANIC_IF_NULL(journal);
+  PANIC_IF_NULL(source_path);
+
+  if (journal->fd < 0) {
+    return FERR_NONE;
+  }
+
+  /* Missing file leaves zero stamp, which never matches on recovery */
+  FileStamp source;
+  FileStamp target;
+  memset(&source, 0, sizeof(source));
+  memset(&target, 0, sizeof(target));
+  file_stamp_read(source_path, &source);
+  if (target_path != NULL) {
+    file_stamp_read(target_path, &target);
+  }
+
+  return append_record(journal, RECORD_DONE, action, source_path, target_path,
+                       &source, &target);
+}
+
+file_error_t journal_record_commit(Journal* journal, int is_durable) {
+  PANIC_IF_NULL(journal);
+
+  if (journal->fd < 0) {
+    return FERR_NONE;
+  }
+
+  file_error_t result = append_record(journal, RECORD_COMMIT, JOURNAL_ACTION_COPY,
+                                      NULL, NULL, NULL, NULL);
+  if (result == FERR_NONE && is_durable && fdatasync(journal->fd) != 0) {
+    result = FERR_ACCESS_DENIED;
+  }
+  return result;
+}
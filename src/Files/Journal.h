@@ -0,0 +1,178 @@
+/**
+ * @file Journal.h
+ * @author MeerkatBoss (solodovnikov.ia@phystech.su)
+ *
+ * @brief Write-ahead journal of file transaction
+ *
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright MeerkatBoss (c) 2026
+ */
+#ifndef __FILES_JOURNAL_H
+#define __FILES_JOURNAL_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "Files/Error.h"
+
+/**
+ * @brief Operation recorded in journal
+ */
+enum JournalAction {
+  JOURNAL_ACTION_COPY = 1,  /*!< Target created, source kept */
+  JOURNAL_ACTION_MOVE,      /*!< Target created, source removed on commit */
+  JOURNAL_ACTION_DELETE     /*!< Source removed on commit */
+};
+
+typedef enum JournalAction journal_action_t;
+
+/**
+ * @brief Size and modification time identifying file contents
+ */
+typedef struct {
+  int64_t size;   /*!< File size in bytes */
+  int64_t mtime;  /*!< Modification time in nanoseconds since epoch */
+} FileStamp;
+
+/**
+ * @brief Completed operation of interrupted transaction
+ */
+typedef struct {
+  char* source_path;        /*!< Source file path (allocated) */
+  char* target_path;        /*!< Created target file path (allocated) */
+  journal_action_t action;  /*!< Completed operation */
+  FileStamp source;         /*!< Source file at the time target was completed */
+  FileStamp target;         /*!< Target file when it was completed */
+  int is_released;          /*!< Nonzero if claimed or rolled back by current transaction */
+} JournalEntry;
+
+/**
+ * @brief Statistics of recovery from interrupted transaction
+ */
+typedef struct {
+  size_t resumable_count;       /*!< Completed targets which can be resumed */
+  size_t rolled_back_count;     /*!< Incomplete or outdated targets removed */
+  size_t rolled_forward_count;  /*!< Sources removed to finish interrupted commit */
+} JournalRecovery;
+
+/**
+ * @brief Append-only journal of transaction in target directory
+ */
+typedef struct {
+  int fd;                   /*!< Journal file, -1 if journal is disabled */
+  char* path;               /*!< Journal file path (allocated) */
+  pthread_mutex_t lock;     /*!< Protects journal file and entries */
+
+  JournalEntry* entries;    /*!< Completed operations of interrupted transaction,
+                                 sorted by target path */
+  size_t entry_count;       /*!< Number of entries */
+} Journal;
+
+/**
+ * @brief Read size and modification time of file at `path`
+ *
+ * @return 0 on success, -1 if file cannot be accessed
+ */
+int file_stamp_read(const char* path, FileStamp* stamp);
+
+/**
+ * @brief Open journal in `directory`, recovering interrupted transaction.
+ *
+ * @note
+ * Journal is locked, so that two processes cannot use the same target
+ * directory at once. If the previous transaction was interrupted during
+ * commit, its commit is finished by removing sources of moved and deleted
+ * files. Otherwise targets of incomplete operations, and of completed ones
+ * whose source or target has changed since, are removed; the rest can be
+ * claimed with `journal_claim()` by the new transaction. If journal cannot
+ * be created, because directory is read-only, journal is disabled and all
+ * other functions do nothing.
+ *
+ * @return FERR_NONE on success,
+ *         FERR_ALREADY_EXISTS if journal is locked by another process
+ */
+file_error_t journal_open(
+  Journal* journal,             /*!< [out] Opened journal */
+  const char* directory,        /*!< [in]  Target directory */
+  JournalRecovery* recovery     /*!< [out] Statistics of recovery */
+);
+
+/**
+ * @brief Initialize journal which records nothing, e.g. for dry run
+ */
+void journal_disable(Journal* journal);
+
+/**
+ * @brief Remove journal of transaction which was committed or rolled back.
+ * Journal stays locked until it is closed.
+ */
+void journal_finish(Journal* journal);
+
+/**
+ * @brief Close journal and free resources. Journal which was not finished
+ * is kept for recovery by the next transaction.
+ */
+void journal_close(Journal* journal);
+
+/**
+ * @brief Claim completed target of interrupted transaction for operation
+ * creating `target_path` from `source_path`.
+ * If a different operation created this target, or either file has changed
+ * since, the target is removed instead, so that it can be created anew.
+ *
+ * @note Can be called from several threads at once.
+ *
+ * @return Nonzero if target can be kept as is
+ */
+int journal_claim(
+  Journal* journal,         /*!< [inout] Opened journal */
+  const char* source_path,  /*!< [in]    Source of operation */
+  const char* target_path,  /*!< [in]    Target of operation */
+  journal_action_t action   /*!< [in]    Operation */
+);
+
+/**
+ * @brief Remove targets of interrupted transaction not claimed so far
+ */
+void journal_release_unclaimed(Journal* journal);
+
+/**
+ * @brief Record that `target_path` is about to be created.
+ * Target is removed on recovery unless it is completed.
+ *
+ * @note Can be called from several threads at once.
+ *
+ * @return FERR_NONE on success,
+ *         FERR_ACCESS_DENIED if journal cannot be written
+ */
+file_error_t journal_record_intent(Journal* journal, const char* target_path);
+
+/**
+ * @brief Record completed operation, along with current size and
+ * modification time of its source and target.
+ *
+ * @note Can be called from several threads at once.
+ *
+ * @return FERR_NONE on success,
+ *         FERR_ACCESS_DENIED if journal cannot be written
+ */
+file_error_t journal_record_done(
+  Journal* journal,         /*!< [inout] Opened journal */
+  const char* source_path,  /*!< [in]    Source of operation */
+  const char* target_path,  /*!< [in]    Created target, `NULL` for deletion */
+  journal_action_t action   /*!< [in]    Completed operation */
+);
+
+/**
+ * @brief Record start of commit, after which transaction can only be
+ * finished, and flush journal to disk if `is_durable` is nonzero
+ *
+ * @return FERR_NONE on success,
+ *         FERR_ACCESS_DENIED if journal cannot be written
+ */
+file_error_t journal_record_commit(Journal* journal, int is_durable);
+
+#endif /* Journal.h */
@@ -0,0 +1,285 @@
+#include "Manifest.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "Common/Panic.h"
+
+#define MANIFEST_NAME "/.corgi-manifest"
+#define MANIFEST_MAGIC "CORGIM01"
+#define TEMP_SUFFIX ".tmp"
+
+enum {
+  MAGIC_LENGTH = sizeof(MANIFEST_MAGIC) - 1
+};
+
+/* Manifest file starts with header followed by sorted array of identities */
+typedef struct {
+  char magic[MAGIC_LENGTH];
+  uint64_t entry_count;
+  uint64_t imported_count;  /* Continues numbering of imported files */
+} ManifestHeader;
+
+static int compare_identities(const void* lhs_ptr, const void* rhs_ptr) {
+  const FileIdentity* lhs = (const FileIdentity*) lhs_ptr;
+  const FileIdentity* rhs = (const FileIdentity*) rhs_ptr;
+
+  if (lhs->device != rhs->device) {
+    return lhs->device < rhs->device ? -1 : 1;
+  }
+  if (lhs->inode != rhs->inode) {
+    return lhs->inode < rhs->inode ? -1 : 1;
+  }
+  if (lhs->size != rhs->size) {
+    return lhs->size < rhs->size ? -1 : 1;
+  }
+  if (lhs->mtime != rhs->mtime) {
+    return lhs->mtime < rhs->mtime ? -1 : 1;
+  }
+  return 0;
+}
+
+static int read_all(int fd, void* buffer, size_t size) {
+  char* data = (char*) buffer;
+  while (size > 0) {
+    ssize_t count = read(fd, data, size);
+    if (count < 0 && errno == EINTR) {
+      continue;
+    }
+    if (count <= 0) {
+      return -1;
+    }
+    data += count;
+    size -= (size_t) count;
+  }
+  return 0;
+}
+
+static int write_all(int fd, const void* buffer, size_t size) {
+  const char* data = (const char*) buffer;
+  while (size > 0) {
+    ssize_t written = write(fd, data, size);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    data += written;
+    size -= (size_t) written;
+  }
+  return 0;
+}
+
+static file_error_t read_manifest(ImportManifest* manifest, int fd) {
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    return FERR_ACCESS_DENIED;
+  }
+
+  ManifestHeader header;
+  if ((size_t) st.st_size < sizeof(header)
+      || read_all(fd, &header, sizeof(header)) != 0
+      || memcmp(header.magic, MANIFEST_MAGIC, MAGIC_LENGTH) != 0) {
+    return FERR_INVALID_VALUE;
+  }
+  size_t data_size = (size_t) st.st_size - sizeof(header);
+  if (data_size % sizeof(FileIdentity) != 0
+      || data_size / sizeof(FileIdentity) != header.entry_count) {
+    return FERR_INVALID_VALUE;
+  }
+  manifest->imported_count = (size_t) header.imported_count;
+  if (header.entry_count == 0) {
+    return FERR_NONE;
+  }
+
+  manifest->entries = (FileIdentity*) malloc(data_size);
+  PANIC_ON_BAD_ALLOC(manifest->entries);
+  manifest->entry_count = (size_t) header.entry_count;
+  if (read_all(fd, manifest->entries, data_size) != 0) {
+    return FERR_ACCESS_DENIED;
+  }
+
+  /* Lookup relies on order, so damaged manifest must not be used */
+  for (size_t i = 1; i < manifest->entry_count; ++i) {
+    if (compare_identities(&manifest->entries[i - 1], &manifest->entries[i]) >= 0) {
+      return FERR_INVALID_VALUE;
+    }
+  }
+  return FERR_NONE;
+}
+
+file_error_t manifest_load(ImportManifest* manifest, const char* directory) {
+  PANIC_IF_NULL(manifest);
+  PANIC_IF_NULL(directory);
+
+  size_t directory_length = strlen(directory);
+  manifest->path = (char*) calloc(directory_length + sizeof(MANIFEST_NAME), 1);
+  PANIC_ON_BAD_ALLOC(manifest->path);
+  memcpy(manifest->path, directory, directory_length);
+  memcpy(manifest->path + directory_length, MANIFEST_NAME, sizeof(MANIFEST_NAME));
+  manifest->imported_count = 0;
+  manifest->entries = NULL;
+  manifest->entry_count = 0;
+  manifest->added = NULL;
+  manifest->added_count = 0;
+  manifest->added_capacity = 0;
+
+  int fd = open(manifest->path, O_RDONLY);
+  if (fd < 0) {
+    if (errno == ENOENT) {
+      return FERR_NONE;
+    }
+    manifest_cleanup(manifest);
+    return FERR_ACCESS_DENIED;
+  }
+
+  file_error_t result = read_manifest(manifest, fd);
+  close(fd);
+  if (result != FERR_NONE) {
+    manifest_cleanup(manifest);
+  }
+  return result;
+}
+
+void manifest_cleanup(ImportManifest* manifest) {
+  PANIC_IF_NULL(manifest);
+
+  free(manifest->path);
+  free(manifest->entries);
+  free(manifest->added);
+  manifest->path = NULL;
+  manifest->entries = NULL;
+  manifest->entry_count = 0;
+  manifest->added = NULL;
+  manifest->added_count = 0;
+  manifest->added_capacity = 0;
+}
+
+int manifest_contains(const ImportManifest* manifest, const FileIdentity* identity) {
+  PANIC_IF_NULL(manifest);
+  PANIC_IF_NULL(identity);
+
+  if (manifest->entry_count == 0) {
+    return 0;
+  }
+  return bsearch(identity, manifest->entries, manifest->entry_count,
+                 sizeof(*manifest->entries), compare_identities) != NULL;
+}
+
+void manifest_add(ImportManifest* manifest, const FileIdentity* identity) {
+  PANIC_IF_NULL(manifest);
+  PANIC_IF_NULL(identity);
+
+  if (manifest->added_count == manifest->added_capacity) {
+    size_t capacity = manifest->added_capacity > 0 ? 2 * manifest->added_capacity : 64;
+    FileIdentity* added = (FileIdentity*) realloc(manifest->added,
+                                                  capacity * sizeof(*added));
+    PANIC_ON_BAD_ALLOC(added);
+    manifest->added = added;
+    manifest->added_capacity = capacity;
+  }
+  manifest->added[manifest->added_count++] = *identity;
+  manifest->imported_count++;
+}
+
+/* Merge sorted loaded identities with added ones, dropping duplicates */
+static size_t merge_identities(const ImportManifest* manifest, FileIdentity* merged) {
+  size_t count = 0;
+  size_t loaded_pos = 0;
+  size_t added_pos = 0;
+
+  while (loaded_pos < manifest->entry_count || added_pos < manifest->added_count) {
+    const FileIdentity* next = NULL;
+    if (added_pos == manifest->added_count) {
+      next = &manifest->entries[loaded_pos++];
+    } else if (loaded_pos == manifest->entry_count) {
+      next = &manifest->added[added_pos++];
+    } else {
+      int order = compare_identities(&manifest->entries[loaded_pos],
+                                     &manifest->added[added_pos]);
+      next = order <= 0 ? &manifest->entries[loaded_pos++]
+                        : &manifest->added[added_pos++];
+    }
+
+    if (count == 0 || compare_identities(&merged[count - 1], next) != 0) {
+      merged[count++] = *next;
+    }
+  }
+  return count;
+}
+
+static file_error_t write_manifest(
+  const char* path,
+  const FileIdentity* entries,
+  size_t entry_count,
+  size_t imported_count
+) {
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return FERR_ACCESS_DENIED;
+  }
+
+  ManifestHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, MANIFEST_MAGIC, MAGIC_LENGTH);
+  header.entry_count = (uint64_t) entry_count;
+  header.imported_count = (uint64_t) imported_count;
+
+  int failed = write_all(fd, &header, sizeof(header)) != 0
+            || write_all(fd, entries, entry_count * sizeof(*entries)) != 0
+            || fsync(fd) != 0;
+  if (close(fd) != 0) {
+    failed = 1;
+  }
+  return failed ? FERR_ACCESS_DENIED : FERR_NONE;
+}
+
+file_error_t manifest_save(ImportManifest* manifest) {
+  PANIC_IF_NULL(manifest);
+  PANIC_IF_NULL(manifest->path);
+
+  if (manifest->added_count > 0) {
+    qsort(manifest->added, manifest->added_count, sizeof(*manifest->added),
+          compare_identities);
+  }
+
+  size_t max_count = manifest->entry_count + manifest->added_count;
+  FileIdentity* merged = (FileIdentity*) malloc((max_count > 0 ? max_count : 1)
+                                                * sizeof(*merged));
+  PANIC_ON_BAD_ALLOC(merged);
+  size_t merged_count = merge_identities(manifest, merged);
+
+  /* Write next to manifest and rename, so that readers see either version */
+  size_t path_length = strlen(manifest->path);
+  char* temp_path = (char*) calloc(path_length + sizeof(TEMP_SUFFIX), 1);
+  PANIC_ON_BAD_ALLOC(temp_path);
+  memcpy(temp_path, manifest->path, path_length);
+  memcpy(temp_path + path_length, TEMP_SUFFIX, sizeof(TEMP_SUFFIX));
+
+  file_error_t result = write_manifest(temp_path, merged, merged_count,
+                                       manifest->imported_count);
+  if (result == FERR_NONE && rename(temp_path, manifest->path) != 0) {
+    result = FERR_ACCESS_DENIED;
+  }
+  if (result != FERR_NONE) {
+    unlink(temp_path);
+    free(merged);
+    free(temp_path);
+    return result;
+  }
+  free(temp_path);
+
+  free(manifest->entries);
+  manifest->entries = merged;
+  manifest->entry_count = merged_count;
+  manifest->added_count = 0;
+  return FERR_NONE;
+}
@@ -0,0 +1,72 @@
+/**
+ * @file Manifest.h
+ * @author MeerkatBoss (solodovnikov.ia@phystech.su)
+ *
+ * @brief Persistent set of already imported source files
+ *
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright MeerkatBoss (c) 2026
+ */
+#ifndef __FILES_MANIFEST_H
+#define __FILES_MANIFEST_H
+
+#include <stddef.h>
+
+#include "Files/Error.h"
+#include "Files/File.h"
+
+/**
+ * @brief Identities of imported files, stored in a binary file sorted by
+ * device, inode, size and modification time
+ */
+typedef struct {
+  char* path;               /*!< Manifest file path (allocated) */
+  size_t imported_count;    /*!< Number of files imported so far, including added ones */
+
+  FileIdentity* entries;    /*!< Loaded identities, sorted */
+  size_t entry_count;       /*!< Number of loaded identities */
+
+  FileIdentity* added;      /*!< Identities added since manifest was loaded */
+  size_t added_count;       /*!< Number of added identities */
+  size_t added_capacity;    /*!< Capacity of `added` */
+} ImportManifest;
+
+/**
+ * @brief Load manifest of target `directory`. Missing manifest is loaded as
+ * empty one.
+ *
+ * @return FERR_NONE on success,
+ *         FERR_INVALID_VALUE if manifest file is damaged,
+ *         FERR_ACCESS_DENIED if manifest file cannot be read
+ */
+file_error_t manifest_load(ImportManifest* manifest, const char* directory);
+
+/**
+ * @brief Free resources used by manifest without saving it
+ */
+void manifest_cleanup(ImportManifest* manifest);
+
+/**
+ * @brief Check whether file with `identity` was recorded in loaded manifest.
+ * Takes logarithmic time, can be called from several threads at once.
+ */
+int manifest_contains(const ImportManifest* manifest, const FileIdentity* identity);
+
+/**
+ * @brief Record file with `identity` as imported and count it in
+ * `imported_count`. Added files are stored by `manifest_save()`.
+ */
+void manifest_add(ImportManifest* manifest, const FileIdentity* identity);
+
+/**
+ * @brief Merge added files into manifest and replace manifest file
+ * atomically, so that interrupted save keeps previous manifest intact.
+ *
+ * @return FERR_NONE on success,
+ *         FERR_ACCESS_DENIED if manifest cannot be written
+ */
+file_error_t manifest_save(ImportManifest* manifest);
+
+#endif /* Manifest.h */
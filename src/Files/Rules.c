@@ -0,0 +1,508 @@
+#include "Rules.h"
+
+#include <errno.h>
+#include <fnmatch.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Common/Panic.h"
+
+enum {
+  SECONDS_PER_DAY = 24 * 60 * 60,
+  INITIAL_RULE_CAPACITY = 8
+};
+
+#define WHITESPACE " \t\r\n"
+
+/* Reported to caller as `RuleError` */
+typedef struct {
+  file_error_t result;
+  const char* message;
+} ParseError;
+
+static int parse_failed(ParseError* error, file_error_t result, const char* message) {
+  error->result = result;
+  error->message = message;
+  return -1;
+}
+
+/* Find position of `extension` in alphabetical order, or where it should be */
+static unsigned find_extension(const RuleSet* rules, const char* extension, int* is_found) {
+  unsigned low = 0;
+  unsigned high = rules->extension_count;
+  while (low < high) {
+    unsigned middle = low + (high - low) / 2;
+    int cmp = strcmp(rules->extensions[rules->sorted_extensions[middle]], extension);
+    if (cmp == 0) {
+      *is_found = 1;
+      return middle;
+    }
+    if (cmp < 0) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  *is_found = 0;
+  return low;
+}
+
+static int intern_extension(RuleSet* rules, const char* extension, unsigned* id) {
+  int is_found = 0;
+  unsigned position = find_extension(rules, extension, &is_found);
+  if (is_found) {
+    *id = rules->sorted_extensions[position];
+    return 0;
+  }
+  if (rules->extension_count == RULE_MAX_EXTENSIONS) {
+    return -1;
+  }
+
+  unsigned new_id = rules->extension_count;
+  strcpy(rules->extensions[new_id], extension);
+  memmove(&rules->sorted_extensions[position + 1], &rules->sorted_extensions[position],
+          (rules->extension_count - position) * sizeof(*rules->sorted_extensions));
+  rules->sorted_extensions[position] = new_id;
+  rules->extension_count++;
+
+  *id = new_id;
+  return 0;
+}
+
+/* Copy lowercase extension of `length` characters, return -1 if it does not fit */
+static int normalize_extension(const char* extension, size_t length, char* buffer) {
+  if (length == 0 || length >= RULE_EXTENSION_BUFSIZE) {
+    return -1;
+  }
+  for (size_t i = 0; i < length; ++i) {
+    char ch = extension[i];
+    buffer[i] = ('A' <= ch && ch <= 'Z') ? (char) (ch - 'A' + 'a') : ch;
+  }
+  buffer[length] = '\0';
+  return 0;
+}
+
+static int parse_extensions(RuleSet* rules, Rule* rule, const char* list, ParseError* error) {
+  if (rule->extensions != 0) {
+    return parse_failed(error, FERR_INVALID_VALUE, "extensions are given twice");
+  }
+
+  while (*list != '\0') {
+    size_t length = strcspn(list, ",");
+    const char* extension = list;
+    if (length > 0 && extension[0] == '.') {
+      extension++;
+      length--;
+    }
+
+    char buffer[RULE_EXTENSION_BUFSIZE];
+    if (normalize_extension(extension, length, buffer) != 0) {
+      return parse_failed(error, FERR_INVALID_VALUE, "extension is empty or too long");
+    }
+    unsigned id = 0;
+    if (intern_extension(rules, buffer, &id) != 0) {
+      return parse_failed(error, FERR_INVALID_OPERATION, "too many distinct extensions");
+    }
+    rule->extensions |= (uint64_t) 1 << id;
+
+    list += length;
+    if (*list == ',') {
+      list++;
+    }
+  }
+
+  if (rule->extensions == 0) {
+    return parse_failed(error, FERR_INVALID_VALUE, "extension list is empty");
+  }
+  return 0;
+}
+
+/* Parse number of bytes, optionally followed by B, K, M or G */
+static int parse_size(const char* value, int64_t* size) {
+  if (value[0] < '0' || value[0] > '9') {
+    return -1;
+  }
+
+  char* end = NULL;
+  errno = 0;
+  unsigned long long number = strtoull(value, &end, 10);
+  if (errno != 0) {
+    return -1;
+  }
+
+  unsigned shift = 0;
+  switch (*end) {
+  case '\0':
+  case 'B':
+  case 'b':
+    break;
+  case 'K':
+  case 'k':
+    shift = 10;
+    break;
+  case 'M':
+  case 'm':
+    shift = 20;
+    break;
+  case 'G':
+  case 'g':
+    shift = 30;
+    break;
+  default:
+    return -1;
+  }
+  if (*end != '\0' && *(end + 1) != '\0') {
+    return -1;
+  }
+  if (number > ((unsigned long long) INT64_MAX >> shift)) {
+    return -1;
+  }
+
+  *size = (int64_t) (number << shift);
+  return 0;
+}
+
+static int parse_size_condition(Rule* rule, const char* condition, ParseError* error) {
+  size_t operator_length = strspn(condition, "<>=");
+  int64_t size = 0;
+  if (operator_length == 0 || parse_size(condition + operator_length, &size) != 0) {
+    return parse_failed(error, FERR_INVALID_VALUE, "size condition must be like 'size>=10M'");
+  }
+
+  int64_t min_size = 0;
+  int64_t max_size = INT64_MAX;
+  if (operator_length == 2 && strncmp(condition, ">=", 2) == 0) {
+    min_size = size;
+  } else if (operator_length == 2 && strncmp(condition, "<=", 2) == 0) {
+    max_size = size;
+  } else if (operator_length == 1 && condition[0] == '>') {
+    /* No file is larger than the largest size */
+    min_size = size < INT64_MAX ? size + 1 : size;
+    max_size = size < INT64_MAX ? INT64_MAX : -1;
+  } else if (operator_length == 1 && condition[0] == '<') {
+    max_size = size - 1;
+  } else if (operator_length == 1 && condition[0] == '=') {
+    min_size = size;
+    max_size = size;
+  } else {
+    return parse_failed(error, FERR_INVALID_VALUE, "unknown size comparison");
+  }
+
+  /* Conditions of one rule narrow the range */
+  if (min_size > rule->min_size) {
+    rule->min_size = min_size;
+  }
+  if (max_size < rule->max_size) {
+    rule->max_size = max_size;
+  }
+  return 0;
+}
+
+/* Number of days from 1970-01-01 to given date of proleptic Gregorian calendar */
+static int64_t days_from_civil(int64_t year, unsigned month, unsigned day) {
+  year -= month <= 2;
+  int64_t era = (year >= 0 ? year : year - 399) / 400;
+  unsigned year_of_era = (unsigned) (year - era * 400);
+  unsigned day_of_year = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+  unsigned day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+  return era * 146097 + (int64_t) day_of_era - 719468;
+}
+
+/* Parse date as start of its day in UTC */
+static int parse_date(const char* value, int64_t* timestamp) {
+  static const unsigned DaysInMonth[] = {31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+
+  unsigned year = 0;
+  unsigned month = 0;
+  unsigned day = 0;
+  int length = 0;
+  if (strlen(value) != 10
+      || sscanf(value, "%4u-%2u-%2u%n", &year, &month, &day, &length) != 3
+      || length != 10) {
+    return -1;
+  }
+  if (month < 1 || month > 12 || day < 1 || day > DaysInMonth[month - 1]) {
+    return -1;
+  }
+  int is_leap = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+  if (month == 2 && day == 29 && !is_leap) {
+    return -1;
+  }
+
+  *timestamp = days_from_civil(year, month, day) * SECONDS_PER_DAY;
+  return 0;
+}
+
+static int parse_condition(RuleSet* rules, Rule* rule, const char* condition, ParseError* error) {
+  if (strncmp(condition, "ext=", 4) == 0) {
+    return parse_extensions(rules, rule, condition + 4, error);
+  }
+  if (strncmp(condition, "name=", 5) == 0) {
+    if (rule->name_pattern != NULL) {
+      return parse_failed(error, FERR_INVALID_VALUE, "name pattern is given twice");
+    }
+    if (condition[5] == '\0') {
+      return parse_failed(error, FERR_INVALID_VALUE, "name pattern is empty");
+    }
+    rule->name_pattern = arena_copy_string(&rules->storage, condition + 5);
+    return 0;
+  }
+  if (strncmp(condition, "size", 4) == 0) {
+    return parse_size_condition(rule, condition + 4, error);
+  }
+
+  int64_t timestamp = 0;
+  if (strncmp(condition, "after=", 6) == 0) {
+    if (parse_date(condition + 6, &timestamp) != 0) {
+      return parse_failed(error, FERR_INVALID_VALUE, "date must be like '2024-12-31'");
+    }
+    if (timestamp > rule->min_timestamp) {
+      rule->min_timestamp = timestamp;
+    }
+    return 0;
+  }
+  if (strncmp(condition, "before=", 7) == 0) {
+    if (parse_date(condition + 7, &timestamp) != 0) {
+      return parse_failed(error, FERR_INVALID_VALUE, "date must be like '2024-12-31'");
+    }
+    if (timestamp - 1 < rule->max_timestamp) {
+      rule->max_timestamp = timestamp - 1;
+    }
+    return 0;
+  }
+
+  return parse_failed(error, FERR_INVALID_VALUE, "unknown condition");
+}
+
+static int parse_action(const char* name, file_action_t* action) {
+  if (strcmp(name, "copy") == 0) {
+    *action = FACT_COPY;
+  } else if (strcmp(name, "move") == 0) {
+    *action = FACT_MOVE;
+  } else if (strcmp(name, "ignore") == 0) {
+    *action = FACT_IGNORE;
+  } else if (strcmp(name, "delete") == 0) {
+    *action = FACT_DELETE;
+  } else {
+    return -1;
+  }
+  return 0;
+}
+
+static int parse_tag(Rule* rule, const char* tag, ParseError* error) {
+  if (!file_tag_is_valid(tag)) {
+    return parse_failed(error, FERR_INVALID_VALUE,
+                        "tag contains invalid characters (only lowercase letters and '-' allowed)");
+  }
+  unsigned id = 0;
+  if (tag_dictionary_intern(tag, &id) != FERR_NONE) {
+    return parse_failed(error, FERR_INVALID_OPERATION, "too many distinct tags");
+  }
+  rule->tags |= (tag_set_t) 1 << id;
+  if (tag_set_count(rule->tags) > FILE_MAX_TAGS) {
+    return parse_failed(error, FERR_INVALID_OPERATION,
+                        "maximum number of tags exceeded (limit: 8 tags per file)");
+  }
+  return 0;
+}
+
+static Rule* add_rule(RuleSet* rules) {
+  if (rules->rule_count == rules->rule_capacity) {
+    size_t capacity = rules->rule_capacity == 0 ? INITIAL_RULE_CAPACITY
+                                                : 2 * rules->rule_capacity;
+    Rule* grown = (Rule*) realloc(rules->rules, capacity * sizeof(*grown));
+    PANIC_ON_BAD_ALLOC(grown);
+    rules->rules = grown;
+    rules->rule_capacity = capacity;
+  }
+
+  Rule* rule = &rules->rules[rules->rule_count];
+  memset(rule, 0, sizeof(*rule));
+  rule->min_size = 0;
+  rule->max_size = INT64_MAX;
+  rule->min_timestamp = INT64_MIN;
+  rule->max_timestamp = INT64_MAX;
+  rule->action = FACT_COPY;
+  return rule;
+}
+
+/* Compile rule from a line of rules file; line is split into words in place */
+static int parse_rule(RuleSet* rules, char* line, ParseError* error) {
+  Rule* rule = add_rule(rules);
+  int has_arrow = 0;
+  int has_action = 0;
+
+  char* word = line + strspn(line, WHITESPACE);
+  while (*word != '\0') {
+    size_t length = strcspn(word, WHITESPACE);
+    char* next = word + length;
+    if (*next != '\0') {
+      *next++ = '\0';
+    }
+    next += strspn(next, WHITESPACE);
+
+    int status = 0;
+    if (!has_arrow && strcmp(word, "->") == 0) {
+      has_arrow = 1;
+    } else if (!has_arrow) {
+      status = parse_condition(rules, rule, word, error);
+    } else if (!has_action) {
+      if (parse_action(word, &rule->action) != 0) {
+        status = parse_failed(error, FERR_INVALID_VALUE,
+                              "action must be one of: copy, move, ignore, delete");
+      }
+      has_action = 1;
+    } else {
+      status = parse_tag(rule, word, error);
+    }
+    if (status != 0) {
+      return status;
+    }
+
+    word = next;
+  }
+
+  if (!has_arrow || !has_action) {
+    return parse_failed(error, FERR_INVALID_VALUE, "rule must end with '-> ACTION [TAG...]'");
+  }
+  rules->rule_count++;
+  return 0;
+}
+
+static int is_blank_or_comment(const char* line) {
+  line += strspn(line, WHITESPACE);
+  return *line == '\0' || *line == '#';
+}
+
+file_error_t rule_set_load(RuleSet* rules, const char* path, RuleError* error) {
+  PANIC_IF_NULL(rules);
+  PANIC_IF_NULL(path);
+  PANIC_IF_NULL(error);
+
+  memset(rules, 0, sizeof(*rules));
+  arena_init(&rules->storage);
+  error->line = 0;
+  error->message = NULL;
+
+  FILE* file = fopen(path, "r");
+  if (file == NULL) {
+    error->message = "cannot open file";
+    return FERR_ACCESS_DENIED;
+  }
+
+  file_error_t result = FERR_NONE;
+  char line[RULE_LINE_BUFSIZE];
+  size_t line_number = 0;
+  while (fgets(line, sizeof(line), file) != NULL) {
+    line_number++;
+    size_t length = strlen(line);
+    if (length == sizeof(line) - 1 && line[length - 1] != '\n' && !feof(file)) {
+      error->line = line_number;
+      error->message = "line is too long";
+      result = FERR_INVALID_VALUE;
+      break;
+    }
+    if (is_blank_or_comment(line)) {
+      continue;
+    }
+
+    ParseError parse_error = {FERR_NONE, NULL};
+    if (parse_rule(rules, line, &parse_error) != 0) {
+      error->line = line_number;
+      error->message = parse_error.message;
+      result = parse_error.result;
+      break;
+    }
+  }
+  if (result == FERR_NONE && ferror(file)) {
+    error->message = "cannot read file";
+    result = FERR_ACCESS_DENIED;
+  }
+
+  fclose(file);
+  if (result != FERR_NONE) {
+    rule_set_cleanup(rules);
+  }
+  return result;
+}
+
+void rule_set_cleanup(RuleSet* rules) {
+  if (rules == NULL) {
+    return;
+  }
+
+  free(rules->rules);
+  arena_destroy(&rules->storage);
+  memset(rules, 0, sizeof(*rules));
+}
+
+/* Get set with ID of extension of file `name`, or empty set if no rule uses it */
+static uint64_t extension_set(const RuleSet* rules, const char* name) {
+  const char* dot = strrchr(name, '.');
+  /* Leading dot marks hidden file, not extension */
+  if (dot == NULL || dot == name) {
+    return 0;
+  }
+
+  char buffer[RULE_EXTENSION_BUFSIZE];
+  if (normalize_extension(dot + 1, strlen(dot + 1), buffer) != 0) {
+    return 0;
+  }
+  int is_found = 0;
+  unsigned position = find_extension(rules, buffer, &is_found);
+  return is_found ? (uint64_t) 1 << rules->sorted_extensions[position] : 0;
+}
+
+static const Rule* find_rule(
+  const RuleSet* rules,
+  const char* name,
+  uint64_t extension,
+  int64_t size,
+  int64_t timestamp
+) {
+  for (size_t i = 0; i < rules->rule_count; ++i) {
+    const Rule* rule = &rules->rules[i];
+    if (rule->extensions != 0 && (rule->extensions & extension) == 0) {
+      continue;
+    }
+    if (size < rule->min_size || size > rule->max_size
+        || timestamp < rule->min_timestamp || timestamp > rule->max_timestamp) {
+      continue;
+    }
+    /* Pattern is the most expensive condition, so it is checked last */
+    if (rule->name_pattern != NULL && fnmatch(rule->name_pattern, name, 0) != 0) {
+      continue;
+    }
+    return rule;
+  }
+  return NULL;
+}
+
+file_error_t rule_set_apply(const RuleSet* rules, FileIndex* index) {
+  PANIC_IF_NULL(rules);
+  PANIC_IF_NULL(index);
+
+  FILE_INDEX_FOREACH(row, *index) {
+    const char* path = file_index_path(index, row);
+    const char* slash = strrchr(path, '/');
+    const char* name = slash != NULL ? slash + 1 : path;
+
+    uint64_t extension = rules->extension_count > 0 ? extension_set(rules, name) : 0;
+    const Rule* rule = find_rule(rules, name, extension, index->identities[row].size,
+                                 (int64_t) index->name_timestamps[row]);
+    if (rule == NULL) {
+      index->actions[row] = FACT_COPY;
+      continue;
+    }
+
+    tag_set_t tags = index->tags[row] | rule->tags;
+    if (tag_set_count(tags) > FILE_MAX_TAGS) {
+      return FERR_INVALID_OPERATION;
+    }
+    index->tags[row] = tags;
+    index->actions[row] = rule->action;
+  }
+
+  return FERR_NONE;
+}
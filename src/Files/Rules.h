@@ -0,0 +1,112 @@
+/**
+ * @file Rules.h
+ * @author MeerkatBoss (solodovnikov.ia@phystech.su)
+ *
+ * @brief Rules deciding action and extra tags of every indexed file
+ *
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright MeerkatBoss (c) 2026
+ */
+#ifndef __FILES_RULES_H
+#define __FILES_RULES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "Common/Arena.h"
+#include "Files/Error.h"
+#include "Files/File.h"
+#include "Files/Index.h"
+#include "Files/Tags.h"
+
+enum {
+  RULE_MAX_EXTENSIONS = 64,     /*!< Maximum number of distinct extensions in rules */
+  RULE_EXTENSION_BUFSIZE = 16,  /*!< Size of buffer for extension, with terminating null */
+  RULE_LINE_BUFSIZE = 4096      /*!< Size of buffer for a line of rules file */
+};
+
+/**
+ * @brief Row of decision table. File matches rule if it matches all of its
+ * conditions; ranges are inclusive.
+ */
+typedef struct {
+  uint64_t extensions;      /*!< Bit `id` is set for every matching extension, 0 to match any */
+  const char* name_pattern; /*!< Glob matched against file name, NULL to match any */
+  int64_t min_size;         /*!< Smallest matching file size in bytes */
+  int64_t max_size;         /*!< Largest matching file size in bytes */
+  int64_t min_timestamp;    /*!< Earliest matching timestamp of file name */
+  int64_t max_timestamp;    /*!< Latest matching timestamp of file name */
+
+  file_action_t action;     /*!< Action of matching files */
+  tag_set_t tags;           /*!< Tags added to matching files */
+} Rule;
+
+/**
+ * @brief Rules compiled into a decision table.
+ *
+ * @note
+ * Rules file has one rule per line, in the form
+ * `CONDITION... -> ACTION [TAG...]`, where action is one of `copy`, `move`,
+ * `ignore` and `delete`. Conditions are:
+ *  - `ext=EXT[,EXT...]` - extension of file, case-insensitive;
+ *  - `name=GLOB` - shell pattern matched against file name;
+ *  - `size>=SIZE`, `size>SIZE`, `size<=SIZE`, `size<SIZE`, `size=SIZE` -
+ *    size of file, in bytes or with B, K, M or G suffix;
+ *  - `after=YYYY-MM-DD`, `before=YYYY-MM-DD` - date of file name (UTC) is
+ *    this date or later, or earlier than this date.
+ *
+ * Rule without conditions matches every file. Empty lines and lines starting
+ * with `#` are skipped. The first matching rule decides; files matching no
+ * rule are copied. Extensions are interned into IDs, so that every rule
+ * checks extension of file with a single bitwise AND.
+ */
+typedef struct {
+  Rule* rules;              /*!< Rules in order of rules file */
+  size_t rule_count;
+  size_t rule_capacity;
+
+  char extensions[RULE_MAX_EXTENSIONS][RULE_EXTENSION_BUFSIZE]; /*!< Extensions by ID */
+  unsigned sorted_extensions[RULE_MAX_EXTENSIONS];  /*!< IDs in alphabetical order of extensions */
+  unsigned extension_count;
+
+  Arena storage;            /*!< Copies of name patterns */
+} RuleSet;
+
+/**
+ * @brief Description of invalid rules file
+ */
+typedef struct {
+  size_t line;              /*!< Line with invalid rule, 0 if file cannot be read */
+  const char* message;      /*!< Description of the problem */
+} RuleError;
+
+/**
+ * @brief Read rules from file at `path` and compile them. Tags of rules are
+ * interned in tag dictionary.
+ *
+ * @warning Must not be called while other threads use tag dictionary
+ *
+ * @return FERR_NONE on success,
+ *         FERR_INVALID_VALUE if a rule is invalid,
+ *         FERR_INVALID_OPERATION if rules use too many extensions or tags,
+ *         FERR_ACCESS_DENIED if file cannot be read
+ */
+file_error_t rule_set_load(RuleSet* rules, const char* path, RuleError* error);
+
+/**
+ * @brief Free memory used by rules
+ */
+void rule_set_cleanup(RuleSet* rules);
+
+/**
+ * @brief Set action of every file in index and add tags of the first rule
+ * it matches, in a single pass over index
+ *
+ * @return FERR_NONE on success,
+ *         FERR_INVALID_OPERATION if a file would have more than FILE_MAX_TAGS tags
+ */
+file_error_t rule_set_apply(const RuleSet* rules, FileIndex* index);
+
+#endif /* Rules.h */
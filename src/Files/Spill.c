@@ -0,0 +1,426 @@
+#if defined(__linux__)
+#define _GNU_SOURCE /* mkdtemp() */
+#endif
+
+#include "Spill.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "Common/Panic.h"
+
+#define SPILL_DIRECTORY_TEMPLATE "/corgi-spill-XXXXXX"
+
+/* Run is a sequence of records, each followed by path of file */
+typedef struct {
+  int64_t timestamp;
+  FileIdentity identity;
+  uint64_t path_length;
+} RunRecord;
+
+void file_spill_init(FileSpill* spill, size_t memory_limit) {
+  PANIC_IF_NULL(spill);
+
+  memset(spill, 0, sizeof(*spill));
+  spill->memory_limit = memory_limit;
+  spill->error = FERR_NONE;
+  file_index_init(&spill->buffer);
+  pthread_mutex_init(&spill->lock, NULL);
+}
+
+static char* run_path(const FileSpill* spill, size_t run) {
+  enum {
+    RUN_NAME_BUFSIZE = 32
+  };
+  size_t size = strlen(spill->directory) + RUN_NAME_BUFSIZE;
+  char* path = (char*) malloc(size);
+  PANIC_ON_BAD_ALLOC(path);
+  snprintf(path, size, "%s/%zu.run", spill->directory, run);
+  return path;
+}
+
+static file_error_t create_spill_directory(FileSpill* spill) {
+  if (spill->directory != NULL) {
+    return FERR_NONE;
+  }
+
+  const char* parent = getenv("TMPDIR");
+  if (parent == NULL || parent[0] == '\0') {
+    parent = "/tmp";
+  }
+  size_t parent_length = strlen(parent);
+  char* directory = (char*) malloc(parent_length + sizeof(SPILL_DIRECTORY_TEMPLATE));
+  PANIC_ON_BAD_ALLOC(directory);
+  memcpy(directory, parent, parent_length);
+  memcpy(directory + parent_length, SPILL_DIRECTORY_TEMPLATE, sizeof(SPILL_DIRECTORY_TEMPLATE));
+
+  if (mkdtemp(directory) == NULL) {
+    free(directory);
+    return FERR_ACCESS_DENIED;
+  }
+  spill->directory = directory;
+  return FERR_NONE;
+}
+
+static int write_record(
+  FILE* file,
+  time_t timestamp,
+  const FileIdentity* identity,
+  const char* path
+) {
+  RunRecord record;
+  memset(&record, 0, sizeof(record));
+  record.timestamp = (int64_t) timestamp;
+  record.identity = *identity;
+  record.path_length = strlen(path);
+
+  if (fwrite(&record, sizeof(record), 1, file) != 1
+      || fwrite(path, 1, record.path_length, file) != record.path_length) {
+    return -1;
+  }
+  return 0;
+}
+
+/* Sort buffered files and write them as a new run, emptying buffer */
+static file_error_t write_buffer(FileSpill* spill) {
+  FileIndex* buffer = &spill->buffer;
+  file_index_sort_by_path(buffer);
+
+  file_error_t result = create_spill_directory(spill);
+  if (result != FERR_NONE) {
+    file_index_truncate(buffer, 0);
+    return result;
+  }
+
+  char* path = run_path(spill, spill->run_count);
+  FILE* file = fopen(path, "wb");
+  free(path);
+  if (file == NULL) {
+    file_index_truncate(buffer, 0);
+    return FERR_ACCESS_DENIED;
+  }
+  spill->run_count++;
+
+  FILE_INDEX_FOREACH(row, *buffer) {
+    if (write_record(file, buffer->timestamps[row], &buffer->identities[row],
+                     file_index_path(buffer, row)) != 0) {
+      result = FERR_ACCESS_DENIED;
+      break;
+    }
+  }
+  if (fclose(file) != 0 && result == FERR_NONE) {
+    result = FERR_ACCESS_DENIED;
+  }
+
+  /* Memory of buffer is reused by the next run */
+  file_index_truncate(buffer, 0);
+  return result;
+}
+
+void file_spill_add(FileSpill* spill, const IndexedFile* file) {
+  PANIC_IF_NULL(spill);
+  PANIC_IF_NULL(file);
+
+  FileMetadata metadata;
+  memset(&metadata, 0, sizeof(metadata));
+  metadata.is_regular = 1;
+  metadata.timestamp = file->real_timestamp;
+  metadata.identity = file->identity;
+
+  pthread_mutex_lock(&spill->lock);
+  file_index_push(&spill->buffer, NULL, file->path, &metadata);
+  spill->file_count++;
+  if (file_index_used_memory(&spill->buffer) >= spill->memory_limit / 2) {
+    file_error_t result = write_buffer(spill);
+    if (spill->error == FERR_NONE) {
+      spill->error = result;
+    }
+  }
+  pthread_mutex_unlock(&spill->lock);
+}
+
+/* Read next record of run, return 1 on success, 0 at end of run, -1 on error */
+static int reader_next(SpillReader* reader) {
+  RunRecord record;
+  if (fread(&record, sizeof(record), 1, reader->file) != 1) {
+    return feof(reader->file) && !ferror(reader->file) ? 0 : -1;
+  }
+
+  if (record.path_length + 1 > reader->path_capacity) {
+    size_t capacity = (size_t) record.path_length + 1;
+    char* path = (char*) realloc(reader->path, capacity);
+    PANIC_ON_BAD_ALLOC(path);
+    reader->path = path;
+    reader->path_capacity = capacity;
+  }
+  if (fread(reader->path, 1, record.path_length, reader->file) != record.path_length) {
+    return -1;
+  }
+  reader->path[record.path_length] = '\0';
+  reader->timestamp = (time_t) record.timestamp;
+  reader->identity = record.identity;
+  return 1;
+}
+
+static int reader_is_before(const SpillReader* lhs, const SpillReader* rhs) {
+  if (lhs->timestamp != rhs->timestamp) {
+    return lhs->timestamp < rhs->timestamp;
+  }
+  return strcmp(lhs->path, rhs->path) < 0;
+}
+
+/* Restore heap order below `position` */
+static void sift_down(FileSpill* spill, size_t position) {
+  size_t* heap = spill->heap;
+  for (;;) {
+    size_t smallest = position;
+    size_t left = 2 * position + 1;
+    size_t right = left + 1;
+    if (left < spill->heap_size
+        && reader_is_before(&spill->readers[heap[left]], &spill->readers[heap[smallest]])) {
+      smallest = left;
+    }
+    if (right < spill->heap_size
+        && reader_is_before(&spill->readers[heap[right]], &spill->readers[heap[smallest]])) {
+      smallest = right;
+    }
+    if (smallest == position) {
+      return;
+    }
+    size_t swapped = heap[position];
+    heap[position] = heap[smallest];
+    heap[smallest] = swapped;
+    position = smallest;
+  }
+}
+
+static void close_runs(FileSpill* spill) {
+  for (size_t i = 0; i < spill->reader_count; ++i) {
+    if (spill->readers[i].file != NULL) {
+      fclose(spill->readers[i].file);
+    }
+    free(spill->readers[i].path);
+  }
+  free(spill->readers);
+  free(spill->heap);
+  spill->readers = NULL;
+  spill->heap = NULL;
+  spill->reader_count = 0;
+  spill->heap_size = 0;
+}
+
+/* Open `count` oldest runs and order them by their first files */
+static file_error_t open_runs(FileSpill* spill, size_t count) {
+  spill->readers = (SpillReader*) calloc(count, sizeof(*spill->readers));
+  PANIC_ON_BAD_ALLOC(spill->readers);
+  spill->heap = (size_t*) calloc(count, sizeof(*spill->heap));
+  PANIC_ON_BAD_ALLOC(spill->heap);
+  spill->reader_count = count;
+  spill->heap_size = 0;
+
+  for (size_t i = 0; i < count; ++i) {
+    char* path = run_path(spill, spill->first_run + i);
+    spill->readers[i].file = fopen(path, "rb");
+    free(path);
+    if (spill->readers[i].file == NULL) {
+      return FERR_ACCESS_DENIED;
+    }
+
+    int status = reader_next(&spill->readers[i]);
+    if (status < 0) {
+      return FERR_ACCESS_DENIED;
+    }
+    if (status > 0) {
+      spill->heap[spill->heap_size++] = i;
+    }
+  }
+
+  for (size_t i = spill->heap_size / 2; i > 0; --i) {
+    sift_down(spill, i - 1);
+  }
+  return FERR_NONE;
+}
+
+/* Replace the first file of merged runs with the next one */
+static file_error_t advance_runs(FileSpill* spill) {
+  int status = reader_next(&spill->readers[spill->heap[0]]);
+  if (status < 0) {
+    return FERR_ACCESS_DENIED;
+  }
+  if (status == 0) {
+    spill->heap[0] = spill->heap[--spill->heap_size];
+  }
+  sift_down(spill, 0);
+  return FERR_NONE;
+}
+
+/* Merge `count` oldest runs into a new one and remove them */
+static file_error_t merge_runs(FileSpill* spill, size_t count) {
+  file_error_t result = open_runs(spill, count);
+
+  char* path = run_path(spill, spill->run_count);
+  FILE* output = fopen(path, "wb");
+  free(path);
+  if (output == NULL) {
+    result = FERR_ACCESS_DENIED;
+  } else {
+    spill->run_count++;
+  }
+
+  while (result == FERR_NONE && spill->heap_size > 0) {
+    const SpillReader* reader = &spill->readers[spill->heap[0]];
+    if (write_record(output, reader->timestamp, &reader->identity, reader->path) != 0) {
+      result = FERR_ACCESS_DENIED;
+      break;
+    }
+    result = advance_runs(spill);
+  }
+  if (output != NULL && fclose(output) != 0 && result == FERR_NONE) {
+    result = FERR_ACCESS_DENIED;
+  }
+  close_runs(spill);
+  if (result != FERR_NONE) {
+    return result;
+  }
+
+  for (size_t i = 0; i < count; ++i) {
+    path = run_path(spill, spill->first_run + i);
+    unlink(path);
+    free(path);
+  }
+  spill->first_run += count;
+  return FERR_NONE;
+}
+
+file_error_t file_spill_finish(FileSpill* spill) {
+  PANIC_IF_NULL(spill);
+
+  if (spill->error != FERR_NONE) {
+    return spill->error;
+  }
+
+  /* Files that fit in memory are never written */
+  if (spill->run_count == 0) {
+    file_index_sort_by_path(&spill->buffer);
+    spill->next_row = 0;
+    return FERR_NONE;
+  }
+
+  if (spill->buffer.file_count > 0) {
+    spill->error = write_buffer(spill);
+    if (spill->error != FERR_NONE) {
+      return spill->error;
+    }
+  }
+  file_index_clear(&spill->buffer);
+
+  while (spill->run_count - spill->first_run > SPILL_MERGE_FAN_IN) {
+    spill->error = merge_runs(spill, SPILL_MERGE_FAN_IN);
+    if (spill->error != FERR_NONE) {
+      return spill->error;
+    }
+  }
+  spill->error = open_runs(spill, spill->run_count - spill->first_run);
+  return spill->error;
+}
+
+/* Check if next file of `size` bytes still fits in window */
+static int window_has_room(
+  const FileSpill* spill,
+  const FileIndex* window,
+  size_t first_count,
+  uint64_t window_bytes,
+  int64_t size,
+  const SpillWindowLimits* limits
+) {
+  size_t count = window->file_count - first_count;
+  /* Window takes at least one file */
+  if (count == 0) {
+    return 1;
+  }
+  if (file_index_used_memory(window) >= spill->memory_limit / 4) {
+    return 0;
+  }
+  if (limits->max_files != 0 && count >= limits->max_files) {
+    return 0;
+  }
+  if (limits->max_bytes != 0 && window_bytes + (uint64_t) size > limits->max_bytes) {
+    return 0;
+  }
+  return 1;
+}
+
+file_error_t file_spill_read(
+  FileSpill* spill,
+  FileIndex* window,
+  const SpillWindowLimits* limits
+) {
+  PANIC_IF_NULL(spill);
+  PANIC_IF_NULL(window);
+  PANIC_IF_NULL(limits);
+
+  size_t first_count = window->file_count;
+  uint64_t window_bytes = 0;
+
+  if (spill->run_count == 0) {
+    while (spill->next_row < spill->buffer.file_count) {
+      const FileIdentity* identity = &spill->buffer.identities[spill->next_row];
+      if (!window_has_room(spill, window, first_count, window_bytes, identity->size, limits)) {
+        break;
+      }
+      FileMetadata metadata;
+      memset(&metadata, 0, sizeof(metadata));
+      metadata.is_regular = 1;
+      metadata.timestamp = spill->buffer.timestamps[spill->next_row];
+      metadata.identity = *identity;
+      file_index_push(window, NULL, file_index_path(&spill->buffer, spill->next_row),
+                      &metadata);
+      window_bytes += (uint64_t) identity->size;
+      spill->next_row++;
+    }
+    return FERR_NONE;
+  }
+
+  while (spill->heap_size > 0) {
+    const SpillReader* reader = &spill->readers[spill->heap[0]];
+    if (!window_has_room(spill, window, first_count, window_bytes, reader->identity.size,
+                         limits)) {
+      break;
+    }
+    FileMetadata metadata;
+    memset(&metadata, 0, sizeof(metadata));
+    metadata.is_regular = 1;
+    metadata.timestamp = reader->timestamp;
+    metadata.identity = reader->identity;
+    file_index_push(window, NULL, reader->path, &metadata);
+    window_bytes += (uint64_t) reader->identity.size;
+
+    file_error_t result = advance_runs(spill);
+    if (result != FERR_NONE) {
+      return result;
+    }
+  }
+  return FERR_NONE;
+}
+
+void file_spill_cleanup(FileSpill* spill) {
+  if (spill == NULL) {
+    return;
+  }
+
+  close_runs(spill);
+  if (spill->directory != NULL) {
+    for (size_t run = spill->first_run; run < spill->run_count; ++run) {
+      char* path = run_path(spill, run);
+      unlink(path);
+      free(path);
+    }
+    rmdir(spill->directory);
+    free(spill->directory);
+    spill->directory = NULL;
+  }
+  file_index_clear(&spill->buffer);
+  pthread_mutex_destroy(&spill->lock);
+}
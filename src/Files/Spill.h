@@ -0,0 +1,120 @@
+/**
+ * @file Spill.h
+ * @author MeerkatBoss (solodovnikov.ia@phystech.su)
+ *
+ * @brief Sorting of found files with bounded memory
+ *
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright MeerkatBoss (c) 2026
+ */
+#ifndef __FILES_SPILL_H
+#define __FILES_SPILL_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "Files/Error.h"
+#include "Files/File.h"
+#include "Files/Index.h"
+
+enum {
+  SPILL_MERGE_FAN_IN = 16 /*!< Maximum number of runs merged at once */
+};
+
+/**
+ * @brief Sorted run being merged
+ */
+typedef struct {
+  FILE* file;             /*!< Run file */
+  time_t timestamp;       /*!< Timestamp of current file */
+  FileIdentity identity;  /*!< Identity of current file */
+  char* path;             /*!< Path of current file (allocated) */
+  size_t path_capacity;   /*!< Capacity of `path` */
+} SpillReader;
+
+/**
+ * @brief Limits of a window read from spill, in addition to memory limit
+ */
+typedef struct {
+  size_t max_files;       /*!< Number of files in window, 0 for no limit */
+  uint64_t max_bytes;     /*!< Total size of files in window, 0 for no limit */
+} SpillWindowLimits;
+
+/**
+ * @brief Files of source directory sorted by timestamp, and by path if
+ * timestamps are equal, without keeping all of them in memory.
+ *
+ * @note
+ * Added files are buffered until they take half of `memory_limit`. Then
+ * buffer is sorted and written to a temporary file, a run. Runs are merged
+ * at most `SPILL_MERGE_FAN_IN` at a time, and files are read back in order
+ * window by window. Runs are kept in a directory created in `$TMPDIR`, or in
+ * `/tmp` if it is not set, until spill is cleaned up. Buffers of open runs
+ * are not counted in `memory_limit`.
+ */
+typedef struct {
+  size_t memory_limit;    /*!< Bytes taken by buffered files and a window, at most */
+  size_t file_count;      /*!< Number of added files */
+
+  FileIndex buffer;       /*!< Files not written to a run yet */
+  size_t next_row;        /*!< Next buffered file to read, if no run was written */
+  pthread_mutex_t lock;   /*!< Protects added files */
+  file_error_t error;     /*!< First failure to write a run */
+
+  char* directory;        /*!< Directory of runs (allocated), NULL until first run */
+  size_t first_run;       /*!< Number of the oldest run not merged yet */
+  size_t run_count;       /*!< Number of runs written, including merged ones */
+
+  SpillReader* readers;   /*!< Runs being merged */
+  size_t reader_count;    /*!< Number of open runs */
+  size_t* heap;          /*!< Readers with remaining files, heap ordered by their files */
+  size_t heap_size;       /*!< Number of readers in `heap` */
+} FileSpill;
+
+/**
+ * @brief Initialize empty spill. With `memory_limit` of `SIZE_MAX` files are
+ * never written to temporary files.
+ */
+void file_spill_init(FileSpill* spill, size_t memory_limit);
+
+/**
+ * @brief Free resources and remove temporary files of spill
+ */
+void file_spill_cleanup(FileSpill* spill);
+
+/**
+ * @brief Add file to spill, writing a run if buffer is full.
+ * Only path, timestamp and identity of file are kept.
+ *
+ * @note Can be called from several threads at once. Failure to write a run
+ *       is reported by `file_spill_finish()`.
+ */
+void file_spill_add(FileSpill* spill, const IndexedFile* file);
+
+/**
+ * @brief Finish adding files and prepare to read them in order
+ *
+ * @return FERR_NONE on success,
+ *         FERR_ACCESS_DENIED if temporary files cannot be written
+ */
+file_error_t file_spill_finish(FileSpill* spill);
+
+/**
+ * @brief Move next files in order to the end of `window`, until files of
+ * window take a quarter of `memory_limit` or reach one of `limits`. At least
+ * one file is moved. Window is left unchanged once all files are read.
+ *
+ * @return FERR_NONE on success,
+ *         FERR_ACCESS_DENIED if temporary files cannot be read
+ */
+file_error_t file_spill_read(
+  FileSpill* spill,
+  FileIndex* window,
+  const SpillWindowLimits* limits
+);
+
+#endif /* Spill.h */
@@ -0,0 +1,103 @@
+#include "Tags.h"
+
+#include <string.h>
+
+#include "Common/Arena.h"
+#include "Common/Panic.h"
+
+/*
+ * IDs are given in order of interning and never change, so that sets stay
+ * valid. Alphabetical order is kept separately as a list of IDs.
+ */
+static struct {
+  Arena storage;                                /* Copies of tag names */
+  const char* names[TAG_DICTIONARY_CAPACITY];   /* Names by ID */
+  unsigned sorted_ids[TAG_DICTIONARY_CAPACITY]; /* IDs in alphabetical order of names */
+  unsigned count;
+} sDictionary;
+
+/* Find position of `tag` in alphabetical order, or where it should be */
+static unsigned find_position(const char* tag, int* is_found) {
+  unsigned low = 0;
+  unsigned high = sDictionary.count;
+  while (low < high) {
+    unsigned middle = low + (high - low) / 2;
+    int cmp = strcmp(sDictionary.names[sDictionary.sorted_ids[middle]], tag);
+    if (cmp == 0) {
+      *is_found = 1;
+      return middle;
+    }
+    if (cmp < 0) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  *is_found = 0;
+  return low;
+}
+
+file_error_t tag_dictionary_intern(const char* tag, unsigned* id) {
+  PANIC_IF_NULL(tag);
+  PANIC_IF_NULL(id);
+
+  int is_found = 0;
+  unsigned position = find_position(tag, &is_found);
+  if (is_found) {
+    *id = sDictionary.sorted_ids[position];
+    return FERR_NONE;
+  }
+  if (sDictionary.count == TAG_DICTIONARY_CAPACITY) {
+    return FERR_INVALID_OPERATION;
+  }
+
+  unsigned new_id = sDictionary.count;
+  sDictionary.names[new_id] = arena_copy_string(&sDictionary.storage, tag);
+  memmove(&sDictionary.sorted_ids[position + 1], &sDictionary.sorted_ids[position],
+          (sDictionary.count - position) * sizeof(*sDictionary.sorted_ids));
+  sDictionary.sorted_ids[position] = new_id;
+  sDictionary.count++;
+
+  *id = new_id;
+  return FERR_NONE;
+}
+
+int tag_dictionary_find(const char* tag, unsigned* id) {
+  PANIC_IF_NULL(tag);
+  PANIC_IF_NULL(id);
+
+  int is_found = 0;
+  unsigned position = find_position(tag, &is_found);
+  if (is_found) {
+    *id = sDictionary.sorted_ids[position];
+  }
+  return is_found;
+}
+
+size_t tag_dictionary_names(tag_set_t tags, size_t max_count, const char* names[]) {
+  PANIC_IF_NULL(names);
+
+  size_t count = 0;
+  for (unsigned i = 0; i < sDictionary.count && tags != 0; ++i) {
+    tag_set_t bit = (tag_set_t) 1 << sDictionary.sorted_ids[i];
+    if ((tags & bit) == 0) {
+      continue;
+    }
+    tags &= ~bit;
+    if (count < max_count) {
+      names[count] = sDictionary.names[sDictionary.sorted_ids[i]];
+    }
+    count++;
+  }
+  return count;
+}
+
+unsigned tag_set_count(tag_set_t tags) {
+  unsigned count = 0;
+  /* Every step clears lowest set bit */
+  while (tags != 0) {
+    tags &= tags - 1;
+    count++;
+  }
+  return count;
+}
@@ -0,0 +1,65 @@
+/**
+ * @file Tags.h
+ * @author MeerkatBoss (solodovnikov.ia@phystech.su)
+ *
+ * @brief Dictionary of interned tags and sets of tags
+ *
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright MeerkatBoss (c) 2026
+ */
+#ifndef __FILES_TAGS_H
+#define __FILES_TAGS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "Files/Error.h"
+
+/**
+ * @brief Set of interned tags, bit `id` is set if tag with this ID is present
+ */
+typedef uint64_t tag_set_t;
+
+enum {
+  TAG_DICTIONARY_CAPACITY = 64 /*!< Maximum number of distinct tags in process */
+};
+
+/**
+ * @brief Get ID of `tag`, adding it to process-wide dictionary if needed.
+ * Tag is copied.
+ *
+ * @warning Must not be called while other threads use the dictionary
+ *
+ * @return FERR_NONE on success,
+ *         FERR_INVALID_OPERATION if dictionary is full
+ */
+file_error_t tag_dictionary_intern(const char* tag, unsigned* id);
+
+/**
+ * @brief Find ID of `tag` without adding it to dictionary
+ *
+ * @return Nonzero if tag was found, zero otherwise
+ */
+int tag_dictionary_find(const char* tag, unsigned* id);
+
+/**
+ * @brief Get names of tags in set in alphabetical order.
+ * Can be called from several threads at once while no tag is interned.
+ *
+ * @return Number of tags in set. If this exceeds `max_count`, returned list
+ *         of names is truncated to fit in buffer.
+ */
+size_t tag_dictionary_names(
+  tag_set_t tags,         /*!< [in]  Set of tags */
+  size_t max_count,       /*!< [in]  Maximum amount of names to store in buffer */
+  const char* names[]     /*!< [out] Buffer for tag names */
+);
+
+/**
+ * @brief Get number of tags in set
+ */
+unsigned tag_set_count(tag_set_t tags);
+
+#endif /* Tags.h */
@@ -1,6 +1,13 @@
+#if defined(__linux__)
+#define _GNU_SOURCE /* syncfs() */
+#endif
+
 #include "Transaction.h"
 
+#include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,8 +16,10 @@
 
 #include "Common/Panic.h"
 #include "Common/Strings.h"
+#include "Files/Copy.h"
 #include "Files/Error.h"
 #include "Files/File.h"
+#include "Files/Uring.h"
 
 static file_error_t create_directory(const char* path) {
   if (path == NULL || path[0] == '\0') {
@@ -74,6 +83,45 @@ quit:
   return result;
 }
 
+static const char* path_name(const char* path) {
+  const char* separator = strrchr(path, '/');
+  return separator != NULL ? separator + 1 : path;
+}
+
+/*
+ * List target directory once, so that collisions are checked without lookup
+ * in a possibly huge directory for every file. Targets of interrupted
+ * transaction are left out, as journal decides whether they are kept.
+ */
+static file_error_t list_target_names(FileTransaction* transaction) {
+  DIR* dir = opendir(transaction->target_directory);
+  if (dir == NULL) {
+    return errno == ENOENT ? FERR_NONE : FERR_ACCESS_DENIED;
+  }
+
+  StringSet journaled;
+  string_set_init(&journaled);
+  for (size_t i = 0; i < transaction->journal.entry_count; ++i) {
+    const char* name = path_name(transaction->journal.entries[i].target_path);
+    string_set_insert(&journaled, name, strlen(name));
+  }
+
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != NULL) {
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+      continue;
+    }
+    size_t length = strlen(entry->d_name);
+    if (!string_set_contains(&journaled, entry->d_name, length)) {
+      string_set_insert(&transaction->target_names, entry->d_name, length);
+    }
+  }
+
+  string_set_destroy(&journaled);
+  closedir(dir);
+  return FERR_NONE;
+}
+
 file_error_t file_transaction_init(
   FileTransaction* transaction,
   const char* target_dir,
@@ -82,12 +130,32 @@ file_error_t file_transaction_init(
   PANIC_IF_NULL(transaction);
   PANIC_IF_NULL(target_dir);
 
-  list_init(&transaction->operations);
+  transaction->operations = NULL;
   transaction->operation_count = 0;
+  transaction->operation_capacity = 0;
   transaction->target_directory = copy_string(target_dir);
+  transaction->staging_pool = NULL;
+  transaction->staging_options = NULL;
+  transaction->staged_count = 0;
+  transaction->staging_failed = 0;
+  pthread_mutex_init(&transaction->staging_lock, NULL);
+  journal_disable(&transaction->journal);
+  string_set_init(&transaction->target_names);
+  file_name_formatter_init(&transaction->name_formatter);
+  memset(&transaction->numbering, 0, sizeof(transaction->numbering));
+  transaction->numbering.first_index = options->first_index;
+  arena_init(&transaction->arena);
+  pthread_mutex_init(&transaction->arena_lock, NULL);
 
   if (options->dry_run) {
-    return FERR_NONE;
+    file_error_t result = list_target_names(transaction);
+    if (result != FERR_NONE) {
+      pthread_mutex_destroy(&transaction->arena_lock);
+      pthread_mutex_destroy(&transaction->staging_lock);
+      free(transaction->target_directory);
+      transaction->target_directory = NULL;
+    }
+    return result;
   }
 
   if (options->verbose) {
@@ -99,7 +167,27 @@ file_error_t file_transaction_init(
     }
   }
   file_error_t result = create_directory(target_dir);
+  if (result == FERR_NONE) {
+    journal_close(&transaction->journal);
+    JournalRecovery recovery;
+    result = journal_open(&transaction->journal, target_dir, &recovery);
+    if (result == FERR_NONE && options->verbose
+        && (recovery.resumable_count > 0 || recovery.rolled_back_count > 0
+            || recovery.rolled_forward_count > 0)) {
+      printf("Recovered interrupted transaction: %zu files to resume, "
+             "%zu removed, %zu sources removed to finish commit\n",
+             recovery.resumable_count, recovery.rolled_back_count,
+             recovery.rolled_forward_count);
+    }
+  }
+  if (result == FERR_NONE) {
+    result = list_target_names(transaction);
+  }
   if (result != FERR_NONE) {
+    string_set_destroy(&transaction->target_names);
+    journal_close(&transaction->journal);
+    pthread_mutex_destroy(&transaction->arena_lock);
+    pthread_mutex_destroy(&transaction->staging_lock);
     free(transaction->target_directory);
     transaction->target_directory = NULL;
     return result;
@@ -113,41 +201,61 @@ static void prepared_operation_cleanup(PreparedOperation* op) {
     return;
   }
 
-  free(op->target_path);
   op->target_path = NULL;
-  op->source_file = NULL;
+  op->source_path = NULL;
   op->state = PREP_STATE_NONE;
 }
 
+static void stop_staging(FileTransaction* transaction) {
+  if (transaction->staging_pool == NULL) {
+    return;
+  }
+
+  /* Completes all queued tasks */
+  thread_pool_destroy(transaction->staging_pool);
+  free(transaction->staging_pool);
+  transaction->staging_pool = NULL;
+}
+
 void file_transaction_cleanup(FileTransaction* transaction) {
   if (transaction == NULL) {
     return;
   }
 
-  LinkedListNode* node = NULL;
-  while ((node = list_pop_front(&transaction->operations))) {
-    PreparedOperation* op = (PreparedOperation*) node;
-    prepared_operation_cleanup(op);
-    free(op);
-  }
+  stop_staging(transaction);
 
+  /* Target paths are released all at once */
+  free(transaction->operations);
+  transaction->operations = NULL;
+  arena_destroy(&transaction->arena);
+
+  journal_close(&transaction->journal);
+  string_set_destroy(&transaction->target_names);
+  free(transaction->numbering.dates);
+  free(transaction->numbering.taken_dates);
+  transaction->numbering.dates = NULL;
+  transaction->numbering.taken_dates = NULL;
   free(transaction->target_directory);
   transaction->target_directory = NULL;
   transaction->operation_count = 0;
+  transaction->operation_capacity = 0;
+  pthread_mutex_destroy(&transaction->arena_lock);
+  pthread_mutex_destroy(&transaction->staging_lock);
 }
 
 static file_error_t copy_file(
   const char* source_path,
   const char* dest_path,
-  const TransactionOptions* options
+  const TransactionOptions* options,
+  copy_method_t* method
 ) {
   file_error_t result = FERR_NONE;
-  FILE* source = NULL;
-  FILE* dest = NULL;
+  int source_fd = -1;
+  int dest_fd = -1;
 
   /* Open source file */
-  source = fopen(source_path, "rb");
-  if (source == NULL) {
+  source_fd = open(source_path, O_RDONLY);
+  if (source_fd < 0) {
     if (errno == ENOENT) {
       result = FERR_INVALID_VALUE;
       goto quit;
@@ -156,23 +264,14 @@ static file_error_t copy_file(
     goto quit;
   }
 
-  /* Forbid overwriting existing file unless force flag is set */
-  {
-    struct stat st;
-    if (stat(dest_path, &st) == 0) {
-      if (!options->force) {
-        result = FERR_ALREADY_EXISTS;
-        goto quit;
-      }
-      if (options->verbose) {
-        fprintf(stderr, "Warning: Overwriting existing file '%s'\n", dest_path);
-      }
+  /* Forbid overwriting existing file unless force flag is set, even if it
+   * was created after target directory was listed */
+  dest_fd = open(dest_path, O_WRONLY | O_CREAT | (options->force ? O_TRUNC : O_EXCL), 0666);
+  if (dest_fd < 0) {
+    if (errno == EEXIST) {
+      result = FERR_ALREADY_EXISTS;
+      goto quit;
     }
-  }
-
-  /* Open destination file */
-  dest = fopen(dest_path, "wb");
-  if (dest == NULL) {
     if (errno == ENOENT) {
       result = FERR_INVALID_VALUE;
       goto quit;
@@ -181,36 +280,40 @@ static file_error_t copy_file(
     goto quit;
   }
 
-  /* Copy file contents in chunks */
-  enum {
-    BUFFER_SIZE = 4096
-  };
-  char buffer[BUFFER_SIZE];
-  size_t bytes_read = 0;
-
-  while ((bytes_read = fread(buffer, 1, BUFFER_SIZE, source)) > 0) {
-    if (fwrite(buffer, 1, bytes_read, dest) != bytes_read) {
-      result = FERR_ACCESS_DENIED;
+  if (options->reflink != REFLINK_NEVER) {
+    result = file_clone_data(source_fd, dest_fd);
+    if (result == FERR_NONE) {
+      *method = COPY_METHOD_CLONE;
+      goto quit;
+    }
+    if (options->reflink == REFLINK_ALWAYS) {
       goto quit;
     }
   }
 
-  if (ferror(source) != 0 || ferror(dest) != 0) {
-    result = FERR_ACCESS_DENIED;
-    goto quit;
-  }
+  CopyOptions copy_options = {
+    .jobs = options->jobs,
+    .cache_policy = options->cache_policy
+  };
+  result = file_copy_data(source_fd, dest_fd, &copy_options, method);
 
 quit:
-  if (source != NULL) {
-    fclose(source);
+  if (source_fd >= 0) {
+    close(source_fd);
   }
-  
-  if (dest != NULL) {
+
+  if (dest_fd >= 0) {
+    if (result == FERR_NONE && options->sync == SYNC_FILE && fdatasync(dest_fd) != 0) {
+      result = FERR_ACCESS_DENIED;
+    }
+    if (close(dest_fd) != 0 && result == FERR_NONE) {
+      /* Delayed write errors are reported on close */
+      result = FERR_ACCESS_DENIED;
+    }
     if (result != FERR_NONE) {
       /* Remove partially created file on error */
       unlink(dest_path);
     }
-    fclose(dest);
   }
 
   return result;
@@ -220,9 +323,11 @@ static file_error_t link_or_copy_file(
   const char* source_path,
   const char* dest_path,
   const TransactionOptions* options,
-  int* used_hardlink
+  int* used_hardlink,
+  copy_method_t* method
 ) {
   *used_hardlink = 0;
+  *method = COPY_METHOD_NONE;
 
   if (link(source_path, dest_path) == 0) {
     *used_hardlink = 1;
@@ -240,20 +345,28 @@ static file_error_t link_or_copy_file(
     return FERR_ACCESS_DENIED;
   }
 
-  return copy_file(source_path, dest_path, options);
+  return copy_file(source_path, dest_path, options, method);
+}
+
+/* Allocate memory living until transaction cleanup, from any thread */
+static void* transaction_alloc(FileTransaction* transaction, size_t size) {
+  pthread_mutex_lock(&transaction->arena_lock);
+  void* memory = arena_alloc(&transaction->arena, size);
+  pthread_mutex_unlock(&transaction->arena_lock);
+  return memory;
 }
 
 static file_error_t build_target_path(
-  const char* target_dir,
+  FileTransaction* transaction,
   const char* filename,
   char** target_path
 ) {
+  const char* target_dir = transaction->target_directory;
   size_t dir_len = strlen(target_dir);
   size_t name_len = strlen(filename);
   size_t total_len = dir_len + name_len + 2;
 
-  *target_path = calloc(total_len, sizeof(char));
-  PANIC_ON_BAD_ALLOC(*target_path);
+  *target_path = (char*) transaction_alloc(transaction, total_len);
 
   (*target_path)[0] = '\0';
   append_string(*target_path, total_len, target_dir);
@@ -263,6 +376,29 @@ static file_error_t build_target_path(
   return FERR_NONE;
 }
 
+/*
+ * Check target against names listed in target directory at initialization.
+ * This is done before target is journaled, so that recovery never removes
+ * a file which existed before the transaction.
+ */
+static file_error_t check_collision(
+  const StringSet* existing,
+  const char* target_path,
+  const TransactionOptions* options
+) {
+  const char* name = path_name(target_path);
+  if (!string_set_contains(existing, name, strlen(name))) {
+    return FERR_NONE;
+  }
+  if (!options->force) {
+    return FERR_ALREADY_EXISTS;
+  }
+  if (options->verbose) {
+    fprintf(stderr, "Warning: Overwriting existing file '%s'\n", target_path);
+  }
+  return FERR_NONE;
+}
+
 static file_error_t prepare_ignore_operation(
   PreparedOperation* op,
   const IndexedFile* file,
@@ -278,6 +414,7 @@ static file_error_t prepare_ignore_operation(
 static file_error_t prepare_dry_run_operation(
   PreparedOperation* op,
   const IndexedFile* file,
+  const StringSet* existing,
   const TransactionOptions* options
 ) {
   prepared_operation_state_t state;
@@ -305,10 +442,10 @@ static file_error_t prepare_dry_run_operation(
   }
 
   /* Check for file collision in dry-run mode (for copy/move operations) */
-  if ((state == PREP_STATE_COPY || state == PREP_STATE_MOVE) && !options->force) {
-    struct stat st;
-    if (stat(op->target_path, &st) == 0) {
-      return FERR_ALREADY_EXISTS;
+  if (state == PREP_STATE_COPY || state == PREP_STATE_MOVE) {
+    file_error_t result = check_collision(existing, op->target_path, options);
+    if (result != FERR_NONE) {
+      return result;
     }
   }
 
@@ -326,19 +463,91 @@ static file_error_t prepare_dry_run_operation(
   return FERR_NONE;
 }
 
+/* Print message about prepared operation in verbose mode */
+static void report_prepared_operation(const PreparedOperation* op) {
+  const char* source_path = op->source_path;
+
+  switch (op->state) {
+  case PREP_STATE_COPY:
+    printf("  Prepared copy: %s -> %s (%s)\n", source_path, op->target_path,
+           op->is_resumed ? "resumed" : copy_method_name(op->copy_method));
+    break;
+  case PREP_STATE_MOVE:
+    printf("  Prepared move (%s): %s -> %s\n",
+           op->is_resumed ? "resumed"
+           : op->copy_method == COPY_METHOD_NONE ? "hardlink" : copy_method_name(op->copy_method),
+           source_path, op->target_path);
+    break;
+  case PREP_STATE_DELETE:
+    printf("  Prepared delete: %s\n", source_path);
+    break;
+  case PREP_STATE_IGNORE:
+    printf("  Ignoring: %s\n", source_path);
+    break;
+  case PREP_STATE_NONE:
+  default:
+    break;
+  }
+}
+
+/*
+ * Keep target completed by interrupted transaction if there is one,
+ * otherwise record that target is about to be created.
+ */
+static file_error_t begin_target(
+  PreparedOperation* op,
+  Journal* journal,
+  journal_action_t action
+) {
+  if (journal_claim(journal, op->source_path, op->target_path, action)) {
+    op->is_resumed = 1;
+    return journal_record_done(journal, op->source_path, op->target_path, action);
+  }
+  return journal_record_intent(journal, op->target_path);
+}
+
+/* Record completed target, removing it if that fails */
+static file_error_t complete_target(
+  PreparedOperation* op,
+  Journal* journal,
+  journal_action_t action
+) {
+  file_error_t result = journal_record_done(journal, op->source_path, op->target_path, action);
+  if (result != FERR_NONE) {
+    unlink(op->target_path);
+  }
+  return result;
+}
+
 static file_error_t prepare_copy_operation(
   PreparedOperation* op,
   const IndexedFile* file,
+  Journal* journal,
+  const StringSet* existing,
   const TransactionOptions* options
 ) {
-  file_error_t result = copy_file(file->path, op->target_path, options);
+  file_error_t result = check_collision(existing, op->target_path, options);
+  if (result == FERR_NONE) {
+    result = begin_target(op, journal, JOURNAL_ACTION_COPY);
+  }
   if (result != FERR_NONE) {
     return result;
   }
 
+  if (!op->is_resumed) {
+    result = copy_file(file->path, op->target_path, options, &op->copy_method);
+    if (result != FERR_NONE) {
+      return result;
+    }
+    result = complete_target(op, journal, JOURNAL_ACTION_COPY);
+    if (result != FERR_NONE) {
+      return result;
+    }
+  }
+
   op->state = PREP_STATE_COPY;
   if (options->verbose) {
-    printf("  Prepared copy: %s -> %s\n", file->path, op->target_path);
+    report_prepared_operation(op);
   }
 
   return FERR_NONE;
@@ -347,18 +556,34 @@ static file_error_t prepare_copy_operation(
 static file_error_t prepare_move_operation(
   PreparedOperation* op,
   const IndexedFile* file,
+  Journal* journal,
+  const StringSet* existing,
   const TransactionOptions* options
 ) {
-  int used_hardlink = 0;
-  file_error_t result = link_or_copy_file(file->path, op->target_path, options, &used_hardlink);
+  file_error_t result = check_collision(existing, op->target_path, options);
+  if (result == FERR_NONE) {
+    result = begin_target(op, journal, JOURNAL_ACTION_MOVE);
+  }
   if (result != FERR_NONE) {
     return result;
   }
 
+  if (!op->is_resumed) {
+    int used_hardlink = 0;
+    result = link_or_copy_file(file->path, op->target_path, options,
+                               &used_hardlink, &op->copy_method);
+    if (result != FERR_NONE) {
+      return result;
+    }
+    result = complete_target(op, journal, JOURNAL_ACTION_MOVE);
+    if (result != FERR_NONE) {
+      return result;
+    }
+  }
+
   op->state = PREP_STATE_MOVE;
   if (options->verbose) {
-    const char* method = used_hardlink ? "hardlink" : "copy";
-    printf("  Prepared move (%s): %s -> %s\n", method, file->path, op->target_path);
+    report_prepared_operation(op);
   }
 
   return FERR_NONE;
@@ -367,191 +592,1063 @@ static file_error_t prepare_move_operation(
 static file_error_t prepare_delete_operation(
   PreparedOperation* op,
   const IndexedFile* file,
+  Journal* journal,
   const TransactionOptions* options
 ) {
+  file_error_t result = journal_record_done(journal, file->path, NULL, JOURNAL_ACTION_DELETE);
+  if (result != FERR_NONE) {
+    return result;
+  }
+
   op->state = PREP_STATE_DELETE;
   if (options->verbose) {
-    printf("  Prepared delete: %s\n", file->path);
+    report_prepared_operation(op);
   }
   return FERR_NONE;
 }
 
-static file_error_t prepare_single_operation(
-  PreparedOperation* op,
-  const IndexedFile* file,
-  unsigned short file_index,
-  const char* target_directory,
-  const TransactionOptions* options
-) {
-  enum {
-    FILENAME_BUFSIZE = FILENAME_MAX + 1
-  };
-  char filename[FILENAME_BUFSIZE];
-  file_generate_name(file, file_index, FILENAME_BUFSIZE, filename);
-
-  file_error_t result = build_target_path(target_directory, filename, &op->target_path);
-  if (result != FERR_NONE) {
-    return result;
+/* Find position of `date` among numbered dates, or where it should be */
+static size_t find_date(const FileNumbering* numbering, const char* date, int* is_found) {
+  size_t low = 0;
+  size_t high = numbering->date_count;
+  while (low < high) {
+    size_t middle = low + (high - low) / 2;
+    int cmp = strcmp(numbering->dates[middle].date, date);
+    if (cmp == 0) {
+      *is_found = 1;
+      return middle;
+    }
+    if (cmp < 0) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
   }
+  *is_found = 0;
+  return low;
+}
 
-  if (options->dry_run) {
-    return prepare_dry_run_operation(op, file, options);
+/* Make `next_index` the first free index of `date`, unless it is lower */
+static void reserve_date_index(FileNumbering* numbering, const char* date, uint64_t next_index) {
+  int is_found = 0;
+  size_t position = find_date(numbering, date, &is_found);
+  if (is_found) {
+    if (numbering->dates[position].next_index < next_index) {
+      numbering->dates[position].next_index = next_index;
+    }
+    return;
   }
-  
-  switch (file->changes.action) {
-  case FACT_IGNORE:
-    return prepare_ignore_operation(op, file, options);
-  case FACT_COPY:
-    return prepare_copy_operation(op, file, options);
-  case FACT_MOVE:
-    return prepare_move_operation(op, file, options);
-  case FACT_DELETE:
-    return prepare_delete_operation(op, file, options);
-  default:
-    return FERR_INVALID_OPERATION;
+
+  if (numbering->date_count == numbering->date_capacity) {
+    size_t capacity = numbering->date_capacity == 0 ? 16 : 2 * numbering->date_capacity;
+    DateIndex* dates = (DateIndex*) realloc(numbering->dates, capacity * sizeof(*dates));
+    PANIC_ON_BAD_ALLOC(dates);
+    numbering->dates = dates;
+    numbering->date_capacity = capacity;
   }
+  memmove(&numbering->dates[position + 1], &numbering->dates[position],
+          (numbering->date_count - position) * sizeof(*numbering->dates));
+  memcpy(numbering->dates[position].date, date, FILE_DATE_BUFSIZE);
+  numbering->dates[position].next_index = next_index;
+  numbering->date_count++;
 }
 
-file_error_t file_transaction_prepare(
-  FileTransaction* transaction,
-  const FileIndex* index,
-  const TransactionOptions* options,
-  const char** failed_path
-) {
-  PANIC_IF_NULL(transaction);
-  PANIC_IF_NULL(index);
-  PANIC_IF_NULL(options);
-
-  if (failed_path != NULL) {
-    *failed_path = NULL;
+/* Read date and index of name `YYYY-MM-DD_N...`, fail for other names */
+static int parse_numbered_name(const char* name, char* date, uint64_t* index) {
+  for (size_t i = 0; i < FILE_DATE_BUFSIZE - 1; ++i) {
+    int is_separator = i == 4 || i == 7;
+    if (is_separator ? name[i] != '-' : (name[i] < '0' || name[i] > '9')) {
+      return 0;
+    }
   }
-
-  if (options->verbose) {
-    printf("Preparing %zu operations...\n", index->file_count);
+  if (name[FILE_DATE_BUFSIZE - 1] != '_') {
+    return 0;
   }
 
-  file_error_t result = FERR_NONE;
-  PreparedOperation* op = NULL;
-  unsigned short file_index = 0;
-  
-  /* Process each file in the index */
-  LIST_CONST_FOREACH(node, index->files) {
-    const IndexedFile* file = (const IndexedFile*) node;
-    
-    op = calloc(1, sizeof(*op));
-    PANIC_ON_BAD_ALLOC(op);
-
-    list_node_init(&op->as_node);
-    op->source_file = file;
-
-    result = prepare_single_operation(
-      op, 
-      file, 
-      file_index, 
-      transaction->target_directory, 
-      options
-    );
-    
-    if (result != FERR_NONE) {
-      if (failed_path != NULL) {
-        *failed_path = file->path;
-      }
-      if (options->verbose) {
-        fprintf(stderr, "  Failed to prepare operation for: %s\n", file->path);
-      }
-      goto quit;
+  const char* digits = name + FILE_DATE_BUFSIZE;
+  uint64_t value = 0;
+  size_t length = 0;
+  for (; digits[length] >= '0' && digits[length] <= '9'; ++length) {
+    unsigned digit = (unsigned) (digits[length] - '0');
+    if (value > (UINT64_MAX - digit) / 10) {
+      return 0;
     }
+    value = value * 10 + digit;
+  }
+  if (length == 0 || (digits[length] != '\0' && digits[length] != '_'
+                      && digits[length] != '.')) {
+    return 0;
+  }
 
-    /* Add successful operation to transaction */
-    list_push_back(&transaction->operations, &op->as_node);
-    transaction->operation_count++;
-    file_index++;
-    op = NULL;
+  memcpy(date, name, FILE_DATE_BUFSIZE - 1);
+  date[FILE_DATE_BUFSIZE - 1] = '\0';
+  *index = value;
+  return 1;
+}
+
+/* Remember free indices of all dates as the ones to start numbering from */
+static void save_taken_dates(FileNumbering* numbering) {
+  size_t size = numbering->date_count * sizeof(*numbering->dates);
+  DateIndex* taken = (DateIndex*) realloc(numbering->taken_dates, size + 1);
+  PANIC_ON_BAD_ALLOC(taken);
+  if (size > 0) {
+    memcpy(taken, numbering->dates, size);
   }
+  numbering->taken_dates = taken;
+  numbering->taken_count = numbering->date_count;
+  numbering->is_taken_known = 1;
+}
 
-quit:
-  if (options->verbose) {
-    if (result == FERR_NONE) {
-      printf("All operations prepared successfully.\n");
-    }
-    else {
-      fprintf(stderr, "Preparation failed.\n");
+static void reset_numbering(FileTransaction* transaction, const TransactionOptions* options) {
+  FileNumbering* numbering = &transaction->numbering;
+  numbering->next_index = numbering->first_index;
+  numbering->per_date = options->per_date_numbering;
+  numbering->date[0] = '\0';
+  numbering->date_count = 0;
+  if (!numbering->per_date) {
+    return;
+  }
+
+  if (numbering->is_taken_known) {
+    for (size_t i = 0; i < numbering->taken_count; ++i) {
+      reserve_date_index(numbering, numbering->taken_dates[i].date,
+                         numbering->taken_dates[i].next_index);
     }
+    return;
   }
 
-  if (result != FERR_NONE && op != NULL) {
-    prepared_operation_cleanup(op);
-    free(op);
+  /* Indices taken by earlier transactions stay taken */
+  const StringSet* names = &transaction->target_names;
+  for (size_t i = 0; i < names->capacity; ++i) {
+    char date[FILE_DATE_BUFSIZE];
+    uint64_t index = 0;
+    if (names->slots[i].string != NULL
+        && parse_numbered_name(names->slots[i].string, date, &index)
+        && index < UINT64_MAX) {
+      reserve_date_index(numbering, date, index + 1);
+    }
   }
-  return result;
+  save_taken_dates(numbering);
 }
 
-static file_error_t commit_move_operation(
-  PreparedOperation* op,
-  const TransactionOptions* options
+/*
+ * Take index of next file in its name. Only copied and moved files use up the
+ * index, ignored and deleted ones get no target.
+ */
+static uint64_t take_file_index(
+  FileTransaction* transaction,
+  time_t name_timestamp,
+  file_action_t action
 ) {
-  int unlink_result = unlink(op->source_file->path);
-  if (unlink_result != 0) {
-    if (options->verbose) {
-      fprintf(stderr, "  Failed to remove source: %s\n", op->source_file->path);
+  FileNumbering* numbering = &transaction->numbering;
+  if (numbering->per_date) {
+    const char* date = file_name_date(&transaction->name_formatter, name_timestamp);
+    if (strcmp(date, numbering->date) != 0) {
+      if (numbering->date[0] != '\0') {
+        reserve_date_index(numbering, numbering->date, numbering->next_index);
+      }
+      int is_found = 0;
+      size_t position = find_date(numbering, date, &is_found);
+      numbering->next_index = is_found ? numbering->dates[position].next_index : 0;
+      memcpy(numbering->date, date, FILE_DATE_BUFSIZE);
     }
-    return FERR_ACCESS_DENIED;
   }
-  if (options->verbose) {
-    printf("  Committed move: %s\n", op->source_file->path);
+
+  uint64_t index = numbering->next_index;
+  if (action == FACT_COPY || action == FACT_MOVE) {
+    numbering->next_index++;
   }
-  return FERR_NONE;
+  return index;
 }
 
-static file_error_t commit_delete_operation(
-  PreparedOperation* op,
+/*
+ * Start numbering files of index. Without fixed width, files are numbered
+ * once in advance to find the largest index.
+ */
+static void start_numbering(
+  FileTransaction* transaction,
+  const FileIndex* index,
   const TransactionOptions* options
 ) {
-  int unlink_result = unlink(op->source_file->path);
-  if (unlink_result != 0) {
-    if (errno == ENOENT) {
-      if (options->verbose) {
-        fprintf(stderr, "  No such file: %s\n", op->source_file->path);
-      }
-      return FERR_INVALID_VALUE;
-    } else {
-      if (options->verbose) {
-        fprintf(stderr, "  Failed to delete: %s\n", op->source_file->path);
+  unsigned width = options->index_width;
+  reset_numbering(transaction, options);
+
+  if (width == 0) {
+    uint64_t max_index = 0;
+    FILE_INDEX_FOREACH(row, *index) {
+      uint64_t file_index = take_file_index(transaction, index->name_timestamps[row],
+                                            index->actions[row]);
+      if (file_index > max_index) {
+        max_index = file_index;
       }
-      return FERR_ACCESS_DENIED;
     }
-  } else if (options->verbose) {
-    printf("  Committed delete: %s\n", op->source_file->path);
+    reset_numbering(transaction, options);
+
+    width = 1;
+    for (; max_index >= 10; max_index /= 10) {
+      width++;
+    }
+    if (width < FILE_INDEX_DEFAULT_WIDTH) {
+      width = FILE_INDEX_DEFAULT_WIDTH;
+    }
   }
-  return FERR_NONE;
+  transaction->name_formatter.index_width = width;
 }
 
-static file_error_t commit_copy_operation(
-  PreparedOperation* op,
-  const TransactionOptions* options
+/*
+ * Names are generated by calling thread only, in index order, so that
+ * consecutive files share cached parts of their names
+ */
+static file_error_t build_next_target_path(
+  FileTransaction* transaction,
+  const IndexedFile* file,
+  char** target_path
 ) {
-  if (options->verbose) {
-    printf("  Nothing to commit for %s (copied)\n", op->source_file->path);
-  }
-  return FERR_NONE;
+  enum {
+    FILENAME_BUFSIZE = FILENAME_MAX + 1
+  };
+  char filename[FILENAME_BUFSIZE];
+  uint64_t file_index = take_file_index(transaction, file->override_timestamp,
+                                        file->changes.action);
+  file_name_format(&transaction->name_formatter, file, file_index, FILENAME_BUFSIZE, filename);
+
+  return build_target_path(transaction, filename, target_path);
 }
 
-static file_error_t commit_ignore_operation(
+static file_error_t assign_target_path(
   PreparedOperation* op,
-  const TransactionOptions* options
+  const IndexedFile* file,
+  FileTransaction* transaction
 ) {
-  if (options->verbose) {
-    printf("  Nothing to commit for %s (ignored)\n", op->source_file->path);
-  }
-  return FERR_NONE;
+  return build_next_target_path(transaction, file, &op->target_path);
 }
 
-static file_error_t commit_single_operation(
+/* Prepare operation with assigned target path, can run on any thread */
+static file_error_t prepare_assigned_operation(
   PreparedOperation* op,
+  const IndexedFile* file,
+  FileTransaction* transaction,
   const TransactionOptions* options
 ) {
-  switch (op->state) {
-  case PREP_STATE_MOVE:
+  Journal* journal = &transaction->journal;
+  const StringSet* existing = &transaction->target_names;
+
+  if (options->dry_run) {
+    return prepare_dry_run_operation(op, file, existing, options);
+  }
+  
+  switch (file->changes.action) {
+  case FACT_IGNORE:
+    return prepare_ignore_operation(op, file, options);
+  case FACT_COPY:
+    return prepare_copy_operation(op, file, journal, existing, options);
+  case FACT_MOVE:
+    return prepare_move_operation(op, file, journal, existing, options);
+  case FACT_DELETE:
+    return prepare_delete_operation(op, file, journal, options);
+  default:
+    return FERR_INVALID_OPERATION;
+  }
+}
+
+static file_error_t prepare_single_operation(
+  PreparedOperation* op,
+  const IndexedFile* file,
+  FileTransaction* transaction,
+  const TransactionOptions* options
+) {
+  file_error_t result = assign_target_path(op, file, transaction);
+  if (result != FERR_NONE) {
+    return result;
+  }
+  return prepare_assigned_operation(op, file, transaction, options);
+}
+
+/*
+ * Add `count` operations prepared in background after the last operation
+ * of transaction and find the earliest failure. Operations completed after
+ * it are added too, so that rollback can undo them. Operations that were
+ * never started, neither prepared nor failed, are dropped.
+ */
+static file_error_t collect_prepared_operations(
+  FileTransaction* transaction,
+  size_t count,
+  const TransactionOptions* options,
+  const char** failed_path
+) {
+  file_error_t result = FERR_NONE;
+  PreparedOperation* ops = transaction->operations + transaction->operation_count;
+
+  for (size_t i = 0; i < count; ++i) {
+    if (ops[i].state == PREP_STATE_NONE && ops[i].staging_result == FERR_NONE) {
+      continue;
+    }
+    PreparedOperation* op = &transaction->operations[transaction->operation_count++];
+    if (op != &ops[i]) {
+      *op = ops[i];
+    }
+
+    if (result != FERR_NONE) {
+      continue;
+    }
+    if (op->staging_result != FERR_NONE) {
+      result = op->staging_result;
+      *failed_path = op->source_path;
+      continue;
+    }
+    if (options->verbose) {
+      report_prepared_operation(op);
+    }
+  }
+
+  return result;
+}
+
+/*
+ * Make room for `count` operations after the last one. Operations stay in
+ * place until room is made again, so workers can keep pointers to them.
+ */
+static void reserve_operations(FileTransaction* transaction, size_t count) {
+  size_t required = transaction->operation_count + count;
+  if (required <= transaction->operation_capacity) {
+    return;
+  }
+
+  size_t capacity = transaction->operation_capacity == 0 ? 16 : 2 * transaction->operation_capacity;
+  if (capacity < required) {
+    capacity = required;
+  }
+  PreparedOperation* operations = (PreparedOperation*) realloc(
+    transaction->operations,
+    capacity * sizeof(*operations)
+  );
+  PANIC_ON_BAD_ALLOC(operations);
+  transaction->operations = operations;
+  transaction->operation_capacity = capacity;
+}
+
+static void init_operation(PreparedOperation* op, const char* source_path, size_t source_row) {
+  memset(op, 0, sizeof(*op));
+  op->source_path = source_path;
+  op->source_row = source_row;
+}
+
+enum {
+  PREPARE_QUEUE_PER_JOB = 2,  /* Operations queued for preparation per worker */
+  PREFETCH_DEPTH = 4          /* Copied files read ahead of the one being prepared */
+};
+
+/* Reading of files ahead of prepared one, in index order */
+typedef struct {
+  const FileIndex* index;
+  size_t next_row;            /* First file not prefetched yet */
+  int is_enabled;
+} Prefetcher;
+
+static void prefetcher_init(
+  Prefetcher* prefetcher,
+  const FileIndex* index,
+  const TransactionOptions* options
+) {
+  prefetcher->index = index;
+  prefetcher->next_row = 0;
+  /* Prefetching only pays off when copied data is not kept in cache anyway */
+  prefetcher->is_enabled = options->cache_policy != CACHE_POLICY_KEEP && !options->dry_run;
+}
+
+/* Start reading copied files up to `PREFETCH_DEPTH` files after `row` */
+static void prefetch_ahead(Prefetcher* prefetcher, size_t row) {
+  if (!prefetcher->is_enabled) {
+    return;
+  }
+
+  const FileIndex* index = prefetcher->index;
+  while (prefetcher->next_row < index->file_count
+         && prefetcher->next_row <= row + PREFETCH_DEPTH) {
+    if (index->actions[prefetcher->next_row] == FACT_COPY) {
+      file_prefetch(file_index_path(index, prefetcher->next_row));
+    }
+    prefetcher->next_row++;
+  }
+}
+
+/* State shared by workers of parallel prepare */
+typedef struct {
+  FileTransaction* transaction;
+  const FileIndex* index;
+  TransactionOptions options;   /* Quiet copy of caller options */
+  pthread_mutex_t lock;
+  int failed;                   /* Nonzero if some operation failed */
+} ParallelPrepare;
+
+typedef struct {
+  ParallelPrepare* shared;
+  PreparedOperation* op;        /* Operation with assigned target path */
+} PrepareTask;
+
+static int parallel_prepare_failed(ParallelPrepare* shared) {
+  pthread_mutex_lock(&shared->lock);
+  int failed = shared->failed;
+  pthread_mutex_unlock(&shared->lock);
+  return failed;
+}
+
+static void prepare_operation_task(void* argument) {
+  PrepareTask* task = (PrepareTask*) argument;
+  ParallelPrepare* shared = task->shared;
+  PreparedOperation* op = task->op;
+
+  /* Queued operations are left unprepared after first failure */
+  if (parallel_prepare_failed(shared)) {
+    return;
+  }
+
+  IndexedFile file = file_index_get(shared->index, op->source_row);
+  file_error_t result = prepare_assigned_operation(
+    op,
+    &file,
+    shared->transaction,
+    &shared->options
+  );
+  op->staging_result = result;
+
+  if (result != FERR_NONE) {
+    pthread_mutex_lock(&shared->lock);
+    shared->failed = 1;
+    pthread_mutex_unlock(&shared->lock);
+  }
+}
+
+/* Prepare operations on `options->jobs` workers */
+static file_error_t prepare_in_parallel(
+  FileTransaction* transaction,
+  const FileIndex* index,
+  const TransactionOptions* options,
+  const char** failed_path
+) {
+  size_t count = index->file_count;
+  PrepareTask* tasks = (PrepareTask*) calloc(count + 1, sizeof(*tasks));
+  PANIC_ON_BAD_ALLOC(tasks);
+  PreparedOperation* ops = transaction->operations + transaction->operation_count;
+
+  ParallelPrepare shared;
+  shared.transaction = transaction;
+  shared.index = index;
+  shared.options = *options;
+  shared.options.verbose = 0;
+  /* Workers already copy files in parallel, large files are not split further */
+  shared.options.jobs = 1;
+  shared.failed = 0;
+  pthread_mutex_init(&shared.lock, NULL);
+
+  ThreadPool pool;
+  thread_pool_init(&pool, options->jobs, options->jobs * PREPARE_QUEUE_PER_JOB);
+
+  Prefetcher prefetcher;
+  prefetcher_init(&prefetcher, index, options);
+
+  size_t scheduled = 0;
+  FILE_INDEX_FOREACH(row, *index) {
+    /* Stop scheduling new work after first failure */
+    if (parallel_prepare_failed(&shared)) {
+      break;
+    }
+
+    prefetch_ahead(&prefetcher, row);
+
+    IndexedFile file = file_index_get(index, row);
+    init_operation(&ops[scheduled], file.path, row);
+    assign_target_path(&ops[scheduled], &file, transaction);
+    tasks[scheduled].shared = &shared;
+    tasks[scheduled].op = &ops[scheduled];
+    thread_pool_submit(&pool, prepare_operation_task, &tasks[scheduled]);
+    scheduled++;
+  }
+
+  /* Wait for operations in flight */
+  thread_pool_destroy(&pool);
+  pthread_mutex_destroy(&shared.lock);
+
+  file_error_t result = collect_prepared_operations(transaction, scheduled,
+                                                    options, failed_path);
+  free(tasks);
+  return result;
+}
+
+/* Copy files through io_uring, preparing other operations synchronously */
+static file_error_t prepare_with_uring(
+  FileTransaction* transaction,
+  const FileIndex* index,
+  const TransactionOptions* options,
+  const char** failed_path
+) {
+  size_t count = index->file_count;
+  PreparedOperation* ops = transaction->operations + transaction->operation_count;
+  UringCopy* copies = (UringCopy*) calloc(count + 1, sizeof(*copies));
+  PANIC_ON_BAD_ALLOC(copies);
+  size_t* copy_ops = (size_t*) calloc(count + 1, sizeof(*copy_ops));
+  PANIC_ON_BAD_ALLOC(copy_ops);
+
+  TransactionOptions quiet_options = *options;
+  quiet_options.verbose = 0;
+
+  size_t scheduled = 0;
+  size_t copy_count = 0;
+  FILE_INDEX_FOREACH(row, *index) {
+    IndexedFile file = file_index_get(index, row);
+    PreparedOperation* op = &ops[scheduled];
+    init_operation(op, file.path, row);
+    scheduled++;
+
+    if (file.changes.action != FACT_COPY) {
+      op->staging_result = prepare_single_operation(op, &file, transaction, &quiet_options);
+      if (op->staging_result != FERR_NONE) {
+        break;
+      }
+      continue;
+    }
+
+    op->staging_result = assign_target_path(op, &file, transaction);
+    if (op->staging_result == FERR_NONE) {
+      op->staging_result = check_collision(&transaction->target_names,
+                                           op->target_path, &quiet_options);
+    }
+    if (op->staging_result == FERR_NONE) {
+      op->staging_result = begin_target(op, &transaction->journal, JOURNAL_ACTION_COPY);
+    }
+    if (op->staging_result != FERR_NONE) {
+      break;
+    }
+    if (op->is_resumed) {
+      op->state = PREP_STATE_COPY;
+      continue;
+    }
+    copies[copy_count].source_path = file.path;
+    copies[copy_count].dest_path = op->target_path;
+    copy_ops[copy_count] = scheduled - 1;
+    copy_count++;
+  }
+
+  file_uring_copy(copy_count, copies, options);
+
+  for (size_t i = 0; i < copy_count; ++i) {
+    PreparedOperation* op = &ops[copy_ops[i]];
+    if (!copies[i].is_started) {
+      /* Not started after failure of another copy, left out of transaction */
+      continue;
+    }
+
+    op->staging_result = copies[i].result;
+    op->copy_method = copies[i].method;
+    if (op->staging_result == FERR_NONE) {
+      op->staging_result = complete_target(op, &transaction->journal, JOURNAL_ACTION_COPY);
+    }
+    if (op->staging_result == FERR_NONE) {
+      op->state = PREP_STATE_COPY;
+    }
+  }
+
+  file_error_t result = collect_prepared_operations(transaction, scheduled,
+                                                    options, failed_path);
+  free(copy_ops);
+  free(copies);
+  return result;
+}
+
+file_error_t file_transaction_prepare(
+  FileTransaction* transaction,
+  const FileIndex* index,
+  const TransactionOptions* options,
+  const char** failed_path
+) {
+  PANIC_IF_NULL(transaction);
+  PANIC_IF_NULL(index);
+  PANIC_IF_NULL(options);
+
+  if (failed_path != NULL) {
+    *failed_path = NULL;
+  }
+
+  if (options->verbose) {
+    printf("Preparing %zu operations...\n", index->file_count);
+  }
+
+  file_error_t result = FERR_NONE;
+  PreparedOperation* op = NULL;
+
+  /* Dry run only checks for collisions, which is not worth batching or parallelizing */
+  int use_uring = options->io_uring && !options->dry_run;
+  if (use_uring && !file_uring_is_available()) {
+    if (options->verbose) {
+      printf("io_uring is not available, copying files synchronously\n");
+    }
+    use_uring = 0;
+  }
+
+  start_numbering(transaction, index, options);
+  /* Operations are not moved while files are prepared */
+  reserve_operations(transaction, index->file_count);
+
+  if (use_uring || (options->jobs > 1 && !options->dry_run)) {
+    const char* failed_source = NULL;
+    if (use_uring) {
+      result = prepare_with_uring(transaction, index, options, &failed_source);
+    } else {
+      result = prepare_in_parallel(transaction, index, options, &failed_source);
+    }
+    if (result != FERR_NONE) {
+      if (failed_path != NULL) {
+        *failed_path = failed_source;
+      }
+      if (options->verbose) {
+        fprintf(stderr, "  Failed to prepare operation for: %s\n", failed_source);
+      }
+    }
+    goto quit;
+  }
+  
+  Prefetcher prefetcher;
+  prefetcher_init(&prefetcher, index, options);
+
+  /* Process each file in the index */
+  FILE_INDEX_FOREACH(row, *index) {
+    IndexedFile file = file_index_get(index, row);
+    prefetch_ahead(&prefetcher, row);
+    
+    op = &transaction->operations[transaction->operation_count];
+    init_operation(op, file.path, row);
+
+    result = prepare_single_operation(op, &file, transaction, options);
+    
+    if (result != FERR_NONE) {
+      if (failed_path != NULL) {
+        *failed_path = file.path;
+      }
+      if (options->verbose) {
+        fprintf(stderr, "  Failed to prepare operation for: %s\n", file.path);
+      }
+      goto quit;
+    }
+
+    /* Add successful operation to transaction */
+    transaction->operation_count++;
+    op = NULL;
+  }
+
+quit:
+  if (result == FERR_NONE) {
+    /* Leftovers of interrupted transaction not reused by this one */
+    journal_release_unclaimed(&transaction->journal);
+  }
+
+  if (options->verbose) {
+    if (result == FERR_NONE) {
+      printf("All operations prepared successfully.\n");
+    }
+    else {
+      fprintf(stderr, "Preparation failed.\n");
+    }
+  }
+
+  if (result != FERR_NONE && op != NULL) {
+    prepared_operation_cleanup(op);
+  }
+  return result;
+}
+
+enum {
+  STAGING_QUEUE_PER_JOB = 16  /* Files queued for staging per worker */
+};
+
+/*
+ * Staging task keeps its own copy of file path in transaction: files found
+ * by scan are not in index yet, and if scan fails, they never will be.
+ * Operation is added to transaction once it is staged.
+ */
+typedef struct {
+  FileTransaction* transaction;
+  PreparedOperation op;
+  IndexedFile source;   /*!< Only `path` and `changes` fields are set */
+} StagingTask;
+
+static void build_staging_path(
+  FileTransaction* transaction,
+  size_t sequence,
+  char** staging_path
+) {
+  enum {
+    STAGING_NAME_BUFSIZE = 64
+  };
+  char name[STAGING_NAME_BUFSIZE];
+  snprintf(name, STAGING_NAME_BUFSIZE, ".corgi-%ld-%zu.part", (long) getpid(), sequence);
+
+  build_target_path(transaction, name, staging_path);
+}
+
+static void stage_operation(void* argument) {
+  StagingTask* task = (StagingTask*) argument;
+  FileTransaction* transaction = task->transaction;
+  PreparedOperation* op = &task->op;
+  const IndexedFile* file = &task->source;
+
+  /* Messages are printed when files get their final names */
+  TransactionOptions quiet_options = *transaction->staging_options;
+  quiet_options.verbose = 0;
+  /* Files are staged on several workers, large files are not split further */
+  quiet_options.jobs = 1;
+
+  pthread_mutex_lock(&transaction->staging_lock);
+  int is_skipped = transaction->staging_failed;
+  size_t sequence = transaction->staged_count++;
+  pthread_mutex_unlock(&transaction->staging_lock);
+
+  file_error_t result = FERR_NONE;
+  if (!is_skipped) {
+    build_staging_path(transaction, sequence, &op->target_path);
+
+    switch (file->changes.action) {
+    case FACT_IGNORE:
+      result = prepare_ignore_operation(op, file, &quiet_options);
+      break;
+    case FACT_COPY:
+      result = prepare_copy_operation(op, file, &transaction->journal,
+                                      &transaction->target_names, &quiet_options);
+      break;
+    case FACT_MOVE:
+      result = prepare_move_operation(op, file, &transaction->journal,
+                                      &transaction->target_names, &quiet_options);
+      break;
+    case FACT_DELETE:
+      result = prepare_delete_operation(op, file, &transaction->journal, &quiet_options);
+      break;
+    default:
+      result = FERR_INVALID_OPERATION;
+      break;
+    }
+  }
+
+  pthread_mutex_lock(&transaction->staging_lock);
+  op->staging_result = result;
+  if (result != FERR_NONE) {
+    transaction->staging_failed = 1;
+  }
+  reserve_operations(transaction, 1);
+  transaction->operations[transaction->operation_count++] = *op;
+  pthread_mutex_unlock(&transaction->staging_lock);
+}
+
+void file_transaction_begin_staging(
+  FileTransaction* transaction,
+  const TransactionOptions* options
+) {
+  PANIC_IF_NULL(transaction);
+  PANIC_IF_NULL(options);
+
+  if (transaction->staging_pool != NULL) {
+    PANIC("staging has already begun");
+  }
+
+  /*
+   * Final names are not known while staging, so leftovers of interrupted
+   * transaction cannot be reused and must not collide with new files
+   */
+  journal_release_unclaimed(&transaction->journal);
+
+  /* Staging runs in background even with single job */
+  size_t worker_count = options->jobs > 1 ? options->jobs : 1;
+  transaction->staging_options = options;
+  transaction->staging_pool = (ThreadPool*) calloc(1, sizeof(*transaction->staging_pool));
+  PANIC_ON_BAD_ALLOC(transaction->staging_pool);
+  thread_pool_init(transaction->staging_pool, worker_count, worker_count * STAGING_QUEUE_PER_JOB);
+}
+
+void file_transaction_stage(FileTransaction* transaction, const IndexedFile* file) {
+  PANIC_IF_NULL(transaction);
+  PANIC_IF_NULL(file);
+
+  if (transaction->staging_pool == NULL) {
+    PANIC("staging has not begun");
+  }
+
+  size_t path_length = strlen(file->path);
+  StagingTask* task = (StagingTask*) transaction_alloc(transaction,
+                                                       sizeof(*task) + path_length + 1);
+  char* path = (char*) (task + 1);
+  memcpy(path, file->path, path_length + 1);
+  /* Row is not known until index is complete */
+  init_operation(&task->op, path, 0);
+  task->transaction = transaction;
+  task->source.path = path;
+  task->source.changes = file->changes;
+
+  thread_pool_submit(transaction->staging_pool, stage_operation, task);
+}
+
+static int compare_source_paths(const void* lhs, const void* rhs) {
+  return strcmp(((const PreparedOperation*) lhs)->source_path,
+                ((const PreparedOperation*) rhs)->source_path);
+}
+
+/*
+ * Lay out staged operations in order of files in index, creating empty
+ * operations for files that were not staged.
+ */
+static void order_staged_operations(FileTransaction* transaction, const FileIndex* index) {
+  PreparedOperation* staged = transaction->operations;
+  size_t staged_count = transaction->operation_count;
+  char* is_used = (char*) calloc(staged_count + 1, sizeof(*is_used));
+  PANIC_ON_BAD_ALLOC(is_used);
+  qsort(staged, staged_count, sizeof(*staged), compare_source_paths);
+
+  transaction->operations = NULL;
+  transaction->operation_count = 0;
+  transaction->operation_capacity = 0;
+  reserve_operations(transaction, index->file_count);
+
+  /* Paths of files in index are unique, so they identify staged files */
+  FILE_INDEX_FOREACH(row, *index) {
+    PreparedOperation key;
+    key.source_path = file_index_path(index, row);
+    PreparedOperation* found = (PreparedOperation*) bsearch(
+      &key, staged, staged_count, sizeof(*staged), compare_source_paths
+    );
+
+    PreparedOperation* op = &transaction->operations[transaction->operation_count++];
+    if (found != NULL && !is_used[found - staged]) {
+      *op = *found;
+      is_used[found - staged] = 1;
+    } else {
+      init_operation(op, NULL, row);
+    }
+    op->source_path = key.source_path;
+    op->source_row = row;
+  }
+
+  /* Operations for files no longer in index cannot be committed, drop them */
+  for (size_t i = 0; i < staged_count; ++i) {
+    if (is_used[i]) {
+      continue;
+    }
+    if (staged[i].state == PREP_STATE_COPY || staged[i].state == PREP_STATE_MOVE) {
+      unlink(staged[i].target_path);
+    }
+  }
+  free(is_used);
+  free(staged);
+}
+
+/* Move staged file to its final name without overwriting unless forced */
+static file_error_t promote_staged_file(
+  const char* staging_path,
+  const char* target_path,
+  const TransactionOptions* options
+) {
+  if (options->force) {
+    return rename(staging_path, target_path) == 0 ? FERR_NONE : FERR_ACCESS_DENIED;
+  }
+
+  /* Unlike rename(), link() never replaces existing file */
+  if (link(staging_path, target_path) == 0) {
+    unlink(staging_path);
+    return FERR_NONE;
+  }
+  if (errno == EEXIST) {
+    return FERR_ALREADY_EXISTS;
+  }
+  if (errno != EPERM && errno != EMLINK && errno != ENOTSUP && errno != EOPNOTSUPP) {
+    return FERR_ACCESS_DENIED;
+  }
+
+  /* File system without hard links */
+  if (access(target_path, F_OK) == 0) {
+    return FERR_ALREADY_EXISTS;
+  }
+  return rename(staging_path, target_path) == 0 ? FERR_NONE : FERR_ACCESS_DENIED;
+}
+
+static file_error_t finish_staged_operation(
+  PreparedOperation* op,
+  const FileIndex* index,
+  FileTransaction* transaction,
+  const TransactionOptions* options
+) {
+  IndexedFile file = file_index_get(index, op->source_row);
+  Journal* journal = &transaction->journal;
+
+  if (op->state == PREP_STATE_NONE && op->target_path == NULL) {
+    /* File was not staged, prepare it now */
+    return prepare_single_operation(op, &file, transaction, options);
+  }
+
+  char* target_path = NULL;
+  build_next_target_path(transaction, &file, &target_path);
+
+  if (op->state == PREP_STATE_COPY || op->state == PREP_STATE_MOVE) {
+    file_error_t result = check_collision(&transaction->target_names, target_path, options);
+    if (result == FERR_NONE) {
+      result = journal_record_intent(journal, target_path);
+    }
+    if (result == FERR_NONE) {
+      result = promote_staged_file(op->target_path, target_path, options);
+    }
+    if (result != FERR_NONE) {
+      return result;
+    }
+  }
+  op->target_path = target_path;
+
+  if (op->state == PREP_STATE_COPY || op->state == PREP_STATE_MOVE) {
+    journal_action_t action = op->state == PREP_STATE_COPY ? JOURNAL_ACTION_COPY
+                                                           : JOURNAL_ACTION_MOVE;
+    file_error_t result = complete_target(op, journal, action);
+    if (result != FERR_NONE) {
+      return result;
+    }
+  }
+
+  if (options->verbose) {
+    report_prepared_operation(op);
+  }
+
+  return FERR_NONE;
+}
+
+file_error_t file_transaction_finish_staging(
+  FileTransaction* transaction,
+  const FileIndex* index,
+  const TransactionOptions* options,
+  const char** failed_path
+) {
+  PANIC_IF_NULL(transaction);
+  PANIC_IF_NULL(index);
+  PANIC_IF_NULL(options);
+
+  if (failed_path != NULL) {
+    *failed_path = NULL;
+  }
+
+  stop_staging(transaction);
+  order_staged_operations(transaction, index);
+
+  if (options->verbose) {
+    printf("Preparing %zu operations...\n", index->file_count);
+  }
+
+  file_error_t result = FERR_NONE;
+  const char* failed_source = NULL;
+
+  /* Report first staging failure in index order */
+  if (transaction->staging_failed) {
+    for (size_t i = 0; i < transaction->operation_count; ++i) {
+      const PreparedOperation* op = &transaction->operations[i];
+      if (op->staging_result != FERR_NONE) {
+        result = op->staging_result;
+        failed_source = op->source_path;
+        break;
+      }
+    }
+  }
+
+  if (result == FERR_NONE) {
+    start_numbering(transaction, index, options);
+    for (size_t i = 0; i < transaction->operation_count; ++i) {
+      PreparedOperation* op = &transaction->operations[i];
+
+      result = finish_staged_operation(op, index, transaction, options);
+      if (result != FERR_NONE) {
+        failed_source = op->source_path;
+        break;
+      }
+    }
+  }
+
+  if (failed_source != NULL) {
+    if (failed_path != NULL) {
+      *failed_path = failed_source;
+    }
+    if (options->verbose) {
+      fprintf(stderr, "  Failed to prepare operation for: %s\n", failed_source);
+    }
+  }
+
+  if (options->verbose) {
+    if (result == FERR_NONE) {
+      printf("All operations prepared successfully.\n");
+    }
+    else {
+      fprintf(stderr, "Preparation failed.\n");
+    }
+  }
+
+  return result;
+}
+
+static file_error_t commit_move_operation(
+  PreparedOperation* op,
+  const TransactionOptions* options
+) {
+  int unlink_result = unlink(op->source_path);
+  if (unlink_result != 0) {
+    if (options->verbose) {
+      fprintf(stderr, "  Failed to remove source: %s\n", op->source_path);
+    }
+    return FERR_ACCESS_DENIED;
+  }
+  if (options->verbose) {
+    printf("  Committed move: %s\n", op->source_path);
+  }
+  return FERR_NONE;
+}
+
+static file_error_t commit_delete_operation(
+  PreparedOperation* op,
+  const TransactionOptions* options
+) {
+  int unlink_result = unlink(op->source_path);
+  if (unlink_result != 0) {
+    if (errno == ENOENT) {
+      if (options->verbose) {
+        fprintf(stderr, "  No such file: %s\n", op->source_path);
+      }
+      return FERR_INVALID_VALUE;
+    } else {
+      if (options->verbose) {
+        fprintf(stderr, "  Failed to delete: %s\n", op->source_path);
+      }
+      return FERR_ACCESS_DENIED;
+    }
+  } else if (options->verbose) {
+    printf("  Committed delete: %s\n", op->source_path);
+  }
+  return FERR_NONE;
+}
+
+static file_error_t commit_copy_operation(
+  PreparedOperation* op,
+  const TransactionOptions* options
+) {
+  if (options->verbose) {
+    printf("  Nothing to commit for %s (copied)\n", op->source_path);
+  }
+  return FERR_NONE;
+}
+
+static file_error_t commit_ignore_operation(
+  PreparedOperation* op,
+  const TransactionOptions* options
+) {
+  if (options->verbose) {
+    printf("  Nothing to commit for %s (ignored)\n", op->source_path);
+  }
+  return FERR_NONE;
+}
+
+static file_error_t commit_single_operation(
+  PreparedOperation* op,
+  const TransactionOptions* options
+) {
+  switch (op->state) {
+  case PREP_STATE_MOVE:
     return commit_move_operation(op, options);
   case PREP_STATE_DELETE:
     return commit_delete_operation(op, options);
@@ -565,6 +1662,73 @@ static file_error_t commit_single_operation(
   }
 }
 
+/* Flush data of all target files to disk */
+static file_error_t sync_target_data(FileTransaction* transaction, int directory_fd) {
+#if defined(__linux__)
+  if (syncfs(directory_fd) == 0) {
+    return FERR_NONE;
+  }
+#else
+  (void) directory_fd;
+#endif
+
+  for (size_t i = 0; i < transaction->operation_count; ++i) {
+    PreparedOperation* op = &transaction->operations[i];
+    if ((op->state != PREP_STATE_COPY && op->state != PREP_STATE_MOVE)
+        || op->target_path == NULL) {
+      continue;
+    }
+
+    /* fdatasync does not need write access, and targets may be read-only */
+    int fd = open(op->target_path, O_RDONLY);
+    if (fd < 0) {
+      return FERR_ACCESS_DENIED;
+    }
+    int sync_result = fdatasync(fd);
+    close(fd);
+    if (sync_result != 0) {
+      return FERR_ACCESS_DENIED;
+    }
+  }
+
+  return FERR_NONE;
+}
+
+/* Make target files and their names durable according to `options->sync` */
+static file_error_t sync_targets(
+  FileTransaction* transaction,
+  const TransactionOptions* options
+) {
+  if (options->sync == SYNC_NONE) {
+    return FERR_NONE;
+  }
+
+  int directory_fd = open(transaction->target_directory, O_RDONLY);
+  if (directory_fd < 0) {
+    return FERR_ACCESS_DENIED;
+  }
+
+  file_error_t result = FERR_NONE;
+  if (options->sync == SYNC_BATCH) {
+    /* Copied files are already flushed with SYNC_FILE */
+    result = sync_target_data(transaction, directory_fd);
+  }
+  /* New directory entries are durable only after directory is flushed */
+  if (result == FERR_NONE && fsync(directory_fd) != 0) {
+    result = FERR_ACCESS_DENIED;
+  }
+  close(directory_fd);
+
+  if (options->verbose) {
+    if (result == FERR_NONE) {
+      printf("  Synced target files to disk\n");
+    } else {
+      fprintf(stderr, "  Failed to sync target files to disk\n");
+    }
+  }
+  return result;
+}
+
 file_error_t file_transaction_commit(
   FileTransaction* transaction,
   const TransactionOptions* options
@@ -583,8 +1747,17 @@ file_error_t file_transaction_commit(
     printf("Committing %zu operations...\n", transaction->operation_count);
   }
 
-  LIST_FOREACH(node, transaction->operations) {
-    PreparedOperation* op = (PreparedOperation*) node;
+  /* Sources must not be removed until their copies are on disk */
+  file_error_t sync_result = sync_targets(transaction, options);
+  if (sync_result == FERR_NONE) {
+    sync_result = journal_record_commit(&transaction->journal, options->sync != SYNC_NONE);
+  }
+  if (sync_result != FERR_NONE) {
+    return sync_result;
+  }
+
+  for (size_t i = 0; i < transaction->operation_count; ++i) {
+    PreparedOperation* op = &transaction->operations[i];
 
     file_error_t result = commit_single_operation(op, options);
     if (result != FERR_NONE) {
@@ -592,12 +1765,47 @@ file_error_t file_transaction_commit(
     }
   }
 
+  journal_finish(&transaction->journal);
   if (options->verbose) {
     printf("All operations committed successfully.\n");
   }
   return FERR_NONE;
 }
 
+file_error_t file_transaction_continue(
+  FileTransaction* transaction,
+  const TransactionOptions* options
+) {
+  PANIC_IF_NULL(transaction);
+  PANIC_IF_NULL(options);
+
+  if (transaction->staging_pool != NULL) {
+    PANIC("cannot continue transaction while staging");
+  }
+
+  FileNumbering* numbering = &transaction->numbering;
+  if (numbering->per_date && numbering->date[0] != '\0') {
+    reserve_date_index(numbering, numbering->date, numbering->next_index);
+  }
+  save_taken_dates(numbering);
+  numbering->first_index = numbering->next_index;
+
+  transaction->operation_count = 0;
+  transaction->staged_count = 0;
+  transaction->staging_failed = 0;
+  arena_destroy(&transaction->arena);
+  arena_init(&transaction->arena);
+
+  if (options->dry_run) {
+    return FERR_NONE;
+  }
+
+  /* Journal of committed operations is already removed */
+  journal_close(&transaction->journal);
+  JournalRecovery recovery;
+  return journal_open(&transaction->journal, transaction->target_directory, &recovery);
+}
+
 file_error_t file_transaction_rollback(
   FileTransaction* transaction,
   const TransactionOptions* options
@@ -605,6 +1813,8 @@ file_error_t file_transaction_rollback(
   PANIC_IF_NULL(transaction);
   PANIC_IF_NULL(options);
 
+  stop_staging(transaction);
+
   if (options->dry_run) {
     if (options->verbose) {
       printf("Rollback (dry run) - no changes to undo.\n");
@@ -616,11 +1826,13 @@ file_error_t file_transaction_rollback(
     printf("Rolling back %zu operations...\n", transaction->operation_count);
   }
 
+  journal_release_unclaimed(&transaction->journal);
+
   file_error_t result = FERR_NONE;
   
   /* Remove target files created during prepare phase */
-  LIST_FOREACH(node, transaction->operations) {
-    PreparedOperation* op = (PreparedOperation*) node;
+  for (size_t i = 0; i < transaction->operation_count; ++i) {
+    PreparedOperation* op = &transaction->operations[i];
 
     switch (op->state) {
     case PREP_STATE_COPY:
@@ -648,6 +1860,10 @@ file_error_t file_transaction_rollback(
     }
   }
 
+  if (result == FERR_NONE) {
+    journal_finish(&transaction->journal);
+  }
+
   if (options->verbose) {
     if (result == FERR_NONE) {
       printf("Rollback completed successfully.\n");
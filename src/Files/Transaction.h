@@ -10,10 +10,38 @@
 #ifndef __FILES_TRANSACTION_H
 #define __FILES_TRANSACTION_H
 
+#include <pthread.h>
+
+#include "Files/Copy.h"
 #include "Files/Error.h"
 #include "Files/File.h"
 #include "Files/Index.h"
-#include "Common/List.h"
+#include "Files/Journal.h"
+#include "Common/Arena.h"
+#include "Common/StringSet.h"
+#include "Common/ThreadPool.h"
+
+/**
+ * @brief Use of copy-on-write clones for copied files
+ */
+enum ReflinkMode {
+  REFLINK_AUTO,   /*!< Clone files when possible, copy data otherwise */
+  REFLINK_ALWAYS, /*!< Fail if file cannot be cloned */
+  REFLINK_NEVER   /*!< Always copy file data */
+};
+
+typedef enum ReflinkMode reflink_mode_t;
+
+/**
+ * @brief Durability of target files before source files are removed
+ */
+enum SyncMode {
+  SYNC_NONE,  /*!< Leave writing data to disk to kernel */
+  SYNC_FILE,  /*!< Flush every copied file to disk as soon as it is written */
+  SYNC_BATCH  /*!< Flush all target files at once before commit */
+};
+
+typedef enum SyncMode sync_mode_t;
 
 /**
  * @brief Options for file operation execution
@@ -22,6 +50,14 @@ typedef struct {
   int dry_run;    /*!< If true, operations are simulated without actual file changes */
   int verbose;    /*!< If true, print detailed operation information */
   int force;      /*!< If true, allow overwriting existing files */
+  unsigned jobs;  /*!< Number of threads preparing operations, 0 or 1 to prepare sequentially */
+  reflink_mode_t reflink; /*!< Whether copies should share data with source files */
+  int io_uring;   /*!< If true, copy files through io_uring when it is available */
+  cache_policy_t cache_policy;  /*!< Use of page cache by copied files */
+  sync_mode_t sync;             /*!< Durability of target files */
+  size_t first_index;           /*!< Index in name of the first file */
+  unsigned index_width;         /*!< Minimal digits of index in name, 0 to fit the largest index */
+  int per_date_numbering;       /*!< If true, every date in names is numbered separately */
 } TransactionOptions;
 
 /**
@@ -41,28 +77,83 @@ typedef enum PreparedOperationState prepared_operation_state_t;
  * @brief Prepared operation for a single file
  */
 typedef struct {
-  LinkedListNode as_node;
-  
-  const IndexedFile* source_file;       /*!< Reference to source file */
-  char* target_path;                    /*!< Target file path (allocated) */
+  const char* source_path;              /*!< Path of source file (owned by index or transaction) */
+  size_t source_row;                    /*!< Row of source file in index */
+  char* target_path;                    /*!< Target file path (in transaction arena) */
   prepared_operation_state_t state;     /*!< Current state of operation */
+  file_error_t staging_result;          /*!< Result of background preparation */
+  copy_method_t copy_method;            /*!< Method used to copy file data */
+  int is_resumed;                       /*!< Target was completed by interrupted transaction */
 } PreparedOperation;
 
+/**
+ * @brief Date in target names with the first index free for it
+ */
+typedef struct {
+  char date[FILE_DATE_BUFSIZE]; /*!< Date in names, `YYYY-MM-DD` */
+  uint64_t next_index;          /*!< Index following the largest one taken */
+} DateIndex;
+
+/**
+ * @brief Indices in names of target files, assigned in index order
+ */
+typedef struct {
+  uint64_t first_index;         /*!< Index of the first file numbered by transaction */
+  uint64_t next_index;          /*!< Index of the next numbered file */
+  int per_date;                 /*!< If true, every date is numbered separately */
+  char date[FILE_DATE_BUFSIZE]; /*!< Date of the last numbered file, if numbered per date */
+  DateIndex* dates;             /*!< Free indices of other dates, sorted by date (allocated) */
+  size_t date_count;            /*!< Number of dates in `dates` */
+  size_t date_capacity;         /*!< Capacity of `dates` */
+  DateIndex* taken_dates;       /*!< Free indices of dates before the first file (allocated) */
+  size_t taken_count;           /*!< Number of dates in `taken_dates`, if known */
+  int is_taken_known;           /*!< Nonzero once `taken_dates` are found */
+} FileNumbering;
+
 /**
  * @brief Transaction context for two-phase operations
  */
 typedef struct {
-  LinkedList operations;  /*!< List of prepared operations */
-  char* target_directory; /*!< Target directory path (allocated) */
-  size_t operation_count; /*!< Number of operations */
+  PreparedOperation* operations;  /*!< Prepared operations in index order (allocated) */
+  size_t operation_count;         /*!< Number of operations */
+  size_t operation_capacity;      /*!< Capacity of `operations` */
+  char* target_directory;         /*!< Target directory path (allocated) */
+
+  ThreadPool* staging_pool;                   /*!< Staging workers, NULL if not staging */
+  const TransactionOptions* staging_options;  /*!< Options used for staging */
+  pthread_mutex_t staging_lock;               /*!< Protects operations during staging */
+  size_t staged_count;                        /*!< Number of files queued for staging */
+  int staging_failed;                         /*!< Nonzero if some file failed to stage */
+
+  Journal journal;                            /*!< Write-ahead journal in target directory */
+  StringSet target_names;                     /*!< Names in target directory before transaction */
+
+  FileNameFormatter name_formatter;           /*!< Names target files on calling thread */
+  FileNumbering numbering;                    /*!< Indices of target files in names */
+
+  Arena arena;                                /*!< Storage of target paths and staging tasks */
+  pthread_mutex_t arena_lock;                 /*!< Serializes allocations from arena */
 } FileTransaction;
 
 /**
  * @brief Initialize operation transaction
  *
+ * @note
+ * Unless running dry, state of every operation is recorded in journal in
+ * target directory until transaction is committed or rolled back. If journal
+ * of interrupted transaction is found, its targets completed with unchanged
+ * source and target are reused by operations with the same source and target
+ * path, and other targets are removed; an interrupted commit is finished
+ * instead. See `journal_open()`.
+ *
+ * Names in target directory are listed once, and collisions of target files
+ * are checked against this list. Files appearing later are still never
+ * overwritten without `options->force`, as targets are created exclusively.
+ *
  * @return FERR_NONE on success,
  *         FERR_INVALID_VALUE if target_dir is invalid,
- *         FERR_ACCESS_DENIED if directory cannot be accessed
+ *         FERR_ACCESS_DENIED if directory cannot be accessed,
+ *         FERR_ALREADY_EXISTS if another process uses target directory
  */
 file_error_t file_transaction_init(
   FileTransaction* transaction,
@@ -76,7 +167,21 @@ file_error_t file_transaction_init(
 void file_transaction_cleanup(FileTransaction* transaction);
 
 /**
- * @brief Prepare transaction for files in index
+ * @brief Prepare transaction for files in index. Target files are numbered
+ * in index order starting from `options->first_index`, skipping ignored files.
+ * With `options->per_date_numbering` every date is numbered separately,
+ * starting after the largest index of this date in target directory.
+ *
+ * Indices are zero-padded to `options->index_width` digits. If the width is
+ * zero, it fits the largest index of transaction, but is at least
+ * `FILE_INDEX_DEFAULT_WIDTH`.
+ *
+ * @note With `options->jobs` greater than one, operations are prepared on
+ * a pool of worker threads, but are still added to transaction in index
+ * order. Every worker copies its file on a single thread, so that large
+ * files are not split into chunks on top of the pool. After the first failure
+ * no new operations are started, including those already queued, and the
+ * failure of the earliest file in index is reported.
  *
  * @return FERR_NONE on success,
  *         error code on failure (no operations committed); if @p failed_path
@@ -90,9 +195,51 @@ file_error_t file_transaction_prepare(
   const char** failed_path
 );
 
+/**
+ * @brief Start preparing files in background as soon as they are found.
+ *
+ * Files queued with `file_transaction_stage()` are copied or linked by
+ * `options->jobs` workers to temporary names in target directory. Final names
+ * depend on order of files, so they are assigned by
+ * `file_transaction_finish_staging()` once the index is complete.
+ *
+ * @note `options` must stay valid until staging is finished
+ */
+void file_transaction_begin_staging(
+  FileTransaction* transaction,
+  const TransactionOptions* options
+);
+
+/**
+ * @brief Queue file for staging. Blocks while staging queue is full.
+ *
+ * @note Can be called from several threads at once. File path is copied,
+ *       so file can be freed if staging is aborted by rollback.
+ */
+void file_transaction_stage(FileTransaction* transaction, const IndexedFile* file);
+
+/**
+ * @brief Wait for staging workers and move staged files to final names
+ * in index order, completing the prepare phase.
+ * Files of index which were not staged are prepared synchronously.
+ *
+ * @return Same as `file_transaction_prepare()`
+ */
+file_error_t file_transaction_finish_staging(
+  FileTransaction* transaction,
+  const FileIndex* index,
+  const TransactionOptions* options,
+  const char** failed_path
+);
+
 /**
  * @brief Commit all prepared operations
  *
+ * @note Unless `options->sync` is `SYNC_NONE`, target files and target
+ * directory are flushed to disk before any source file is removed. With
+ * `SYNC_BATCH` the whole target file system is synced at once where
+ * `syncfs()` is available, otherwise target files are flushed one by one.
+ *
  * @return FERR_NONE on success,
  *         error code on failure (partial commit may have occurred)
  */
@@ -101,6 +248,25 @@ file_error_t file_transaction_commit(
   const TransactionOptions* options
 );
 
+/**
+ * @brief Start another round of prepare and commit in committed transaction,
+ * e.g. for the next window of files too many to prepare at once.
+ *
+ * @note Prepared operations are dropped. Files of the next round are
+ * numbered after files of the committed ones, so their names never repeat
+ * committed targets, which are not listed again. Unless running dry, a new
+ * journal is started.
+ *
+ * @warning Must only be called after successful commit
+ *
+ * @return FERR_NONE on success,
+ *         FERR_ALREADY_EXISTS if another process took over target directory
+ */
+file_error_t file_transaction_continue(
+  FileTransaction* transaction,
+  const TransactionOptions* options
+);
+
 /**
  * @brief Rollback all prepared operations
  *
@@ -0,0 +1,677 @@
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+
+#include "Uring.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+/* Kernel headers may be missing, e.g. with musl toolchain */
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+/* Opening and closing files through ring requires Linux 5.6 headers */
+#if defined(IORING_FEAT_RW_CUR_POS) && defined(__NR_io_uring_setup)
+#define HAVE_IO_URING
+#endif
+#endif
+#endif
+
+#include "Common/Panic.h"
+
+#if defined(HAVE_IO_URING)
+
+enum {
+  SLOT_COUNT = 32,              /* Files in flight, one buffer each */
+  SLOT_BUFFER_SIZE = 256 << 10, /* Size of registered buffer */
+  MAX_PROBED_OPS = 256          /* Opcodes checked by support probe */
+};
+
+/* Shared rings mapped from kernel */
+typedef struct {
+  int fd;
+
+  unsigned* sq_tail;
+  unsigned sq_mask;
+  unsigned* sq_array;
+  struct io_uring_sqe* sqes;
+  unsigned sqe_tail;          /* Tail including entries not yet published */
+  unsigned to_submit;         /* Entries queued since last submission */
+
+  unsigned* cq_head;
+  unsigned* cq_tail;
+  unsigned cq_mask;
+  struct io_uring_cqe* cqes;
+
+  void* sq_ring;
+  size_t sq_ring_size;
+  void* cq_ring;              /* NULL if shared with submission ring */
+  size_t cq_ring_size;
+  size_t sqes_size;
+} Ring;
+
+typedef enum {
+  STEP_IDLE,
+  STEP_OPEN_SOURCE,
+  STEP_OPEN_DEST,
+  STEP_READ,
+  STEP_WRITE,
+  STEP_CLOSE_SOURCE,
+  STEP_SYNC_DEST,
+  STEP_EVICT_DEST,
+  STEP_CLOSE_DEST
+} copy_step_t;
+
+/* File copy in flight */
+typedef struct {
+  UringCopy* copy;
+  copy_step_t step;
+  int source_fd;
+  int dest_fd;
+  int dest_flags;       /* Flags used to open destination */
+  char* buffer;         /* Registered buffer owned by slot */
+  off_t offset;         /* Position of buffer data in file */
+  unsigned length;      /* Amount of data in buffer */
+  unsigned written;     /* Amount of buffer data already written */
+  int is_synced;        /* Nonzero if destination data is flushed to disk */
+  int is_evicted;       /* Nonzero if destination is dropped from page cache */
+} CopySlot;
+
+typedef struct {
+  Ring ring;
+  CopySlot slots[SLOT_COUNT];
+  char* buffers;
+  int use_fixed_buffers;  /* Nonzero if buffers are registered in kernel */
+  size_t active_count;    /* Number of busy slots */
+  int failed;             /* Nonzero if some copy failed */
+  const TransactionOptions* options;
+} Copier;
+
+static int io_uring_setup(unsigned entries, struct io_uring_params* params) {
+  return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+  return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int io_uring_register(int fd, unsigned opcode, void* argument, unsigned count) {
+  return (int) syscall(__NR_io_uring_register, fd, opcode, argument, count);
+}
+
+static void ring_destroy(Ring* ring) {
+  if (ring->sqes != NULL) {
+    munmap(ring->sqes, ring->sqes_size);
+  }
+  if (ring->cq_ring != NULL) {
+    munmap(ring->cq_ring, ring->cq_ring_size);
+  }
+  if (ring->sq_ring != NULL) {
+    munmap(ring->sq_ring, ring->sq_ring_size);
+  }
+  if (ring->fd >= 0) {
+    close(ring->fd);
+  }
+  memset(ring, 0, sizeof(*ring));
+  ring->fd = -1;
+}
+
+static void* map_ring(int fd, size_t size, unsigned long long offset) {
+  void* memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      fd, (off_t) offset);
+  return memory == MAP_FAILED ? NULL : memory;
+}
+
+static int ring_init(Ring* ring, unsigned entries) {
+  memset(ring, 0, sizeof(*ring));
+
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  ring->fd = io_uring_setup(entries, &params);
+  if (ring->fd < 0) {
+    return -1;
+  }
+
+  ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    if (ring->cq_ring_size > ring->sq_ring_size) {
+      ring->sq_ring_size = ring->cq_ring_size;
+    }
+  }
+
+  ring->sq_ring = map_ring(ring->fd, ring->sq_ring_size, IORING_OFF_SQ_RING);
+  if (ring->sq_ring == NULL) {
+    goto fail;
+  }
+
+  char* cq_base = (char*) ring->sq_ring;
+  if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+    ring->cq_ring = map_ring(ring->fd, ring->cq_ring_size, IORING_OFF_CQ_RING);
+    if (ring->cq_ring == NULL) {
+      goto fail;
+    }
+    cq_base = (char*) ring->cq_ring;
+  }
+
+  ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = (struct io_uring_sqe*) map_ring(ring->fd, ring->sqes_size, IORING_OFF_SQES);
+  if (ring->sqes == NULL) {
+    goto fail;
+  }
+
+  char* sq_base = (char*) ring->sq_ring;
+  ring->sq_tail = (unsigned*) (sq_base + params.sq_off.tail);
+  ring->sq_mask = *(unsigned*) (sq_base + params.sq_off.ring_mask);
+  ring->sq_array = (unsigned*) (sq_base + params.sq_off.array);
+  ring->sqe_tail = *ring->sq_tail;
+
+  ring->cq_head = (unsigned*) (cq_base + params.cq_off.head);
+  ring->cq_tail = (unsigned*) (cq_base + params.cq_off.tail);
+  ring->cq_mask = *(unsigned*) (cq_base + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe*) (cq_base + params.cq_off.cqes);
+
+  return 0;
+
+fail:
+  ring_destroy(ring);
+  return -1;
+}
+
+/* Check that kernel supports all operations used for copying */
+static int ring_supports_copy(Ring* ring) {
+  size_t probe_size = sizeof(struct io_uring_probe)
+                    + MAX_PROBED_OPS * sizeof(struct io_uring_probe_op);
+  struct io_uring_probe* probe = (struct io_uring_probe*) calloc(1, probe_size);
+  PANIC_ON_BAD_ALLOC(probe);
+
+  int is_supported = 0;
+  if (io_uring_register(ring->fd, IORING_REGISTER_PROBE, probe, MAX_PROBED_OPS) < 0) {
+    goto quit;
+  }
+
+  static const unsigned RequiredOps[] = {
+    IORING_OP_OPENAT,
+    IORING_OP_CLOSE,
+    IORING_OP_READ,
+    IORING_OP_WRITE,
+    IORING_OP_READ_FIXED,
+    IORING_OP_WRITE_FIXED,
+    IORING_OP_FSYNC,
+    IORING_OP_SYNC_FILE_RANGE
+  };
+  for (size_t i = 0; i < sizeof(RequiredOps) / sizeof(*RequiredOps); ++i) {
+    unsigned op = RequiredOps[i];
+    if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+      goto quit;
+    }
+  }
+  is_supported = 1;
+
+quit:
+  free(probe);
+  return is_supported;
+}
+
+/* Get entry for new request. Ring is large enough for one request per slot. */
+static struct io_uring_sqe* ring_get_sqe(Ring* ring, size_t slot_index) {
+  unsigned index = ring->sqe_tail & ring->sq_mask;
+
+  struct io_uring_sqe* sqe = &ring->sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->user_data = (unsigned long long) slot_index;
+  ring->sq_array[index] = index;
+
+  ring->sqe_tail++;
+  ring->to_submit++;
+
+  return sqe;
+}
+
+static int ring_submit_and_wait(Ring* ring) {
+  /* Entries must be visible to kernel before tail is moved */
+  __atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+
+  for (;;) {
+    int submitted = io_uring_enter(ring->fd, ring->to_submit, 1, IORING_ENTER_GETEVENTS);
+    if (submitted >= 0) {
+      ring->to_submit -= (unsigned) submitted;
+      return 0;
+    }
+    if (errno != EINTR && errno != EAGAIN) {
+      return -1;
+    }
+  }
+}
+
+static void submit_open(Copier* copier, size_t slot_index, const char* path, int flags) {
+  struct io_uring_sqe* sqe = ring_get_sqe(&copier->ring, slot_index);
+  sqe->opcode = IORING_OP_OPENAT;
+  sqe->fd = AT_FDCWD;
+  sqe->addr = (unsigned long long) (uintptr_t) path;
+  sqe->len = 0666;
+  sqe->open_flags = (unsigned) flags;
+}
+
+static void submit_close(Copier* copier, size_t slot_index, int fd) {
+  struct io_uring_sqe* sqe = ring_get_sqe(&copier->ring, slot_index);
+  sqe->opcode = IORING_OP_CLOSE;
+  sqe->fd = fd;
+}
+
+static void submit_datasync(Copier* copier, size_t slot_index, int fd) {
+  struct io_uring_sqe* sqe = ring_get_sqe(&copier->ring, slot_index);
+  sqe->opcode = IORING_OP_FSYNC;
+  sqe->fd = fd;
+  sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+}
+
+/* Write destination to disk and wait for it, so that its pages can be evicted */
+static void submit_writeback(Copier* copier, size_t slot_index, int fd) {
+  struct io_uring_sqe* sqe = ring_get_sqe(&copier->ring, slot_index);
+  sqe->opcode = IORING_OP_SYNC_FILE_RANGE;
+  sqe->fd = fd;
+  sqe->sync_range_flags = SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE
+                        | SYNC_FILE_RANGE_WAIT_AFTER;
+}
+
+static void submit_read(Copier* copier, size_t slot_index) {
+  CopySlot* slot = &copier->slots[slot_index];
+  struct io_uring_sqe* sqe = ring_get_sqe(&copier->ring, slot_index);
+  sqe->opcode = copier->use_fixed_buffers ? IORING_OP_READ_FIXED : IORING_OP_READ;
+  sqe->fd = slot->source_fd;
+  sqe->addr = (unsigned long long) (uintptr_t) slot->buffer;
+  sqe->len = SLOT_BUFFER_SIZE;
+  sqe->off = (unsigned long long) slot->offset;
+  if (copier->use_fixed_buffers) {
+    sqe->buf_index = (unsigned short) slot_index;
+  }
+}
+
+static void submit_write(Copier* copier, size_t slot_index) {
+  CopySlot* slot = &copier->slots[slot_index];
+  struct io_uring_sqe* sqe = ring_get_sqe(&copier->ring, slot_index);
+  sqe->opcode = copier->use_fixed_buffers ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+  sqe->fd = slot->dest_fd;
+  sqe->addr = (unsigned long long) (uintptr_t) (slot->buffer + slot->written);
+  sqe->len = slot->length - slot->written;
+  sqe->off = (unsigned long long) (slot->offset + slot->written);
+  if (copier->use_fixed_buffers) {
+    sqe->buf_index = (unsigned short) slot_index;
+  }
+}
+
+static void start_copy(Copier* copier, size_t slot_index, UringCopy* copy) {
+  CopySlot* slot = &copier->slots[slot_index];
+  slot->copy = copy;
+  slot->source_fd = -1;
+  slot->dest_fd = -1;
+  slot->offset = 0;
+  slot->length = 0;
+  slot->written = 0;
+  slot->is_synced = 0;
+  slot->is_evicted = 0;
+
+  copy->is_started = 1;
+  copy->result = FERR_NONE;
+  copy->method = COPY_METHOD_NONE;
+
+  slot->step = STEP_OPEN_SOURCE;
+  submit_open(copier, slot_index, copy->source_path, O_RDONLY | O_CLOEXEC);
+  copier->active_count++;
+}
+
+/* Flush and close files of finished copy, one request at a time */
+static void finish_copy(Copier* copier, size_t slot_index, file_error_t result) {
+  CopySlot* slot = &copier->slots[slot_index];
+  if (slot->copy->result == FERR_NONE) {
+    slot->copy->result = result;
+  }
+
+  int is_copied = slot->copy->result == FERR_NONE;
+  int drops_cache = copier->options->cache_policy != CACHE_POLICY_KEEP;
+  if (slot->source_fd >= 0) {
+#if defined(POSIX_FADV_DONTNEED)
+    if (drops_cache) {
+      posix_fadvise(slot->source_fd, 0, 0, POSIX_FADV_DONTNEED);
+    }
+#endif
+    slot->step = STEP_CLOSE_SOURCE;
+    submit_close(copier, slot_index, slot->source_fd);
+    slot->source_fd = -1;
+    return;
+  }
+  if (slot->dest_fd >= 0 && !slot->is_synced
+      && is_copied && copier->options->sync == SYNC_FILE) {
+    slot->is_synced = 1;
+    slot->step = STEP_SYNC_DEST;
+    submit_datasync(copier, slot_index, slot->dest_fd);
+    return;
+  }
+  if (slot->dest_fd >= 0 && !slot->is_evicted && is_copied && drops_cache) {
+    slot->is_evicted = 1;
+    slot->step = STEP_EVICT_DEST;
+    submit_writeback(copier, slot_index, slot->dest_fd);
+    return;
+  }
+  if (slot->dest_fd >= 0) {
+    slot->step = STEP_CLOSE_DEST;
+    submit_close(copier, slot_index, slot->dest_fd);
+    slot->dest_fd = -1;
+    return;
+  }
+
+  if (slot->copy->result != FERR_NONE) {
+    copier->failed = 1;
+  }
+  slot->step = STEP_IDLE;
+  slot->copy = NULL;
+  copier->active_count--;
+}
+
+static file_error_t open_error(int error) {
+  return error == ENOENT ? FERR_INVALID_VALUE : FERR_ACCESS_DENIED;
+}
+
+static void handle_open_dest(Copier* copier, size_t slot_index, int res) {
+  CopySlot* slot = &copier->slots[slot_index];
+  const TransactionOptions* options = copier->options;
+
+  if (res == -EEXIST && (slot->dest_flags & O_EXCL)) {
+    if (!options->force) {
+      finish_copy(copier, slot_index, FERR_ALREADY_EXISTS);
+      return;
+    }
+    if (options->verbose) {
+      fprintf(stderr, "Warning: Overwriting existing file '%s'\n", slot->copy->dest_path);
+    }
+    slot->dest_flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+    submit_open(copier, slot_index, slot->copy->dest_path, slot->dest_flags);
+    return;
+  }
+  if (res < 0) {
+    finish_copy(copier, slot_index, open_error(-res));
+    return;
+  }
+  slot->dest_fd = res;
+
+  if (options->reflink != REFLINK_NEVER) {
+    file_error_t result = file_clone_data(slot->source_fd, slot->dest_fd);
+    if (result == FERR_NONE) {
+      slot->copy->method = COPY_METHOD_CLONE;
+      finish_copy(copier, slot_index, FERR_NONE);
+      return;
+    }
+    if (options->reflink == REFLINK_ALWAYS) {
+      finish_copy(copier, slot_index, result);
+      return;
+    }
+  }
+
+  slot->copy->method = COPY_METHOD_URING;
+  slot->step = STEP_READ;
+  submit_read(copier, slot_index);
+}
+
+static void handle_completion(Copier* copier, size_t slot_index, int res) {
+  CopySlot* slot = &copier->slots[slot_index];
+
+  switch (slot->step) {
+  case STEP_OPEN_SOURCE:
+    if (res < 0) {
+      finish_copy(copier, slot_index, open_error(-res));
+      return;
+    }
+    slot->source_fd = res;
+#if defined(POSIX_FADV_SEQUENTIAL)
+    if (copier->options->cache_policy != CACHE_POLICY_KEEP) {
+      posix_fadvise(slot->source_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+#endif
+    slot->step = STEP_OPEN_DEST;
+    slot->dest_flags = O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC;
+    submit_open(copier, slot_index, slot->copy->dest_path, slot->dest_flags);
+    return;
+
+  case STEP_OPEN_DEST:
+    handle_open_dest(copier, slot_index, res);
+    return;
+
+  case STEP_READ:
+    if (res == -EINTR || res == -EAGAIN) {
+      submit_read(copier, slot_index);
+      return;
+    }
+    if (res < 0) {
+      finish_copy(copier, slot_index, FERR_ACCESS_DENIED);
+      return;
+    }
+    if (res == 0) {
+      /* End of file */
+      finish_copy(copier, slot_index, FERR_NONE);
+      return;
+    }
+    slot->length = (unsigned) res;
+    slot->written = 0;
+    slot->step = STEP_WRITE;
+    submit_write(copier, slot_index);
+    return;
+
+  case STEP_WRITE:
+    if (res == -EINTR || res == -EAGAIN) {
+      submit_write(copier, slot_index);
+      return;
+    }
+    if (res <= 0) {
+      finish_copy(copier, slot_index, FERR_ACCESS_DENIED);
+      return;
+    }
+    slot->written += (unsigned) res;
+    if (slot->written < slot->length) {
+      submit_write(copier, slot_index);
+      return;
+    }
+    slot->offset += slot->length;
+    slot->step = STEP_READ;
+    submit_read(copier, slot_index);
+    return;
+
+  case STEP_CLOSE_SOURCE:
+    finish_copy(copier, slot_index, FERR_NONE);
+    return;
+
+  case STEP_SYNC_DEST:
+    finish_copy(copier, slot_index, res < 0 ? FERR_ACCESS_DENIED : FERR_NONE);
+    return;
+
+  case STEP_EVICT_DEST:
+#if defined(POSIX_FADV_DONTNEED)
+    if (res >= 0) {
+      posix_fadvise(slot->dest_fd, 0, 0, POSIX_FADV_DONTNEED);
+    }
+#endif
+    /* Failed writeback is reported by close */
+    finish_copy(copier, slot_index, FERR_NONE);
+    return;
+
+  case STEP_CLOSE_DEST:
+    /* Delayed write errors are reported on close */
+    if (res < 0 && slot->copy->result == FERR_NONE) {
+      slot->copy->result = FERR_ACCESS_DENIED;
+    }
+    if (slot->copy->result != FERR_NONE) {
+      /* Remove partially created file on error */
+      unlink(slot->copy->dest_path);
+    }
+    finish_copy(copier, slot_index, FERR_NONE);
+    return;
+
+  case STEP_IDLE:
+  default:
+    PANIC("completion for idle copy slot");
+  }
+}
+
+static void register_buffers(Copier* copier) {
+  struct iovec iovecs[SLOT_COUNT];
+  for (size_t i = 0; i < SLOT_COUNT; ++i) {
+    iovecs[i].iov_base = copier->slots[i].buffer;
+    iovecs[i].iov_len = SLOT_BUFFER_SIZE;
+  }
+
+  /* Locked memory limit may be too low, plain reads and writes work anyway */
+  copier->use_fixed_buffers =
+    io_uring_register(copier->ring.fd, IORING_REGISTER_BUFFERS, iovecs, SLOT_COUNT) == 0;
+}
+
+/* Fail all copies in flight when ring cannot be used anymore */
+static void abort_copies(Copier* copier) {
+  for (size_t i = 0; i < SLOT_COUNT; ++i) {
+    CopySlot* slot = &copier->slots[i];
+    if (slot->step == STEP_IDLE) {
+      continue;
+    }
+
+    if (slot->source_fd >= 0) {
+      close(slot->source_fd);
+    }
+    /*
+     * Destination being opened may still be created by kernel after abort.
+     * Its name was free when target directory was listed, and missing file
+     * is fine to unlink.
+     */
+    if (slot->dest_fd >= 0 || slot->step == STEP_OPEN_DEST
+        || slot->step == STEP_CLOSE_DEST) {
+      if (slot->dest_fd >= 0) {
+        close(slot->dest_fd);
+      }
+      unlink(slot->copy->dest_path);
+    }
+    slot->copy->result = FERR_ACCESS_DENIED;
+    slot->step = STEP_IDLE;
+    slot->copy = NULL;
+  }
+  copier->active_count = 0;
+  copier->failed = 1;
+}
+
+static void process_completions(Copier* copier) {
+  Ring* ring = &copier->ring;
+  unsigned head = *ring->cq_head;
+  unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+  while (head != tail) {
+    const struct io_uring_cqe* cqe = &ring->cqes[head & ring->cq_mask];
+    size_t slot_index = (size_t) cqe->user_data;
+    int res = cqe->res;
+
+    head++;
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+    handle_completion(copier, slot_index, res);
+  }
+}
+
+static pthread_once_t sAvailabilityOnce = PTHREAD_ONCE_INIT;
+static int sIsAvailable = 0;
+
+static void check_availability(void) {
+  Ring ring;
+  if (ring_init(&ring, 1) != 0) {
+    return;
+  }
+  sIsAvailable = ring_supports_copy(&ring);
+  ring_destroy(&ring);
+}
+
+int file_uring_is_available(void) {
+  pthread_once(&sAvailabilityOnce, check_availability);
+  return sIsAvailable;
+}
+
+void file_uring_copy(size_t count, UringCopy copies[], const TransactionOptions* options) {
+  PANIC_IF_NULL(options);
+
+  for (size_t i = 0; i < count; ++i) {
+    copies[i].is_started = 0;
+    copies[i].result = FERR_NONE;
+    copies[i].method = COPY_METHOD_NONE;
+  }
+  if (count == 0) {
+    return;
+  }
+
+  Copier* copier = (Copier*) calloc(1, sizeof(*copier));
+  PANIC_ON_BAD_ALLOC(copier);
+  copier->options = options;
+
+  if (ring_init(&copier->ring, SLOT_COUNT) != 0) {
+    free(copier);
+    copies[0].is_started = 1;
+    copies[0].result = FERR_ACCESS_DENIED;
+    return;
+  }
+
+  copier->buffers = (char*) malloc((size_t) SLOT_COUNT * SLOT_BUFFER_SIZE);
+  PANIC_ON_BAD_ALLOC(copier->buffers);
+  for (size_t i = 0; i < SLOT_COUNT; ++i) {
+    copier->slots[i].buffer = copier->buffers + i * SLOT_BUFFER_SIZE;
+    copier->slots[i].step = STEP_IDLE;
+  }
+  register_buffers(copier);
+
+  size_t next = 0;
+  for (;;) {
+    /* Start new copies in free slots, unless some copy has failed */
+    for (size_t i = 0; i < SLOT_COUNT && next < count && !copier->failed; ++i) {
+      if (copier->slots[i].step == STEP_IDLE) {
+        start_copy(copier, i, &copies[next]);
+        next++;
+      }
+    }
+
+    if (copier->active_count == 0) {
+      break;
+    }
+
+    if (ring_submit_and_wait(&copier->ring) != 0) {
+      /* Pending requests are cancelled when ring is destroyed */
+      ring_destroy(&copier->ring);
+      abort_copies(copier);
+      break;
+    }
+    process_completions(copier);
+  }
+
+  if (copier->ring.fd >= 0) {
+    ring_destroy(&copier->ring);
+  }
+  free(copier->buffers);
+  free(copier);
+}
+
+#else /* HAVE_IO_URING */
+
+int file_uring_is_available(void) {
+  return 0;
+}
+
+void file_uring_copy(size_t count, UringCopy copies[], const TransactionOptions* options) {
+  (void) count;
+  (void) copies;
+  (void) options;
+  PANIC("io_uring is not supported on this platform");
+}
+
+#endif /* HAVE_IO_URING */
@@ -0,0 +1,64 @@
+/**
+ * @file Uring.h
+ * @author MeerkatBoss (solodovnikov.ia@phystech.su)
+ *
+ * @brief Batched asynchronous file copying with io_uring
+ *
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright MeerkatBoss (c) 2026
+ */
+#ifndef __FILES_URING_H
+#define __FILES_URING_H
+
+#include <stddef.h>
+
+#include "Files/Copy.h"
+#include "Files/Error.h"
+#include "Files/Transaction.h"
+
+/**
+ * @brief Single file copied with `file_uring_copy()`
+ */
+typedef struct {
+  const char* source_path;  /*!< [in]  Path to source file */
+  const char* dest_path;    /*!< [in]  Path to created file */
+
+  int is_started;           /*!< [out] Nonzero if copy was attempted */
+  file_error_t result;      /*!< [out] Result of copy, if started */
+  copy_method_t method;     /*!< [out] Method that copied the data */
+} UringCopy;
+
+/**
+ * @brief Check whether io_uring can be used for copying files.
+ * The check is performed once, the result is cached.
+ */
+int file_uring_is_available(void);
+
+/**
+ * @brief Copy files with many of them in flight at once.
+ *
+ * @note
+ * Opening, reading, writing and closing files is submitted to kernel in
+ * batches through io_uring, using a fixed-size pool of registered buffers.
+ * Copies are started in order; after the first failure no new copies are
+ * started, while copies in flight are completed. Partially written
+ * destination files are removed. Existing destination files are only
+ * overwritten with `options->force`, files are cloned according to
+ * `options->reflink` and flushed according to `options->sync` as with
+ * synchronous copy. Unless `options->cache_policy` is `CACHE_POLICY_KEEP`,
+ * sources are read sequentially and both files are evicted from page cache
+ * once copied; `O_DIRECT` is never used.
+ *
+ * @warning io_uring must be available, see `file_uring_is_available()`.
+ * If kernel resources cannot be allocated, the first copy fails with
+ * FERR_ACCESS_DENIED.
+ */
+void file_uring_copy(
+  size_t count,                     /*!< [in]    Number of files */
+  UringCopy copies[],               /*!< [inout] Copied files */
+  const TransactionOptions* options /*!< [in]    Copy options */
+);
+
+#endif /* Uring.h */
@@ -0,0 +1,499 @@
+#if defined(__linux__)
+#define _GNU_SOURCE /* fdopendir(), d_type, O_DIRECTORY */
+#endif
+
+#include "Walker.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Common/Panic.h"
+#include "Common/Strings.h"
+#include "Files/File.h"
+
+enum {
+  DEQUE_INITIAL_CAPACITY = 16,
+  VISITED_INITIAL_CAPACITY = 64
+};
+
+typedef struct {
+  char* path;     /* Full path to directory (allocated) */
+  unsigned depth; /* Nesting level, root directory has depth 0 */
+} DirectoryTask;
+
+/*
+ * Double-ended queue of pending directories. Owner pushes and pops at the
+ * back (depth-first, keeps caches warm), thieves take from the front, where
+ * the oldest and typically largest subtrees are.
+ */
+typedef struct {
+  pthread_mutex_t lock;
+  DirectoryTask* tasks; /* Ring buffer */
+  size_t capacity;
+  size_t head;
+  size_t count;
+} TaskDeque;
+
+typedef struct {
+  dev_t device;
+  ino_t inode;
+} DirectoryId;
+
+/* Open-addressing hash set of visited directories */
+typedef struct {
+  DirectoryId* slots;
+  unsigned char* used;
+  size_t capacity;
+  size_t count;
+} VisitedSet;
+
+typedef struct Walker_ Walker;
+
+typedef struct {
+  Walker* walker;
+  size_t id;
+  pthread_t thread;
+
+  TaskDeque deque;
+  FileIndex files;    /* Files found by this worker */
+} WalkerWorker;
+
+struct Walker_ {
+  WalkerWorker* workers;
+  size_t worker_count;
+  unsigned max_depth;
+  const IndexOptions* options;
+
+  pthread_mutex_t lock;
+  pthread_cond_t has_work;  /* Signalled when task is queued or walk is over */
+  size_t queued;            /* Tasks waiting in deques */
+  size_t pending;           /* Tasks waiting in deques or being processed */
+  file_error_t error;       /* First error encountered */
+
+  pthread_mutex_t visited_lock;
+  VisitedSet visited;
+};
+
+static void deque_init(TaskDeque* deque) {
+  pthread_mutex_init(&deque->lock, NULL);
+  deque->tasks = NULL;
+  deque->capacity = 0;
+  deque->head = 0;
+  deque->count = 0;
+}
+
+static void deque_destroy(TaskDeque* deque) {
+  for (size_t i = 0; i < deque->count; ++i) {
+    free(deque->tasks[(deque->head + i) % deque->capacity].path);
+  }
+  free(deque->tasks);
+  deque->tasks = NULL;
+  deque->capacity = 0;
+  deque->count = 0;
+  pthread_mutex_destroy(&deque->lock);
+}
+
+static void deque_push_back(TaskDeque* deque, DirectoryTask task) {
+  pthread_mutex_lock(&deque->lock);
+
+  if (deque->count == deque->capacity) {
+    size_t new_capacity = deque->capacity > 0 ? 2 * deque->capacity : DEQUE_INITIAL_CAPACITY;
+    DirectoryTask* new_tasks = (DirectoryTask*) calloc(new_capacity, sizeof(*new_tasks));
+    PANIC_ON_BAD_ALLOC(new_tasks);
+    for (size_t i = 0; i < deque->count; ++i) {
+      new_tasks[i] = deque->tasks[(deque->head + i) % deque->capacity];
+    }
+    free(deque->tasks);
+    deque->tasks = new_tasks;
+    deque->capacity = new_capacity;
+    deque->head = 0;
+  }
+
+  deque->tasks[(deque->head + deque->count) % deque->capacity] = task;
+  deque->count++;
+
+  pthread_mutex_unlock(&deque->lock);
+}
+
+static int deque_pop_back(TaskDeque* deque, DirectoryTask* task) {
+  int found = 0;
+
+  pthread_mutex_lock(&deque->lock);
+  if (deque->count > 0) {
+    deque->count--;
+    *task = deque->tasks[(deque->head + deque->count) % deque->capacity];
+    found = 1;
+  }
+  pthread_mutex_unlock(&deque->lock);
+
+  return found;
+}
+
+static int deque_pop_front(TaskDeque* deque, DirectoryTask* task) {
+  int found = 0;
+
+  pthread_mutex_lock(&deque->lock);
+  if (deque->count > 0) {
+    *task = deque->tasks[deque->head];
+    deque->head = (deque->head + 1) % deque->capacity;
+    deque->count--;
+    found = 1;
+  }
+  pthread_mutex_unlock(&deque->lock);
+
+  return found;
+}
+
+static size_t directory_id_hash(DirectoryId id, size_t capacity) {
+  uint64_t hash = (uint64_t) id.inode * 0x9E3779B97F4A7C15ULL;
+  hash ^= (uint64_t) id.device + (hash >> 29);
+  return (size_t) (hash % capacity);
+}
+
+static void visited_init(VisitedSet* set) {
+  set->slots = NULL;
+  set->used = NULL;
+  set->capacity = 0;
+  set->count = 0;
+}
+
+static void visited_destroy(VisitedSet* set) {
+  free(set->slots);
+  free(set->used);
+  visited_init(set);
+}
+
+static void visited_grow(VisitedSet* set) {
+  size_t new_capacity = set->capacity > 0 ? 2 * set->capacity : VISITED_INITIAL_CAPACITY;
+  DirectoryId* new_slots = (DirectoryId*) calloc(new_capacity, sizeof(*new_slots));
+  unsigned char* new_used = (unsigned char*) calloc(new_capacity, sizeof(*new_used));
+  PANIC_ON_BAD_ALLOC(new_slots);
+  PANIC_ON_BAD_ALLOC(new_used);
+
+  for (size_t i = 0; i < set->capacity; ++i) {
+    if (!set->used[i]) {
+      continue;
+    }
+    size_t pos = directory_id_hash(set->slots[i], new_capacity);
+    while (new_used[pos]) {
+      pos = (pos + 1) % new_capacity;
+    }
+    new_slots[pos] = set->slots[i];
+    new_used[pos] = 1;
+  }
+
+  free(set->slots);
+  free(set->used);
+  set->slots = new_slots;
+  set->used = new_used;
+  set->capacity = new_capacity;
+}
+
+/* Returns nonzero if directory was not visited before */
+static int visited_insert(VisitedSet* set, DirectoryId id) {
+  if (2 * (set->count + 1) > set->capacity) {
+    visited_grow(set);
+  }
+
+  size_t pos = directory_id_hash(id, set->capacity);
+  while (set->used[pos]) {
+    if (set->slots[pos].device == id.device && set->slots[pos].inode == id.inode) {
+      return 0;
+    }
+    pos = (pos + 1) % set->capacity;
+  }
+
+  set->slots[pos] = id;
+  set->used[pos] = 1;
+  set->count++;
+  return 1;
+}
+
+static int walker_mark_visited(Walker* walker, const struct stat* dir_stat) {
+  DirectoryId id = {dir_stat->st_dev, dir_stat->st_ino};
+
+  pthread_mutex_lock(&walker->visited_lock);
+  int is_new = visited_insert(&walker->visited, id);
+  pthread_mutex_unlock(&walker->visited_lock);
+
+  return is_new;
+}
+
+static void walker_push(WalkerWorker* worker, char* path, unsigned depth) {
+  Walker* walker = worker->walker;
+  DirectoryTask task = {path, depth};
+
+  /* Account for task first, so that counters never drop below zero */
+  pthread_mutex_lock(&walker->lock);
+  walker->queued++;
+  walker->pending++;
+  pthread_cond_signal(&walker->has_work);
+  pthread_mutex_unlock(&walker->lock);
+
+  deque_push_back(&worker->deque, task);
+}
+
+static int walker_take(WalkerWorker* worker, DirectoryTask* task) {
+  Walker* walker = worker->walker;
+  int found = deque_pop_back(&worker->deque, task);
+
+  /* Steal from other workers, starting from the next one */
+  for (size_t i = 1; !found && i < walker->worker_count; ++i) {
+    WalkerWorker* victim = &walker->workers[(worker->id + i) % walker->worker_count];
+    found = deque_pop_front(&victim->deque, task);
+  }
+
+  if (found) {
+    pthread_mutex_lock(&walker->lock);
+    walker->queued--;
+    pthread_mutex_unlock(&walker->lock);
+  }
+  return found;
+}
+
+static void walker_finish_task(Walker* walker, file_error_t result) {
+  pthread_mutex_lock(&walker->lock);
+  if (result != FERR_NONE && walker->error == FERR_NONE) {
+    walker->error = result;
+  }
+  walker->pending--;
+  if (walker->pending == 0) {
+    pthread_cond_broadcast(&walker->has_work);
+  }
+  pthread_mutex_unlock(&walker->lock);
+}
+
+static int walker_has_failed(Walker* walker) {
+  pthread_mutex_lock(&walker->lock);
+  int failed = (walker->error != FERR_NONE);
+  pthread_mutex_unlock(&walker->lock);
+
+  return failed;
+}
+
+static char* join_path(const char* dir_path, size_t dir_length, const char* name) {
+  size_t name_length = strlen(name);
+  char* path = (char*) calloc(dir_length + name_length + 2, 1);
+  PANIC_ON_BAD_ALLOC(path);
+
+  memcpy(path, dir_path, dir_length);
+  path[dir_length] = '/';
+  memcpy(path + dir_length + 1, name, name_length + 1);
+
+  return path;
+}
+
+static file_error_t open_error(int error, unsigned depth) {
+  if (error == ENOENT || error == ENOTDIR) {
+    /* Nested directory may be removed after it has been listed */
+    return depth == 0 ? FERR_INVALID_VALUE : FERR_NONE;
+  }
+  return FERR_ACCESS_DENIED;
+}
+
+/*
+ * Check that directory entry is not a symbolic link. Following links would
+ * make the set of scanned paths depend on traversal order.
+ */
+static int is_real_directory(int dir_fd, const struct dirent* entry) {
+#if defined(DT_UNKNOWN)
+  if (entry->d_type == DT_DIR) {
+    return 1;
+  }
+  if (entry->d_type != DT_UNKNOWN) {
+    return 0;
+  }
+#endif
+  struct stat entry_stat;
+  if (fstatat(dir_fd, entry->d_name, &entry_stat, AT_SYMLINK_NOFOLLOW) != 0) {
+    return 0;
+  }
+  return S_ISDIR(entry_stat.st_mode);
+}
+
+static file_error_t scan_directory(WalkerWorker* worker, const DirectoryTask* task) {
+  Walker* walker = worker->walker;
+
+  int dir_fd = open(task->path, O_RDONLY | O_DIRECTORY);
+  if (dir_fd < 0) {
+    return open_error(errno, task->depth);
+  }
+
+  struct stat dir_stat;
+  if (fstat(dir_fd, &dir_stat) != 0) {
+    close(dir_fd);
+    return FERR_ACCESS_DENIED;
+  }
+  if (!walker_mark_visited(walker, &dir_stat)) {
+    /* Already reached through another path, e.g. bind mount loop */
+    close(dir_fd);
+    return FERR_NONE;
+  }
+
+  DIR* dir = fdopendir(dir_fd);
+  if (dir == NULL) {
+    close(dir_fd);
+    return FERR_ACCESS_DENIED;
+  }
+
+  int can_descend = (walker->max_depth == 0 || task->depth < walker->max_depth);
+  size_t dir_length = strlen(task->path);
+  file_error_t result = FERR_NONE;
+  struct dirent* entry;
+
+  while ((entry = readdir(dir)) != NULL) {
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+      continue;
+    }
+
+    FileMetadata metadata = {0, 0, 0};
+#if defined(DT_UNKNOWN)
+    if (entry->d_type == DT_DIR) {
+      /* Directory is inspected when opened, no need to probe it here */
+      metadata.is_directory = 1;
+    } else if (entry->d_type != DT_REG && entry->d_type != DT_LNK
+               && entry->d_type != DT_UNKNOWN) {
+      continue;
+    }
+#endif
+
+    if (!metadata.is_directory) {
+      result = file_probe_at(dirfd(dir), entry->d_name, &metadata);
+      if (result == FERR_INVALID_VALUE) {
+        /* Entry was removed after it has been listed */
+        result = FERR_NONE;
+        continue;
+      }
+      if (result != FERR_NONE) {
+        break;
+      }
+    }
+
+    if (metadata.is_directory) {
+      if (can_descend && is_real_directory(dirfd(dir), entry)) {
+        walker_push(worker, join_path(task->path, dir_length, entry->d_name), task->depth + 1);
+      }
+      continue;
+    }
+    if (!metadata.is_regular) {
+      continue;
+    }
+    if (walker->options->manifest != NULL
+        && manifest_contains(walker->options->manifest, &metadata.identity)) {
+      worker->files.skipped_count++;
+      continue;
+    }
+
+    size_t row = file_index_push(&worker->files, task->path, entry->d_name, &metadata);
+    if (walker->options->on_file != NULL) {
+      IndexedFile file = file_index_get(&worker->files, row);
+      walker->options->on_file(walker->options->callback_context, &file);
+    }
+    if (walker->options->discard_files) {
+      file_index_truncate(&worker->files, row);
+    }
+  }
+
+  closedir(dir);
+  return result;
+}
+
+static void* worker_main(void* argument) {
+  WalkerWorker* worker = (WalkerWorker*) argument;
+  Walker* walker = worker->walker;
+
+  for (;;) {
+    DirectoryTask task;
+    if (walker_take(worker, &task)) {
+      file_error_t result = FERR_NONE;
+      /* After failure remaining tasks are drained without scanning */
+      if (!walker_has_failed(walker)) {
+        result = scan_directory(worker, &task);
+      }
+      free(task.path);
+      walker_finish_task(walker, result);
+      continue;
+    }
+
+    pthread_mutex_lock(&walker->lock);
+    while (walker->queued == 0 && walker->pending > 0) {
+      pthread_cond_wait(&walker->has_work, &walker->lock);
+    }
+    int is_done = (walker->pending == 0);
+    pthread_mutex_unlock(&walker->lock);
+
+    if (is_done) {
+      break;
+    }
+  }
+
+  return NULL;
+}
+
+file_error_t file_walker_scan(
+  FileIndex* index,
+  const char* root_path,
+  const IndexOptions* options
+) {
+  PANIC_IF_NULL(index);
+  PANIC_IF_NULL(root_path);
+  PANIC_IF_NULL(options);
+
+  Walker walker;
+  walker.worker_count = options->jobs > 1 ? options->jobs : 1;
+  walker.max_depth = options->max_depth;
+  walker.options = options;
+  walker.queued = 0;
+  walker.pending = 0;
+  walker.error = FERR_NONE;
+  pthread_mutex_init(&walker.lock, NULL);
+  pthread_cond_init(&walker.has_work, NULL);
+  pthread_mutex_init(&walker.visited_lock, NULL);
+  visited_init(&walker.visited);
+
+  walker.workers = (WalkerWorker*) calloc(walker.worker_count, sizeof(*walker.workers));
+  PANIC_ON_BAD_ALLOC(walker.workers);
+  for (size_t i = 0; i < walker.worker_count; ++i) {
+    walker.workers[i].walker = &walker;
+    walker.workers[i].id = i;
+    deque_init(&walker.workers[i].deque);
+    file_index_init(&walker.workers[i].files);
+  }
+
+  walker_push(&walker.workers[0], copy_string(root_path), 0);
+
+  /* Calling thread acts as the first worker */
+  int* started = (int*) calloc(walker.worker_count, sizeof(*started));
+  PANIC_ON_BAD_ALLOC(started);
+  for (size_t i = 1; i < walker.worker_count; ++i) {
+    started[i] = pthread_create(&walker.workers[i].thread, NULL,
+                                worker_main, &walker.workers[i]) == 0;
+  }
+  worker_main(&walker.workers[0]);
+  for (size_t i = 1; i < walker.worker_count; ++i) {
+    if (started[i]) {
+      pthread_join(walker.workers[i].thread, NULL);
+    }
+  }
+  free(started);
+
+  for (size_t i = 0; i < walker.worker_count; ++i) {
+    file_index_splice_back(index, &walker.workers[i].files);
+    deque_destroy(&walker.workers[i].deque);
+  }
+  free(walker.workers);
+
+  visited_destroy(&walker.visited);
+  pthread_mutex_destroy(&walker.visited_lock);
+  pthread_cond_destroy(&walker.has_work);
+  pthread_mutex_destroy(&walker.lock);
+
+  return walker.error;
+}
@@ -0,0 +1,41 @@
+/**
+ * @file Walker.h
+ * @author MeerkatBoss (solodovnikov.ia@phystech.su)
+ *
+ * @brief Parallel recursive directory walker
+ *
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright MeerkatBoss (c) 2026
+ */
+#ifndef __FILES_WALKER_H
+#define __FILES_WALKER_H
+
+#include "Files/Error.h"
+#include "Files/Index.h"
+
+/**
+ * @brief Append all regular files from directory tree at `root_path` to index
+ * in unspecified order.
+ *
+ * @note
+ * Directories are distributed between `options->jobs` workers with work
+ * stealing: each worker owns a deque of pending directories, taking work
+ * from its back and letting idle workers steal from its front. Symbolic
+ * links to files are followed, symbolic links to directories are not, and
+ * every directory is visited at most once, so the walk cannot loop.
+ * Directories nested deeper than `options->max_depth` are not visited
+ * unless it is zero.
+ *
+ * @return FERR_NONE on success,
+ *         FERR_INVALID_VALUE if the path is invalid,
+ *         FERR_ACCESS_DENIED if some directory or file cannot be accessed
+ */
+file_error_t file_walker_scan(
+  FileIndex* index,             /*!< [inout] Index receiving found files */
+  const char* root_path,        /*!< [in]    Root of directory tree */
+  const IndexOptions* options   /*!< [in]    Scan options */
+);
+
+#endif /* Walker.h */
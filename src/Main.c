@@ -1,10 +1,16 @@
 #include <assert.h>
+#include <stdint.h>
 #include <stdio.h>
 
 #include "Common/List.h"
+#include "Files/Dedup.h"
 #include "Files/Error.h"
 #include "Files/File.h"
 #include "Files/Index.h"
+#include "Files/Manifest.h"
+#include "Files/Rules.h"
+#include "Files/Spill.h"
+#include "Files/Tags.h"
 #include "Files/Transaction.h"
 #include "Cli.h"
 
@@ -31,6 +37,22 @@ static const char* directory_error_to_string(file_error_t error) {
     return "target directory is not found";
   case FERR_ACCESS_DENIED:
     return "permission denied";
+  case FERR_ALREADY_EXISTS:
+    return "another import into it is in progress";
+  case FERR_INVALID_OPERATION:
+  default:
+    return "unknown error";
+  }
+}
+
+static const char* manifest_error_to_string(file_error_t error) {
+  switch (error) {
+  case FERR_NONE:
+    return "no error";
+  case FERR_INVALID_VALUE:
+    return "manifest file is damaged";
+  case FERR_ACCESS_DENIED:
+    return "permission denied";
   case FERR_INVALID_OPERATION:
   case FERR_ALREADY_EXISTS:
   default:
@@ -38,9 +60,91 @@ static const char* directory_error_to_string(file_error_t error) {
   }
 }
 
+static void report_prepare_failure(
+  FileTransaction* transaction,
+  const TransactionOptions* options,
+  file_error_t result,
+  const char* failed_path
+) {
+  if (failed_path != NULL) {
+    fprintf(stderr, "Error: Failed to prepare operation for '%s': %s\n",
+            failed_path, file_error_to_string(result));
+  } else {
+    fprintf(stderr, "Error: Failed to prepare file operations: %s\n",
+            file_error_to_string(result));
+  }
+  if (result == FERR_ALREADY_EXISTS) {
+    fprintf(stderr, "Hint: use --force to allow overwriting of files\n");
+  }
+  if (result == FERR_INVALID_OPERATION && options->reflink == REFLINK_ALWAYS) {
+    fprintf(stderr, "Hint: use --reflink=auto to copy files which cannot be cloned\n");
+  }
+  fprintf(stderr, "Rolling back changes...\n");
+  file_error_t rollback_result = file_transaction_rollback(transaction, options);
+  if (rollback_result != FERR_NONE) {
+    fprintf(stderr, "Error: Failed to rollback operations: %s\n",
+            file_error_to_string(rollback_result));
+  }
+}
+
+/*
+ * Record copied and moved files in manifest, so that they are skipped next
+ * time and their numbers are not reused
+ */
+static void record_imported_files(ImportManifest* manifest, const FileIndex* index) {
+  FILE_INDEX_FOREACH(row, *index) {
+    if (index->actions[row] == FACT_COPY || index->actions[row] == FACT_MOVE) {
+      manifest_add(manifest, &index->identities[row]);
+    }
+  }
+}
+
+/* Manifest is saved while transaction still holds target directory */
+static file_error_t save_manifest(ImportManifest* manifest) {
+  file_error_t result = manifest_save(manifest);
+  if (result != FERR_NONE) {
+    fprintf(stderr, "Error: Failed to update manifest '%s': %s\n",
+            manifest->path, manifest_error_to_string(result));
+  }
+  return result;
+}
+
+static file_error_t commit_operations(
+  FileTransaction* transaction,
+  const FileIndex* index,
+  ImportManifest* manifest,
+  const TransactionOptions* options
+) {
+  file_error_t result = file_transaction_commit(transaction, options);
+  if (result != FERR_NONE) {
+    fprintf(stderr, "Error: Failed to commit operations: %s\n",
+            file_error_to_string(result));
+    fprintf(stderr, "Warning: Cannot safely rollback after commit failure.\n");
+    fprintf(stderr, "Target files have been preserved to prevent data loss.\n");
+    return result;
+  }
+
+  if (manifest != NULL && !options->dry_run) {
+    record_imported_files(manifest, index);
+    result = save_manifest(manifest);
+    if (result != FERR_NONE) {
+      return result;
+    }
+  }
+
+  return FERR_NONE;
+}
+
+static void report_success(size_t file_count, const TransactionOptions* options) {
+  if (options->verbose || options->dry_run) {
+    printf("Successfully processed %zu files.\n", file_count);
+  }
+}
+
 static file_error_t execute_operations(
   FileIndex* index,
   const char* target_dir,
+  ImportManifest* manifest,
   const TransactionOptions* options
 ) {
   file_error_t result = FERR_NONE;
@@ -58,42 +162,364 @@ static file_error_t execute_operations(
   const char* failed_path = NULL;
   result = file_transaction_prepare(&transaction, index, options, &failed_path);
   if (result != FERR_NONE) {
-    if (failed_path != NULL) {
-      fprintf(stderr, "Error: Failed to prepare operation for '%s': %s\n",
-              failed_path, file_error_to_string(result));
-    } else {
-      fprintf(stderr, "Error: Failed to prepare file operations: %s\n",
-              file_error_to_string(result));
+    report_prepare_failure(&transaction, options, result, failed_path);
+    goto cleanup;
+  }
+
+  result = commit_operations(&transaction, index, manifest, options);
+  if (result == FERR_NONE) {
+    report_success(index->file_count, options);
+  }
+
+cleanup:
+  if (transaction_initialized) {
+    file_transaction_cleanup(&transaction);
+  }
+
+  return result;
+}
+
+static file_error_t apply_rules(const RuleSet* rules, FileIndex* index) {
+  if (rules == NULL) {
+    return FERR_NONE;
+  }
+  file_error_t result = rule_set_apply(rules, index);
+  if (result != FERR_NONE) {
+    fprintf(stderr, "Error: Failed to apply rules to files: %s\n",
+            file_tag_error_to_string(result));
+  }
+  return result;
+}
+
+/*
+ * Intern tags of command line before any file is indexed, so that running out
+ * of distinct tags is told apart from a file exceeding its limit of tags
+ */
+static file_error_t intern_tags(const CliArgs* args) {
+  for (size_t i = 0; i < args->tag_count; ++i) {
+    if (!file_tag_is_valid(args->tags[i])) {
+      fprintf(stderr, "Error: Failed to add tags to files: %s\n",
+              file_tag_error_to_string(FERR_INVALID_VALUE));
+      return FERR_INVALID_VALUE;
     }
-    if (result == FERR_ALREADY_EXISTS) {
-      fprintf(stderr, "Hint: use --force to allow overwriting of files\n");
+  }
+  for (size_t i = 0; i < args->tag_count; ++i) {
+    unsigned id = 0;
+    file_error_t result = tag_dictionary_intern(args->tags[i], &id);
+    if (result != FERR_NONE) {
+      fprintf(stderr, "Error: Failed to add tags to files: too many distinct tags "
+                      "(limit: %d)\n", TAG_DICTIONARY_CAPACITY);
+      return result;
     }
-    fprintf(stderr, "Rolling back changes...\n");
-    file_error_t rollback_result = file_transaction_rollback(&transaction, options);
-    if (rollback_result != FERR_NONE) {
-      fprintf(stderr, "Error: Failed to rollback operations: %s\n",
-              file_error_to_string(rollback_result));
+  }
+  return FERR_NONE;
+}
+
+static file_error_t mark_duplicates(FileIndex* index, const CliArgs* args) {
+  DedupStats dedup_stats;
+  file_error_t result = file_index_mark_duplicates(index, args->target_dir, args->jobs,
+                                                   &dedup_stats);
+  if (result != FERR_NONE) {
+    fprintf(stderr, "Error: Failed to search for duplicates in target '%s': %s\n",
+            args->target_dir, directory_error_to_string(result));
+    return result;
+  }
+  if (args->verbose) {
+    printf("Found %zu duplicate files, %zu of them already in target "
+           "(%zu files hashed partially, %zu completely)\n",
+           dedup_stats.duplicate_count, dedup_stats.in_target_count,
+           dedup_stats.partial_hash_count, dedup_stats.full_hash_count);
+  }
+  return FERR_NONE;
+}
+
+static void stage_found_file(void* context, const IndexedFile* file) {
+  file_transaction_stage((FileTransaction*) context, file);
+}
+
+/*
+ * Copy files to target directory as soon as they are found, overlapping
+ * directory scan with file copying.
+ */
+static file_error_t execute_pipelined(
+  FileIndex* index,
+  CliArgs* args,
+  const IndexOptions* scan_options,
+  ImportManifest* manifest,
+  const TransactionOptions* options
+) {
+  file_error_t result = FERR_NONE;
+  FileTransaction transaction;
+  int transaction_initialized = 0;
+
+  /* Check tags before any file is copied */
+  result = file_index_add_tags(index, args->tag_count, args->tags);
+  if (result != FERR_NONE) {
+    fprintf(stderr, "Error: Failed to add tags to files: %s\n",
+            file_tag_error_to_string(result));
+    goto cleanup;
+  }
+
+  result = file_transaction_init(&transaction, args->target_dir, options);
+  if (result != FERR_NONE) {
+    fprintf(stderr, "Error: Failed to initialize transaction for target '%s': %s\n",
+            args->target_dir, directory_error_to_string(result));
+    goto cleanup;
+  }
+  transaction_initialized = 1;
+
+  file_transaction_begin_staging(&transaction, options);
+
+  IndexOptions index_options = *scan_options;
+  index_options.on_file = stage_found_file;
+  index_options.callback_context = &transaction;
+
+  result = file_index_read_directory(index, args->source_dir, &index_options);
+  if (result != FERR_NONE) {
+    fprintf(stderr, "Error: Failed to read source directory '%s': %s\n",
+            args->source_dir, directory_error_to_string(result));
+    file_transaction_rollback(&transaction, options);
+    goto cleanup;
+  }
+
+  if (args->verbose) {
+    printf("Found %zu files in '%s'\n", index->file_count, args->source_dir);
+    if (index->skipped_count > 0) {
+      printf("Skipped %zu already imported files\n", index->skipped_count);
     }
+  }
+
+  if (index->file_count == 0) {
+    fprintf(stderr, "Warning: No files to process.\n");
     goto cleanup;
   }
 
-  result = file_transaction_commit(&transaction, options);
+  result = file_index_add_tags(index, args->tag_count, args->tags);
   if (result != FERR_NONE) {
-    fprintf(stderr, "Error: Failed to commit operations: %s\n",
+    fprintf(stderr, "Error: Failed to add tags to files: %s\n",
+            file_tag_error_to_string(result));
+    file_transaction_rollback(&transaction, options);
+    goto cleanup;
+  }
+
+  const char* failed_path = NULL;
+  result = file_transaction_finish_staging(&transaction, index, options, &failed_path);
+  if (result != FERR_NONE) {
+    report_prepare_failure(&transaction, options, result, failed_path);
+    goto cleanup;
+  }
+
+  result = commit_operations(&transaction, index, manifest, options);
+  if (result == FERR_NONE) {
+    report_success(index->file_count, options);
+  }
+
+cleanup:
+  if (transaction_initialized) {
+    file_transaction_cleanup(&transaction);
+  }
+
+  return result;
+}
+
+static void spill_found_file(void* context, const IndexedFile* file) {
+  file_spill_add((FileSpill*) context, file);
+}
+
+/* Width of the largest number given to `file_count` files, at least the default one */
+static unsigned fit_index_width(size_t first_index, size_t file_count) {
+  uint64_t max_index = (uint64_t) first_index + file_count - 1;
+  unsigned width = 1;
+  for (; max_index >= 10; max_index /= 10) {
+    width++;
+  }
+  return width < FILE_INDEX_DEFAULT_WIDTH ? FILE_INDEX_DEFAULT_WIDTH : width;
+}
+
+/* Prepare and commit window of files in transaction */
+static file_error_t execute_window(
+  FileTransaction* transaction,
+  FileIndex* window,
+  CliArgs* args,
+  const RuleSet* rules,
+  ImportManifest* manifest,
+  const TransactionOptions* options
+) {
+  file_error_t result = file_index_add_tags(window, args->tag_count, args->tags);
+  if (result != FERR_NONE) {
+    fprintf(stderr, "Error: Failed to add tags to files: %s\n",
+            file_tag_error_to_string(result));
+    return result;
+  }
+
+  result = apply_rules(rules, window);
+  if (result != FERR_NONE) {
+    return result;
+  }
+
+  if (args->dedup) {
+    result = mark_duplicates(window, args);
+    if (result != FERR_NONE) {
+      return result;
+    }
+  }
+
+  const char* failed_path = NULL;
+  result = file_transaction_prepare(transaction, window, options, &failed_path);
+  if (result != FERR_NONE) {
+    report_prepare_failure(transaction, options, result, failed_path);
+    return result;
+  }
+
+  /* Manifest is saved once, after the last window */
+  result = commit_operations(transaction, window, NULL, options);
+  if (result == FERR_NONE && manifest != NULL && !options->dry_run) {
+    record_imported_files(manifest, window);
+  }
+  return result;
+}
+
+/*
+ * Sort found files and import them window by window, continuing the
+ * transaction after every commit. Windows are limited by batch size, so that
+ * sources are handled in smaller transactions, and by memory limit, with
+ * files sorted in temporary files, so that memory use does not grow with
+ * number of files. Windows committed before a failure stay imported.
+ * Imported files are recorded in manifest after every window, but manifest
+ * is rewritten only once at the end, including after a failure.
+ */
+static file_error_t execute_windowed(
+  CliArgs* args,
+  const IndexOptions* scan_options,
+  const RuleSet* rules,
+  ImportManifest* manifest,
+  const TransactionOptions* options
+) {
+  file_error_t result = FERR_NONE;
+  FileSpill spill;
+  FileIndex found;
+  FileIndex window;
+  FileTransaction transaction;
+  int transaction_initialized = 0;
+  int is_manifest_saved = 0;
+  TransactionOptions window_options = *options;
+
+  SpillWindowLimits limits = {
+    .max_files = args->batch_files,
+    .max_bytes = args->batch_bytes
+  };
+
+  file_spill_init(&spill, args->max_memory > 0 ? args->max_memory : SIZE_MAX);
+  file_index_init(&found);
+  file_index_init(&window);
+
+  /* Check tags before source directory is scanned */
+  result = file_index_add_tags(&window, args->tag_count, args->tags);
+  if (result != FERR_NONE) {
+    fprintf(stderr, "Error: Failed to add tags to files: %s\n",
+            file_tag_error_to_string(result));
+    goto cleanup;
+  }
+
+  IndexOptions index_options = *scan_options;
+  index_options.on_file = spill_found_file;
+  index_options.callback_context = &spill;
+  index_options.discard_files = 1;
+
+  result = file_index_read_directory(&found, args->source_dir, &index_options);
+  if (result != FERR_NONE) {
+    fprintf(stderr, "Error: Failed to read source directory '%s': %s\n",
+            args->source_dir, directory_error_to_string(result));
+    goto cleanup;
+  }
+  result = file_spill_finish(&spill);
+  if (result != FERR_NONE) {
+    fprintf(stderr, "Error: Failed to sort found files in temporary directory: %s\n",
             file_error_to_string(result));
-    fprintf(stderr, "Warning: Cannot safely rollback after commit failure.\n");
-    fprintf(stderr, "Target files have been preserved to prevent data loss.\n");
     goto cleanup;
   }
 
-  if (options->verbose || options->dry_run) {
-    printf("Successfully processed %zu files.\n", index->file_count);
+  if (args->verbose) {
+    printf("Found %zu files in '%s'\n", spill.file_count, args->source_dir);
+    if (found.skipped_count > 0) {
+      printf("Skipped %zu already imported files\n", found.skipped_count);
+    }
+  }
+
+  if (spill.file_count == 0) {
+    fprintf(stderr, "Warning: No files to process.\n");
+    goto cleanup;
+  }
+
+  /* Every window would fit width to its own files otherwise */
+  if (window_options.index_width == 0) {
+    window_options.index_width = fit_index_width(window_options.first_index, spill.file_count);
+  }
+
+  result = file_transaction_init(&transaction, args->target_dir, &window_options);
+  if (result != FERR_NONE) {
+    fprintf(stderr, "Error: Failed to initialize transaction for target '%s': %s\n",
+            args->target_dir, directory_error_to_string(result));
+    goto cleanup;
   }
+  transaction_initialized = 1;
+
+  size_t processed_count = 0;
+  for (;;) {
+    file_index_truncate(&window, 0);
+    result = file_spill_read(&spill, &window, &limits);
+    if (result != FERR_NONE) {
+      fprintf(stderr, "Error: Failed to read sorted files from temporary directory: %s\n",
+              file_error_to_string(result));
+      goto cleanup;
+    }
+    if (window.file_count == 0) {
+      break;
+    }
+
+    if (processed_count > 0) {
+      result = file_transaction_continue(&transaction, &window_options);
+      if (result != FERR_NONE) {
+        fprintf(stderr, "Error: Failed to continue transaction in target '%s': %s\n",
+                args->target_dir, directory_error_to_string(result));
+        goto cleanup;
+      }
+    }
+
+    result = execute_window(&transaction, &window, args, rules, manifest, &window_options);
+    if (result != FERR_NONE) {
+      if (processed_count > 0) {
+        fprintf(stderr, "Note: %zu files of earlier batches stay imported\n", processed_count);
+      }
+      goto cleanup;
+    }
+    processed_count += window.file_count;
+
+    if (args->verbose) {
+      printf("Processed %zu of %zu files\n", processed_count, spill.file_count);
+    }
+  }
+
+  if (manifest != NULL && !window_options.dry_run) {
+    is_manifest_saved = 1;
+    result = save_manifest(manifest);
+    if (result != FERR_NONE) {
+      goto cleanup;
+    }
+  }
+  report_success(processed_count, &window_options);
 
 cleanup:
   if (transaction_initialized) {
+    /* Keep windows committed before failure recorded */
+    if (manifest != NULL && !window_options.dry_run && !is_manifest_saved) {
+      save_manifest(manifest);
+    }
     file_transaction_cleanup(&transaction);
   }
+  file_index_clear(&window);
+  file_index_clear(&found);
+  file_spill_cleanup(&spill);
 
   return result;
 }
@@ -109,11 +535,82 @@ int main(int argc, char** argv) {
   file_error_t result = FERR_NONE;
   FileIndex index;
   int index_initialized = 0;
+  ImportManifest manifest;
+  ImportManifest* loaded_manifest = NULL;
+  RuleSet rules;
+  RuleSet* loaded_rules = NULL;
 
   file_index_init(&index);
   index_initialized = 1;
 
-  result = file_index_read_directory(&index, args.source_dir);
+  IndexOptions index_options = {
+    .jobs = args.jobs,
+    .recursive = args.recursive,
+    .max_depth = args.max_depth
+  };
+
+  TransactionOptions options = {
+    .dry_run = args.dry_run,
+    .verbose = args.verbose,
+    .force = args.force,
+    .jobs = args.jobs,
+    .reflink = args.reflink,
+    .io_uring = args.io_uring,
+    .cache_policy = args.cache_policy,
+    .sync = args.sync,
+    .index_width = args.index_width,
+    .per_date_numbering = args.per_date_numbering
+  };
+
+  if (args.rules_path != NULL) {
+    RuleError rule_error;
+    result = rule_set_load(&rules, args.rules_path, &rule_error);
+    if (result != FERR_NONE) {
+      if (rule_error.line > 0) {
+        fprintf(stderr, "Error: Invalid rule at '%s' line %zu: %s\n",
+                args.rules_path, rule_error.line, rule_error.message);
+      } else {
+        fprintf(stderr, "Error: Failed to read rules file '%s': %s\n",
+                args.rules_path, rule_error.message);
+      }
+      goto cleanup;
+    }
+    loaded_rules = &rules;
+  }
+
+  result = intern_tags(&args);
+  if (result != FERR_NONE) {
+    goto cleanup;
+  }
+
+  if (args.incremental) {
+    result = manifest_load(&manifest, args.target_dir);
+    if (result != FERR_NONE) {
+      fprintf(stderr, "Error: Failed to load manifest of target '%s': %s\n",
+              args.target_dir, manifest_error_to_string(result));
+      goto cleanup;
+    }
+    loaded_manifest = &manifest;
+    index_options.manifest = loaded_manifest;
+    /* Do not reuse names of files imported before */
+    options.first_index = manifest.imported_count;
+  }
+
+  if (args.max_memory > 0 || args.batch_files > 0 || args.batch_bytes > 0) {
+    result = execute_windowed(&args, &index_options, loaded_rules, loaded_manifest, &options);
+    goto cleanup;
+  }
+
+  /*
+   * Nothing to overlap with scan in dry run, duplicates need complete index,
+   * and staged files are always copied
+   */
+  if (args.pipeline && !args.dry_run && !args.dedup && loaded_rules == NULL) {
+    result = execute_pipelined(&index, &args, &index_options, loaded_manifest, &options);
+    goto cleanup;
+  }
+
+  result = file_index_read_directory(&index, args.source_dir, &index_options);
   if (result != FERR_NONE) {
     fprintf(stderr, "Error: Failed to read source directory '%s': %s\n",
             args.source_dir, directory_error_to_string(result));
@@ -122,6 +619,9 @@ int main(int argc, char** argv) {
 
   if (args.verbose) {
     printf("Found %zu files in '%s'\n", index.file_count, args.source_dir);
+    if (index.skipped_count > 0) {
+      printf("Skipped %zu already imported files\n", index.skipped_count);
+    }
   }
 
   if (index.file_count == 0) {
@@ -136,20 +636,31 @@ int main(int argc, char** argv) {
     goto cleanup;
   }
 
-  LIST_FOREACH(node, index.files) {
-    IndexedFile* file = (IndexedFile*) node;
-    file->changes.action = FACT_COPY;
+  FILE_INDEX_FOREACH(row, index) {
+    index.actions[row] = FACT_COPY;
   }
 
-  TransactionOptions options = {
-    .dry_run = args.dry_run,
-    .verbose = args.verbose,
-    .force = args.force
-  };
+  result = apply_rules(loaded_rules, &index);
+  if (result != FERR_NONE) {
+    goto cleanup;
+  }
 
-  result = execute_operations(&index, args.target_dir, &options);
+  if (args.dedup) {
+    result = mark_duplicates(&index, &args);
+    if (result != FERR_NONE) {
+      goto cleanup;
+    }
+  }
+
+  result = execute_operations(&index, args.target_dir, loaded_manifest, &options);
 
 cleanup:
+  if (loaded_manifest != NULL) {
+    manifest_cleanup(loaded_manifest);
+  }
+  if (loaded_rules != NULL) {
+    rule_set_cleanup(loaded_rules);
+  }
   if (index_initialized) {
     file_index_clear(&index);
   }
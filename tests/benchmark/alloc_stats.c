@@ -0,0 +1,133 @@
+/*
+ * Preloaded library counting heap allocations of a process. On exit, the
+ * number of allocations and peak resident set size are appended to file
+ * named by ALLOC_STATS_OUTPUT as "<allocations> <peak RSS in KiB>".
+ *
+ * Build: cc -shared -fPIC -o alloc_stats.so alloc_stats.c -ldl
+ * Usage: ALLOC_STATS_OUTPUT=stats.txt LD_PRELOAD=./alloc_stats.so corgi ...
+ */
+#define _GNU_SOURCE /* RTLD_NEXT */
+
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef void* (*malloc_t)(size_t);
+typedef void* (*calloc_t)(size_t, size_t);
+typedef void* (*realloc_t)(void*, size_t);
+typedef void (*free_t)(void*);
+
+static malloc_t real_malloc;
+static calloc_t real_calloc;
+static realloc_t real_realloc;
+static free_t real_free;
+
+static unsigned long allocation_count;
+
+/* dlsym() may allocate before real functions are known */
+static char bootstrap_buffer[4096];
+static size_t bootstrap_used;
+static int is_resolving;
+
+static void resolve(void) {
+  if (real_free != NULL || is_resolving) {
+    return;
+  }
+  is_resolving = 1;
+  real_malloc = (malloc_t) dlsym(RTLD_NEXT, "malloc");
+  real_calloc = (calloc_t) dlsym(RTLD_NEXT, "calloc");
+  real_realloc = (realloc_t) dlsym(RTLD_NEXT, "realloc");
+  real_free = (free_t) dlsym(RTLD_NEXT, "free");
+  is_resolving = 0;
+}
+
+static int is_bootstrap(const void* ptr) {
+  return (const char*) ptr >= bootstrap_buffer
+      && (const char*) ptr < bootstrap_buffer + sizeof(bootstrap_buffer);
+}
+
+static void* bootstrap_alloc(size_t size) {
+  size = (size + 15) & ~(size_t) 15;
+  if (bootstrap_used + size > sizeof(bootstrap_buffer)) {
+    return NULL;
+  }
+  void* result = bootstrap_buffer + bootstrap_used;
+  bootstrap_used += size;
+  return result;
+}
+
+void* malloc(size_t size) {
+  resolve();
+  if (real_malloc == NULL) {
+    return bootstrap_alloc(size);
+  }
+  __atomic_add_fetch(&allocation_count, 1, __ATOMIC_RELAXED);
+  return real_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+  resolve();
+  if (real_calloc == NULL) {
+    /* Bootstrap buffer is static, hence zeroed */
+    return bootstrap_alloc(count * size);
+  }
+  __atomic_add_fetch(&allocation_count, 1, __ATOMIC_RELAXED);
+  return real_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+  resolve();
+  if (is_bootstrap(ptr)) {
+    void* result = malloc(size);
+    if (result != NULL) {
+      size_t available = (size_t) (bootstrap_buffer + sizeof(bootstrap_buffer) - (char*) ptr);
+      memcpy(result, ptr, size < available ? size : available);
+    }
+    return result;
+  }
+  __atomic_add_fetch(&allocation_count, 1, __ATOMIC_RELAXED);
+  return real_realloc(ptr, size);
+}
+
+void free(void* ptr) {
+  if (ptr == NULL || is_bootstrap(ptr)) {
+    return;
+  }
+  resolve();
+  real_free(ptr);
+}
+
+static long peak_rss_kib(void) {
+  FILE* status = fopen("/proc/self/status", "r");
+  if (status == NULL) {
+    return -1;
+  }
+  char line[256];
+  long peak = -1;
+  while (fgets(line, sizeof(line), status) != NULL) {
+    if (strncmp(line, "VmHWM:", 6) == 0) {
+      peak = strtol(line + 6, NULL, 10);
+      break;
+    }
+  }
+  fclose(status);
+  return peak;
+}
+
+__attribute__((destructor)) static void report(void) {
+  const char* output_path = getenv("ALLOC_STATS_OUTPUT");
+  if (output_path == NULL) {
+    return;
+  }
+  /* Counted before report allocates anything itself */
+  unsigned long count = __atomic_load_n(&allocation_count, __ATOMIC_RELAXED);
+  long peak = peak_rss_kib();
+
+  FILE* output = fopen(output_path, "a");
+  if (output == NULL) {
+    return;
+  }
+  fprintf(output, "%lu %ld\n", count, peak);
+  fclose(output);
+}
@@ -0,0 +1,39 @@
+#!/bin/sh
+
+# Throughput of copying large files, compared with cp(1) as a reference.
+# Use BENCH_DIR on the device of interest; copying between different file
+# systems exercises sendfile() and read/write fallbacks of copy engine.
+# Files of BENCH_FILE_SIZE_MB >= 128 are copied in chunks by --jobs threads.
+
+set -eu
+. "$(dirname "$0")/common.sh"
+
+FILE_COUNT="${BENCH_FILES:-8}"
+FILE_SIZE_MB="${BENCH_FILE_SIZE_MB:-64}"
+SOURCE_DIR="$BENCH_DIR/source"
+TARGET_DIR="$BENCH_DIR/target"
+
+make_files "$SOURCE_DIR" "$FILE_COUNT" $((FILE_SIZE_MB * 1024 * 1024))
+total_mb=$((FILE_COUNT * FILE_SIZE_MB))
+
+# Print throughput in MB/s
+throughput() {
+    echo "$1 $2" | awk '{ if ($2 > 0) printf "%.1f", $1 / $2; else print "-" }'
+}
+
+echo "Copying $FILE_COUNT files of $FILE_SIZE_MB MB (best of $BENCH_RUNS)"
+printf "%12s %12s %12s\n" "tool" "seconds" "MB/s"
+
+export BENCH_SETUP="rm -rf '$TARGET_DIR'"
+
+elapsed=$(measure cp -r "$SOURCE_DIR" "$TARGET_DIR")
+printf "%12s %12s %12s\n" "cp" "$elapsed" "$(throughput "$total_mb" "$elapsed")"
+
+for jobs in $(job_counts); do
+    elapsed=$(measure "$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" --jobs "$jobs")
+    printf "%12s %12s %12s\n" "corgi -j $jobs" "$elapsed" "$(throughput "$total_mb" "$elapsed")"
+done
+
+unset BENCH_SETUP
+"$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" --force --verbose 2>/dev/null \
+    | sed -n 's/.*Prepared copy: .* (\([^)]*\))$/Copy method: \1/p' | sort -u
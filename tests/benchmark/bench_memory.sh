@@ -0,0 +1,67 @@
+#!/bin/sh
+
+# Heap allocations and peak memory of indexing and preparing a large batch.
+# Allocations are counted by preloaded alloc_stats.c (Linux, glibc or musl
+# dynamic build). Set BENCH_BASELINE to another corgi binary to compare.
+
+set -eu
+. "$(dirname "$0")/common.sh"
+
+FILE_COUNT="${BENCH_FILES:-1000000}"
+SOURCE_DIR="$BENCH_DIR/source"
+TARGET_DIR="$BENCH_DIR/target"
+STATS_LIBRARY="$BENCH_DIR/alloc_stats.so"
+STATS_OUTPUT="$BENCH_DIR/alloc_stats.txt"
+
+if ! ${CC:-cc} -O2 -shared -fPIC -o "$STATS_LIBRARY" "$SCRIPT_DIR/alloc_stats.c" -ldl \
+        2> /dev/null; then
+    echo "Cannot build allocation counter, skipping"
+    exit 0
+fi
+
+make_empty_files "$SOURCE_DIR" "$FILE_COUNT"
+
+# Print allocations, peak RSS in MiB and seconds of a single run
+run_with_stats() {
+    rm -f "$STATS_OUTPUT"
+    local start
+    local finish
+    start=$(now)
+    ALLOC_STATS_OUTPUT="$STATS_OUTPUT" LD_PRELOAD="$STATS_LIBRARY" \
+        "$@" > /dev/null 2>&1 || true
+    finish=$(now)
+    if [ ! -s "$STATS_OUTPUT" ]; then
+        echo "- - -"
+        return
+    fi
+    echo "$(cat "$STATS_OUTPUT") $start $finish" | awk '{
+        printf "%s %.1f %.3f", $1, $2 / 1024, $4 - $3
+    }'
+}
+
+report() {
+    local binary_name="$1"
+    local scenario="$2"
+    shift 2
+    set -- $(run_with_stats "$@")
+    printf "%10s %-12s %12s %12s %10s\n" "$binary_name" "$scenario" "$1" "$2" "$3"
+}
+
+echo "Dry run of $FILE_COUNT files"
+printf "%10s %-12s %12s %12s %10s\n" "binary" "scenario" "allocations" "peak MiB" "seconds"
+
+binaries="current:$BINARY"
+if [ -n "${BENCH_BASELINE:-}" ]; then
+    binaries="baseline:$BENCH_BASELINE $binaries"
+fi
+
+for entry in $binaries; do
+    name="${entry%%:*}"
+    binary="${entry#*:}"
+    report "$name" "scan" "$binary" --source "$SOURCE_DIR" --target "$TARGET_DIR" \
+        --dry-run
+    report "$name" "scan+tags" "$binary" --source "$SOURCE_DIR" --target "$TARGET_DIR" \
+        --dry-run --tag holiday --tag family
+    report "$name" "scan-jobs-4" "$binary" --source "$SOURCE_DIR" --target "$TARGET_DIR" \
+        --dry-run --jobs 4
+done
@@ -0,0 +1,21 @@
+#!/bin/sh
+
+# Throughput of file name generation, without any file system access.
+# Compares names generated one by one with names generated by a formatter
+# caching date and tags shared by consecutive files.
+
+set -eu
+. "$(dirname "$0")/common.sh"
+
+FILE_COUNT="${BENCH_FILES:-1000000}"
+SOURCE_ROOT="$SCRIPT_DIR/../../src"
+PROGRAM="$BENCH_DIR/name_rate"
+
+if ! ${CC:-cc} -O2 -I"$SOURCE_ROOT" -o "$PROGRAM" "$SCRIPT_DIR/name_rate.c" \
+        "$SOURCE_ROOT/Files/File.c" "$SOURCE_ROOT/Files/Tags.c" \
+        "$SOURCE_ROOT/Common/Arena.c" "$SOURCE_ROOT/Common/Strings.c" -lpthread; then
+    echo "Cannot build name generation benchmark, skipping"
+    exit 0
+fi
+
+"$PROGRAM" "$FILE_COUNT"
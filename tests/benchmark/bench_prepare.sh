@@ -0,0 +1,34 @@
+#!/bin/sh
+
+# Scaling of prepare phase (copying files to target) with number of jobs.
+# Fast targets (NVMe, RAID) benefit most; use BENCH_DIR on such device.
+
+set -eu
+. "$(dirname "$0")/common.sh"
+
+FILE_COUNT="${BENCH_FILES:-64}"
+FILE_SIZE_MB="${BENCH_FILE_SIZE_MB:-8}"
+SOURCE_DIR="$BENCH_DIR/source"
+TARGET_DIR="$BENCH_DIR/target"
+
+make_files "$SOURCE_DIR" "$FILE_COUNT" $((FILE_SIZE_MB * 1024 * 1024))
+total_mb=$((FILE_COUNT * FILE_SIZE_MB))
+
+# Print throughput in MB/s
+throughput() {
+    echo "$1 $2" | awk '{ if ($2 > 0) printf "%.1f", $1 / $2; else print "-" }'
+}
+
+echo "Copying $FILE_COUNT files of $FILE_SIZE_MB MB (best of $BENCH_RUNS)"
+printf "%8s %12s %12s %10s\n" "jobs" "seconds" "MB/s" "speedup"
+
+export BENCH_SETUP="rm -rf '$TARGET_DIR'"
+
+baseline=""
+for jobs in $(job_counts); do
+    elapsed=$(measure "$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" \
+                                --reflink=never --jobs "$jobs")
+    baseline="${baseline:-$elapsed}"
+    printf "%8s %12s %12s %10s\n" "$jobs" "$elapsed" \
+        "$(throughput "$total_mb" "$elapsed")" "$(speedup "$baseline" "$elapsed")"
+done
@@ -0,0 +1,25 @@
+#!/bin/sh
+
+# Scaling of directory scan with number of metadata probing threads.
+# Latency-bound devices (SD cards, USB readers) show the effect best;
+# use BENCH_DIR on such device and BENCH_DROP_CACHES=1 to avoid warm cache.
+
+set -eu
+. "$(dirname "$0")/common.sh"
+
+FILE_COUNT="${BENCH_FILES:-20000}"
+SOURCE_DIR="$BENCH_DIR/source"
+TARGET_DIR="$BENCH_DIR/target"
+
+make_files "$SOURCE_DIR" "$FILE_COUNT"
+
+echo "Scanning $FILE_COUNT files (dry run, best of $BENCH_RUNS)"
+printf "%8s %12s %10s\n" "jobs" "seconds" "speedup"
+
+baseline=""
+for jobs in $(job_counts); do
+    elapsed=$(measure "$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" \
+                                --dry-run --jobs "$jobs")
+    baseline="${baseline:-$elapsed}"
+    printf "%8s %12s %10s\n" "$jobs" "$elapsed" "$(speedup "$baseline" "$elapsed")"
+done
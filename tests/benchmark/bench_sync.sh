@@ -0,0 +1,30 @@
+#!/bin/sh
+
+# Cost of durability modes: without flushing, with fdatasync() of every copy
+# and with a single flush of target file system before commit. Time without
+# flushing does not include writeback, which kernel performs later.
+
+set -eu
+. "$(dirname "$0")/common.sh"
+
+FILE_COUNT="${BENCH_FILES:-2000}"
+FILE_SIZE_KB="${BENCH_FILE_SIZE_KB:-64}"
+SOURCE_DIR="$BENCH_DIR/source"
+TARGET_DIR="$BENCH_DIR/target"
+
+make_files "$SOURCE_DIR" "$FILE_COUNT" $((FILE_SIZE_KB * 1024))
+
+echo "Copying $FILE_COUNT files of $FILE_SIZE_KB KB (best of $BENCH_RUNS)"
+printf "%12s %12s %10s\n" "sync" "seconds" "slowdown"
+
+export BENCH_SETUP="rm -rf '$TARGET_DIR'; sync"
+
+none_elapsed=$(measure "$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" \
+                                 --reflink=never --sync=none)
+printf "%12s %12s %10s\n" "none" "$none_elapsed" "1.00x"
+
+for mode in file batch; do
+    elapsed=$(measure "$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" \
+                                --reflink=never --sync=$mode)
+    printf "%12s %12s %10s\n" "$mode" "$elapsed" "$(speedup "$elapsed" "$none_elapsed")"
+done
@@ -0,0 +1,29 @@
+#!/bin/sh
+
+# Copying many small files synchronously and through io_uring.
+# Per-file syscall overhead dominates this workload; use BENCH_DROP_CACHES=1
+# to include reading files from device.
+
+set -eu
+. "$(dirname "$0")/common.sh"
+
+FILE_COUNT="${BENCH_FILES:-5000}"
+FILE_SIZE_KB="${BENCH_FILE_SIZE_KB:-16}"
+SOURCE_DIR="$BENCH_DIR/source"
+TARGET_DIR="$BENCH_DIR/target"
+
+make_files "$SOURCE_DIR" "$FILE_COUNT" $((FILE_SIZE_KB * 1024))
+
+echo "Copying $FILE_COUNT files of $FILE_SIZE_KB KB (best of $BENCH_RUNS)"
+printf "%12s %12s %10s\n" "backend" "seconds" "speedup"
+
+export BENCH_SETUP="rm -rf '$TARGET_DIR'"
+
+sync_elapsed=$(measure "$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" \
+                                 --reflink=never)
+printf "%12s %12s %10s\n" "sync" "$sync_elapsed" "1.00x"
+
+uring_elapsed=$(measure "$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" \
+                                  --reflink=never --io-uring)
+printf "%12s %12s %10s\n" "io_uring" "$uring_elapsed" \
+    "$(speedup "$sync_elapsed" "$uring_elapsed")"
@@ -0,0 +1,87 @@
+#!/bin/sh
+
+BENCH_RUNS="${BENCH_RUNS:-3}"
+
+# Print current time in seconds with sub-second precision
+now() {
+    local value
+    value=$(date +%s.%N)
+    case "$value" in
+        *N) perl -MTime::HiRes=time -e 'printf "%.6f\n", time' ;;
+        *)  echo "$value" ;;
+    esac
+}
+
+# Drop page cache between runs if requested (Linux, requires root)
+drop_caches() {
+    if [ "${BENCH_DROP_CACHES:-0}" = "1" ]; then
+        sync
+        echo 3 > /proc/sys/vm/drop_caches
+    fi
+}
+
+# Print best wall-clock time of BENCH_RUNS runs of a command, in seconds.
+# Optional setup command from BENCH_SETUP is executed before every run.
+measure() {
+    local best=""
+    local run=0
+    while [ "$run" -lt "$BENCH_RUNS" ]; do
+        if [ -n "${BENCH_SETUP:-}" ]; then
+            eval "$BENCH_SETUP"
+        fi
+        drop_caches
+        local start
+        local finish
+        start=$(now)
+        "$@" > /dev/null 2>&1
+        finish=$(now)
+        best=$(echo "$start $finish ${best:-}" | awk '{
+            elapsed = $2 - $1
+            if ($3 == "" || elapsed < $3) { printf "%.3f", elapsed }
+            else { printf "%.3f", $3 }
+        }')
+        run=$((run + 1))
+    done
+    echo "$best"
+}
+
+# Print ratio of two durations
+speedup() {
+    echo "$1 $2" | awk '{ if ($2 > 0) printf "%.2fx", $1 / $2; else print "-" }'
+}
+
+# Create COUNT files of SIZE bytes in DIR
+make_files() {
+    local directory="$1"
+    local count="$2"
+    local size="${3:-16}"
+
+    mkdir -p "$directory"
+    head -c "$size" /dev/zero > "$directory/.template"
+    local i=0
+    while [ "$i" -lt "$count" ]; do
+        cp "$directory/.template" "$directory/file$i.jpg"
+        i=$((i + 1))
+    done
+    rm "$directory/.template"
+}
+
+# Create COUNT empty files in DIR, much faster than make_files for large COUNT
+make_empty_files() {
+    local directory="$1"
+    local count="$2"
+
+    mkdir -p "$directory"
+    (cd "$directory" && awk -v n="$count" 'BEGIN { for (i = 0; i < n; i++) print "file" i ".jpg" }' \
+        | xargs touch)
+}
+
+# Default list of thread counts: 1, 2, 4, ... up to BENCH_MAX_JOBS
+job_counts() {
+    local max="${BENCH_MAX_JOBS:-8}"
+    local jobs=1
+    while [ "$jobs" -le "$max" ]; do
+        echo "$jobs"
+        jobs=$((jobs * 2))
+    done
+}
@@ -0,0 +1,81 @@
+/*
+ * Microbenchmark of file name generation. Names are generated for a batch
+ * of synthetic files, several files per day, all with the same tags, once
+ * with `file_generate_name()` and once with a shared `FileNameFormatter`.
+ *
+ * Build: cc -O2 -Isrc -o name_rate name_rate.c src/Files/File.c src/Files/Tags.c \
+ *           src/Common/Arena.c src/Common/Strings.c -lpthread
+ * Usage: name_rate [FILE_COUNT]
+ */
+#define _GNU_SOURCE /* clock_gettime() */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "Files/File.h"
+
+enum {
+  DEFAULT_FILE_COUNT = 1000000,
+  FILES_PER_DAY = 50,
+  NAME_BUFSIZE = FILENAME_MAX + 1,
+  PATH_BUFSIZE = 64
+};
+
+static double now(void) {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (double) time.tv_sec + (double) time.tv_nsec * 1e-9;
+}
+
+/* Keep compiler from dropping generated names */
+static volatile unsigned long checksum;
+
+static void report(const char* method, size_t count, double seconds) {
+  printf("%12s %14.0f %12.1f\n", method, (double) count / seconds,
+         seconds * 1e9 / (double) count);
+}
+
+int main(int argc, char** argv) {
+  size_t count = argc > 1 ? (size_t) strtoul(argv[1], NULL, 10) : DEFAULT_FILE_COUNT;
+
+  IndexedFile* files = (IndexedFile*) calloc(count, sizeof(*files));
+  char* paths = (char*) calloc(count, PATH_BUFSIZE);
+  if (files == NULL || paths == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    return 1;
+  }
+
+  time_t start_time = 1700000000;
+  for (size_t i = 0; i < count; ++i) {
+    char* path = paths + i * PATH_BUFSIZE;
+    snprintf(path, PATH_BUFSIZE, "/media/card/DCIM/IMG_%06zu.jpg", i);
+    time_t timestamp = start_time + (time_t) (i / FILES_PER_DAY) * 24 * 60 * 60;
+    file_init_with_timestamp(&files[i], path, timestamp);
+    file_add_tag(&files[i], "vacation");
+    file_add_tag(&files[i], "family");
+  }
+
+  char name[NAME_BUFSIZE];
+  printf("Generating %zu names\n", count);
+  printf("%12s %14s %12s\n", "method", "names/s", "ns/name");
+
+  double begin = now();
+  for (size_t i = 0; i < count; ++i) {
+    checksum += file_generate_name(&files[i], (uint64_t) i, NAME_BUFSIZE, name);
+  }
+  report("uncached", count, now() - begin);
+
+  FileNameFormatter formatter;
+  file_name_formatter_init(&formatter);
+  begin = now();
+  for (size_t i = 0; i < count; ++i) {
+    checksum += file_name_format(&formatter, &files[i], (uint64_t) i,
+                                 NAME_BUFSIZE, name);
+  }
+  report("formatter", count, now() - begin);
+
+  free(paths);
+  free(files);
+  return 0;
+}
@@ -0,0 +1,63 @@
+#!/bin/sh
+
+set -eu
+
+BENCH_DIR="${BENCH_DIR:-.tmp/bench}"
+BINARY="${CORGI_BINARY:-build/bin/corgi}"
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+
+export BENCH_DIR
+export BINARY
+export SCRIPT_DIR
+
+run_bench_file() {
+    local bench_file="$1"
+    local bench_name=$(basename "$bench_file")
+    bench_name=${bench_name%.*}
+    bench_name=${bench_name#bench_}
+    echo "============================"
+    echo "Running '$bench_name' benchmark..."
+    echo ""
+
+    rm -rf "${BENCH_DIR:?}"/*
+    sh "$bench_file"
+    echo ""
+}
+
+main() {
+    echo "Corgi Benchmark Suite"
+    echo "---------------------"
+    echo "Benchmark directory: $BENCH_DIR"
+    echo "Binary: $BINARY"
+    echo ""
+
+    if [ ! -x "$BINARY" ]; then
+        echo "Error: Binary not found at $BINARY"
+        echo "Run 'make all TARGET=Release' first"
+        exit 1
+    fi
+
+    mkdir -p "$BENCH_DIR"
+
+    # If benchmark names are provided as arguments, run only those
+    if [ $# -gt 0 ]; then
+        for bench_name in "$@"; do
+            bench_file="$SCRIPT_DIR/bench_${bench_name}.sh"
+            if [ ! -f "$bench_file" ]; then
+                echo "Error: Benchmark file 'bench_${bench_name}.sh' not found"
+                exit 1
+            fi
+            run_bench_file "$bench_file"
+        done
+    else
+        for bench_file in "$SCRIPT_DIR"/bench_*.sh; do
+            if [ -f "$bench_file" ]; then
+                run_bench_file "$bench_file"
+            fi
+        done
+    fi
+
+    rm -rf "${BENCH_DIR:?}"/*
+}
+
+main "$@"
@@ -0,0 +1,121 @@
+/*
+ * Stress test of file numbering. Transactions are prepared in dry run for
+ * index of synthetic files, and names of all target files are checked to be
+ * unique. Files are numbered continuously within one day, continuously across
+ * days, and separately for every day, each time with more files sharing a
+ * name date than 16-bit numbers could tell apart.
+ *
+ * Build: cc -O2 -Isrc -o numbering_stress numbering_stress.c <sources of
+ *        src/Files and src/Common> -lpthread
+ * Usage: numbering_stress TARGET_DIR [FILE_COUNT]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Common/StringSet.h"
+#include "Files/Index.h"
+#include "Files/Transaction.h"
+
+enum {
+  DEFAULT_FILE_COUNT = 1100000,
+  SECONDS_PER_DAY = 24 * 60 * 60
+};
+
+static const time_t START_TIME = 1700000000;
+
+/* Fill index with `count` files, `files_per_day` of them sharing every date */
+static void fill_index(FileIndex* index, size_t count, size_t files_per_day) {
+  file_index_init(index);
+  FileMetadata metadata;
+  memset(&metadata, 0, sizeof(metadata));
+  metadata.is_regular = 1;
+  for (size_t i = 0; i < count; ++i) {
+    time_t day = (time_t) (i / files_per_day);
+    /* Files of one day are spread over it, in order of index */
+    time_t second = (time_t) ((i % files_per_day) * SECONDS_PER_DAY / files_per_day);
+    metadata.timestamp = START_TIME + day * SECONDS_PER_DAY + second;
+    file_index_push(index, NULL, "synthetic.jpg", &metadata);
+  }
+}
+
+static int check_unique_names(
+  const char* scenario,
+  const char* target_dir,
+  size_t count,
+  size_t files_per_day,
+  TransactionOptions* options
+) {
+  FileIndex index;
+  fill_index(&index, count, files_per_day);
+
+  FileTransaction transaction;
+  file_error_t result = file_transaction_init(&transaction, target_dir, options);
+  if (result == FERR_NONE) {
+    result = file_transaction_prepare(&transaction, &index, options, NULL);
+  }
+  if (result != FERR_NONE) {
+    fprintf(stderr, "%s: failed to prepare transaction (error %d)\n", scenario, (int) result);
+    file_index_clear(&index);
+    return 1;
+  }
+
+  StringSet names;
+  string_set_init(&names);
+  size_t duplicate_count = 0;
+  size_t longest_name = 0;
+  for (size_t i = 0; i < transaction.operation_count; ++i) {
+    const PreparedOperation* op = &transaction.operations[i];
+    const char* name = strrchr(op->target_path, '/') + 1;
+    size_t length = strlen(name);
+    if (!string_set_insert(&names, name, length)) {
+      if (duplicate_count == 0) {
+        fprintf(stderr, "%s: duplicate name %s\n", scenario, name);
+      }
+      duplicate_count++;
+    }
+    if (length > longest_name) {
+      longest_name = length;
+    }
+  }
+
+  size_t unique_count = names.count;
+  printf("%s: %zu files, %zu unique names, longest name %zu characters\n",
+         scenario, transaction.operation_count, unique_count, longest_name);
+
+  string_set_destroy(&names);
+  file_transaction_cleanup(&transaction);
+  file_index_clear(&index);
+  return duplicate_count == 0 && unique_count == count ? 0 : 1;
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s TARGET_DIR [FILE_COUNT]\n", argv[0]);
+    return 2;
+  }
+  const char* target_dir = argv[1];
+  size_t count = argc > 2 ? (size_t) strtoul(argv[2], NULL, 10) : DEFAULT_FILE_COUNT;
+
+  TransactionOptions options;
+  memset(&options, 0, sizeof(options));
+  options.dry_run = 1;
+  options.index_width = FILE_INDEX_DEFAULT_WIDTH;
+
+  int failures = 0;
+  failures += check_unique_names("one day", target_dir, count, count, &options);
+
+  options.index_width = 0;
+  options.first_index = 70000;
+  failures += check_unique_names("many days, auto width", target_dir, count, count / 7, &options);
+
+  options.per_date_numbering = 1;
+  failures += check_unique_names("per date", target_dir, count, count / 11, &options);
+
+  if (failures != 0) {
+    printf("Names are not unique\n");
+    return 1;
+  }
+  printf("All names are unique\n");
+  return 0;
+}
@@ -318,6 +318,43 @@ test_group "Long option abbreviation"
         "$BINARY" --source "$SOURCE_DIR" --ta "$TARGET_DIR" --dry-run
 finish_test || exit 1
 
+test_group "Jobs option"
+    setup_file
+
+    assert_success "Accepts -j N" \
+        "$BINARY" -s "$SOURCE_DIR" -d "$TARGET_DIR" -j 4 --dry-run
+
+    assert_success "Accepts --jobs=N" \
+        "$BINARY" -s "$SOURCE_DIR" -d "$TARGET_DIR" --jobs=4 --dry-run
+
+    output=$("$BINARY" -s "$SOURCE_DIR" -d "$TARGET_DIR" -j 0 2>&1 || true)
+    assert_contains "Rejects zero jobs" "$output" "Number of jobs"
+
+    output=$("$BINARY" -s "$SOURCE_DIR" -d "$TARGET_DIR" -j many 2>&1 || true)
+    assert_contains "Rejects non-numeric jobs" "$output" "Number of jobs"
+
+    output=$("$BINARY" -s "$SOURCE_DIR" -d "$TARGET_DIR" -j 4x 2>&1 || true)
+    assert_contains "Rejects trailing characters" "$output" "Number of jobs"
+finish_test || exit 1
+
+test_group "Recursion options"
+    setup_file
+
+    assert_success "Accepts -r" \
+        "$BINARY" -s "$SOURCE_DIR" -d "$TARGET_DIR" -r --dry-run
+
+    assert_success "Accepts --max-depth=N" \
+        "$BINARY" -s "$SOURCE_DIR" -d "$TARGET_DIR" --max-depth=3 --dry-run
+
+    output=$("$BINARY" -s "$SOURCE_DIR" -d "$TARGET_DIR" \
+                       --max-depth 0 2>&1 || true)
+    assert_contains "Rejects zero depth" "$output" "Maximum depth"
+
+    output=$("$BINARY" --help 2>&1)
+    assert_contains "Long-only option shown without short name" \
+        "$output" "  --max-depth=N"
+finish_test || exit 1
+
 # == Errors in usage ==
 
 test_group "Missing required options"
@@ -409,6 +446,10 @@ test_group "Too many tags"
         -t i -t j -t k -t l -t m -t n -t o -t p 2>&1 || true)
     assert_contains "16 tags: CLI accepts, file limit reached" \
         "$output" "Failed to add tags"
+
+    assert_success "Repeated tags count once" \
+        "$BINARY" -s "$SOURCE_DIR" -d "$TARGET_DIR" --dry-run \
+        -t a -t b -t c -t d -t e -t f -t g -t h -t a -t b
 finish_test || exit 1
 
 test_group "Repeated options"
@@ -425,4 +466,92 @@ test_group "Repeated options"
 finish_test || exit 1
 
 
+test_group "Reflink option"
+    setup_file
+
+    for mode in auto always never; do
+        assert_success "Accepts --reflink=$mode" \
+            "$BINARY" -s "$SOURCE_DIR" -d "$TARGET_DIR" --reflink=$mode --dry-run
+    done
+
+    output=$("$BINARY" -s "$SOURCE_DIR" -d "$TARGET_DIR" --reflink=maybe 2>&1 || true)
+    assert_contains "Rejects unknown mode" "$output" "Reflink mode"
+finish_test || exit 1
+
+test_group "io_uring option"
+    setup_file
+
+    assert_success "Accepts --io-uring" \
+        "$BINARY" -s "$SOURCE_DIR" -d "$TARGET_DIR" --io-uring --dry-run
+finish_test || exit 1
+
+test_group "Cache policy option"
+    setup_file
+
+    for policy in keep drop direct; do
+        assert_success "Accepts --cache-policy=$policy" \
+            "$BINARY" -s "$SOURCE_DIR" -d "$TARGET_DIR" --cache-policy=$policy --dry-run
+    done
+
+    output=$("$BINARY" -s "$SOURCE_DIR" -d "$TARGET_DIR" --cache-policy=maybe 2>&1 || true)
+    assert_contains "Rejects unknown policy" "$output" "Cache policy"
+finish_test || exit 1
+
+test_group "Sync option"
+    setup_file
+
+    for mode in none file batch; do
+        assert_success "Accepts --sync=$mode" \
+            "$BINARY" -s "$SOURCE_DIR" -d "$TARGET_DIR" --sync=$mode --dry-run
+    done
+
+    output=$("$BINARY" -s "$SOURCE_DIR" -d "$TARGET_DIR" --sync=always 2>&1 || true)
+    assert_contains "Rejects unknown mode" "$output" "Sync mode"
+finish_test || exit 1
+
+test_group "Index width option"
+    setup_file
+
+    for width in 1 3 20 auto; do
+        assert_success "Accepts --index-width=$width" \
+            "$BINARY" -s "$SOURCE_DIR" -d "$TARGET_DIR" --index-width=$width --dry-run
+    done
+
+    for width in 0 21 wide; do
+        output=$("$BINARY" -s "$SOURCE_DIR" -d "$TARGET_DIR" --index-width=$width 2>&1 || true)
+        assert_contains "Rejects --index-width=$width" "$output" "Index width"
+    done
+
+    assert_success "Accepts --per-date-numbering" \
+        "$BINARY" -s "$SOURCE_DIR" -d "$TARGET_DIR" --per-date-numbering --dry-run
+finish_test || exit 1
+
+test_group "Memory limit option"
+    setup_file
+
+    for size in 16384 64K 64k 256M 1G; do
+        assert_success "Accepts --max-memory=$size" \
+            "$BINARY" -s "$SOURCE_DIR" -d "$TARGET_DIR" --max-memory=$size --dry-run
+    done
+
+    for size in 0 16383 8K 1T 12KB much; do
+        output=$("$BINARY" -s "$SOURCE_DIR" -d "$TARGET_DIR" --max-memory=$size 2>&1 || true)
+        assert_contains "Rejects --max-memory=$size" "$output" "Memory limit"
+    done
+finish_test || exit 1
+
+test_group "Batch size option"
+    setup_file
+
+    for size in 1 100 512B 64K 1g; do
+        assert_success "Accepts --batch-size=$size" \
+            "$BINARY" -s "$SOURCE_DIR" -d "$TARGET_DIR" --batch-size=$size --dry-run
+    done
+
+    for size in 0 0K -5 10KB files; do
+        output=$("$BINARY" -s "$SOURCE_DIR" -d "$TARGET_DIR" --batch-size=$size 2>&1 || true)
+        assert_contains "Rejects --batch-size=$size" "$output" "Batch size"
+    done
+finish_test || exit 1
+
 exit 0
@@ -50,4 +50,99 @@ test_group "Preserve content"
     done
 finish_test || exit 1
 
+test_group "Large file copy"
+    rm -rf "$SOURCE_DIR" "$TARGET_DIR"
+    mkdir -p "$SOURCE_DIR" "$TARGET_DIR"
+    head -c 3000000 /dev/urandom > "$SOURCE_DIR/video.mp4"
+    : > "$SOURCE_DIR/empty.mp4"
+
+    output=$("$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" --verbose 2>&1)
+    assert_matches "Copy method reported" "$output" \
+        "video.mp4 -> .* \((copy_file_range|sendfile|read/write)\)"
+
+    target_file=$(find "$TARGET_DIR" -type f -size +0 | head -1)
+    assert_files_identical "Content preserved" "$SOURCE_DIR/video.mp4" "$target_file"
+    assert_file_count "Empty file copied" "$TARGET_DIR" 2
+finish_test || exit 1
+
+test_group "Chunked copy"
+    rm -rf "$SOURCE_DIR" "$TARGET_DIR"
+    mkdir -p "$SOURCE_DIR" "$TARGET_DIR"
+    # Above chunked copy threshold, not a multiple of chunk size
+    head -c 150000001 /dev/urandom > "$SOURCE_DIR/video.mp4"
+
+    assert_success "Just works" \
+        "$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" --jobs 4
+
+    target_file=$(find "$TARGET_DIR" -type f | head -1)
+    assert_files_identical "Content preserved" "$SOURCE_DIR/video.mp4" "$target_file"
+finish_test || exit 1
+
+test_group "Cache policies"
+    rm -rf "$SOURCE_DIR" "$TARGET_DIR"
+    mkdir -p "$SOURCE_DIR"
+    # Above O_DIRECT threshold, with last block not aligned
+    head -c 140000001 /dev/urandom > "$SOURCE_DIR/video.mp4"
+    create_test_file "$SOURCE_DIR/photo.jpg" "small content"
+
+    for policy in keep drop direct; do
+        rm -rf "$TARGET_DIR"
+        mkdir -p "$TARGET_DIR"
+        assert_success "Works with --cache-policy=$policy" \
+            "$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" \
+                      --cache-policy=$policy --reflink=never
+
+        target_file=$(find "$TARGET_DIR" -type f -name "*.mp4" | head -1)
+        assert_files_identical "Large file preserved with $policy" \
+            "$SOURCE_DIR/video.mp4" "$target_file"
+        target_file=$(find "$TARGET_DIR" -type f -name "*.jpg" | head -1)
+        assert_files_identical "Small file preserved with $policy" \
+            "$SOURCE_DIR/photo.jpg" "$target_file"
+    done
+finish_test || exit 1
+
+test_group "Reflink modes"
+    rm -rf "$SOURCE_DIR" "$TARGET_DIR"
+    mkdir -p "$SOURCE_DIR" "$TARGET_DIR"
+    create_test_file "$SOURCE_DIR/file.txt" "cloned content"
+
+    output=$("$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" \
+                       --reflink=never --verbose 2>&1)
+    assert_contains_count "Data copied" "$output" "(reflink)" 0
+    rm -rf "$TARGET_DIR"/*
+
+    assert_success "Falls back to copy" \
+        "$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" --reflink=auto
+    assert_file_count "File copied" "$TARGET_DIR" 1
+    rm -rf "$TARGET_DIR"/*
+
+    # Result depends on whether file system supports reflinks
+    if output=$("$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" \
+                          --reflink=always --verbose 2>&1); then
+        assert_contains "File cloned" "$output" "(reflink)"
+        assert_file_count "Clone created" "$TARGET_DIR" 1
+    else
+        assert_contains "Hint reported" "$output" "--reflink=auto"
+        assert_file_count "Nothing left after rollback" "$TARGET_DIR" 0
+    fi
+finish_test || exit 1
+
+test_group "io_uring copy"
+    rm -rf "$SOURCE_DIR" "$TARGET_DIR"
+    mkdir -p "$SOURCE_DIR" "$TARGET_DIR"
+    head -c 1000000 /dev/urandom > "$SOURCE_DIR/video.mp4"
+    create_test_file "$SOURCE_DIR/file.txt" "small content"
+    : > "$SOURCE_DIR/empty.txt"
+
+    output=$("$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" \
+                       --io-uring --reflink=never --verbose 2>&1)
+    # Falls back to synchronous copy on kernels without io_uring
+    assert_matches "Files copied" "$output" \
+        "video.mp4 -> .* \((io_uring|copy_file_range|sendfile|read/write)\)"
+
+    target_file=$(find "$TARGET_DIR" -type f -name "*.mp4" | head -1)
+    assert_files_identical "Content preserved" "$SOURCE_DIR/video.mp4" "$target_file"
+    assert_file_count "All files copied" "$TARGET_DIR" 3
+finish_test || exit 1
+
 exit 0
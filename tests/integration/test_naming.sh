@@ -93,4 +93,77 @@ test_group "Preserve extension"
         "$(find "$TARGET_DIR" -name "*_mixed" -type f ! -name "*.*" | head -1)"
 finish_test || exit 1
 
+test_group "Names do not depend on number of jobs"
+    rm -rf "$SOURCE_DIR" "$TARGET_DIR"
+    mkdir -p "$SOURCE_DIR" "$TARGET_DIR"
+    for i in $(seq 1 200); do
+        create_test_file "$SOURCE_DIR/file$i.txt" "content $i"
+    done
+
+    sequential=$("$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" \
+                           --verbose --dry-run --jobs 1 2>&1)
+    parallel=$("$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" \
+                         --verbose --dry-run --jobs 8 2>&1)
+
+    assert_contains "All files found" "$parallel" "Found 200 files"
+    assert_success "Same names generated" \
+        test "$sequential" = "$parallel"
+finish_test || exit 1
+
+test_group "Index width"
+    rm -rf "$SOURCE_DIR" "$TARGET_DIR"
+    mkdir -p "$SOURCE_DIR"
+    for i in $(seq 1 12); do
+        create_test_file "$SOURCE_DIR/file$i.txt" "content $i"
+    done
+
+    output=$("$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" \
+                       --verbose --dry-run --index-width 5 2>&1)
+    assert_contains_count "Numbers padded to given width" "$output" "_000" 12
+    assert_contains "Last number padded" "$output" "_00011.txt"
+
+    output=$("$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" \
+                       --verbose --dry-run --index-width 1 2>&1)
+    assert_contains "Narrow width does not truncate numbers" "$output" "_11.txt"
+
+    output=$("$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" \
+                       --verbose --dry-run --index-width auto 2>&1)
+    assert_contains "Automatic width is at least three digits" "$output" "_011.txt"
+finish_test || exit 1
+
+test_group "Per-date numbering"
+    rm -rf "$SOURCE_DIR" "$TARGET_DIR"
+    mkdir -p "$SOURCE_DIR" "$TARGET_DIR"
+    for i in 1 2 3; do
+        create_test_file "$SOURCE_DIR/old$i.txt" "old $i"
+    done
+
+    assert_success "First import" \
+        "$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" --per-date-numbering
+    rm -f "$SOURCE_DIR"/*
+    for i in 1 2; do
+        create_test_file "$SOURCE_DIR/new$i.txt" "new $i"
+    done
+
+    assert_success "Second import continues numbering" \
+        "$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" --per-date-numbering
+    assert_file_count "All files kept" "$TARGET_DIR" 5
+    assert_file_exists "Numbered after existing files" \
+        "$(find "$TARGET_DIR" -name "*_004.txt" | head -1)"
+finish_test || exit 1
+
+test_group "More than a million names"
+    STRESS_PROGRAM="$TEST_DIR/numbering_stress"
+    SOURCE_ROOT="$SCRIPT_DIR/../../src"
+
+    assert_success "Stress test builds" \
+        ${CC:-cc} -std=c99 -O2 -pthread -I"$SOURCE_ROOT" -o "$STRESS_PROGRAM" \
+            "$SCRIPT_DIR/numbering_stress.c" "$SOURCE_ROOT"/Files/*.c "$SOURCE_ROOT"/Common/*.c
+
+    output=$("$STRESS_PROGRAM" "$TEST_DIR/stress_target" 2>&1 || true)
+    assert_contains "Names of 1100000 files are unique" "$output" "All names are unique"
+    assert_contains "Numbers of one day exceed 16 bits" \
+        "$output" "one day: 1100000 files, 1100000 unique names"
+finish_test || exit 1
+
 exit 0
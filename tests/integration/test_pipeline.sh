@@ -0,0 +1,73 @@
+#!/bin/sh
+
+set -eu
+. "$(dirname "$0")/assertions.sh"
+
+SOURCE_DIR="$TEST_DIR/source"
+TARGET_DIR="$TEST_DIR/target"
+REFERENCE_DIR="$TEST_DIR/reference"
+
+setup_tree() {
+    rm -rf "$SOURCE_DIR" "$TARGET_DIR" "$REFERENCE_DIR"
+    mkdir -p "$SOURCE_DIR" "$TARGET_DIR" "$REFERENCE_DIR"
+    for i in $(seq 1 20); do
+        create_test_file "$SOURCE_DIR/dir$((i % 4))/file$i.jpg" "content $i"
+    done
+}
+
+test_group "Pipelined copy"
+    setup_tree
+
+    assert_success "Just works" \
+        "$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" \
+                  --recursive --pipeline --jobs 4 --tag pipe
+    assert_file_count "All files copied" "$TARGET_DIR" 20
+    assert_success "No temporary files left" \
+        test "$(find "$TARGET_DIR" -name '.*' -type f | wc -l)" -eq 0
+finish_test || exit 1
+
+test_group "Same result as without pipeline"
+    setup_tree
+
+    assert_success "Pipelined run works" \
+        "$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" \
+                  --recursive --pipeline --jobs 4
+    assert_success "Regular run works" \
+        "$BINARY" --source "$SOURCE_DIR" --target "$REFERENCE_DIR" \
+                  --recursive
+
+    for reference in "$REFERENCE_DIR"/*; do
+        assert_files_identical "Same file at $(basename "$reference")" \
+            "$reference" "$TARGET_DIR/$(basename "$reference")"
+    done
+finish_test || exit 1
+
+test_group "Rollback on file collision"
+    setup_tree
+
+    assert_success "Works first time" \
+        "$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" \
+                  --recursive --pipeline --jobs 4
+
+    output=$("$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" \
+                       --recursive --pipeline --jobs 4 2>&1 || true)
+
+    assert_contains "Error reported" "$output" "already exists"
+    assert_file_count "Original files preserved, copies removed" "$TARGET_DIR" 20
+
+    assert_success "Force overwrite succeeds" \
+        "$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" \
+                  --recursive --pipeline --jobs 4 --force
+    assert_file_count "Files overwritten" "$TARGET_DIR" 20
+finish_test || exit 1
+
+test_group "Invalid tag"
+    setup_tree
+
+    assert_failure "Rejected before copying" \
+        "$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" \
+                  --recursive --pipeline --tag "Bad Tag"
+    assert_file_count "Nothing copied" "$TARGET_DIR" 0
+finish_test || exit 1
+
+exit 0
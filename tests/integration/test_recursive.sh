@@ -0,0 +1,76 @@
+#!/bin/sh
+
+set -eu
+. "$(dirname "$0")/assertions.sh"
+
+SOURCE_DIR="$TEST_DIR/source"
+TARGET_DIR="$TEST_DIR/target"
+
+setup_tree() {
+    rm -rf "$SOURCE_DIR" "$TARGET_DIR"
+    mkdir -p "$SOURCE_DIR" "$TARGET_DIR"
+    create_test_file "$SOURCE_DIR/top.jpg" "top"
+    create_test_file "$SOURCE_DIR/DCIM/100CANON/first.jpg" "first"
+    create_test_file "$SOURCE_DIR/DCIM/100CANON/second.jpg" "second"
+    create_test_file "$SOURCE_DIR/DCIM/101CANON/third.jpg" "third"
+    create_test_file "$SOURCE_DIR/DCIM/101CANON/deep/fourth.jpg" "fourth"
+}
+
+test_group "Flat scan by default"
+    setup_tree
+
+    assert_success "Just works" \
+        "$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR"
+    assert_file_count "Only top-level file copied" "$TARGET_DIR" 1
+finish_test || exit 1
+
+test_group "Recursive scan"
+    setup_tree
+
+    assert_success "Just works" \
+        "$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" --recursive
+    assert_file_count "Nested files copied" "$TARGET_DIR" 5
+    assert_success "Target is flat" \
+        test "$(find "$TARGET_DIR" -mindepth 1 -type d | wc -l)" -eq 0
+finish_test || exit 1
+
+test_group "Maximum depth"
+    setup_tree
+
+    output=$("$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" \
+                       --max-depth 2 --verbose --dry-run 2>&1)
+    assert_contains "Files up to depth found" "$output" "Found 4 files"
+    assert_contains_count "Deeper file skipped" "$output" "fourth.jpg" 0
+
+    output=$("$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" \
+                       --max-depth 1 --verbose --dry-run 2>&1)
+    assert_contains "Only top level scanned" "$output" "Found 1 files"
+finish_test || exit 1
+
+test_group "Symbolic link loop"
+    setup_tree
+    ln -s .. "$SOURCE_DIR/DCIM/loop"
+    ln -s "$SOURCE_DIR/DCIM/100CANON" "$SOURCE_DIR/alias"
+
+    output=$("$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" \
+                       --recursive --verbose --dry-run 2>&1)
+    assert_contains "Each file found once" "$output" "Found 5 files"
+finish_test || exit 1
+
+test_group "Result does not depend on number of jobs"
+    setup_tree
+    for i in $(seq 1 20); do
+        create_test_file "$SOURCE_DIR/DCIM/10${i}CANON/file.jpg" "$i"
+    done
+
+    sequential=$("$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" \
+                           --recursive --verbose --dry-run --jobs 1 2>&1)
+    parallel=$("$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" \
+                         --recursive --verbose --dry-run --jobs 8 2>&1)
+
+    assert_contains "All files found" "$parallel" "Found 25 files"
+    assert_success "Same names generated" \
+        test "$sequential" = "$parallel"
+finish_test || exit 1
+
+exit 0
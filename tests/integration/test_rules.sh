@@ -0,0 +1,98 @@
+#!/bin/sh
+
+set -eu
+. "$(dirname "$0")/assertions.sh"
+
+SOURCE_DIR="$TEST_DIR/source"
+TARGET_DIR="$TEST_DIR/target"
+RULES_FILE="$TEST_DIR/rules"
+
+setup_files() {
+    rm -rf "$SOURCE_DIR" "$TARGET_DIR"
+    mkdir -p "$SOURCE_DIR" "$TARGET_DIR"
+    head -c 2048 /dev/zero > "$SOURCE_DIR/clip.MP4"
+    create_test_file "$SOURCE_DIR/short.mp4" "short"
+    create_test_file "$SOURCE_DIR/image.cr2" "raw"
+    create_test_file "$SOURCE_DIR/image.thumb.jpg" "thumbnail"
+    create_test_file "$SOURCE_DIR/photo.jpg" "photo"
+    create_test_file "$SOURCE_DIR/notes.tmp" "junk"
+}
+
+test_group "Actions decided by rules"
+    setup_files
+    cat > "$RULES_FILE" <<EOF
+# Large videos are moved, small ones fall through to default copy
+ext=mp4,mov size>=1K -> move video
+
+ext=cr2 -> copy raw
+name=*.thumb.* -> ignore
+ext=tmp -> delete
+ext=jpg after=2000-01-01 before=2100-01-01 -> copy photo
+EOF
+
+    output=$("$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" \
+                       --rules "$RULES_FILE" --dry-run --verbose 2>&1)
+    assert_contains "Large video moved" "$output" "Move: $SOURCE_DIR/clip.MP4"
+    assert_contains "Small video copied" "$output" "Copy: $SOURCE_DIR/short.mp4"
+    assert_contains "Thumbnail ignored" "$output" "Ignore: $SOURCE_DIR/image.thumb.jpg"
+    assert_contains "Temporary file deleted" "$output" "Delete: $SOURCE_DIR/notes.tmp"
+    assert_contains "Rule tags added" "$output" "_photo.jpg"
+
+    assert_success "Rules applied" \
+        "$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" --rules "$RULES_FILE"
+    assert_file_count "Moved and copied files in target" "$TARGET_DIR" 4
+    assert_file_count "Moved and deleted files removed from source" "$SOURCE_DIR" 4
+    assert_contains "Moved file tagged" "$(ls "$TARGET_DIR")" "_video.MP4"
+    assert_contains "Numbers not taken by ignored and deleted files" \
+        "$(ls "$TARGET_DIR" | cut -c12-14 | tr '\n' ' ')" "000 001 002 003 "
+finish_test || exit 1
+
+test_group "First matching rule decides"
+    setup_files
+    cat > "$RULES_FILE" <<EOF
+name=photo.* -> ignore
+-> copy all
+EOF
+
+    output=$("$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" \
+                       --rules "$RULES_FILE" --dry-run --verbose 2>&1)
+    assert_contains "Earlier rule wins" "$output" "Ignore: $SOURCE_DIR/photo.jpg"
+    assert_contains_count "Rule without conditions matches rest" "$output" "_all." 5
+finish_test || exit 1
+
+test_group "Invalid rules"
+    setup_files
+
+    for rule in "ext=jpg -> rename" "ext=jpg" "size~1K -> copy" "after=2024-02-30 -> copy" \
+                "colour=red -> copy" "-> copy Photos"; do
+        printf '# Comment\n%s\n' "$rule" > "$RULES_FILE"
+        output=$("$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" \
+                           --rules "$RULES_FILE" 2>&1 || true)
+        assert_contains "Rejects '$rule'" "$output" "Invalid rule at '$RULES_FILE' line 2"
+    done
+
+    output=$("$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" \
+                       --rules "$TEST_DIR/missing" 2>&1 || true)
+    assert_contains "Missing rules file reported" "$output" "Failed to read rules file"
+    assert_file_count "Nothing copied" "$TARGET_DIR" 0
+finish_test || exit 1
+
+test_group "Too many distinct tags"
+    setup_files
+    : > "$RULES_FILE"
+    for first in a b c d e f g h; do
+        printf 'name=%s* -> copy' "$first" >> "$RULES_FILE"
+        for second in a b c d e f g h; do
+            printf ' %s%s' "$first" "$second" >> "$RULES_FILE"
+        done
+        printf '\n' >> "$RULES_FILE"
+    done
+
+    output=$("$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" \
+                       --rules "$RULES_FILE" --tag extra 2>&1 || true)
+    assert_contains "Full tag dictionary reported" "$output" "too many distinct tags"
+    assert_contains_count "Not reported as tag limit of file" "$output" "tags per file" 0
+    assert_file_count "Nothing copied" "$TARGET_DIR" 0
+finish_test || exit 1
+
+exit 0
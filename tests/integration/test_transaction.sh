@@ -6,6 +6,41 @@ set -eu
 SOURCE_DIR="$TEST_DIR/source"
 TARGET_DIR="$TEST_DIR/target"
 
+# Print COUNT bytes of VALUE in little-endian order, as decimal numbers
+le_bytes() {
+    local count="$1"
+    local value="$2"
+    local i=0
+    while [ "$i" -lt "$count" ]; do
+        printf ' %d' $(( (value >> (8 * i)) & 255 ))
+        i=$((i + 1))
+    done
+}
+
+# Print journal record as decimal bytes:
+# journal_record TYPE ACTION SOURCE TARGET SOURCE_SIZE SOURCE_MTIME TARGET_SIZE TARGET_MTIME
+journal_record() {
+    local body="$(le_bytes 2 "$1") $(le_bytes 2 "$2")"
+    body="$body $(le_bytes 4 ${#3}) $(le_bytes 4 ${#4})"
+    body="$body $(le_bytes 8 "$5") $(le_bytes 8 "$6") $(le_bytes 8 "$7") $(le_bytes 8 "$8")"
+    body="$body $(printf '%s%s' "$3" "$4" | od -An -tu1)"
+
+    # FNV-1a checksum of everything after it
+    local hash=2166136261
+    for byte in $body; do
+        hash=$(( ((hash ^ byte) * 16777619) & 4294967295 ))
+    done
+    echo "$(le_bytes 4 "$hash") $body"
+}
+
+# Write journal with header and records given as decimal bytes to FILE
+write_journal() {
+    local file="$1"
+    shift
+    printf 'CORGIJ01' > "$file"
+    printf "$(printf '\\%03o' $*)" >> "$file"
+}
+
 test_group "Rollback on file collision"
     rm -rf "$SOURCE_DIR" "$TARGET_DIR"
     mkdir -p "$SOURCE_DIR" "$TARGET_DIR"
@@ -24,6 +59,21 @@ test_group "Rollback on file collision"
     assert_file_count "Original files preserved" "$TARGET_DIR" "$original_count"
 finish_test || exit 1
 
+test_group "Collision in dry run"
+    rm -rf "$SOURCE_DIR" "$TARGET_DIR"
+    mkdir -p "$SOURCE_DIR" "$TARGET_DIR"
+    create_test_file "$SOURCE_DIR/file1.txt" "content1"
+
+    assert_success "Works first time" \
+        "$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR"
+
+    output=$("$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" \
+                       --dry-run 2>&1 || true)
+    assert_contains "Cause reported" "$output" "already exists"
+    assert_success "Accepted with force" \
+        "$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" --dry-run --force
+finish_test || exit 1
+
 test_group "Force flag"
     rm -rf "$SOURCE_DIR" "$TARGET_DIR"
     mkdir -p "$SOURCE_DIR" "$TARGET_DIR"
@@ -57,4 +107,191 @@ test_group "Overwrite warning in verbose mode"
         "$output" "Warning: Overwriting existing file '$TARGET_DIR/"
 finish_test || exit 1
 
+test_group "Parallel prepare"
+    rm -rf "$SOURCE_DIR" "$TARGET_DIR"
+    mkdir -p "$SOURCE_DIR" "$TARGET_DIR"
+    for i in $(seq 1 30); do
+        create_test_file "$SOURCE_DIR/file$i.txt" "content $i"
+    done
+
+    sequential=$("$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" \
+                           --verbose --jobs 1 2>&1)
+    rm -rf "${TARGET_DIR:?}"/*
+    parallel=$("$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" \
+                         --verbose --jobs 8 2>&1)
+    assert_success "Same operations reported in same order" \
+        test "$sequential" = "$parallel"
+    assert_file_count "All files copied" "$TARGET_DIR" 30
+
+    # Collision in the middle of index, later files are copied and rolled back
+    victim=$(ls "$TARGET_DIR" | sed -n 15p)
+    rm "$TARGET_DIR/$victim"
+    output=$("$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" \
+                       --jobs 8 2>&1 || true)
+    assert_contains "Cause reported" "$output" "already exists"
+    assert_file_count "Copies rolled back" "$TARGET_DIR" 29
+    assert_file_not_exists "Missing file not restored" "$TARGET_DIR/$victim"
+finish_test || exit 1
+
+test_group "Durable commit"
+    for mode in none file batch; do
+        rm -rf "$SOURCE_DIR" "$TARGET_DIR"
+        mkdir -p "$SOURCE_DIR" "$TARGET_DIR"
+        create_test_file "$SOURCE_DIR/file1.txt" "content 1"
+        create_test_file "$SOURCE_DIR/file2.txt" "content 2"
+
+        output=$("$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" \
+                           --sync=$mode --verbose 2>&1)
+        if [ "$mode" = "none" ]; then
+            assert_contains_count "Nothing synced with $mode" "$output" "Synced" 0
+        else
+            assert_contains "Targets synced with $mode" "$output" "Synced target files"
+        fi
+        assert_file_count "All files copied with $mode" "$TARGET_DIR" 2
+    done
+finish_test || exit 1
+
+test_group "Crash recovery"
+    rm -rf "$SOURCE_DIR" "$TARGET_DIR"
+    mkdir -p "$SOURCE_DIR" "$TARGET_DIR"
+    create_test_file "$SOURCE_DIR/file1.txt" "content 1"
+    create_test_file "$SOURCE_DIR/file2.txt" "content 2"
+    touch -d @1700000000 "$SOURCE_DIR/file1.txt" "$SOURCE_DIR/file2.txt"
+
+    plan=$("$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" --dry-run --verbose)
+    target1=$(echo "$plan" | sed -n "s|.*Copy: $SOURCE_DIR/file1.txt -> ||p")
+    target2=$(echo "$plan" | sed -n "s|.*Copy: $SOURCE_DIR/file2.txt -> ||p")
+
+    # Journal of import interrupted after completing first copy and during second
+    cp -p "$SOURCE_DIR/file1.txt" "$target1"
+    create_test_file "$target2" "partial"
+    size=$(wc -c < "$SOURCE_DIR/file1.txt")
+    mtime=1700000000000000000
+    write_journal "$TARGET_DIR/.corgi-journal" \
+        "$(journal_record 1 1 "" "$target1" 0 0 0 0)" \
+        "$(journal_record 2 1 "$SOURCE_DIR/file1.txt" "$target1" "$size" $mtime "$size" $mtime)" \
+        "$(journal_record 1 1 "" "$target2" 0 0 0 0)"
+
+    output=$("$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" --verbose 2>&1)
+    assert_contains "Completed copy resumed, partial one removed" "$output" \
+        "Recovered interrupted transaction: 1 files to resume, 1 removed"
+    assert_contains "Completed copy kept" "$output" "$target1 (resumed)"
+    assert_file_count "All files copied once" "$TARGET_DIR" 2
+    assert_files_identical "Partial copy made anew" "$SOURCE_DIR/file2.txt" "$target2"
+    assert_file_not_exists "Journal removed" "$TARGET_DIR/.corgi-journal"
+
+    # Completed copy changed since, so it is removed and made anew
+    rm -rf "${TARGET_DIR:?}"/*
+    create_test_file "$target1" "changed"
+    write_journal "$TARGET_DIR/.corgi-journal" \
+        "$(journal_record 2 1 "$SOURCE_DIR/file1.txt" "$target1" "$size" $mtime "$size" $mtime)"
+
+    output=$("$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" --verbose 2>&1)
+    assert_contains "Changed copy rolled back" "$output" \
+        "Recovered interrupted transaction: 0 files to resume, 1 removed"
+    assert_files_identical "Changed copy made anew" "$SOURCE_DIR/file1.txt" "$target1"
+finish_test || exit 1
+
+test_group "Incremental import"
+    rm -rf "$SOURCE_DIR" "$TARGET_DIR"
+    mkdir -p "$SOURCE_DIR" "$TARGET_DIR"
+    create_test_file "$SOURCE_DIR/file1.txt" "content 1"
+    create_test_file "$SOURCE_DIR/file2.txt" "content 2"
+
+    assert_success "First import succeeds" \
+        "$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" --incremental
+    assert_file_exists "Manifest created" "$TARGET_DIR/.corgi-manifest"
+
+    create_test_file "$SOURCE_DIR/file3.txt" "content 3"
+    output=$("$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" \
+                       --incremental --verbose 2>&1)
+    assert_contains "Imported files skipped" "$output" "Skipped 2 already imported files"
+    assert_contains "Only new file copied" "$output" "Found 1 files"
+    assert_file_count "New file added under new name" "$TARGET_DIR" 4
+
+    create_test_file "$SOURCE_DIR/file1.txt" "changed content 1"
+    output=$("$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" \
+                       --incremental --verbose --recursive 2>&1)
+    assert_contains "Changed file imported again" "$output" "Found 1 files"
+    assert_file_count "Changed file added" "$TARGET_DIR" 5
+
+    output=$("$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" --incremental 2>&1)
+    assert_contains "Nothing left to import" "$output" "No files to process"
+    assert_file_count "Nothing copied" "$TARGET_DIR" 5
+finish_test || exit 1
+
+test_group "Duplicate detection"
+    rm -rf "$SOURCE_DIR" "$TARGET_DIR"
+    mkdir -p "$SOURCE_DIR" "$TARGET_DIR"
+    head -c 300000 /dev/urandom > "$SOURCE_DIR/photo.jpg"
+    cp "$SOURCE_DIR/photo.jpg" "$SOURCE_DIR/photo-copy.jpg"
+    # Same size, head and tail, but different contents
+    cp "$SOURCE_DIR/photo.jpg" "$SOURCE_DIR/edited.jpg"
+    printf 'x' | dd of="$SOURCE_DIR/edited.jpg" bs=1 seek=150000 conv=notrunc 2>/dev/null
+    create_test_file "$SOURCE_DIR/note.txt" "imported before"
+    create_test_file "$TARGET_DIR/old.txt" "imported before"
+
+    output=$("$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" \
+                       --dedup --verbose 2>&1)
+    assert_contains "Duplicates reported" "$output" "Found 2 duplicate files, 1 of them already in target"
+    assert_contains_count "Duplicates ignored" "$output" "Ignoring:" 2
+    assert_file_count "Only unique files copied" "$TARGET_DIR" 3
+    assert_contains "Numbering skips duplicates" "$(ls "$TARGET_DIR")" "_001.jpg"
+finish_test || exit 1
+
+test_group "Import in windows under memory limit"
+    rm -rf "$SOURCE_DIR" "$TARGET_DIR" "$TEST_DIR/spill"
+    mkdir -p "$SOURCE_DIR/a" "$SOURCE_DIR/b" "$TARGET_DIR" "$TEST_DIR/spill"
+    i=0
+    while [ $i -lt 400 ]; do
+        create_test_file "$SOURCE_DIR/a/file$i.txt" "a $i"
+        create_test_file "$SOURCE_DIR/b/file$i.txt" "b $i"
+        i=$((i + 1))
+    done
+
+    "$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" --recursive --tag spill \
+              --dry-run --verbose 2>&1 | grep "DRY RUN" > "$TEST_DIR/unlimited.txt"
+    output=$(TMPDIR="$TEST_DIR/spill" "$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" \
+                     --recursive --tag spill --dry-run --verbose --max-memory 16K 2>&1)
+    assert_contains "Files imported in several windows" "$output" "Processed 800 of 800 files"
+    echo "$output" | grep "DRY RUN" > "$TEST_DIR/windowed.txt"
+    assert_files_identical "Same operations as without memory limit" \
+        "$TEST_DIR/unlimited.txt" "$TEST_DIR/windowed.txt"
+    assert_file_count "Temporary files removed" "$TEST_DIR/spill" 0
+
+    output=$(TMPDIR="$TEST_DIR/spill" "$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" \
+                     --recursive --jobs 4 --incremental --max-memory 16K 2>&1)
+    assert_file_count "All files copied" "$TARGET_DIR" 801
+    assert_contains "Numbering continues across windows" "$(ls "$TARGET_DIR")" "_799.txt"
+
+    output=$("$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" \
+                       --recursive --incremental --max-memory 16K --verbose 2>&1)
+    assert_contains "Manifest records every window" "$output" "Skipped 800 already imported files"
+finish_test || exit 1
+
+test_group "Import in batches"
+    rm -rf "$SOURCE_DIR" "$TARGET_DIR"
+    mkdir -p "$SOURCE_DIR" "$TARGET_DIR"
+    i=0
+    while [ $i -lt 25 ]; do
+        create_test_file "$SOURCE_DIR/file$i.txt" "contents of file $i"
+        i=$((i + 1))
+    done
+
+    "$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" --recursive --tag batch \
+              --dry-run --verbose 2>&1 | grep "DRY RUN" > "$TEST_DIR/single.txt"
+    output=$("$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" --recursive --tag batch \
+                       --dry-run --verbose --batch-size 10 2>&1)
+    assert_contains "Files imported in batches" "$output" "Processed 20 of 25 files"
+    echo "$output" | grep "DRY RUN" > "$TEST_DIR/batched.txt"
+    assert_files_identical "Same operations as in one transaction" \
+        "$TEST_DIR/single.txt" "$TEST_DIR/batched.txt"
+
+    output=$("$BINARY" --source "$SOURCE_DIR" --target "$TARGET_DIR" --tag batch \
+                       --verbose --batch-size 100B 2>&1)
+    assert_contains "Batches limited by size" "$output" "Processed 5 of 25 files"
+    assert_file_count "All files copied" "$TARGET_DIR" 25
+    assert_contains "Numbering continues across batches" "$(ls "$TARGET_DIR")" "_024_batch.txt"
+finish_test || exit 1
+
 exit 0